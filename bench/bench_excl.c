@@ -0,0 +1,240 @@
+/* Exclusion lookup benchmark.
+
+   usage: bench_excl [nres [nlig [reps]]]
+
+   Builds a bonded receptor of nres residues joined with a ligand of
+   nlig heavy atoms. Hydrogens of both are numbered after all heavy
+   atoms of their molecule and every 50th residue is crosslinked to a
+   residue far along the chain, so connected atoms are often far apart
+   in numbering. Compares the excl_tab/exta tables with the excl_rows
+   rows in size, build time and lookup time over candidate pairs, and
+   checks that both give the same answer for every candidate. */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "mol.0.0.6.h"
+#include "tests/test_util.h"
+
+#define HEAVY_PER_RES 8
+#define H_PER_RES 6
+#define LIG_H_PER_HEAVY 1
+
+static void add_bond(struct atomgrp *ag, int i, int j)
+{
+	struct atombond *b = &(ag->bonds[ag->nbonds++]);
+	b->a0 = &(ag->atoms[i]);
+	b->a1 = &(ag->atoms[j]);
+	b->ai = i;
+	b->aj = j;
+	ag->atoms[i].bonds[ag->atoms[i].nbonds++] = b;
+	ag->atoms[j].bonds[ag->atoms[j].nbonds++] = b;
+}
+
+// heavy atoms on a serpentine 1.5 A lattice walk, hydrogens 1 A off
+static void place(struct atom *a, int k, int m)
+{
+	int x = k % m, y = (k / m) % m, z = k / (m * m);
+	if (y % 2)
+		x = m - 1 - x;
+	if (z % 2)
+		y = m - 1 - y;
+	a->X = 1.5 * x;
+	a->Y = 1.5 * y;
+	a->Z = 1.5 * z;
+}
+
+static struct atomgrp *make_joined_ag(int nres, int nlig)
+{
+	const int nrh = nres * HEAVY_PER_RES, nlh = nlig;
+	const int nrec = nrh + nres * H_PER_RES;
+	const int natoms = nrec + nlh + nlh * LIG_H_PER_HEAVY;
+	int i, r, h, m = 1;
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+
+	while (m * m * m < nrh + nlh)
+		m++;
+	lcg_seed(12345u);
+	ag->natoms = natoms;
+	ag->atoms = calloc(natoms, sizeof(struct atom));
+	ag->nactives = natoms;
+	ag->activelist = malloc(natoms * sizeof(int));
+	ag->bonds = calloc(2 * natoms, sizeof(struct atombond));
+	for (i = 0; i < natoms; i++) {
+		ag->atoms[i].ingrp = i;
+		ag->atoms[i].bonds = malloc(6 * sizeof(struct atombond *));
+		ag->activelist[i] = i;
+	}
+/* receptor heavy atoms, backbone chain with one side branch per residue. */
+	for (i = 0; i < nrh; i++) {
+		place(&(ag->atoms[i]), i, m);
+		if (i > 0 && i % HEAVY_PER_RES != 5)
+			add_bond(ag, i - 1, i);
+		else if (i > 0)
+			add_bond(ag, i - 3, i);
+	}
+	for (r = 0; r + nres / 2 < nres; r += 50)
+		add_bond(ag, r * HEAVY_PER_RES + 4,
+			 (r + nres / 2) * HEAVY_PER_RES + 7);
+/* receptor hydrogens after all receptor heavy atoms. */
+	for (r = 0; r < nres; r++) {
+		for (h = 0; h < H_PER_RES; h++) {
+			const int ia = nrh + r * H_PER_RES + h;
+			const int ib = r * HEAVY_PER_RES + h;
+			ag->atoms[ia].X = ag->atoms[ib].X + lcg_uniform();
+			ag->atoms[ia].Y = ag->atoms[ib].Y + lcg_uniform();
+			ag->atoms[ia].Z = ag->atoms[ib].Z + lcg_uniform();
+			add_bond(ag, ib, ia);
+		}
+	}
+/* ligand chain continuing the walk, its hydrogens at the very end. */
+	for (i = 0; i < nlh; i++) {
+		const int ia = nrec + i;
+		const int ih = nrec + nlh + i;
+		place(&(ag->atoms[ia]), nrh + i, m);
+		if (i > 0)
+			add_bond(ag, ia - 1, ia);
+		ag->atoms[ih].X = ag->atoms[ia].X + lcg_uniform();
+		ag->atoms[ih].Y = ag->atoms[ia].Y + lcg_uniform();
+		ag->atoms[ih].Z = ag->atoms[ia].Z + lcg_uniform();
+		add_bond(ag, ia, ih);
+	}
+	return ag;
+}
+
+static void free_joined_ag(struct atomgrp *ag)
+{
+	int i;
+	for (i = 0; i < ag->natoms; i++)
+		free(ag->atoms[i].bonds);
+	free(ag->bonds);
+	free(ag->activelist);
+	free(ag->atoms);
+	free(ag);
+}
+
+// wall clock seconds; clock() would sum the cpu time of all threads
+static double wall(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static double seconds(double t0)
+{
+	return wall() - t0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nres = (argc > 1) ? atoi(argv[1]) : 2000;
+	int nlig = (argc > 2) ? atoi(argv[2]) : 40;
+	int reps = (argc > 3) ? atoi(argv[3]) : 20;
+	struct atomgrp *ag = make_joined_ag(nres, nlig);
+	const int natoms = ag->natoms;
+	int *list01 = malloc(2 * ag->nbonds * sizeof(int));
+	int *na01 = malloc(natoms * sizeof(int));
+	int **pna01 = malloc(natoms * sizeof(int *));
+	int *na02 = malloc(natoms * sizeof(int));
+	int **pna02 = malloc(natoms * sizeof(int *));
+	int *atmind = malloc(2 * natoms * sizeof(int));
+	int n02, n03, nd1, nd2, ndm, i, j, r, ncand, nbad = 0;
+	int *list02, *list03, *excl_list, **pd1, **pd2;
+	int *excl_offs, *excl_pairs, *cand;
+	long nex_tab = 0, nex_rows = 0;
+	double t_tab, t_rows, l_tab, l_rows, sz_tab, sz_rows;
+	double t0;
+
+	comp_list01(ag, list01, na01, pna01);
+	comp_n23(natoms, na01, pna01, &n02, &n03);
+	list02 = malloc(2 * n02 * sizeof(int));
+	list03 = malloc(2 * n03 * sizeof(int));
+	comp_list02(natoms, na01, pna01, na02, pna02, &n02, list02);
+	comp_list03(natoms, na01, pna01, list03);
+	trim_list03(natoms, na01, pna01, na02, pna02, &n03, list03);
+
+	t0 = wall();
+	excl_dims(natoms, na01, pna01, n02, list02, n03, list03,
+		  &nd1, &nd2, &ndm, atmind);
+	i = 10 * (natoms + nd1 + 1) + (nd2 + 1) * (ndm - 20);
+	excl_list = malloc(i * sizeof(int));
+	pd1 = malloc(natoms * sizeof(int *));
+	pd2 = malloc(natoms * sizeof(int *));
+	excl_tab(natoms, na01, pna01, n02, list02, n03, list03,
+		 nd1, nd2, ndm, atmind, excl_list, pd1, pd2);
+	t_tab = seconds(t0);
+	sz_tab = (i * sizeof(int) + 2.0 * natoms * sizeof(int *)) / 1048576.0;
+
+	t0 = wall();
+	excl_rows(natoms, na01, pna01, n02, list02, n03, list03,
+		  &excl_offs, &excl_pairs);
+	t_rows = seconds(t0);
+	sz_rows = (natoms + 1.0 + excl_offs[natoms]) * sizeof(int) / 1048576.0;
+
+/* candidates: 48 following atoms and 16 random ones per atom. */
+	cand = malloc(2 * 64 * (size_t) natoms * sizeof(int));
+	ncand = 0;
+	for (i = 0; i < natoms; i++) {
+		for (j = i + 1; j < natoms && j <= i + 48; j++) {
+			cand[2 * ncand] = i;
+			cand[2 * ncand++ + 1] = j;
+		}
+		for (r = 0; r < 16; r++) {
+			j = (int)(lcg_uniform() * natoms);
+			if (j == i)
+				continue;
+			cand[2 * ncand] = (i < j) ? i : j;
+			cand[2 * ncand++ + 1] = (i < j) ? j : i;
+		}
+	}
+	for (i = 0; i < ncand; i++)
+		if (exta(cand[2 * i], cand[2 * i + 1], excl_list, pd1, pd2, ndm)
+		    != exta_rows(cand[2 * i], cand[2 * i + 1], excl_offs,
+				 excl_pairs))
+			nbad++;
+
+	t0 = wall();
+	for (r = 0; r < reps; r++)
+		for (i = 0; i < ncand; i++)
+			nex_tab += exta(cand[2 * i], cand[2 * i + 1], excl_list,
+					pd1, pd2, ndm) > 0;
+	l_tab = seconds(t0);
+	t0 = wall();
+	for (r = 0; r < reps; r++)
+		for (i = 0; i < ncand; i++)
+			nex_rows += exta_rows(cand[2 * i], cand[2 * i + 1],
+					      excl_offs, excl_pairs) > 0;
+	l_rows = seconds(t0);
+
+	printf("natoms %d bonds %d n02 %d n03 %d ndm %d nd1 %d nd2 %d\n",
+	       natoms, ag->nbonds, n02, n03, ndm, nd1, nd2);
+	printf("%-10s %10s %10s %14s %10s\n", "layout", "size(MB)",
+	       "build(s)", "lookups/s", "excluded");
+	printf("%-10s %10.2f %10.4f %14.3g %10ld\n", "excl_tab", sz_tab,
+	       t_tab, reps * (double)ncand / l_tab, nex_tab / reps);
+	printf("%-10s %10.2f %10.4f %14.3g %10ld\n", "excl_rows", sz_rows,
+	       t_rows, reps * (double)ncand / l_rows, nex_rows / reps);
+	printf("mismatches %d of %d candidates\n", nbad, ncand);
+
+	free(cand);
+	free(excl_pairs);
+	free(excl_offs);
+	free(pd2);
+	free(pd1);
+	free(excl_list);
+	free(atmind);
+	free(list03);
+	free(list02);
+	free(pna02);
+	free(na02);
+	free(pna01);
+	free(na01);
+	free(list01);
+	free_joined_ag(ag);
+	return nbad != 0;
+}
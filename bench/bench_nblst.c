@@ -0,0 +1,88 @@
+/* Nonbonded list cutoff / skin benchmark.
+
+   usage: bench_nblst [natoms [cutoff [steps [step]]]]
+
+   Builds a liquid-like jittered lattice of natoms atoms, then for a
+   range of skins random-walks all atoms by step A per coordinate for
+   steps steps, updating the list with check_clusterupdate and
+   evaluating vdweng and eleng after each step. Reports the pairs per
+   atom, the number of list rebuilds and the time spent in list
+   updates and in energy evaluation. */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "mol.0.0.6.h"
+#include "tests/test_util.h"
+
+// wall clock seconds; clock() would sum the cpu time of all threads
+static double wall(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static double seconds(double t0)
+{
+	return wall() - t0;
+}
+
+int main(int argc, char *argv[])
+{
+	const double skins[] = { 0.5, 1.0, 1.5, 2.0, 3.0 };
+	const int nskins = sizeof(skins) / sizeof(skins[0]);
+	int natoms = (argc > 1) ? atoi(argv[1]) : 8000;
+	double cutoff = (argc > 2) ? atof(argv[2]) : 8.0;
+	int nsteps = (argc > 3) ? atoi(argv[3]) : 200;
+	double step = (argc > 4) ? atof(argv[4]) : 0.02;
+	int i, s, k, nrebuilds;
+	double tlist, teng, ev, ee, pairs;
+	double t0;
+
+	printf("natoms %d cutoff %.2f steps %d step %.3f\n", natoms, cutoff,
+	       nsteps, step);
+	printf("%6s %12s %9s %10s %10s %10s\n", "skin", "pairs/atom",
+	       "rebuilds", "list(s)", "energy(s)", "total(s)");
+	for (s = 0; s < nskins; s++) {
+		// 2.2 A spacing, about the density of water
+		struct atomgrp *ag = make_lattice_ag(natoms, 2.2, 0.4, 12345u);
+		struct agsetup ags;
+
+		t0 = wall();
+		init_nblst_cutoff(ag, &ags, cutoff, skins[s]);
+		update_nblst(ag, &ags);
+		tlist = seconds(t0);
+		teng = 0.0;
+		pairs = 0.0;
+		nrebuilds = 0;
+		for (k = 0; k < nsteps; k++) {
+			for (i = 0; i < natoms; i++) {
+				ag->atoms[i].X += step * (2.0 * lcg_uniform() - 1.0);
+				ag->atoms[i].Y += step * (2.0 * lcg_uniform() - 1.0);
+				ag->atoms[i].Z += step * (2.0 * lcg_uniform() - 1.0);
+			}
+			t0 = wall();
+			nrebuilds += check_clusterupdate(ag, &ags);
+			tlist += seconds(t0);
+			pairs += ags.nblst->npairs;
+
+			t0 = wall();
+			ev = ee = 0.0;
+			zero_grads(ag);
+			vdweng(ag, &ev, ags.nblst);
+			eleng(ag, 1.0, &ee, ags.nblst);
+			teng += seconds(t0);
+		}
+		printf("%6.2f %12.1f %9d %10.3f %10.3f %10.3f\n", skins[s],
+		       2.0 * pairs / nsteps / natoms, nrebuilds, tlist, teng,
+		       tlist + teng);
+		destroy_agsetup(&ags);
+		free_lattice_ag(ag);
+	}
+	return 0;
+}
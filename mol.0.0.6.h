@@ -61,6 +61,9 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mol.0.0.6/atom.h"
 #include "mol.0.0.6/matrix.h"
 #include "mol.0.0.6/atom_group.h"
+#include "mol.0.0.6/soa.h"
+#include "mol.0.0.6/btab.h"
+#include "mol.0.0.6/parallel.h"
 #include "mol.0.0.6/_atom_group_copy_from_deprecated.h"
 #include "mol.0.0.6/icharmm.h"
 #include "mol.0.0.6/init.h"
@@ -73,11 +76,17 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mol.0.0.6/energy.h"
 #include "mol.0.0.6/benergy.h"
 #include "mol.0.0.6/nbenergy.h"
+#include "mol.0.0.6/nbsimd.h"
+#include "mol.0.0.6/nbtab.h"
+#include "mol.0.0.6/packed_octree.h"
 #include "mol.0.0.6/minimize.h"
 #include "mol.0.0.6/compare.h"
 #include "mol.0.0.6/subag.h"
 #include "mol.0.0.6/hbond.h"
 #include "mol.0.0.6/hbond_probev2.h"
+#include "mol.0.0.6/workspace.h"
+#include "mol.0.0.6/rlcomplex.h"
+#include "mol.0.0.6/rgrid.h"
 #include "mol.0.0.6/version.h"
 #include "mol.0.0.6/mol2.h"
 #include "mol.0.0.6/phys.h"
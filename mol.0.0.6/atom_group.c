@@ -135,6 +135,16 @@ void mol_atom_group_destroy(mol_atom_group * ag)
 		free(ag->impact);
 	}
 
+	if (ag->soa != NULL) {
+		free_agsoa(ag->soa);
+		ag->soa = NULL;
+	}
+
+	if (ag->btab != NULL) {
+		free_agbtab(ag->btab);
+		ag->btab = NULL;
+	}
+
 	return;
 }
 
@@ -242,6 +252,10 @@ void full_free_atomgrp(struct atomgrp *ag)
 	free(ag->res_type);
 	free(ag->atypenn);
 	free(ag->atom_group_name);
+	if (ag->soa != NULL)
+		free_agsoa(ag->soa);	// free packed coordinate view
+	if (ag->btab != NULL)
+		free_agbtab(ag->btab);	// free flattened bonded terms
 
 	free(ag);		// free the ag itself
 }
@@ -37,6 +37,8 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 typedef struct atomgrp mol_atom_group;
 
+struct agsoa;
+
 enum mol_res_type {
 	UNK,
 	ALA,
@@ -138,6 +140,8 @@ struct atomgrp {
         struct prm *prm;        
         
         void *flow_struct; // for netfork-flow based hydrogen bonding
+        struct agsoa *soa; /**< optional packed coordinate/gradient view, see soa.h */
+        struct agbtab *btab; /**< flattened active bonded terms, see btab.h */
 	char *atom_group_name;
         bool is_psf_read; //psf has been read in
 };
@@ -33,368 +33,754 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include _MOL_INCLUDE_
 
-void beng(struct atomgrp *ag, double *en)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(_WIN32)
+#define MOL_SIMD_X86
+#include <immintrin.h>
+#define MOL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+static int bonded_mode = MOL_BONDED_TRIG;
+
+enum mol_bonded_mode mol_bonded_mode(void)
 {
-	int i;
-	struct atom *a0, *a1;
-	double dx, dy, dz, l, dl, e1;
-	struct atombond *bp;
-	for (i = 0; i < ag->nbact; i++) {
-		bp = ag->bact[i];
-		a0 = bp->a0;
-		a1 = bp->a1;
+	return (enum mol_bonded_mode)bonded_mode;
+}
+
+void mol_bonded_set_mode(enum mol_bonded_mode mode)
+{
+	bonded_mode = mode;
+}
+
+//! acos(c) for |c| <= 1 from the rational asin approximation of fdlibm.
+/*! Plain arithmetic and one sqrt, accurate to a few ulp. */
+static double bonded_acos(double c)
+{
+	const double pS0 = 1.66666666666666657415e-01;
+	const double pS1 = -3.25565818622400915405e-01;
+	const double pS2 = 2.01212532134862925881e-01;
+	const double pS3 = -4.00555345006794114027e-02;
+	const double pS4 = 7.91534994289814532176e-04;
+	const double pS5 = 3.47933107596021167570e-05;
+	const double qS1 = -2.40339491173441421878e+00;
+	const double qS2 = 2.02094576023350569471e+00;
+	const double qS3 = -6.88283971605453293030e-01;
+	const double qS4 = 7.70381505559019352791e-02;
+	double z, s, r;
+
+	if (c > 1.0)
+		c = 1.0;
+	if (c < -1.0)
+		c = -1.0;
+	z = (fabs(c) < 0.5) ? c * c : 0.5 * (1.0 - fabs(c));
+	r = z * (pS0 + z * (pS1 + z * (pS2 + z * (pS3 + z * (pS4 + z * pS5)))))
+	    / (1.0 + z * (qS1 + z * (qS2 + z * (qS3 + z * qS4))));
+	if (fabs(c) < 0.5)
+		return M_PI_2 - (c + c * r);
+	s = sqrt(z);
+	s += s * r;		// asin(sqrt(z))
+	return (c > 0) ? 2.0 * s : M_PI - 2.0 * s;
+}
+
+//! Trig-free pass of angle_block over angles [t0, n) of a block.
+/*! th holds the cosines on entry and the angles on return, sth their
+    sines from the cross product of the bonds. */
+static void angle_trigfree_scalar(int t0, int n,
+				  double d10[3][AGBTAB_BLOCK],
+				  double d12[3][AGBTAB_BLOCK],
+				  const double *l02, double *th, double *sth)
+{
+	int t;
+	for (t = t0; t < n; t++) {
+		double cx = d10[1][t] * d12[2][t] - d10[2][t] * d12[1][t];
+		double cy = d10[2][t] * d12[0][t] - d10[0][t] * d12[2][t];
+		double cz = d10[0][t] * d12[1][t] - d10[1][t] * d12[0][t];
+		th[t] = bonded_acos(th[t]);
+		sth[t] = sqrt(cx * cx + cy * cy + cz * cz) / l02[t];
+	}
+}
+
+//! Trig-free pass of torsion_block over torsions [t0, n) of a block.
+static void torsion_trigfree_scalar(int t0, int n, const double *ysi,
+				    const double *xco, const double *cosd,
+				    const double *sind, const int *mult,
+				    double *ctor, double *stor)
+{
+	int t;
+	for (t = t0; t < n; t++) {
+		double r = sqrt(xco[t] * xco[t] + ysi[t] * ysi[t]);
+		double c1 = (r > 0) ? xco[t] / r : 1.0;
+		double s1 = (r > 0) ? ysi[t] / r : 0.0;
+		double cn = 1.0, sn = 0.0, tmp;
+		int j, m = abs(mult[t]);
+		for (j = 0; j < m; j++) {
+			tmp = cn * c1 - sn * s1;
+			sn = sn * c1 + cn * s1;
+			cn = tmp;
+		}
+		if (mult[t] < 0)
+			sn = -sn;
+		ctor[t] = cn * cosd[t] + sn * sind[t];
+		stor[t] = sn * cosd[t] - cn * sind[t];
+	}
+}
+
+#ifdef MOL_SIMD_X86
+//! bonded_acos of four cosines, both branches evaluated and blended.
+MOL_TARGET_AVX2 static inline __m256d bonded_acos4_avx2(__m256d c)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d two = _mm256_set1_pd(2.0);
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	__m256d a, small, z, p, q, r, s, lo, hi;
+
+	c = _mm256_min_pd(_mm256_max_pd(c, _mm256_set1_pd(-1.0)), one);
+	a = _mm256_andnot_pd(sign, c);
+	small = _mm256_cmp_pd(a, half, _CMP_LT_OQ);
+	z = _mm256_blendv_pd(_mm256_mul_pd(half, _mm256_sub_pd(one, a)),
+			     _mm256_mul_pd(c, c), small);
+	p = _mm256_fmadd_pd(z, _mm256_set1_pd(3.47933107596021167570e-05),
+			    _mm256_set1_pd(7.91534994289814532176e-04));
+	p = _mm256_fmadd_pd(z, p,
+			    _mm256_set1_pd(-4.00555345006794114027e-02));
+	p = _mm256_fmadd_pd(z, p, _mm256_set1_pd(2.01212532134862925881e-01));
+	p = _mm256_fmadd_pd(z, p,
+			    _mm256_set1_pd(-3.25565818622400915405e-01));
+	p = _mm256_fmadd_pd(z, p, _mm256_set1_pd(1.66666666666666657415e-01));
+	p = _mm256_mul_pd(z, p);
+	q = _mm256_fmadd_pd(z, _mm256_set1_pd(7.70381505559019352791e-02),
+			    _mm256_set1_pd(-6.88283971605453293030e-01));
+	q = _mm256_fmadd_pd(z, q, _mm256_set1_pd(2.02094576023350569471e+00));
+	q = _mm256_fmadd_pd(z, q,
+			    _mm256_set1_pd(-2.40339491173441421878e+00));
+	q = _mm256_fmadd_pd(z, q, one);
+	r = _mm256_div_pd(p, q);
+	// |c| < 0.5: pi/2 - (c + c * r)
+	lo = _mm256_sub_pd(_mm256_set1_pd(M_PI_2), _mm256_fmadd_pd(c, r, c));
+	// else 2 asin(sqrt(z)), or pi minus it for negative c
+	s = _mm256_sqrt_pd(z);
+	s = _mm256_mul_pd(two, _mm256_fmadd_pd(s, r, s));
+	hi = _mm256_blendv_pd(_mm256_sub_pd(_mm256_set1_pd(M_PI), s), s,
+			      _mm256_cmp_pd(c, _mm256_setzero_pd(),
+					    _CMP_GT_OQ));
+	return _mm256_blendv_pd(hi, lo, small);
+}
+
+//! angle_trigfree_scalar four angles at a time.
+MOL_TARGET_AVX2 static void angle_trigfree_avx2(int n,
+						double d10[3][AGBTAB_BLOCK],
+						double d12[3][AGBTAB_BLOCK],
+						const double *l02, double *th,
+						double *sth)
+{
+	int t;
+	for (t = 0; t + 4 <= n; t += 4) {
+		__m256d x10 = _mm256_loadu_pd(&d10[0][t]);
+		__m256d y10 = _mm256_loadu_pd(&d10[1][t]);
+		__m256d z10 = _mm256_loadu_pd(&d10[2][t]);
+		__m256d x12 = _mm256_loadu_pd(&d12[0][t]);
+		__m256d y12 = _mm256_loadu_pd(&d12[1][t]);
+		__m256d z12 = _mm256_loadu_pd(&d12[2][t]);
+		__m256d cx = _mm256_fmsub_pd(y10, z12, _mm256_mul_pd(z10, y12));
+		__m256d cy = _mm256_fmsub_pd(z10, x12, _mm256_mul_pd(x10, z12));
+		__m256d cz = _mm256_fmsub_pd(x10, y12, _mm256_mul_pd(y10, x12));
+		__m256d c2 = _mm256_fmadd_pd(cx, cx,
+					     _mm256_fmadd_pd(cy, cy,
+							     _mm256_mul_pd(cz,
+									   cz)));
+		_mm256_storeu_pd(th + t,
+				 bonded_acos4_avx2(_mm256_loadu_pd(th + t)));
+		_mm256_storeu_pd(sth + t,
+				 _mm256_div_pd(_mm256_sqrt_pd(c2),
+					       _mm256_loadu_pd(l02 + t)));
+	}
+	angle_trigfree_scalar(t, n, d10, d12, l02, th, sth);
+}
+
+//! torsion_trigfree_scalar four torsions at a time.
+/*! The recurrence runs to the largest periodicity of the four, lanes
+    past their own periodicity keep their value. */
+MOL_TARGET_AVX2 static void torsion_trigfree_avx2(int n, const double *ysi,
+						  const double *xco,
+						  const double *cosd,
+						  const double *sind,
+						  const int *mult,
+						  double *ctor, double *stor)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d zero = _mm256_setzero_pd();
+	int t;
+	for (t = 0; t + 4 <= n; t += 4) {
+		__m256d x = _mm256_loadu_pd(xco + t);
+		__m256d y = _mm256_loadu_pd(ysi + t);
+		__m256d r = _mm256_sqrt_pd(_mm256_fmadd_pd(x, x,
+							   _mm256_mul_pd(y,
+									 y)));
+		__m256d pos = _mm256_cmp_pd(r, zero, _CMP_GT_OQ);
+		__m256d c1 = _mm256_blendv_pd(one, _mm256_div_pd(x, r), pos);
+		__m256d s1 = _mm256_blendv_pd(zero, _mm256_div_pd(y, r), pos);
+		__m128i mi = _mm_loadu_si128((const __m128i *)(mult + t));
+		__m256d m = _mm256_cvtepi32_pd(_mm_abs_epi32(mi));
+		__m256d ms = _mm256_cvtepi32_pd(mi);
+		__m256d cn = one, sn = zero, cd, sd;
+		int j, mmax = 0;
+		for (j = 0; j < 4; j++)
+			if (abs(mult[t + j]) > mmax)
+				mmax = abs(mult[t + j]);
+		for (j = 0; j < mmax; j++) {
+			__m256d act = _mm256_cmp_pd(_mm256_set1_pd(j), m,
+						    _CMP_LT_OQ);
+			__m256d cn1 = _mm256_fmsub_pd(cn, c1,
+						      _mm256_mul_pd(sn, s1));
+			__m256d sn1 = _mm256_fmadd_pd(sn, c1,
+						      _mm256_mul_pd(cn, s1));
+			cn = _mm256_blendv_pd(cn, cn1, act);
+			sn = _mm256_blendv_pd(sn, sn1, act);
+		}
+		sn = _mm256_blendv_pd(sn, _mm256_sub_pd(zero, sn),
+				      _mm256_cmp_pd(ms, zero, _CMP_LT_OQ));
+		cd = _mm256_loadu_pd(cosd + t);
+		sd = _mm256_loadu_pd(sind + t);
+		_mm256_storeu_pd(ctor + t,
+				 _mm256_fmadd_pd(cn, cd, _mm256_mul_pd(sn, sd)));
+		_mm256_storeu_pd(stor + t,
+				 _mm256_fmsub_pd(sn, cd, _mm256_mul_pd(cn, sd)));
+	}
+	torsion_trigfree_scalar(t, n, ysi, xco, cosd, sind, mult, ctor, stor);
+}
+#endif				/* MOL_SIMD_X86 */
+
+//! Trig-free pass of angle_block, vectorized as mol_simd_level() allows.
+static void angle_trigfree(int n, double d10[3][AGBTAB_BLOCK],
+			   double d12[3][AGBTAB_BLOCK], const double *l02,
+			   double *th, double *sth)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+	case MOL_SIMD_AVX2:
+		angle_trigfree_avx2(n, d10, d12, l02, th, sth);
+		return;
+#endif
+	default:
+		angle_trigfree_scalar(0, n, d10, d12, l02, th, sth);
+	}
+}
+
+//! Trig-free pass of torsion_block, vectorized as mol_simd_level() allows.
+static void torsion_trigfree(int n, const double *ysi, const double *xco,
+			     const double *cosd, const double *sind,
+			     const int *mult, double *ctor, double *stor)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+	case MOL_SIMD_AVX2:
+		torsion_trigfree_avx2(n, ysi, xco, cosd, sind, mult, ctor,
+				      stor);
+		return;
+#endif
+	default:
+		torsion_trigfree_scalar(0, n, ysi, xco, cosd, sind, mult, ctor,
+					stor);
+	}
+}
+
+//! Adds < x, y, z > to the gradient of atom a, in g if given, else in atoms.
+static inline void add_grad(mol_atom * atoms, double *g, int a,
+			    double x, double y, double z)
+{
+	if (g != NULL) {
+		g[3 * a] += x;
+		g[3 * a + 1] += y;
+		g[3 * a + 2] += z;
+	} else {
+		atoms[a].GX += x;
+		atoms[a].GY += y;
+		atoms[a].GZ += z;
+	}
+}
+
+//! Bonds ia[2 * t], ia[2 * t + 1] for t < n, returns their energy.
+static double bond_block(const int *ia, const double *k, const double *l0,
+			 int n, mol_atom * atoms, double *g)
+{
+	int t;
+	double en = 0;
+	for (t = 0; t < n; t++) {
+		const mol_atom *a0 = &(atoms[ia[2 * t]]);
+		const mol_atom *a1 = &(atoms[ia[2 * t + 1]]);
+		double dx, dy, dz, l, dl, e1;
 		dx = a0->X - a1->X;
 		dy = a0->Y - a1->Y;
 		dz = a0->Z - a1->Z;
 		l = sqrt(dx * dx + dy * dy + dz * dz);
-		dl = l - (bp->l0);
-		e1 = (bp->k) * dl;
-		(*en) += e1 * dl;
+		dl = l - l0[t];
+		e1 = k[t] * dl;
+		en += e1 * dl;
 		e1 = -2 * e1 / l;
-		dl = e1 * dx;
-		(a0->GX) += dl;
-		(a1->GX) -= dl;
-		dl = e1 * dy;
-		(a0->GY) += dl;
-		(a1->GY) -= dl;
-		dl = e1 * dz;
-		(a0->GZ) += dl;
-		(a1->GZ) -= dl;
+		add_grad(atoms, g, ia[2 * t], e1 * dx, e1 * dy, e1 * dz);
+		add_grad(atoms, g, ia[2 * t + 1], -e1 * dx, -e1 * dy, -e1 * dz);
 	}
+	return en;
 }
 
-void aeng(struct atomgrp *ag, double *en)
+//! Angles ia[3 * t .. 3 * t + 2] for t < n, 'first' numbers them in warnings.
+/*! The geometry, the acos/sin of all angles of the block and the
+    forces are done in three separate passes over block arrays;
+    blocks are the unit that btab_eng_omp() deals to threads. In
+    MOL_BONDED_TRIGFREE mode the sine comes from the cross product
+    of the bonds and the angle from bonded_acos(), and the middle
+    pass runs four angles at a time with AVX2 (angle_trigfree).
+    MOL_BONDED_TRIG calls libm acos and sin one angle at a time. */
+static double angle_block(const int *ia, const double *k, const double *th0,
+			  int n, int first, mol_atom * atoms, double *g)
 {
-	const double DEGRA = M_PI / 180.0;
 	const double small = 0.0000001;
-	int i;
-	struct atom *a0, *a1, *a2;
-	double dx10, dx12, dy10, dy12, dz10, dz12;
-	double dsx10, dsy10, dsz10, ls10, l10;
-	double dsx12, dsy12, dsz12, ls12, l12, l02;
-	double dth, sth, e1, e2, e3;
-	double yzp, yzm, xzp, xzm, xyp, xym;
-	struct atomangle *ap;
+	double d10[3][AGBTAB_BLOCK], d12[3][AGBTAB_BLOCK];
+	double ls10[AGBTAB_BLOCK], ls12[AGBTAB_BLOCK], l02[AGBTAB_BLOCK];
+	double th[AGBTAB_BLOCK], sth[AGBTAB_BLOCK];
+	double en = 0;
+	int t;
+
+	for (t = 0; t < n; t++) {
+		const mol_atom *a0 = &(atoms[ia[3 * t]]);
+		const mol_atom *a1 = &(atoms[ia[3 * t + 1]]);
+		const mol_atom *a2 = &(atoms[ia[3 * t + 2]]);
+		d10[0][t] = a0->X - a1->X;
+		d10[1][t] = a0->Y - a1->Y;
+		d10[2][t] = a0->Z - a1->Z;
+		d12[0][t] = a2->X - a1->X;
+		d12[1][t] = a2->Y - a1->Y;
+		d12[2][t] = a2->Z - a1->Z;
+		ls10[t] = d10[0][t] * d10[0][t] + d10[1][t] * d10[1][t]
+		    + d10[2][t] * d10[2][t];
+		ls12[t] = d12[0][t] * d12[0][t] + d12[1][t] * d12[1][t]
+		    + d12[2][t] * d12[2][t];
+		l02[t] = sqrt(ls10[t]) * sqrt(ls12[t]);
+		th[t] = (d10[0][t] * d12[0][t] + d10[1][t] * d12[1][t]
+			 + d10[2][t] * d12[2][t]) / l02[t];
+	}
+
+	if (bonded_mode == MOL_BONDED_TRIGFREE) {
+		angle_trigfree(n, d10, d12, l02, th, sth);
+	} else {
+		for (t = 0; t < n; t++) {
+			th[t] = acos(th[t]);
+			sth[t] = sin(th[t]);
+		}
+	}
 
-	for (i = 0; i < ag->nangact; i++) {
-		ap = ag->angact[i];
-		a0 = ap->a0;
-		a1 = ap->a1;
-		a2 = ap->a2;
-//                if(a0->fixed == 1 && a1->fixed == 1 && a2->fixed == 1)continue;
-		dx10 = a0->X - a1->X;
-		dx12 = a2->X - a1->X;
-		dy10 = a0->Y - a1->Y;
-		dy12 = a2->Y - a1->Y;
-		dz10 = a0->Z - a1->Z;
-		dz12 = a2->Z - a1->Z;
-
-		dsx10 = dx10 * dx10;
-		dsy10 = dy10 * dy10;
-		dsz10 = dz10 * dz10;
-
-		ls10 = dsx10 + dsy10 + dsz10;
-		l10 = sqrt(ls10);
-
-		dsx12 = dx12 * dx12;
-		dsy12 = dy12 * dy12;
-		dsz12 = dz12 * dz12;
-
-		ls12 = dsx12 + dsy12 + dsz12;
-		l12 = sqrt(ls12);
-
-		l02 = l10 * l12;
-		dth = acos((dx10 * dx12 + dy10 * dy12 + dz10 * dz12) / l02);
-		sth = sin(dth);
-
-		if (sth < small) {
+	for (t = 0; t < n; t++) {
+		double dx10 = d10[0][t], dy10 = d10[1][t], dz10 = d10[2][t];
+		double dx12 = d12[0][t], dy12 = d12[1][t], dz12 = d12[2][t];
+		double dsx, dsy, dsz, dth, e1, e2, gx, gy, gz;
+		double s = sth[t];
+
+		if (s < small) {
 			fprintf(stderr,
-				"angle %d (%d, %d, %d) is close to linear\n", i,
-				a0->ingrp, a1->ingrp, a2->ingrp);
+				"angle %d (%d, %d, %d) is close to linear\n",
+				first + t, atoms[ia[3 * t]].ingrp,
+				atoms[ia[3 * t + 1]].ingrp,
+				atoms[ia[3 * t + 2]].ingrp);
 			fprintf(stderr,
 				"accuracy of forces will be compromised\n");
-			sth = small;
+			s = small;
 		}
 
-		dth -= DEGRA * (ap->th0);
-		e1 = (ap->k) * dth;
-		(*en) += e1 * dth;
-		e1 *= 2.0 / sth / l02;
+		dth = th[t] - th0[t];
+		e1 = k[t] * dth;
+		en += e1 * dth;
+		e1 *= 2.0 / s / l02[t];
 // 10 bond
-		e2 = e1 / ls10;
-
-		yzp = dsy10 + dsz10;
-		yzm = -dy10 * dz10;
-		xzp = dsx10 + dsz10;
-		xzm = -dx10 * dz10;
-		xyp = dsx10 + dsy10;
-		xym = -dx10 * dy10;
-
-		e3 = e2 * (yzp * dx12 + xym * dy12 + xzm * dz12);
-		(a0->GX) += e3;
-		(a1->GX) -= e3;
-
-		e3 = e2 * (xym * dx12 + xzp * dy12 + yzm * dz12);
-		(a0->GY) += e3;
-		(a1->GY) -= e3;
-
-		e3 = e2 * (xzm * dx12 + yzm * dy12 + xyp * dz12);
-		(a0->GZ) += e3;
-		(a1->GZ) -= e3;
+		e2 = e1 / ls10[t];
+		dsx = dx10 * dx10;
+		dsy = dy10 * dy10;
+		dsz = dz10 * dz10;
+		gx = e2 * ((dsy + dsz) * dx12 - dx10 * dy10 * dy12
+			   - dx10 * dz10 * dz12);
+		gy = e2 * (-dx10 * dy10 * dx12 + (dsx + dsz) * dy12
+			   - dy10 * dz10 * dz12);
+		gz = e2 * (-dx10 * dz10 * dx12 - dy10 * dz10 * dy12
+			   + (dsx + dsy) * dz12);
+		add_grad(atoms, g, ia[3 * t], gx, gy, gz);
+		add_grad(atoms, g, ia[3 * t + 1], -gx, -gy, -gz);
 // 12 bond
-		e2 = e1 / ls12;
-
-		yzp = dsy12 + dsz12;
-		yzm = -dy12 * dz12;
-		xzp = dsx12 + dsz12;
-		xzm = -dx12 * dz12;
-		xyp = dsx12 + dsy12;
-		xym = -dx12 * dy12;
-
-		e3 = e2 * (yzp * dx10 + xym * dy10 + xzm * dz10);
-		(a2->GX) += e3;
-		(a1->GX) -= e3;
-
-		e3 = e2 * (xym * dx10 + xzp * dy10 + yzm * dz10);
-		(a2->GY) += e3;
-		(a1->GY) -= e3;
-
-		e3 = e2 * (xzm * dx10 + yzm * dy10 + xyp * dz10);
-		(a2->GZ) += e3;
-		(a1->GZ) -= e3;
+		e2 = e1 / ls12[t];
+		dsx = dx12 * dx12;
+		dsy = dy12 * dy12;
+		dsz = dz12 * dz12;
+		gx = e2 * ((dsy + dsz) * dx10 - dx12 * dy12 * dy10
+			   - dx12 * dz12 * dz10);
+		gy = e2 * (-dx12 * dy12 * dx10 + (dsx + dsz) * dy10
+			   - dy12 * dz12 * dz10);
+		gz = e2 * (-dx12 * dz12 * dx10 - dy12 * dz12 * dy10
+			   + (dsx + dsy) * dz10);
+		add_grad(atoms, g, ia[3 * t + 2], gx, gy, gz);
+		add_grad(atoms, g, ia[3 * t + 1], -gx, -gy, -gz);
 	}
+	return en;
 }
 
-void ieng(struct atomgrp *ag, double *en)
+/** bond vectors and plane normals of a dihedral a0-a1-a2-a3 */
+struct dihedral_geom {
+	double d01[3], d12[3], d23[3], d02[3], d13[3];
+	double v02[3], v13[3]; /**< 01x12 and 12x23 */
+	double ds02, ds13, d12l;
+};
+
+//! Fills h for the dihedral ia[0..3], returns atan2 arguments in *ysi, *xco.
+static void dihedral_geometry(const mol_atom * atoms, const int *ia,
+			      struct dihedral_geom *h, double *ysi,
+			      double *xco)
 {
-	const double PI2 = 2 * M_PI;
-	const double DEGRA = M_PI / 180.0;
-
-	int i;
-	struct atom *a0, *a1, *a2, *a3;
-	double dx01, dy01, dz01;
-	double dx12, dy12, dz12;
-	double dx23, dy23, dz23;
-	double dx02, dy02, dz02;
-	double dx13, dy13, dz13;
-	double vx02, vy02, vz02;
-	double vx13, vy13, vz13;
+	const mol_atom *a0 = &(atoms[ia[0]]);
+	const mol_atom *a1 = &(atoms[ia[1]]);
+	const mol_atom *a2 = &(atoms[ia[2]]);
+	const mol_atom *a3 = &(atoms[ia[3]]);
 	double vx03, vy03, vz03;
-	double ds02, ds13, d12;
-	double xco, ysi, impan, imp0, dimp, e1, e2;
-	double x1, y1, z1, x2, y2, z2, dx, dy, dz;
-	struct atomimproper *ip;
 
-	for (i = 0; i < ag->nimpact; i++) {
-		ip = ag->impact[i];
-		a0 = ip->a0;
-		a1 = ip->a1;
-		a2 = ip->a2;
-		a3 = ip->a3;
-//                if(a0->fixed == 1 && a1->fixed == 1 && a2->fixed == 1 && a3->fixed == 1)continue;
-		dx01 = a1->X - a0->X;
-		dy01 = a1->Y - a0->Y;
-		dz01 = a1->Z - a0->Z;
-		dx12 = a2->X - a1->X;
-		dy12 = a2->Y - a1->Y;
-		dz12 = a2->Z - a1->Z;
-		dx23 = a3->X - a2->X;
-		dy23 = a3->Y - a2->Y;
-		dz23 = a3->Z - a2->Z;
-		dx02 = a2->X - a0->X;
-		dy02 = a2->Y - a0->Y;
-		dz02 = a2->Z - a0->Z;
-		dx13 = a3->X - a1->X;
-		dy13 = a3->Y - a1->Y;
-		dz13 = a3->Z - a1->Z;
+	h->d01[0] = a1->X - a0->X;
+	h->d01[1] = a1->Y - a0->Y;
+	h->d01[2] = a1->Z - a0->Z;
+	h->d12[0] = a2->X - a1->X;
+	h->d12[1] = a2->Y - a1->Y;
+	h->d12[2] = a2->Z - a1->Z;
+	h->d23[0] = a3->X - a2->X;
+	h->d23[1] = a3->Y - a2->Y;
+	h->d23[2] = a3->Z - a2->Z;
+	h->d02[0] = a2->X - a0->X;
+	h->d02[1] = a2->Y - a0->Y;
+	h->d02[2] = a2->Z - a0->Z;
+	h->d13[0] = a3->X - a1->X;
+	h->d13[1] = a3->Y - a1->Y;
+	h->d13[2] = a3->Z - a1->Z;
 // 01x12
-		vx02 = dy01 * dz12 - dy12 * dz01;
-		vy02 = dz01 * dx12 - dz12 * dx01;
-		vz02 = dx01 * dy12 - dx12 * dy01;
+	h->v02[0] = h->d01[1] * h->d12[2] - h->d12[1] * h->d01[2];
+	h->v02[1] = h->d01[2] * h->d12[0] - h->d12[2] * h->d01[0];
+	h->v02[2] = h->d01[0] * h->d12[1] - h->d12[0] * h->d01[1];
 // 12x23
-		vx13 = dy12 * dz23 - dy23 * dz12;
-		vy13 = dz12 * dx23 - dz23 * dx12;
-		vz13 = dx12 * dy23 - dx23 * dy12;
+	h->v13[0] = h->d12[1] * h->d23[2] - h->d23[1] * h->d12[2];
+	h->v13[1] = h->d12[2] * h->d23[0] - h->d23[2] * h->d12[0];
+	h->v13[2] = h->d12[0] * h->d23[1] - h->d23[0] * h->d12[1];
 // (01x12)x(12x23)
-		vx03 = vy02 * vz13 - vy13 * vz02;
-		vy03 = vz02 * vx13 - vz13 * vx02;
-		vz03 = vx02 * vy13 - vx13 * vy02;
+	vx03 = h->v02[1] * h->v13[2] - h->v13[1] * h->v02[2];
+	vy03 = h->v02[2] * h->v13[0] - h->v13[2] * h->v02[0];
+	vz03 = h->v02[0] * h->v13[1] - h->v13[0] * h->v02[1];
 // lengths
-		ds02 = vx02 * vx02 + vy02 * vy02 + vz02 * vz02;
-		ds13 = vx13 * vx13 + vy13 * vy13 + vz13 * vz13;
-		d12 = sqrt(dx12 * dx12 + dy12 * dy12 + dz12 * dz12);
-
-		xco = vx02 * vx13 + vy02 * vy13 + vz02 * vz13;
-		ysi = (dx12 * vx03 + dy12 * vy03 + dz12 * vz03) / d12;
-		impan = atan2(ysi, xco);
-		imp0 = DEGRA * (ip->psi0);
-		dimp = impan - imp0;
+	h->ds02 = h->v02[0] * h->v02[0] + h->v02[1] * h->v02[1]
+	    + h->v02[2] * h->v02[2];
+	h->ds13 = h->v13[0] * h->v13[0] + h->v13[1] * h->v13[1]
+	    + h->v13[2] * h->v13[2];
+	h->d12l = sqrt(h->d12[0] * h->d12[0] + h->d12[1] * h->d12[1]
+		       + h->d12[2] * h->d12[2]);
+
+	*xco = h->v02[0] * h->v13[0] + h->v02[1] * h->v13[1]
+	    + h->v02[2] * h->v13[2];
+	*ysi = (h->d12[0] * vx03 + h->d12[1] * vy03 + h->d12[2] * vz03)
+	    / h->d12l;
+}
+
+//! Scatters the forces of a dihedral energy with derivative dedphi.
+static void dihedral_forces(const struct dihedral_geom *h, const int *ia,
+			    double dedphi, mol_atom * atoms, double *g)
+{
+	const double *d01 = h->d01, *d12 = h->d12, *d23 = h->d23;
+	const double *d02 = h->d02, *d13 = h->d13;
+	const double *v02 = h->v02, *v13 = h->v13;
+	double e1 = dedphi / h->d12l;
+	double e2 = e1 / h->ds13;
+	double x1, y1, z1, x2, y2, z2;
+
+	e1 /= (-h->ds02);
+
+	x1 = e1 * (v02[1] * d12[2] - d12[1] * v02[2]);
+	y1 = e1 * (v02[2] * d12[0] - d12[2] * v02[0]);
+	z1 = e1 * (v02[0] * d12[1] - d12[0] * v02[1]);
+
+	x2 = e2 * (v13[1] * d12[2] - d12[1] * v13[2]);
+	y2 = e2 * (v13[2] * d12[0] - d12[2] * v13[0]);
+	z2 = e2 * (v13[0] * d12[1] - d12[0] * v13[1]);
+
+	add_grad(atoms, g, ia[0],
+		 d12[2] * y1 - d12[1] * z1,
+		 d12[0] * z1 - d12[2] * x1,
+		 d12[1] * x1 - d12[0] * y1);
+	add_grad(atoms, g, ia[1],
+		 d02[1] * z1 - d02[2] * y1 + d23[2] * y2 - d23[1] * z2,
+		 d02[2] * x1 - d02[0] * z1 + d23[0] * z2 - d23[2] * x2,
+		 d02[0] * y1 - d02[1] * x1 + d23[1] * x2 - d23[0] * y2);
+	add_grad(atoms, g, ia[2],
+		 d01[2] * y1 - d01[1] * z1 + d13[1] * z2 - d13[2] * y2,
+		 d01[0] * z1 - d01[2] * x1 + d13[2] * x2 - d13[0] * z2,
+		 d01[1] * x1 - d01[0] * y1 + d13[0] * y2 - d13[1] * x2);
+	add_grad(atoms, g, ia[3],
+		 d12[2] * y2 - d12[1] * z2,
+		 d12[0] * z2 - d12[2] * x2,
+		 d12[1] * x2 - d12[0] * y2);
+}
+
+//! Impropers ia[4 * t .. 4 * t + 3] for t < n, passes as in angle_block.
+static double improper_block(const int *ia, const double *k,
+			     const double *psi0, int n, mol_atom * atoms,
+			     double *g)
+{
+	const double PI2 = 2 * M_PI;
+	struct dihedral_geom h[AGBTAB_BLOCK];
+	double ysi[AGBTAB_BLOCK], xco[AGBTAB_BLOCK], impan[AGBTAB_BLOCK];
+	double en = 0;
+	int t;
+
+	for (t = 0; t < n; t++)
+		dihedral_geometry(atoms, ia + 4 * t, &(h[t]), &(ysi[t]),
+				  &(xco[t]));
+
+	for (t = 0; t < n; t++)
+		impan[t] = atan2(ysi[t], xco[t]);
+
+	for (t = 0; t < n; t++) {
+		double dimp = impan[t] - psi0[t];
 		while (dimp > M_PI)
 			dimp -= PI2;
 		while (dimp < -M_PI)
 			dimp += PI2;
-		e1 = (ip->k) * dimp;
-		(*en) += e1 * dimp;
+		en += k[t] * dimp * dimp;
+		dihedral_forces(&(h[t]), ia + 4 * t, 2.0 * k[t] * dimp, atoms,
+				g);
+	}
+	return en;
+}
 
-		e1 *= 2.0 / d12;
-		e2 = e1 / ds13;
-		e1 /= (-ds02);
+//! Torsions ia[4 * t .. 4 * t + 3] for t < n, passes as in angle_block.
+/*! In MOL_BONDED_TRIGFREE mode cos(n * chi) and sin(n * chi) come from
+    the multiple-angle recurrence on cos(chi) and sin(chi), which are the
+    normalized atan2 arguments, and the phase shift enters through
+    cosd = cos(d) and sind = sin(d); that pass is vectorized as in
+    angle_block (torsion_trigfree). */
+static double torsion_block(const int *ia, const double *k, const double *d,
+			    const double *cosd, const double *sind,
+			    const int *mult, int n, mol_atom * atoms,
+			    double *g)
+{
+	struct dihedral_geom h[AGBTAB_BLOCK];
+	double ysi[AGBTAB_BLOCK], xco[AGBTAB_BLOCK];
+	double ctor[AGBTAB_BLOCK], stor[AGBTAB_BLOCK];
+	double en = 0;
+	int t;
+
+	for (t = 0; t < n; t++)
+		dihedral_geometry(atoms, ia + 4 * t, &(h[t]), &(ysi[t]),
+				  &(xco[t]));
+
+	if (bonded_mode == MOL_BONDED_TRIGFREE) {
+		torsion_trigfree(n, ysi, xco, cosd, sind, mult, ctor, stor);
+	} else {
+		for (t = 0; t < n; t++) {
+			double dtor = mult[t] * atan2(ysi[t], xco[t]) - d[t];
+			ctor[t] = cos(dtor);
+			stor[t] = sin(dtor);
+		}
+	}
 
-		x1 = e1 * (vy02 * dz12 - dy12 * vz02);
-		y1 = e1 * (vz02 * dx12 - dz12 * vx02);
-		z1 = e1 * (vx02 * dy12 - dx12 * vy02);
+	for (t = 0; t < n; t++) {
+		en += k[t] * (1.0 + ctor[t]);
+		dihedral_forces(&(h[t]), ia + 4 * t, -k[t] * mult[t] * stor[t],
+				atoms, g);
+	}
+	return en;
+}
 
-		x2 = e2 * (vy13 * dz12 - dy12 * vz13);
-		y2 = e2 * (vz13 * dx12 - dz12 * vx13);
-		z2 = e2 * (vx13 * dy12 - dx12 * vy13);
+//! Terms [t0, t1) of the given type of table bt, t1 - t0 <= AGBTAB_BLOCK.
+static double btab_block(const struct agbtab *bt, int type, int t0, int t1,
+			 mol_atom * atoms, double *g)
+{
+	switch (type) {
+	case AGBTAB_BONDS:
+		return bond_block(bt->bond_atoms + 2 * t0, bt->bond_k + t0,
+				  bt->bond_l0 + t0, t1 - t0, atoms, g);
+	case AGBTAB_ANGLES:
+		return angle_block(bt->ang_atoms + 3 * t0, bt->ang_k + t0,
+				   bt->ang_th0 + t0, t1 - t0, t0, atoms, g);
+	case AGBTAB_TORSIONS:
+		return torsion_block(bt->tor_atoms + 4 * t0, bt->tor_k + t0,
+				     bt->tor_d + t0, bt->tor_cosd + t0,
+				     bt->tor_sind + t0, bt->tor_n + t0, t1 - t0,
+				     atoms, g);
+	default:
+		return improper_block(bt->imp_atoms + 4 * t0, bt->imp_k + t0,
+				      bt->imp_psi0 + t0, t1 - t0, atoms, g);
+	}
+}
 
-		dx = dz12 * y1 - dy12 * z1;
-		dy = dx12 * z1 - dz12 * x1;
-		dz = dy12 * x1 - dx12 * y1;
+#ifdef _OPENMP
+//! Threaded btab_eng, blocks are dealt to threads in fixed chunks.
+static double btab_eng_omp(struct atomgrp *ag, int type, int nterms,
+			   int nthreads)
+{
+	const int natoms = ag->natoms;
+	const int nblocks = (nterms + AGBTAB_BLOCK - 1) / AGBTAB_BLOCK;
+	double *tg = mol_thread_grads_alloc(nthreads, natoms);
+	double *ten = _mol_calloc(nthreads, sizeof(double));
+	double en;
+
+#pragma omp parallel num_threads(nthreads)
+	{
+		int b;
+		const int tid = omp_get_thread_num();
+		double *g = tg + (size_t) tid * 3 * natoms;
+		double e = 0.0;
+
+#pragma omp for schedule(static, 4)
+		for (b = 0; b < nblocks; b++) {
+			int t0 = b * AGBTAB_BLOCK;
+			int t1 = (t0 + AGBTAB_BLOCK < nterms) ?
+			    t0 + AGBTAB_BLOCK : nterms;
+			e += btab_block(ag->btab, type, t0, t1, ag->atoms, g);
+		}
+		ten[tid] = e;
+	}
+	mol_thread_grads_reduce(ag->atoms, natoms, nthreads, tg);
+	en = mol_thread_sum(nthreads, ten);
+	free(ten);
+	free(tg);
+	return en;
+}
+#endif
+
+//! Energy of all terms of the given type in ag->btab, gradients to the atoms.
+static double btab_eng(struct atomgrp *ag, int type, int nterms)
+{
+	double en = 0.0;
+	int t0;
 
-		(a0->GX) += dx;
-		(a0->GY) += dy;
-		(a0->GZ) += dz;
+#ifdef _OPENMP
+	if (nterms >= AGBTAB_PARALLEL_MIN_TERMS && mol_num_threads() > 1)
+		return btab_eng_omp(ag, type, nterms, mol_num_threads());
+#endif
+	for (t0 = 0; t0 < nterms; t0 += AGBTAB_BLOCK) {
+		int t1 = (t0 + AGBTAB_BLOCK < nterms) ?
+		    t0 + AGBTAB_BLOCK : nterms;
+		en += btab_block(ag->btab, type, t0, t1, ag->atoms, NULL);
+	}
+	return en;
+}
 
-		dx = dy02 * z1 - dz02 * y1 + dz23 * y2 - dy23 * z2;
-		dy = dz02 * x1 - dx02 * z1 + dx23 * z2 - dz23 * x2;
-		dz = dx02 * y1 - dy02 * x1 + dy23 * x2 - dx23 * y2;
+void beng(struct atomgrp *ag, double *en)
+{
+	int ia[2 * AGBTAB_BLOCK];
+	double k[AGBTAB_BLOCK], l0[AGBTAB_BLOCK];
+	int i, t0, n;
+	struct atombond *bp;
 
-		(a1->GX) += dx;
-		(a1->GY) += dy;
-		(a1->GZ) += dz;
+	if (agbtab_current(ag)) {
+		(*en) += btab_eng(ag, AGBTAB_BONDS, ag->btab->nbonds);
+		return;
+	}
+	for (t0 = 0; t0 < ag->nbact; t0 += n) {
+		n = (ag->nbact - t0 < AGBTAB_BLOCK) ? ag->nbact - t0 :
+		    AGBTAB_BLOCK;
+		for (i = 0; i < n; i++) {
+			bp = ag->bact[t0 + i];
+			ia[2 * i] = bp->a0 - ag->atoms;
+			ia[2 * i + 1] = bp->a1 - ag->atoms;
+			k[i] = bp->k;
+			l0[i] = bp->l0;
+		}
+		(*en) += bond_block(ia, k, l0, n, ag->atoms, NULL);
+	}
+}
 
-		dx = dz01 * y1 - dy01 * z1 + dy13 * z2 - dz13 * y2;
-		dy = dx01 * z1 - dz01 * x1 + dz13 * x2 - dx13 * z2;
-		dz = dy01 * x1 - dx01 * y1 + dx13 * y2 - dy13 * x2;
+void aeng(struct atomgrp *ag, double *en)
+{
+	const double DEGRA = M_PI / 180.0;
+	int ia[3 * AGBTAB_BLOCK];
+	double k[AGBTAB_BLOCK], th0[AGBTAB_BLOCK];
+	int i, t0, n;
+	struct atomangle *ap;
 
-		(a2->GX) += dx;
-		(a2->GY) += dy;
-		(a2->GZ) += dz;
+	if (agbtab_current(ag)) {
+		(*en) += btab_eng(ag, AGBTAB_ANGLES, ag->btab->nangs);
+		return;
+	}
+	for (t0 = 0; t0 < ag->nangact; t0 += n) {
+		n = (ag->nangact - t0 < AGBTAB_BLOCK) ? ag->nangact - t0 :
+		    AGBTAB_BLOCK;
+		for (i = 0; i < n; i++) {
+			ap = ag->angact[t0 + i];
+			ia[3 * i] = ap->a0 - ag->atoms;
+			ia[3 * i + 1] = ap->a1 - ag->atoms;
+			ia[3 * i + 2] = ap->a2 - ag->atoms;
+			k[i] = ap->k;
+			th0[i] = DEGRA * (ap->th0);
+		}
+		(*en) += angle_block(ia, k, th0, n, t0, ag->atoms, NULL);
+	}
+}
 
-		dx = dz12 * y2 - dy12 * z2;
-		dy = dx12 * z2 - dz12 * x2;
-		dz = dy12 * x2 - dx12 * y2;
+void ieng(struct atomgrp *ag, double *en)
+{
+	const double DEGRA = M_PI / 180.0;
+	int ia[4 * AGBTAB_BLOCK];
+	double k[AGBTAB_BLOCK], psi0[AGBTAB_BLOCK];
+	int i, t0, n;
+	struct atomimproper *ip;
 
-		(a3->GX) += dx;
-		(a3->GY) += dy;
-		(a3->GZ) += dz;
+	if (agbtab_current(ag)) {
+		(*en) += btab_eng(ag, AGBTAB_IMPROPERS, ag->btab->nimps);
+		return;
+	}
+	for (t0 = 0; t0 < ag->nimpact; t0 += n) {
+		n = (ag->nimpact - t0 < AGBTAB_BLOCK) ? ag->nimpact - t0 :
+		    AGBTAB_BLOCK;
+		for (i = 0; i < n; i++) {
+			ip = ag->impact[t0 + i];
+			ia[4 * i] = ip->a0 - ag->atoms;
+			ia[4 * i + 1] = ip->a1 - ag->atoms;
+			ia[4 * i + 2] = ip->a2 - ag->atoms;
+			ia[4 * i + 3] = ip->a3 - ag->atoms;
+			k[i] = ip->k;
+			psi0[i] = DEGRA * (ip->psi0);
+		}
+		(*en) += improper_block(ia, k, psi0, n, ag->atoms, NULL);
 	}
 }
 
 void teng(struct atomgrp *ag, double *en)
 {
 	const long double DEGRA = M_PI / 180.0;
-	int i, n;
-	struct atom *a0, *a1, *a2, *a3;
-	double dx01, dy01, dz01;
-	double dx12, dy12, dz12;
-	double dx23, dy23, dz23;
-	double dx02, dy02, dz02;
-	double dx13, dy13, dz13;
-	double vx02, vy02, vz02;
-	double vx13, vy13, vz13;
-	double vx03, vy03, vz03;
-	double ds02, ds13, d12;
-	double xco, ysi, toran, tor0, dtor, e1, e2;
-	double x1, y1, z1, x2, y2, z2, dx, dy, dz;
+	int ia[4 * AGBTAB_BLOCK], mult[AGBTAB_BLOCK];
+	double k[AGBTAB_BLOCK], d[AGBTAB_BLOCK];
+	double cosd[AGBTAB_BLOCK], sind[AGBTAB_BLOCK];
+	int i, t0, n;
 	struct atomtorsion *tp;
 
-	for (i = 0; i < ag->ntoract; i++) {
-		tp = ag->toract[i];
-		a0 = tp->a0;
-		a1 = tp->a1;
-		a2 = tp->a2;
-		a3 = tp->a3;
-//                if(a0->fixed == 1 && a1->fixed == 1 && a2->fixed == 1 && a3->fixed == 1)continue;
-		dx01 = a1->X - a0->X;
-		dy01 = a1->Y - a0->Y;
-		dz01 = a1->Z - a0->Z;
-		dx12 = a2->X - a1->X;
-		dy12 = a2->Y - a1->Y;
-		dz12 = a2->Z - a1->Z;
-		dx23 = a3->X - a2->X;
-		dy23 = a3->Y - a2->Y;
-		dz23 = a3->Z - a2->Z;
-		dx02 = a2->X - a0->X;
-		dy02 = a2->Y - a0->Y;
-		dz02 = a2->Z - a0->Z;
-		dx13 = a3->X - a1->X;
-		dy13 = a3->Y - a1->Y;
-		dz13 = a3->Z - a1->Z;
-// 01x12
-		vx02 = dy01 * dz12 - dy12 * dz01;
-		vy02 = dz01 * dx12 - dz12 * dx01;
-		vz02 = dx01 * dy12 - dx12 * dy01;
-// 12x23
-		vx13 = dy12 * dz23 - dy23 * dz12;
-		vy13 = dz12 * dx23 - dz23 * dx12;
-		vz13 = dx12 * dy23 - dx23 * dy12;
-// (01x12)x(12x23)
-		vx03 = vy02 * vz13 - vy13 * vz02;
-		vy03 = vz02 * vx13 - vz13 * vx02;
-		vz03 = vx02 * vy13 - vx13 * vy02;
-// lengths
-		ds02 = vx02 * vx02 + vy02 * vy02 + vz02 * vz02;
-		ds13 = vx13 * vx13 + vy13 * vy13 + vz13 * vz13;
-		d12 = sqrt(dx12 * dx12 + dy12 * dy12 + dz12 * dz12);
-
-		xco = vx02 * vx13 + vy02 * vy13 + vz02 * vz13;
-		ysi = (dx12 * vx03 + dy12 * vy03 + dz12 * vz03) / d12;
-
-		toran = atan2(ysi, xco);
-		tor0 = DEGRA * (tp->d);
-		n = tp->n;
-		dtor = n * toran - tor0;
-		e1 = tp->k;
-		(*en) += e1 * (1.0 + cos(dtor));
-
-		e1 *= (-n * sin(dtor) / d12);
-		e2 = e1 / ds13;
-		e1 /= (-ds02);
-
-		x1 = e1 * (vy02 * dz12 - dy12 * vz02);
-		y1 = e1 * (vz02 * dx12 - dz12 * vx02);
-		z1 = e1 * (vx02 * dy12 - dx12 * vy02);
-
-		x2 = e2 * (vy13 * dz12 - dy12 * vz13);
-		y2 = e2 * (vz13 * dx12 - dz12 * vx13);
-		z2 = e2 * (vx13 * dy12 - dx12 * vy13);
-
-		dx = dz12 * y1 - dy12 * z1;
-		dy = dx12 * z1 - dz12 * x1;
-		dz = dy12 * x1 - dx12 * y1;
-
-		(a0->GX) += dx;
-		(a0->GY) += dy;
-		(a0->GZ) += dz;
-
-		dx = dy02 * z1 - dz02 * y1 + dz23 * y2 - dy23 * z2;
-		dy = dz02 * x1 - dx02 * z1 + dx23 * z2 - dz23 * x2;
-		dz = dx02 * y1 - dy02 * x1 + dy23 * x2 - dx23 * y2;
-
-		(a1->GX) += dx;
-		(a1->GY) += dy;
-		(a1->GZ) += dz;
-
-		dx = dz01 * y1 - dy01 * z1 + dy13 * z2 - dz13 * y2;
-		dy = dx01 * z1 - dz01 * x1 + dz13 * x2 - dx13 * z2;
-		dz = dy01 * x1 - dx01 * y1 + dx13 * y2 - dy13 * x2;
-
-		(a2->GX) += dx;
-		(a2->GY) += dy;
-		(a2->GZ) += dz;
-
-		dx = dz12 * y2 - dy12 * z2;
-		dy = dx12 * z2 - dz12 * x2;
-		dz = dy12 * x2 - dx12 * y2;
-
-		(a3->GX) += dx;
-		(a3->GY) += dy;
-		(a3->GZ) += dz;
+	if (agbtab_current(ag)) {
+		(*en) += btab_eng(ag, AGBTAB_TORSIONS, ag->btab->ntors);
+		return;
+	}
+	for (t0 = 0; t0 < ag->ntoract; t0 += n) {
+		n = (ag->ntoract - t0 < AGBTAB_BLOCK) ? ag->ntoract - t0 :
+		    AGBTAB_BLOCK;
+		for (i = 0; i < n; i++) {
+			tp = ag->toract[t0 + i];
+			ia[4 * i] = tp->a0 - ag->atoms;
+			ia[4 * i + 1] = tp->a1 - ag->atoms;
+			ia[4 * i + 2] = tp->a2 - ag->atoms;
+			ia[4 * i + 3] = tp->a3 - ag->atoms;
+			k[i] = tp->k;
+			d[i] = DEGRA * (tp->d);
+			cosd[i] = cos(d[i]);
+			sind[i] = sin(d[i]);
+			mult[i] = tp->n;
+		}
+		(*en) += torsion_block(ia, k, d, cosd, sind, mult, n,
+				       ag->atoms, NULL);
 	}
 }
 
@@ -36,6 +36,23 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 	(bonds, angles, dihedrals, impropers)
 */
 
+/**
+  how aeng and teng evaluate angles: MOL_BONDED_TRIG calls acos, sin,
+  atan2 and cos; MOL_BONDED_TRIGFREE uses dot and cross products, a
+  rational acos for the angle terms and the multiple-angle recurrence
+  of cos(n*chi), sin(n*chi) for the integer torsion periodicities
+  (no transcendental calls on ag->btab, see btab.h); with AVX2 (see
+  mol_simd_level) those passes run four terms at a time
+*/
+enum mol_bonded_mode {
+	MOL_BONDED_TRIG = 0,
+	MOL_BONDED_TRIGFREE = 1
+};
+
+/** angle evaluation of the bonded kernels, MOL_BONDED_TRIG by default */
+enum mol_bonded_mode mol_bonded_mode(void);
+void mol_bonded_set_mode(enum mol_bonded_mode mode);
+
 /**
   find the bond energy and forces
 */
@@ -0,0 +1,214 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+
+#include _MOL_INCLUDE_
+
+//! Stable counting sort of n terms by the index of their first atom.
+/*! Returns the permutation: perm[k] is the active list position of
+    the k-th term of the table. */
+static int *order_by_first_atom(int n, const int *first, int natoms)
+{
+	int *perm = _mol_malloc((n > 0 ? n : 1) * sizeof(int));
+	int *start = _mol_calloc(natoms + 1, sizeof(int));
+	int i;
+
+	for (i = 0; i < n; i++)
+		start[first[i] + 1]++;
+	for (i = 0; i < natoms; i++)
+		start[i + 1] += start[i];
+	for (i = 0; i < n; i++)
+		perm[start[first[i]]++] = i;
+
+	free(start);
+	return perm;
+}
+
+void init_agbtab(struct atomgrp *ag)
+{
+	const double DEGRA = M_PI / 180.0;
+	const long double LDEGRA = M_PI / 180.0;
+	struct agbtab *btab = ag->btab;
+	struct atom *atoms = ag->atoms;
+	int nmax, i, t;
+	int *first, *perm;
+
+	if (btab == NULL) {
+		btab = _mol_calloc(1, sizeof(struct agbtab));
+		ag->btab = btab;
+	} else
+		destroy_agbtab(btab);
+
+	nmax = ag->nbact;
+	if (ag->nangact > nmax)
+		nmax = ag->nangact;
+	if (ag->ntoract > nmax)
+		nmax = ag->ntoract;
+	if (ag->nimpact > nmax)
+		nmax = ag->nimpact;
+	first = _mol_malloc((nmax > 0 ? nmax : 1) * sizeof(int));
+
+// bonds
+	btab->nbonds = ag->nbact;
+	btab->bond_atoms = _mol_malloc((2 * ag->nbact + 1) * sizeof(int));
+	btab->bond_k = _mol_malloc((ag->nbact + 1) * sizeof(double));
+	btab->bond_l0 = _mol_malloc((ag->nbact + 1) * sizeof(double));
+	for (i = 0; i < ag->nbact; i++)
+		first[i] = ag->bact[i]->a0 - atoms;
+	perm = order_by_first_atom(ag->nbact, first, ag->natoms);
+	for (t = 0; t < ag->nbact; t++) {
+		struct atombond *bp = ag->bact[perm[t]];
+		btab->bond_atoms[2 * t] = bp->a0 - atoms;
+		btab->bond_atoms[2 * t + 1] = bp->a1 - atoms;
+		btab->bond_k[t] = bp->k;
+		btab->bond_l0[t] = bp->l0;
+	}
+	free(perm);
+// angles
+	btab->nangs = ag->nangact;
+	btab->ang_atoms = _mol_malloc((3 * ag->nangact + 1) * sizeof(int));
+	btab->ang_k = _mol_malloc((ag->nangact + 1) * sizeof(double));
+	btab->ang_th0 = _mol_malloc((ag->nangact + 1) * sizeof(double));
+	for (i = 0; i < ag->nangact; i++)
+		first[i] = ag->angact[i]->a0 - atoms;
+	perm = order_by_first_atom(ag->nangact, first, ag->natoms);
+	for (t = 0; t < ag->nangact; t++) {
+		struct atomangle *ap = ag->angact[perm[t]];
+		btab->ang_atoms[3 * t] = ap->a0 - atoms;
+		btab->ang_atoms[3 * t + 1] = ap->a1 - atoms;
+		btab->ang_atoms[3 * t + 2] = ap->a2 - atoms;
+		btab->ang_k[t] = ap->k;
+		btab->ang_th0[t] = DEGRA * (ap->th0);
+	}
+	free(perm);
+// dihedrals
+	btab->ntors = ag->ntoract;
+	btab->tor_atoms = _mol_malloc((4 * ag->ntoract + 1) * sizeof(int));
+	btab->tor_k = _mol_malloc((ag->ntoract + 1) * sizeof(double));
+	btab->tor_d = _mol_malloc((ag->ntoract + 1) * sizeof(double));
+	btab->tor_cosd = _mol_malloc((ag->ntoract + 1) * sizeof(double));
+	btab->tor_sind = _mol_malloc((ag->ntoract + 1) * sizeof(double));
+	btab->tor_n = _mol_malloc((ag->ntoract + 1) * sizeof(int));
+	for (i = 0; i < ag->ntoract; i++)
+		first[i] = ag->toract[i]->a0 - atoms;
+	perm = order_by_first_atom(ag->ntoract, first, ag->natoms);
+	for (t = 0; t < ag->ntoract; t++) {
+		struct atomtorsion *tp = ag->toract[perm[t]];
+		btab->tor_atoms[4 * t] = tp->a0 - atoms;
+		btab->tor_atoms[4 * t + 1] = tp->a1 - atoms;
+		btab->tor_atoms[4 * t + 2] = tp->a2 - atoms;
+		btab->tor_atoms[4 * t + 3] = tp->a3 - atoms;
+		btab->tor_k[t] = tp->k;
+		// same rounding as teng() on the pointer lists
+		btab->tor_d[t] = LDEGRA * (tp->d);
+		btab->tor_cosd[t] = cos(btab->tor_d[t]);
+		btab->tor_sind[t] = sin(btab->tor_d[t]);
+		btab->tor_n[t] = tp->n;
+	}
+	free(perm);
+// impropers
+	btab->nimps = ag->nimpact;
+	btab->imp_atoms = _mol_malloc((4 * ag->nimpact + 1) * sizeof(int));
+	btab->imp_k = _mol_malloc((ag->nimpact + 1) * sizeof(double));
+	btab->imp_psi0 = _mol_malloc((ag->nimpact + 1) * sizeof(double));
+	for (i = 0; i < ag->nimpact; i++)
+		first[i] = ag->impact[i]->a0 - atoms;
+	perm = order_by_first_atom(ag->nimpact, first, ag->natoms);
+	for (t = 0; t < ag->nimpact; t++) {
+		struct atomimproper *ip = ag->impact[perm[t]];
+		btab->imp_atoms[4 * t] = ip->a0 - atoms;
+		btab->imp_atoms[4 * t + 1] = ip->a1 - atoms;
+		btab->imp_atoms[4 * t + 2] = ip->a2 - atoms;
+		btab->imp_atoms[4 * t + 3] = ip->a3 - atoms;
+		btab->imp_k[t] = ip->k;
+		btab->imp_psi0[t] = DEGRA * (ip->psi0);
+	}
+	free(perm);
+
+	free(first);
+	btab->atoms = atoms;
+	btab->natoms = ag->natoms;
+	btab->bact = ag->bact;
+	btab->angact = ag->angact;
+	btab->toract = ag->toract;
+	btab->impact = ag->impact;
+}
+
+int agbtab_current(const struct atomgrp *ag)
+{
+	const struct agbtab *btab = ag->btab;
+
+	return btab != NULL && btab->atoms == ag->atoms
+	    && btab->natoms == ag->natoms
+	    && btab->nbonds == ag->nbact && btab->bact == ag->bact
+	    && btab->nangs == ag->nangact && btab->angact == ag->angact
+	    && btab->ntors == ag->ntoract && btab->toract == ag->toract
+	    && btab->nimps == ag->nimpact && btab->impact == ag->impact;
+}
+
+void destroy_agbtab(struct agbtab *btab)
+{
+	free(btab->bond_atoms);
+	free(btab->bond_k);
+	free(btab->bond_l0);
+	free(btab->ang_atoms);
+	free(btab->ang_k);
+	free(btab->ang_th0);
+	free(btab->tor_atoms);
+	free(btab->tor_k);
+	free(btab->tor_d);
+	free(btab->tor_cosd);
+	free(btab->tor_sind);
+	free(btab->tor_n);
+	free(btab->imp_atoms);
+	free(btab->imp_k);
+	free(btab->imp_psi0);
+	btab->bond_atoms = btab->ang_atoms = NULL;
+	btab->tor_atoms = btab->tor_n = btab->imp_atoms = NULL;
+	btab->bond_k = btab->bond_l0 = btab->ang_k = btab->ang_th0 = NULL;
+	btab->tor_k = btab->tor_d = btab->imp_k = btab->imp_psi0 = NULL;
+	btab->tor_cosd = btab->tor_sind = NULL;
+	btab->nbonds = btab->nangs = btab->ntors = btab->nimps = 0;
+	btab->atoms = NULL;
+	btab->natoms = 0;
+	btab->bact = NULL;
+	btab->angact = NULL;
+	btab->toract = NULL;
+	btab->impact = NULL;
+}
+
+void free_agbtab(struct agbtab *btab)
+{
+	destroy_agbtab(btab);
+	free(btab);
+}
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_BTAB_H_
+#define _MOL_BTAB_H_
+
+/** \file btab.h
+	This file contains a flattened copy of the active bonded
+	terms of an atomgrp (bonds, angles, torsions, impropers):
+	atom indices and parameters in plain arrays, so that the
+	bonded energy kernels do not chase pointers.
+*/
+
+/** number of terms the bonded kernels evaluate per pass, and the
+    unit of work the threaded kernels hand out */
+#define AGBTAB_BLOCK 64
+
+/** smallest number of terms of one type worth spreading over threads */
+#define AGBTAB_PARALLEL_MIN_TERMS 2048
+
+/** term types of struct agbtab */
+enum agbtab_type {
+	AGBTAB_BONDS,
+	AGBTAB_ANGLES,
+	AGBTAB_TORSIONS,
+	AGBTAB_IMPROPERS
+};
+
+/**
+	Active bonded terms of an atomgrp packed by term type.
+	Atom indices refer to ag->atoms, term t of a type with m atoms
+	uses entries m * t ... m * t + m - 1 of its index array. Terms of
+	each type are sorted by the index of their first atom, ties keep
+	the order of the active lists. Angles are stored in radians.
+*/
+struct agbtab
+{
+	int nbonds; /**< number of active bonds */
+	int *bond_atoms; /**< a0, a1 of each bond */
+	double *bond_k; /**< spring constants */
+	double *bond_l0; /**< equilibrium lengths */
+
+	int nangs; /**< number of active angles */
+	int *ang_atoms; /**< a0, a1, a2 of each angle */
+	double *ang_k; /**< spring constants */
+	double *ang_th0; /**< equilibrium angles */
+
+	int ntors; /**< number of active torsions */
+	int *tor_atoms; /**< a0, a1, a2, a3 of each torsion */
+	double *tor_k; /**< k constants */
+	double *tor_d; /**< phase shifts */
+	double *tor_cosd, *tor_sind; /**< cos and sin of the phase shifts */
+	int *tor_n; /**< multiplicities */
+
+	int nimps; /**< number of active impropers */
+	int *imp_atoms; /**< a0, a1, a2, a3 of each improper */
+	double *imp_k; /**< spring constants */
+	double *imp_psi0; /**< equilibrium angles */
+
+	const struct atom *atoms; /**< ag->atoms the table was built for */
+	int natoms; /**< ag->natoms the table was built for */
+	struct atombond **bact; /**< active lists the table was built from */
+	struct atomangle **angact;
+	struct atomtorsion **toract;
+	struct atomimproper **impact;
+};
+
+/**
+	Allocates ag->btab (if not present) and fills it from the
+	active lists ag->bact, ag->angact, ag->toract and ag->impact.
+	Called by fixed_update() and fixed_update_nolist(); call it
+	again after changing bonded parameters of an atomgrp.
+*/
+void init_agbtab(struct atomgrp *ag);
+
+/**
+	Returns 1 if ag->btab exists and was built from the current
+	atoms and active lists of ag, 0 otherwise. The bonded kernels
+	fall back to the active lists when it returns 0. Parameters
+	edited in place are not detected, see init_agbtab().
+*/
+int agbtab_current(const struct atomgrp *ag);
+
+void destroy_agbtab(struct agbtab *btab);
+void free_agbtab(struct agbtab *btab);
+
+#endif
@@ -34,6 +34,9 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include _MOL_INCLUDE_
 
@@ -208,6 +211,10 @@ void ace_ini(struct atomgrp *ag, struct acesetup *ac_s)
 	ac_s->zf = _mol_calloc(sizeof(double), ag->natoms);
 	ac_s->diarr = _mol_calloc(sizeof(double), ag->natoms);
 	ac_s->list0123 = _mol_calloc(sizeof(int), 1);
+	ac_s->budget = ACE_DEFAULT_BUDGET;
+	ac_s->lean = 0;
+	ac_s->chunkbuf = NULL;
+	ac_s->nchunkbuf = 0;
 }
 
 static int *compute_0123_list(struct atomgrp *ag, int *n0123, int *list03,
@@ -243,6 +250,81 @@ static int *compute_0123_list(struct atomgrp *ag, int *n0123, int *list03,
 	return list0123;
 }
 
+//! Self energy taken from atom type it by kt at distance r, and its force.
+/*! Returns ffk, the radial force over r; the energy term is put in *temp. */
+static double ace_selfterm(const struct acesetup *const ac_s, const int it,
+			   const int kt, const double r2, const double r3,
+			   const double r4, const double sw, const double dsw,
+			   double *const temp)
+{
+	const int ik = it * ac_s->ntypes + kt;
+	const double expterm =
+	    ac_s->wace[ik] * exp(-r2 / ac_s->s2ace[ik]);
+	const double u4ace = pow(ac_s->uace[ik], 4);
+	const double rmu = r4 + u4ace;
+	const double term =
+	    (ac_s->vsolv[kt] / (8.0 * M_PI)) * pow((r3 / rmu), 4);
+	*temp = 2.0 * (expterm + term);
+	return ((-8 * term * (3 * u4ace - r4) / (r2 * rmu)) +
+		(4 * expterm / ac_s->s2ace[ik])) * sw - (*temp) * dsw;
+}
+
+//! ace_selfterm in single precision, for MOL_NB_MIXED.
+static double ace_selftermf(const struct acesetup *const ac_s, const int it,
+			    const int kt, const float r2, const float r3,
+			    const float r4, const float sw, const float dsw,
+			    double *const temp)
+{
+	const int ik = it * ac_s->ntypes + kt;
+	const float s2 = ac_s->s2ace[ik];
+	const float expterm = (float)ac_s->wace[ik] * expf(-r2 / s2);
+	const float u = ac_s->uace[ik];
+	const float u4ace = (u * u) * (u * u);
+	const float rmu = r4 + u4ace;
+	const float q = (r3 / rmu) * (r3 / rmu);
+	const float term = (float)(ac_s->vsolv[kt] / (8.0 * M_PI)) * q * q;
+	const float t = 2.0f * (expterm + term);
+	*temp = t;
+	return ((-8.0f * term * (3.0f * u4ace - r4) / (r2 * rmu)) +
+		(4.0f * expterm / s2)) * sw - t * dsw;
+}
+
+//! Switch of the self energy at squared distance r2, swc from ace_switch_init.
+/*! Returns 0 beyond the cutoff, else puts the switch and its derivative
+    over r in *sw and *dsw. */
+static inline int ace_switch(const double *const swc, const double r2,
+			     double *const sw, double *const dsw)
+{
+	double rl, ru;
+	if (r2 >= swc[1])
+		return 0;
+	*sw = 1.0;
+	*dsw = 0;
+	if (r2 > swc[0]) {
+		rl = swc[0] - r2;
+		ru = swc[1] - r2;
+		*sw = ru * ru * (ru - 3 * rl) * swc[2];
+		*dsw = rl * ru * swc[3];
+	}
+	return 1;
+}
+
+//! ace_selfterm or ace_selftermf at distance r, as picked by mixed.
+static double ace_selfforce(const struct acesetup *const ac_s, const int it,
+			    const int kt, const double r2, const double r,
+			    const double sw, const double dsw,
+			    const int mixed, double *const temp)
+{
+	const double r3 = r2 * r;
+	const double r4 = r2 * r2;
+	if (mixed)
+		return ace_selftermf(ac_s, it, kt, r2, r3, r4, sw, dsw, temp);
+	return ace_selfterm(ac_s, it, kt, r2, r3, r4, sw, dsw, temp);
+}
+
+//! Self energy update of pair ij from the separation dx, dy, dz.
+/*! The pair caches swarr, dswarr, darr and xsf, ysf, zsf are only
+    written when given, they are NULL for a lean acesetup. */
 static void ace_eselfupdate(const int i1, const int i2, const int it,
 			    const int kt, const int ij, const double dx,
 			    const double dy, const double dz,
@@ -256,97 +338,57 @@ static void ace_eselfupdate(const int i1, const int i2, const int it,
 			    double *const restrict zf,
 			    double *const restrict xsf,
 			    double *const restrict ysf,
-			    double *const restrict zsf, const double rul3,
-			    const double rul12, const double nb2cot,
-			    const double nb2cof, const int nbsize)
+			    double *const restrict zsf,
+			    const double *const swc, const int nbsize,
+			    const int mixed)
 {
-	double sw, dsw, expterm, temp, rmu, term, rl, ru, u4ace, ffk;
+	double sw, dsw, temp, ffk, fx, fy, fz;
 	const double r2 = dx * dx + dy * dy + dz * dz;
-	darr[ij] = -1;
-
-	if (r2 < nb2cof) {
-		sw = 1.0;
-		dsw = 0;
-		if (r2 > nb2cot) {
-			rl = (nb2cot) - r2;
-			ru = (nb2cof) - r2;
-			sw = ru * ru * (ru - 3 * rl) * rul3;
-			dsw = rl * ru * rul12;
-		}
+	double r;
+	if (darr != NULL)
+		darr[ij] = -1;
 
+	if (!ace_switch(swc, r2, &sw, &dsw))
+		return;
+	r = sqrt(r2);
+	if (darr != NULL) {
 		swarr[ij] = sw;
 		dswarr[ij] = dsw;
-		const double r = sqrt(r2);
 		darr[ij] = r;
-		const double r3 = r2 * r;
-		const double r4 = r2 * r2;
-		if (ac_s->vsolv[kt] > 0) {
-			expterm =
-			    ac_s->wace[it * ac_s->ntypes +
-				       kt] * exp(-r2 / ac_s->s2ace[it *
-								   ac_s->
-								   ntypes +
-								   kt]);
-			u4ace = pow(ac_s->uace[it * ac_s->ntypes + kt], 4);
-			rmu = r4 + u4ace;
-			term =
-			    (ac_s->vsolv[kt] / (8.0 * M_PI)) * pow((r3 / rmu),
-								   4);
-
-			temp = 2.0 * (expterm + term);
-			eself[i1] -= temp * sw;
-			ffk =
-			    ((-8 * term * (3 * u4ace - r4) / (r2 * rmu)) +
-			     (4 * expterm /
-			      ac_s->s2ace[it * ac_s->ntypes + kt])) * sw -
-			    temp * dsw;
-
-			xsf[ij] = ffk * dx;
-			ysf[ij] = ffk * dy;
-			zsf[ij] = ffk * dz;
-
-			xf[i1] -= xsf[ij];
-			yf[i1] -= ysf[ij];
-			zf[i1] -= zsf[ij];
-		} else {
-			xsf[ij] = 0;
-			ysf[ij] = 0;
-			zsf[ij] = 0;
-		}
-		if (ac_s->vsolv[it] > 0) {
-			int ind;
-			expterm =
-			    ac_s->wace[kt * ac_s->ntypes +
-				       it] * exp(-r2 / ac_s->s2ace[kt *
-								   ac_s->
-								   ntypes +
-								   it]);
-			u4ace = pow(ac_s->uace[kt * ac_s->ntypes + it], 4);
-			rmu = r4 + u4ace;
-			term =
-			    (ac_s->vsolv[it] / (8.0 * M_PI)) * pow((r3 / rmu),
-								   4);
-			temp = 2.0 * (expterm + term);
-			eself[i2] -= temp * sw;
-			ffk =
-			    ((-8 * term * (3 * u4ace - r4) / (r2 * rmu)) +
-			     (4 * expterm /
-			      ac_s->s2ace[kt * ac_s->ntypes + it])) * sw -
-			    temp * dsw;
-
-			ind = ij + nbsize;
-			xsf[ind] = -ffk * dx;
-			ysf[ind] = -ffk * dy;
-			zsf[ind] = -ffk * dz;
-
-			xf[i2] -= xsf[ind];
-			yf[i2] -= ysf[ind];
-			zf[i2] -= zsf[ind];
-		} else {
-			xsf[ij + nbsize] = 0;
-			ysf[ij + nbsize] = 0;
-			zsf[ij + nbsize] = 0;
-		}
+	}
+	fx = fy = fz = 0;
+	if (ac_s->vsolv[kt] > 0) {
+		ffk = ace_selfforce(ac_s, it, kt, r2, r, sw, dsw, mixed,
+				    &temp);
+		eself[i1] -= temp * sw;
+		fx = ffk * dx;
+		fy = ffk * dy;
+		fz = ffk * dz;
+		xf[i1] -= fx;
+		yf[i1] -= fy;
+		zf[i1] -= fz;
+	}
+	if (xsf != NULL) {
+		xsf[ij] = fx;
+		ysf[ij] = fy;
+		zsf[ij] = fz;
+	}
+	fx = fy = fz = 0;
+	if (ac_s->vsolv[it] > 0) {
+		ffk = ace_selfforce(ac_s, kt, it, r2, r, sw, dsw, mixed,
+				    &temp);
+		eself[i2] -= temp * sw;
+		fx = -ffk * dx;
+		fy = -ffk * dy;
+		fz = -ffk * dz;
+		xf[i2] -= fx;
+		yf[i2] -= fy;
+		zf[i2] -= fz;
+	}
+	if (xsf != NULL) {
+		xsf[ij + nbsize] = fx;
+		ysf[ij + nbsize] = fy;
+		zsf[ij + nbsize] = fz;
 	}
 }
 
@@ -382,6 +424,19 @@ void ace_updatenblst(const struct agsetup *const restrict ags,
 	}
 	nbsize += ac_s->n0123;
 	ac_s->nbsize = nbsize;
+	ac_s->lean = ac_s->budget > 0
+	    && 9 * sizeof(double) * (size_t) nbsize > ac_s->budget;
+	if (ac_s->lean) {
+		free(ac_s->swarr);
+		free(ac_s->dswarr);
+		free(ac_s->darr);
+		free(ac_s->xsf);
+		free(ac_s->ysf);
+		free(ac_s->zsf);
+		ac_s->swarr = ac_s->dswarr = ac_s->darr = NULL;
+		ac_s->xsf = ac_s->ysf = ac_s->zsf = NULL;
+		return;
+	}
 	ac_s->swarr = _mol_realloc(ac_s->swarr, nbsize * sizeof(double));
 	ac_s->dswarr = _mol_realloc(ac_s->dswarr, nbsize * sizeof(double));
 	ac_s->darr = _mol_realloc(ac_s->darr, nbsize * sizeof(double));
@@ -415,6 +470,7 @@ void destroy_acesetup(struct acesetup *ac_s)
 	free(ac_s->uace);
 	free(ac_s->wace);
 	free(ac_s->hydr);
+	free(ac_s->chunkbuf);
 }
 
 void free_acesetup(struct acesetup *ac_s)
@@ -589,40 +645,16 @@ void test_acegrads_nonpolar(struct atomgrp *ag, struct agsetup *ags,
 	free(fs);
 }
 
-static void aceeng_internal(const struct atomgrp *const ag,
-			    double *const restrict en,
-			    const struct acesetup *const ac_s,
-			    const struct agsetup *const ags,
-			    const ACE_ENERGY_TYPE ace_energy_type)
+//! Reset self energies and self energy forces, returns the b0 radius.
+static double ace_selfinit(const struct atomgrp *const ag,
+			   const struct acesetup *const ac_s)
 {
-	double x1, y1, z1, dx, dy, dz;
-	int i1, i2, it, j, i, n2, kt, ij = 0;
-	int *p;
+	int i, it;
 	double b0 = 0;
-	const double nb2cot = 8.0 * 8.0;	//Switching start
-	const double nb2cof = ags->nblst->nbcof * ags->nblst->nbcof;
-	const int nbsize = ac_s->nbsize;
-	double etotal = 0;
-	double ecoul = 0;
-	int *list0123 = ac_s->list0123;
-	int n0123 = ac_s->n0123;
 	double *eself = ac_s->eself;
-	double *rborn = ac_s->rborn;
-	double *swarr = ac_s->swarr;
-	double *dswarr = ac_s->dswarr;
-	double *darr = ac_s->darr;
-	//d(rb)/d(eself)
-	double *dbrdes = ac_s->dbrdes;
-	double *xsf = ac_s->xsf;
-	double *ysf = ac_s->ysf;
-	double *zsf = ac_s->zsf;
 	double *xf = ac_s->xf;
 	double *yf = ac_s->yf;
 	double *zf = ac_s->zf;
-	double *diarr = ac_s->diarr;
-	const double rul3 = 1.0 / pow((nb2cof - nb2cot), 3.0);
-	const double rul12 = 12.0 * rul3;
-	double ehydr = 0;
 	//NBLST RBORN
 	for (i = 0; i < ag->natoms; i++) {
 		double ri;
@@ -634,53 +666,415 @@ static void aceeng_internal(const struct atomgrp *const ag,
 		yf[i] = 0;
 		zf[i] = 0;
 	}
-	b0 = pow((0.75 * b0 / M_PI), 1.0 / 3.0);
-	ij = 0;
-	//Loop through non bonded atoms
-	for (i = 0; i < ags->nblst->nfat; i++) {
-		i1 = ags->nblst->ifat[i];
+	return pow((0.75 * b0 / M_PI), 1.0 / 3.0);
+}
+
+//! Switching constants of the self energy: nb2cot, nb2cof, rul3, rul12.
+/*! The switching starts at ACE_SWITCH_ON, as it always has; only
+    cutoffs at or below it, where that window would be empty, start at
+    two thirds of nbcof instead. */
+static void ace_switch_init(double swc[4], const double nbcof)
+{
+	const double ton = (nbcof > ACE_SWITCH_ON) ? ACE_SWITCH_ON :
+		2.0 * nbcof / 3.0;
+
+	swc[0] = ton * ton;	//Switching start
+	swc[1] = nbcof * nbcof;
+	swc[2] = 1.0 / pow((swc[1] - swc[0]), 3.0);
+	swc[3] = 12.0 * swc[2];
+}
+
+//! Self energy update of pair ij between atoms i1 and i2 of ag.
+/*! dx, dy, dz is the separation vector i1 - i2, swc from ace_switch_init,
+    mixed selects the single precision pair terms. Self energies and
+    their forces are accumulated in eself, xf, yf, zf (those of ac_s,
+    or private arrays of a thread), the per-pair caches in ac_s. */
+static void ace_pairupdate(const struct atomgrp *const ag,
+			   const struct acesetup *const ac_s, const int i1,
+			   const int i2, const int ij, const double dx,
+			   const double dy, const double dz,
+			   const double *const swc, const int mixed,
+			   double *const eself, double *const xf,
+			   double *const yf, double *const zf)
+{
+	ace_eselfupdate(i1, i2, ag->atoms[i1].atom_ftypen,
+			ag->atoms[i2].atom_ftypen, ij, dx, dy, dz, ac_s,
+			eself, ac_s->swarr, ac_s->dswarr, ac_s->darr,
+			xf, yf, zf, ac_s->xsf, ac_s->ysf, ac_s->zsf, swc,
+			ac_s->nbsize, mixed);
+}
+
+//! Self energy sweep over nblist rows [r0, r1), see ace_pairupdate.
+static void ace_sweeprows(const struct atomgrp *const ag,
+			  const struct acesetup *const ac_s,
+			  const struct nblist *const nblst, const int r0,
+			  const int r1, const double *const swc,
+			  const int mixed, double *const eself,
+			  double *const xf, double *const yf, double *const zf)
+{
+	double x1, y1, z1;
+	int i1, i2, j, i, n2, ij;
+	int *p;
+	for (i = r0; i < r1; i++) {
+		i1 = nblst->ifat[i];
 		x1 = ag->atoms[i1].X;
 		y1 = ag->atoms[i1].Y;
 		z1 = ag->atoms[i1].Z;
-		n2 = ags->nblst->nsat[i];
+		n2 = nblst->nsat[i];
+		ij = nblst->offs[i];
 
-		p = ags->nblst->isat[i];
-		it = ag->atoms[i1].atom_ftypen;
+		p = nblst->isat[i];
 		for (j = 0; j < n2; j++) {
 			i2 = p[j];
-			dx = x1 - ag->atoms[i2].X;
-			dy = y1 - ag->atoms[i2].Y;
-			dz = z1 - ag->atoms[i2].Z;
-			kt = ag->atoms[i2].atom_ftypen;
-			ace_eselfupdate(i1, i2, it, kt, ij++, dx, dy, dz, ac_s,
-					eself, swarr, dswarr, darr, xf, yf, zf,
-					xsf, ysf, zsf, rul3, rul12, nb2cot,
-					nb2cof, nbsize);
+			ace_pairupdate(ag, ac_s, i1, i2, ij++,
+				       x1 - ag->atoms[i2].X,
+				       y1 - ag->atoms[i2].Y,
+				       z1 - ag->atoms[i2].Z, swc, mixed,
+				       eself, xf, yf, zf);
+		}
+	}
+}
+
+//! Self energy sweep over entries [k0, k1) of the 1-2-3-4 list.
+/*! Pair indices of the list start at ij0. */
+static void ace_sweep0123(const struct atomgrp *const ag,
+			  const struct acesetup *const ac_s, const int ij0,
+			  const int k0, const int k1, const double *const swc,
+			  const int mixed, double *const eself,
+			  double *const xf, double *const yf, double *const zf)
+{
+	int i, i1, i2;
+	for (i = k0; i < k1; i++) {
+		i1 = ac_s->list0123[2 * i];
+		i2 = ac_s->list0123[2 * i + 1];
+		ace_pairupdate(ag, ac_s, i1, i2, ij0 + i,
+			       ag->atoms[i1].X - ag->atoms[i2].X,
+			       ag->atoms[i1].Y - ag->atoms[i2].Y,
+			       ag->atoms[i1].Z - ag->atoms[i2].Z, swc, mixed,
+			       eself, xf, yf, zf);
+	}
+}
+
+//! Adds -< fx, fy, fz > to the gradient of atom i, in g if given, else in atoms.
+static inline void ace_subgrad(mol_atom * atoms, double *g, const int i,
+			       const double fx, const double fy,
+			       const double fz)
+{
+	if (g != NULL) {
+		g[3 * i] -= fx;
+		g[3 * i + 1] -= fy;
+		g[3 * i + 2] -= fz;
+	} else {
+		atoms[i].GX -= fx;
+		atoms[i].GY -= fy;
+		atoms[i].GZ -= fz;
+	}
+}
+
+//! Distance of pair ij between i1 and i2 within the cutoff, else -1.
+/*! The switch and its derivative go to *sw and *dsw. They are read from
+    the pair caches, or recomputed the way ace_eselfupdate does for a
+    lean acesetup. */
+static inline double ace_pairgeom(const struct atomgrp *const ag,
+				  const struct acesetup *const ac_s,
+				  const double *const swc, const int i1,
+				  const int i2, const int ij, double *const sw,
+				  double *const dsw)
+{
+	double dx, dy, dz;
+	if (!ac_s->lean) {
+		*sw = ac_s->swarr[ij];
+		*dsw = ac_s->dswarr[ij];
+		return ac_s->darr[ij];
+	}
+	dx = ag->atoms[i1].X - ag->atoms[i2].X;
+	dy = ag->atoms[i1].Y - ag->atoms[i2].Y;
+	dz = ag->atoms[i1].Z - ag->atoms[i2].Z;
+	if (!ace_switch(swc, dx * dx + dy * dy + dz * dz, sw, dsw))
+		return -1;
+	return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+//! Polar energy of pair i1, i2 at distance s, its forces and Born radius derivatives.
+/*! sw and dsw are the pair switch, f14 is the scale of the coulomb term
+    added to the pair, 0 for 1-2 and 1-3 pairs. Derivatives go to diarr,
+    gradients to g (see ace_subgrad), energies to *etotal and *ecoul. */
+static void ace_polarpair(const struct atomgrp *const ag,
+			  const struct acesetup *const ac_s, const int i1,
+			  const int i2, const double s, const double sw,
+			  const double dsw, const double f14,
+			  const int mixed, double *const diarr, double *g,
+			  double *const etotal, double *const ecoul)
+{
+	//Electrostatic constant need to carry over to constants
+	const double kelec = 332.0716;
+	//change to epsilons;
+	const double tau = ((1 / 4.0) - (1 / 78.0));
+	const double fac1 = -kelec * tau;
+	const double facc1 = kelec / (4.0);
+	const double *rborn = ac_s->rborn;
+	const double *dbrdes = ac_s->dbrdes;
+	double s2, brij, expo, fexp, rij2, rij, cij, fac2, fac3, fac4, dij,
+	    dji, facc2, fac5, dx, dy, dz;
+
+	dx = ag->atoms[i1].X - ag->atoms[i2].X;
+	dy = ag->atoms[i1].Y - ag->atoms[i2].Y;
+	dz = ag->atoms[i1].Z - ag->atoms[i2].Z;
+	s2 = s * s;
+	brij = rborn[i1] * rborn[i2];
+	expo = s2 / (4.0 * brij);
+	fexp = mixed ? expf(-expo) : exp(-expo);
+	rij2 = s2 + brij * fexp;
+	rij = mixed ? sqrtf(rij2) : sqrt(rij2);
+	cij = ag->atoms[i1].chrg * ag->atoms[i2].chrg;
+	fac2 = fac1 * cij / rij;
+	*etotal += fac2 * sw;
+	fac3 = fac2 / rij2;
+	fac4 = 0.5 * fac3 * (1 + expo) * fexp;
+	fac4 = fac4 * sw;
+	dij = fac4 * rborn[i2] * dbrdes[i1];
+	dji = fac4 * rborn[i1] * dbrdes[i2];
+	diarr[i1] += dij;
+	diarr[i2] += dji;
+	if (f14 != 0) {
+		//full field force (incl. coulomb), 1-4 switching
+		facc2 = f14 * facc1 * cij / s;
+		fac5 = fac3 * (0.25 * fexp - 1.0) - facc2 / s2;
+		*ecoul += facc2 * sw;
+		fac5 = sw * fac5 + (fac2 + facc2) * dsw;
+	} else {
+		//1-3 1-2 interactions
+		fac5 = fac3 * (0.25 * fexp - 1.0);
+		fac5 = sw * fac5 + (fac2) * dsw;
+	}
+	ace_subgrad(ag->atoms, g, i1, fac5 * dx, fac5 * dy, fac5 * dz);
+	ace_subgrad(ag->atoms, g, i2, -fac5 * dx, -fac5 * dy, -fac5 * dz);
+}
+
+//! Polar pair sweep over nblist rows [r0, r1) and 1-2-3-4 entries [k0, k1).
+static void ace_polarsweep(const struct atomgrp *const ag,
+			   const struct acesetup *const ac_s,
+			   const struct agsetup *const ags,
+			   const double *const swc, const int r0,
+			   const int r1, const int k0, const int k1,
+			   const int mixed, double *const diarr, double *g,
+			   double *const etotal, double *const ecoul)
+{
+	const struct nblist *nblst = ags->nblst;
+	const int ij0 = nblst->offs[nblst->nfat];
+	int i, j, i1, i2, ij;
+	double r, sw, dsw;
+	for (i = r0; i < r1; i++) {
+		i1 = nblst->ifat[i];
+		if (ag->atoms[i1].chrg == 0)
+			continue;
+		ij = nblst->offs[i];
+		for (j = 0; j < nblst->nsat[i]; j++, ij++) {
+			i2 = nblst->isat[i][j];
+			if (ag->atoms[i2].chrg == 0)
+				continue;
+			r = ace_pairgeom(ag, ac_s, swc, i1, i2, ij, &sw, &dsw);
+			if (r > 0)
+				ace_polarpair(ag, ac_s, i1, i2, r, sw, dsw, 1.0,
+					      mixed, diarr, g, etotal, ecoul);
 		}
 	}
+	for (i = k0; i < k1; i++) {
+		i1 = ac_s->list0123[2 * i];
+		i2 = ac_s->list0123[2 * i + 1];
+		if ((ag->atoms[i1].chrg == 0) || (ag->atoms[i2].chrg == 0))
+			continue;
+		r = ace_pairgeom(ag, ac_s, swc, i1, i2, ij0 + i, &sw, &dsw);
+		if (r > 0)
+			ace_polarpair(ag, ac_s, i1, i2, r, sw, dsw,
+				      (i < ags->nf03) ? ac_s->efac : 0.0,
+				      mixed, diarr, g, etotal, ecoul);
+	}
+}
+
+//! Self energy forces of pair ij between i1 and i2, 0 beyond the cutoff.
+/*! f[0..2] is the force of i2 on the self energy of i1, f[3..5] that of
+    i1 on i2: xsf, ysf, zsf at ij and ij + nbsize, or recomputed for a
+    lean acesetup. */
+static int ace_pairselfforces(const struct atomgrp *const ag,
+			      const struct acesetup *const ac_s,
+			      const double *const swc, const int i1,
+			      const int i2, const int ij, const int mixed,
+			      double f[6])
+{
+	const int it = ag->atoms[i1].atom_ftypen;
+	const int kt = ag->atoms[i2].atom_ftypen;
+	double dx, dy, dz, r2, r, sw, dsw, temp, ffk;
+	if (!ac_s->lean) {
+		const int nbsize = ac_s->nbsize;
+		if (ac_s->darr[ij] <= 0)
+			return 0;
+		f[0] = ac_s->xsf[ij];
+		f[1] = ac_s->ysf[ij];
+		f[2] = ac_s->zsf[ij];
+		f[3] = ac_s->xsf[ij + nbsize];
+		f[4] = ac_s->ysf[ij + nbsize];
+		f[5] = ac_s->zsf[ij + nbsize];
+		return 1;
+	}
+	dx = ag->atoms[i1].X - ag->atoms[i2].X;
+	dy = ag->atoms[i1].Y - ag->atoms[i2].Y;
+	dz = ag->atoms[i1].Z - ag->atoms[i2].Z;
+	r2 = dx * dx + dy * dy + dz * dz;
+	if (!ace_switch(swc, r2, &sw, &dsw))
+		return 0;
+	r = sqrt(r2);
+	if (r <= 0)
+		return 0;
+	f[0] = f[1] = f[2] = f[3] = f[4] = f[5] = 0;
+	if (ac_s->vsolv[kt] > 0) {
+		ffk = ace_selfforce(ac_s, it, kt, r2, r, sw, dsw, mixed,
+				    &temp);
+		f[0] = ffk * dx;
+		f[1] = ffk * dy;
+		f[2] = ffk * dz;
+	}
+	if (ac_s->vsolv[it] > 0) {
+		ffk = ace_selfforce(ac_s, kt, it, r2, r, sw, dsw, mixed,
+				    &temp);
+		f[3] = -ffk * dx;
+		f[4] = -ffk * dy;
+		f[5] = -ffk * dz;
+	}
+	return 1;
+}
+
+//! Self energy forces of pair i1, i2 scaled by the Born radius derivatives.
+static void ace_selfpair(const struct atomgrp *const ag,
+			 const struct acesetup *const ac_s,
+			 const double *const swc, const int i1, const int i2,
+			 const int ij, const double factor_E, const int mixed,
+			 double *g)
+{
+	double f[6], fdiarr1, fdiarr2;
+	if (!ace_pairselfforces(ag, ac_s, swc, i1, i2, ij, mixed, f))
+		return;
+	fdiarr1 = -factor_E * ac_s->diarr[i1];
+	fdiarr2 = -factor_E * ac_s->diarr[i2];
+	ace_subgrad(ag->atoms, g, i2, fdiarr1 * f[0], fdiarr1 * f[1],
+		    fdiarr1 * f[2]);
+	ace_subgrad(ag->atoms, g, i1, fdiarr2 * f[3], fdiarr2 * f[4],
+		    fdiarr2 * f[5]);
+}
+
+//! Self energy forces of nblist rows [r0, r1) and 1-2-3-4 entries [k0, k1).
+static void ace_selfforces(const struct atomgrp *const ag,
+			   const struct acesetup *const ac_s,
+			   const struct nblist *const nblst,
+			   const double *const swc, const int r0,
+			   const int r1, const int k0, const int k1,
+			   const double factor_E, const int mixed, double *g)
+{
+	const int ij0 = nblst->offs[nblst->nfat];
+	int i, j, ij;
+	for (i = r0; i < r1; i++) {
+		ij = nblst->offs[i];
+		for (j = 0; j < nblst->nsat[i]; j++, ij++)
+			ace_selfpair(ag, ac_s, swc, nblst->ifat[i],
+				     nblst->isat[i][j], ij, factor_E, mixed, g);
+	}
 	//Loop through 1-2-3-4 list
-	for (i = 0; i < n0123; i++) {
-		i1 = list0123[2 * i];
-		i2 = list0123[2 * i + 1];
-		x1 = ag->atoms[i1].X;
-		y1 = ag->atoms[i1].Y;
-		z1 = ag->atoms[i1].Z;
-		it = ag->atoms[i1].atom_ftypen;
-		dx = x1 - ag->atoms[i2].X;
-		dy = y1 - ag->atoms[i2].Y;
-		dz = z1 - ag->atoms[i2].Z;
-		kt = ag->atoms[i2].atom_ftypen;
-		ace_eselfupdate(i1, i2, it, kt, ij++, dx, dy, dz, ac_s, eself,
-				swarr, dswarr, darr, xf, yf, zf, xsf, ysf, zsf,
-				rul3, rul12, nb2cot, nb2cof, nbsize);
+	for (i = k0; i < k1; i++)
+		ace_selfpair(ag, ac_s, swc, ac_s->list0123[2 * i],
+			     ac_s->list0123[2 * i + 1], ij0 + i, factor_E,
+			     mixed, g);
+}
+
+/*! Number of chunks the threaded ACE sweeps split a list of npairs
+    pairs into, one per thread, or 0 to run them in one piece. Each
+    chunk keeps its own partial sums, added in chunk order, so a given
+    number of threads always gives the same result. */
+static int ace_nchunks(const int npairs)
+{
+	const int nthreads = mol_num_threads();
+	if (nthreads < 2 || npairs < MOL_PARALLEL_MIN_PAIRS)
+		return 0;
+	return nthreads;
+}
+
+#ifdef _OPENMP
+//! First nblist row of the pairs from start on.
+static int ace_chunkrow(const struct nblist *const nblst,
+			const long long start)
+{
+	int lo = 0, hi = nblst->nfat;
+	while (lo < hi) {
+		const int mid = lo + (hi - lo) / 2;
+		if (nblst->offs[mid] < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+//! Chunk c of nc is nblist rows [*r0, *r1), split by pair count, and
+//! 1-2-3-4 entries [*k0, *k1).
+static void ace_chunk(const struct nblist *const nblst, const int n0123,
+		      const int c, const int nc, int *r0, int *r1, int *k0,
+		      int *k1)
+{
+	const long long npairs = nblst->offs[nblst->nfat];
+	*r0 = ace_chunkrow(nblst, npairs * c / nc);
+	*r1 = c + 1 < nc ? ace_chunkrow(nblst, npairs * (c + 1) / nc)
+	    : nblst->nfat;
+	*k0 = (int)((long long)n0123 * c / nc);
+	*k1 = (int)((long long)n0123 * (c + 1) / nc);
+}
+
+//! Zeroed scratch of n doubles for the chunk sums, kept on ac_s.
+/*! The block only grows, so repeated calls on one system allocate
+    once; destroy_acesetup releases it. */
+static double *ace_chunkbuf(struct acesetup *const ac_s, const size_t n)
+{
+	if (n > ac_s->nchunkbuf) {
+		free(ac_s->chunkbuf);
+		ac_s->chunkbuf = _mol_malloc(n * sizeof(double));
+		ac_s->nchunkbuf = n;
 	}
+	memset(ac_s->chunkbuf, 0, n * sizeof(double));
+	return ac_s->chunkbuf;
+}
+#endif
+
+//! Born radii, energies and forces once all self energies are known.
+/*! With nc > 0 the two pair sweeps run in nc chunks with private Born
+    radius derivatives and gradients, reduced in chunk order, the chunks
+    dealt to threads. */
+static void ace_finish(const struct atomgrp *const ag,
+		       double *const restrict en,
+		       struct acesetup *const ac_s,
+		       const struct agsetup *const ags,
+		       const ACE_ENERGY_TYPE ace_energy_type, const double b0,
+		       const double *const swc, const int mixed, const int nc)
+{
+	int it, i;
+	const int natoms = ag->natoms;
+	const struct nblist *nblst = ags->nblst;
+	double etotal = 0;
+	double ecoul = 0;
+	double *eself = ac_s->eself;
+	double *rborn = ac_s->rborn;
+	//d(rb)/d(eself)
+	double *dbrdes = ac_s->dbrdes;
+	double *xf = ac_s->xf;
+	double *yf = ac_s->yf;
+	double *zf = ac_s->zf;
+	double *diarr = ac_s->diarr;
+	double ehydr = 0;
+	double *tg = NULL;
 	//Electrostatic constant need to carry over to constants
 	const double kelec = 332.0716;
 	const double factor_E = -kelec / 2.0;
 	//change to epsilons;
 	const double tau = ((1 / 4.0) - (1 / 78.0));
 
-	for (i = 0; i < ag->natoms; i++) {
+	for (i = 0; i < natoms; i++) {
 		double c2;
 		diarr[i] = 0;
 		if (ace_energy_type & ACE_NONPOLAR) {
@@ -702,188 +1096,326 @@ static void aceeng_internal(const struct atomgrp *const ag,
 			diarr[i] += c2;
 		}
 	}
-	if (ace_energy_type & ACE_POLAR) {
-		//Second loop calculating energy nb
-		ij = 0;
-		const double fac1 = -kelec * tau;
-		const double facc1 = kelec / (4.0);
-		for (i = 0; i < ags->nblst->nfat; i++) {
-			i1 = ags->nblst->ifat[i];
-			n2 = ags->nblst->nsat[i];
-			p = ags->nblst->isat[i];
-			x1 = ag->atoms[i1].X;
-			y1 = ag->atoms[i1].Y;
-			z1 = ag->atoms[i1].Z;
-			if (ag->atoms[i1].chrg != 0) {
-				for (j = 0; j < n2; j++) {
-					double s, s2, brij, expo, fexp, rij2,
-					    rij, cij, fac2, sw, dsw, fac3, fac4,
-					    dij, dji, facc2, fac5, fx, fy, fz;
-					i2 = p[j];
-					if ((ag->atoms[i2].chrg != 0)
-					    && (darr[ij] > 0)) {
-						dx = x1 - ag->atoms[i2].X;
-						dy = y1 - ag->atoms[i2].Y;
-						dz = z1 - ag->atoms[i2].Z;
-						s = darr[ij];
-						s2 = s * s;
-						brij = rborn[i1] * rborn[i2];
-						expo = s2 / (4.0 * brij);
-						fexp = exp(-expo);
-						rij2 = s2 + brij * fexp;
-						rij = sqrt(rij2);
-						cij =
-						    ag->atoms[i1].chrg *
-						    ag->atoms[i2].chrg;
-						fac2 = fac1 * cij / rij;
-						sw = swarr[ij];
-						dsw = dswarr[ij];
-						etotal += fac2 * sw;
-						fac3 = fac2 / rij2;
-						fac4 =
-						    0.5 * fac3 * (1 +
-								  expo) * fexp;
-						fac4 = fac4 * sw;
-						dij =
-						    fac4 * rborn[i2] *
-						    dbrdes[i1];
-						dji =
-						    fac4 * rborn[i1] *
-						    dbrdes[i2];
-						diarr[i1] += dij;
-						diarr[i2] += dji;
-						//full field force (incl. coulomb) for non-bonded pairs
-						facc2 = facc1 * cij / s;
-						fac5 =
-						    fac3 * (0.25 * fexp - 1.0) -
-						    facc2 / s2;
-						ecoul += facc2 * sw;
-						fac5 =
-						    sw * fac5 + (fac2 +
-								 facc2) * dsw;
-						fx = fac5 * dx;
-						fy = fac5 * dy;
-						fz = fac5 * dz;
-						ag->atoms[i1].GX -= fx;
-						ag->atoms[i1].GY -= fy;
-						ag->atoms[i1].GZ -= fz;
-						ag->atoms[i2].GX += fx;
-						ag->atoms[i2].GY += fy;
-						ag->atoms[i2].GZ += fz;
-					}
-					ij++;
-				}
-			} else {
-				ij += n2;
-			}
+#ifdef _OPENMP
+	//nc gradient blocks, then nc Born radius derivative blocks
+	if (nc > 0)
+		tg = ace_chunkbuf(ac_s, (size_t) nc * 4 * natoms);
+#endif
+	if ((ace_energy_type & ACE_POLAR) && tg == NULL)
+		ace_polarsweep(ag, ac_s, ags, swc, 0, nblst->nfat, 0,
+			       ac_s->n0123, mixed, diarr, NULL, &etotal,
+			       &ecoul);
+#ifdef _OPENMP
+	if ((ace_energy_type & ACE_POLAR) && tg != NULL) {
+		double *tdi = tg + (size_t) nc * 3 * natoms;
+		double *ten = _mol_calloc(2 * nc, sizeof(double));
+		int c;
+#pragma omp parallel for num_threads(nc) schedule(static, 1)
+		for (c = 0; c < nc; c++) {
+			int r0, r1, k0, k1;
+			ace_chunk(nblst, ac_s->n0123, c, nc, &r0, &r1, &k0, &k1);
+			ace_polarsweep(ag, ac_s, ags, swc, r0, r1, k0, k1,
+				       mixed, tdi + (size_t) c * natoms,
+				       tg + (size_t) c * 3 * natoms,
+				       &ten[2 * c], &ten[2 * c + 1]);
 		}
-		//1-2-3-4 second loop
-		for (i = 0; i < n0123; i++) {
-			double s, s2, brij, expo, fexp, rij2, rij, cij, fac2,
-			    sw, dsw, fac3, fac4, dij, dji, facc2, fac5, fx, fy,
-			    fz;
-			i1 = list0123[2 * i];
-			i2 = list0123[2 * i + 1];
-			x1 = ag->atoms[i1].X;
-			y1 = ag->atoms[i1].Y;
-			z1 = ag->atoms[i1].Z;
-			dx = x1 - ag->atoms[i2].X;
-			dy = y1 - ag->atoms[i2].Y;
-			dz = z1 - ag->atoms[i2].Z;
-			if ((darr[ij] > 0) && (ag->atoms[i1].chrg != 0)
-			    && (ag->atoms[i2].chrg != 0)) {
-				s = darr[ij];
-				s2 = s * s;
-				brij = rborn[i1] * rborn[i2];
-				expo = s2 / (4.0 * brij);
-				fexp = exp(-expo);
-				rij2 = s2 + brij * fexp;
-				rij = sqrt(rij2);
-				cij = ag->atoms[i1].chrg * ag->atoms[i2].chrg;
-				fac2 = fac1 * cij / rij;
-				sw = swarr[ij];
-				dsw = dswarr[ij];
-				etotal += fac2 * sw;
-				fac3 = fac2 / rij2;
-				fac4 = 0.5 * fac3 * (1 + expo) * fexp;
-				fac4 = fac4 * sw;
-				dij = fac4 * rborn[i2] * dbrdes[i1];
-				dji = fac4 * rborn[i1] * dbrdes[i2];
-				diarr[i1] += dij;
-				diarr[i2] += dji;
-				//1-4 switching
-				if (i < ags->nf03) {
-					facc2 = ac_s->efac * facc1 * cij / s;
-					fac5 =
-					    fac3 * (0.25 * fexp - 1.0) -
-					    facc2 / s2;
-					ecoul += facc2 * sw;
-					fac5 = sw * fac5 + (fac2 + facc2) * dsw;
-				} else {
-					//1-3 1-2 interactions
-					fac5 = fac3 * (0.25 * fexp - 1.0);
-					fac5 = sw * fac5 + (fac2) * dsw;
-				}
-
-				fx = fac5 * dx;
-				fy = fac5 * dy;
-				fz = fac5 * dz;
-				ag->atoms[i1].GX -= fx;
-				ag->atoms[i1].GY -= fy;
-				ag->atoms[i1].GZ -= fz;
-				ag->atoms[i2].GX += fx;
-				ag->atoms[i2].GY += fy;
-				ag->atoms[i2].GZ += fz;
-			}
-			ij++;
+		for (c = 0; c < nc; c++) {
+			const double *di = tdi + (size_t) c * natoms;
+			for (i = 0; i < natoms; i++)
+				diarr[i] += di[i];
+			etotal += ten[2 * c];
+			ecoul += ten[2 * c + 1];
 		}
+		free(ten);
 	}
+#endif
 	*en += ecoul + etotal + ehydr;
 
-	for (i = 0; i < ag->natoms; i++) {
+	for (i = 0; i < natoms; i++) {
 		double fdiarr = -factor_E * diarr[i];
 		ag->atoms[i].GX -= fdiarr * xf[i];
 		ag->atoms[i].GY -= fdiarr * yf[i];
 		ag->atoms[i].GZ -= fdiarr * zf[i];
 	}
-	ij = 0;
-	for (i = 0; i < ags->nblst->nfat; i++) {
-		i1 = ags->nblst->ifat[i];
-		n2 = ags->nblst->nsat[i];
-		p = ags->nblst->isat[i];
+	if (tg == NULL) {
+		ace_selfforces(ag, ac_s, nblst, swc, 0, nblst->nfat, 0,
+			       ac_s->n0123, factor_E, mixed, NULL);
+		return;
+	}
+#ifdef _OPENMP
+	{
+		int c;
+#pragma omp parallel for num_threads(nc) schedule(static, 1)
+		for (c = 0; c < nc; c++) {
+			int r0, r1, k0, k1;
+			ace_chunk(nblst, ac_s->n0123, c, nc, &r0, &r1, &k0, &k1);
+			ace_selfforces(ag, ac_s, nblst, swc, r0, r1, k0, k1,
+				       factor_E, mixed,
+				       tg + (size_t) c * 3 * natoms);
+		}
+	}
+#endif
+	mol_thread_grads_reduce(ag->atoms, natoms, nc, tg);
+}
+
+#ifdef _OPENMP
+//! Adds the self energy sums of the nc chunks in acc to ac_s.
+/*! Chunk c holds eself, xf, yf, zf at acc + 4 * natoms * c. */
+static void ace_chunks_reduce(const struct acesetup *const ac_s,
+			      const int natoms, const int nc,
+			      const double *const acc)
+{
+	int c, i;
+	for (c = 0; c < nc; c++) {
+		const double *a = acc + (size_t) c * 4 * natoms;
+		for (i = 0; i < natoms; i++) {
+			ac_s->eself[i] += a[i];
+			ac_s->xf[i] += a[natoms + i];
+			ac_s->yf[i] += a[2 * natoms + i];
+			ac_s->zf[i] += a[3 * natoms + i];
+		}
+	}
+}
+
+//! Self energy sweeps of aceeng in nc chunks, see ace_nchunks.
+static void ace_sweeps_chunks(const struct atomgrp *const ag,
+			      struct acesetup *const ac_s,
+			      const struct nblist *const nblst,
+			      const double *const swc, const int mixed,
+			      const int nc)
+{
+	const int natoms = ag->natoms;
+	const int ij0 = nblst->offs[nblst->nfat];
+	double *acc = ace_chunkbuf(ac_s, (size_t) nc * 4 * natoms);
+	int c;
+
+#pragma omp parallel for num_threads(nc) schedule(static, 1)
+	for (c = 0; c < nc; c++) {
+		double *a = acc + (size_t) c * 4 * natoms;
+		int r0, r1, k0, k1;
+		ace_chunk(nblst, ac_s->n0123, c, nc, &r0, &r1, &k0, &k1);
+		ace_sweeprows(ag, ac_s, nblst, r0, r1, swc, mixed,
+			      a, a + natoms, a + 2 * natoms, a + 3 * natoms);
+		ace_sweep0123(ag, ac_s, ij0, k0, k1, swc, mixed,
+			      a, a + natoms, a + 2 * natoms, a + 3 * natoms);
+	}
+	ace_chunks_reduce(ac_s, natoms, nc, acc);
+}
+#endif
+
+static void aceeng_internal(const struct atomgrp *const ag,
+			    double *const restrict en,
+			    struct acesetup *const ac_s,
+			    const struct agsetup *const ags,
+			    const ACE_ENERGY_TYPE ace_energy_type)
+{
+	const struct nblist *nblst = ags->nblst;
+	double swc[4];
+	const int mixed = mol_nb_precision() == MOL_NB_MIXED;
+	const int nc = ace_nchunks(nblst->npairs);
+	const double b0 = ace_selfinit(ag, ac_s);
+	ace_switch_init(swc, nblst->nbcof);
+#ifdef _OPENMP
+	if (nc > 0)
+		ace_sweeps_chunks(ag, ac_s, nblst, swc, mixed, nc);
+	else
+#endif
+	{
+		//Loop through non bonded atoms, then the 1-2-3-4 list
+		ace_sweeprows(ag, ac_s, nblst, 0, nblst->nfat, swc, mixed,
+			      ac_s->eself, ac_s->xf, ac_s->yf, ac_s->zf);
+		ace_sweep0123(ag, ac_s, nblst->offs[nblst->nfat], 0,
+			      ac_s->n0123, swc, mixed, ac_s->eself, ac_s->xf,
+			      ac_s->yf, ac_s->zf);
+	}
+	ace_finish(ag, en, ac_s, ags, ace_energy_type, b0, swc, mixed, nc);
+}
+
+//! Rows [r0, r1) of the fused pass of nbeng.
+/*! Gradients go to g if given, else to the atoms, the self energies of
+    NBENG_ACE to eself, xf, yf, zf, and the vdw and elec energies are
+    added to *ev and *ee. With mixed the vdw and elec pair terms go
+    through vdw_pairf and ele_pairf, as in vdw_rows_mixed. */
+static void nbeng_rows(struct atomgrp *ag, const struct nblist *nblst,
+		       const int r0, const int r1, const int terms,
+		       const double pf, const struct acesetup *ac_s,
+		       const double *const swc, const int mixed,
+		       double *eself, double *xf, double *yf, double *zf,
+		       double *g, double *ev, double *ee)
+{
+	int i, j, i1, i2, n2, ij = nblst->offs[r0];
+	const int *p;
+	const int do_vdw = terms & NBENG_VDW;
+	const int do_elec = terms & NBENG_ELEC;
+	const int do_ace = terms & NBENG_ACE;
+	const double rc = nblst->nbcof;
+	const double rc2 = rc * rc;
+	const double rc2i = 1.0 / rc2;
+	const float rcif = 1.0 / rc, rc2if = rc2i;
+	double x1, y1, z1, ei, ri, ch1, dx, dy, dz, d2, dven, desh, gp;
+	float dvenf, deshf;
+	double gx1, gy1, gz1, ev1 = *ev, ee1 = *ee;
+	struct atom *a1, *a2;
+
+	for (i = r0; i < r1; i++) {
+		i1 = nblst->ifat[i];
+		a1 = &(ag->atoms[i1]);
+		x1 = a1->X;
+		y1 = a1->Y;
+		z1 = a1->Z;
+		ei = a1->eps;
+		ri = a1->rminh;
+		ch1 = pf * a1->chrg;
+		gx1 = gy1 = gz1 = 0.0;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
 		for (j = 0; j < n2; j++) {
-			if (darr[ij] > 0) {
-				double fdiarr1;
-				double fdiarr2;
-				i2 = p[j];
-				fdiarr1 = -factor_E * diarr[i1];
-				fdiarr2 = -factor_E * diarr[i2];
-				ag->atoms[i2].GX -= fdiarr1 * xsf[ij];
-				ag->atoms[i2].GY -= fdiarr1 * ysf[ij];
-				ag->atoms[i2].GZ -= fdiarr1 * zsf[ij];
-				ag->atoms[i1].GX -= fdiarr2 * xsf[ij + nbsize];
-				ag->atoms[i1].GY -= fdiarr2 * ysf[ij + nbsize];
-				ag->atoms[i1].GZ -= fdiarr2 * zsf[ij + nbsize];
+			i2 = p[j];
+			a2 = &(ag->atoms[i2]);
+			dx = x1 - a2->X;
+			dy = y1 - a2->Y;
+			dz = z1 - a2->Z;
+			if (do_ace)
+				ace_pairupdate(ag, ac_s, i1, i2, ij++, dx, dy,
+					       dz, swc, mixed, eself, xf, yf,
+					       zf);
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 >= rc2)
+				continue;
+			gp = 0.0;
+			if (do_vdw && mixed) {
+				const float rij = ri + a2->rminh;
+				ev1 += vdw_pairf(ei * a2->eps, rij * rij, d2,
+						 rc2if, &dvenf);
+				gp += dvenf;
+			} else if (do_vdw) {
+				ev1 += vdw_pair(ei * a2->eps,
+						(ri + a2->rminh) * (ri +
+								    a2->rminh),
+						d2, rc2, &dven);
+				gp += dven;
+			}
+			if (do_elec && mixed) {
+				ee1 += ele_pairf(ch1 * a2->chrg, d2, rcif,
+						 rc2if, &deshf);
+				gp += deshf;
+			} else if (do_elec) {
+				ee1 += ele_pair(ch1 * a2->chrg, d2, rc, rc2i,
+						&desh);
+				gp += desh;
 			}
-			ij++;
+			gx1 += gp * dx;
+			gy1 += gp * dy;
+			gz1 += gp * dz;
+			ace_subgrad(ag->atoms, g, i2, gp * dx, gp * dy,
+				    gp * dz);
 		}
+		ace_subgrad(ag->atoms, g, i1, -gx1, -gy1, -gz1);
 	}
-	//Loop through 1-2-3-4 list
-	for (i = 0; i < n0123; i++) {
-		i1 = list0123[2 * i];
-		i2 = list0123[2 * i + 1];
-		if (darr[ij] > 0) {
-			double fdiarr1 = -factor_E * diarr[i1];
-			double fdiarr2 = -factor_E * diarr[i2];
-			ag->atoms[i2].GX -= fdiarr1 * xsf[ij];
-			ag->atoms[i2].GY -= fdiarr1 * ysf[ij];
-			ag->atoms[i2].GZ -= fdiarr1 * zsf[ij];
-			ag->atoms[i1].GX -= fdiarr2 * xsf[ij + nbsize];
-			ag->atoms[i1].GY -= fdiarr2 * ysf[ij + nbsize];
-			ag->atoms[i1].GZ -= fdiarr2 * zsf[ij + nbsize];
-		}
-		ij++;
+	*ev = ev1;
+	*ee = ee1;
+}
+
+#ifdef _OPENMP
+//! nbeng pass in nc chunks, see ace_nchunks.
+/*! Each chunk has its own gradients, energies and, with NBENG_ACE, self
+    energy sums, added in chunk order. The chunk sums live on ac_s when
+    there is one, in a block freed on return otherwise. */
+static void nbeng_chunks(struct atomgrp *ag, const struct nblist *nblst,
+			 const int terms, const double pf,
+			 struct acesetup *ac_s, const double *const swc,
+			 const int mixed, const int nc, double *ev, double *ee)
+{
+	const int natoms = ag->natoms;
+	const int do_ace = terms & NBENG_ACE;
+	const int ij0 = nblst->offs[nblst->nfat];
+	//nc gradient blocks, then with NBENG_ACE nc self energy blocks
+	const size_t n = (size_t) nc * (do_ace ? 7 : 3) * natoms;
+	double *tg = ac_s ? ace_chunkbuf(ac_s, n)
+	    : _mol_calloc(n, sizeof(double));
+	double *acc = do_ace ? tg + (size_t) nc * 3 * natoms : NULL;
+	double *ten = _mol_calloc(2 * nc, sizeof(double));
+	int c;
+
+#pragma omp parallel for num_threads(nc) schedule(static, 1)
+	for (c = 0; c < nc; c++) {
+		double *a = do_ace ? acc + (size_t) c * 4 * natoms : NULL;
+		int r0, r1, k0, k1;
+		ace_chunk(nblst, do_ace ? ac_s->n0123 : 0, c, nc, &r0, &r1,
+			  &k0, &k1);
+		nbeng_rows(ag, nblst, r0, r1, terms, pf, ac_s, swc, mixed, a,
+			   a ? a + natoms : NULL, a ? a + 2 * natoms : NULL,
+			   a ? a + 3 * natoms : NULL,
+			   tg + (size_t) c * 3 * natoms, &ten[2 * c],
+			   &ten[2 * c + 1]);
+		if (do_ace)
+			ace_sweep0123(ag, ac_s, ij0, k0, k1, swc, mixed, a,
+				      a + natoms, a + 2 * natoms,
+				      a + 3 * natoms);
+	}
+	mol_thread_grads_reduce(ag->atoms, natoms, nc, tg);
+	for (c = 0; c < nc; c++) {
+		*ev += ten[2 * c];
+		*ee += ten[2 * c + 1];
+	}
+	if (do_ace)
+		ace_chunks_reduce(ac_s, natoms, nc, acc);
+	if (ac_s == NULL)
+		free(tg);
+	free(ten);
+}
+#endif
+
+//! Fused nonbonded evaluator.
+/*! One pass over ags->nblst computes the vdweng (NBENG_VDW), eleng
+    (NBENG_ELEC) and the pairwise part of aceeng (NBENG_ACE) terms
+    selected in terms, sharing the coordinate loads and separation
+    vector of each pair. The ACE Born radii and the polar sweep that
+    depend on all self energies are then done as in aceeng, from the
+    per-pair values cached during the pass (recomputed for a lean
+    acesetup, see ace_updatenblst). With OpenMP and at least
+    MOL_PARALLEL_MIN_PAIRS pairs the pass and the ACE sweeps run in one
+    chunk per thread, with the same result on every call with the same
+    number of threads. Energies are added to ven, een and aen; ac_s
+    may be NULL without NBENG_ACE. */
+void nbeng(struct atomgrp *ag, const int terms, const double eps,
+	   double *ven, double *een, double *aen, struct acesetup *ac_s,
+	   struct agsetup *ags)
+{
+	const struct nblist *nblst = ags->nblst;
+	const int do_ace = terms & NBENG_ACE;
+	const int nc = ace_nchunks(nblst->npairs);
+	const double pf = CCELEC / eps;
+	double ev = 0.0, ee = 0.0, b0 = 0.0;
+	double swc[4];
+	const int mixed = mol_nb_precision() == MOL_NB_MIXED;
+
+	if (do_ace) {
+		b0 = ace_selfinit(ag, ac_s);
+		ace_switch_init(swc, nblst->nbcof);
+	}
+#ifdef _OPENMP
+	if (nc > 0)
+		nbeng_chunks(ag, nblst, terms, pf, ac_s, swc, mixed, nc, &ev,
+			     &ee);
+	else
+#endif
+	{
+		nbeng_rows(ag, nblst, 0, nblst->nfat, terms, pf, ac_s, swc,
+			   mixed, do_ace ? ac_s->eself : NULL,
+			   do_ace ? ac_s->xf : NULL, do_ace ? ac_s->yf : NULL,
+			   do_ace ? ac_s->zf : NULL, NULL, &ev, &ee);
+		if (do_ace)
+			ace_sweep0123(ag, ac_s, nblst->offs[nblst->nfat], 0,
+				      ac_s->n0123, swc, mixed, ac_s->eself,
+				      ac_s->xf, ac_s->yf, ac_s->zf);
 	}
+	if (terms & NBENG_VDW)
+		(*ven) += ev;
+	if (terms & NBENG_ELEC)
+		(*een) += ee;
+	if (do_ace)
+		ace_finish(ag, aen, ac_s, ags, ACE_ALL, b0, swc, mixed, nc);
 }
 
 void aceeng(struct atomgrp *ag, double *en, struct acesetup *ac_s,
@@ -27,6 +27,11 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #ifndef _MOL_GBSA_H_
 #define _MOL_GBSA_H_
+//Start of the switching window of the ace self energy, which ends at
+//the list cutoff nbcof. Cutoffs at or below it, where the window would
+//be empty, switch from 2/3 of nbcof instead; all others, the 12A
+//default included, give the same energies as before that case existed.
+#define ACE_SWITCH_ON 8.0
 struct acesetup {
     int ntypes;
     int nbsize;//Size of nblist
@@ -48,18 +53,29 @@ struct acesetup {
     double* diarr;
     double  *lwace,*rsolv,*vsolv,*s2ace,*uace,*wace,*hydr;
     int n0123;
-   
+    size_t budget;//Byte budget of swarr, dswarr, darr, xsf, ysf, zsf, 0 for no limit
+    int lean;//swarr, dswarr, darr and xsf, ysf, zsf are not kept but recomputed
+    double* chunkbuf;//Per-chunk sums of the threaded sweeps, reused across calls
+    size_t nchunkbuf;//doubles in chunkbuf
 };
+//Budget ace_ini gives an acesetup: 9 doubles per pair, so lists of
+//about 15 million pairs (some 35000 atoms at the 12A cutoff) go lean
+#define ACE_DEFAULT_BUDGET ((size_t) 1 << 30)
 //Initialize ace data types
 void ace_ini(struct atomgrp* ag,struct acesetup* ac_s);
 //Update ace lists once fixedlist was updated
 void ace_fixedupdate(struct atomgrp* ag,struct agsetup* ags ,struct acesetup* ac_s);
-//Update nblst once nblist is updated
+//Update nblst once nblist is updated; lists whose per-pair arrays
+//need more than ac_s->budget bytes make the acesetup lean
 void ace_updatenblst(const struct agsetup* const restrict ags, struct acesetup* const restrict ac_s);
 //Calculate ace energy and gradients
 void aceeng(struct atomgrp* ag,double *en,struct acesetup* ac_s,struct agsetup* ags);
 void aceeng_nonpolar(struct atomgrp* ag,double* en,struct acesetup* ac_s,struct agsetup* ags);
 void aceeng_polar(struct atomgrp* ag,double* en,struct acesetup* ac_s,struct agsetup* ags);
+//Fused vdw/elec/ace evaluation in one pass over the nblist, terms is a mask of NBENG_*
+void nbeng(struct atomgrp* ag, const int terms, const double eps,
+           double* ven, double* een, double* aen,
+           struct acesetup* ac_s, struct agsetup* ags);
 //Free ace data
 void destroy_acesetup(struct acesetup* ac_s);
 void free_acesetup(struct acesetup* ac_s);
@@ -435,7 +435,7 @@ static bool is_hydrogen(mol_atom * atom, struct prm *prm)
 }
 
 // returns the non-self index of the atom bonded to atom
-// atomi at atomi's bond index bondi
+// atomi at atomi's bond index bondi
 static int bonded_atom_index(mol_atom_group * ag, int atomi, int bondi)
 {
 	int bonded_atomi;
@@ -1124,6 +1124,7 @@ static int water_mediated_hbond_compute_energy_and_gradient(int hbe, mol_atom *
 	FLOAT cosTht;
 	FLOAT dE_dr;
 	FLOAT u;
+	FLOAT e;
 
 	if (energy != NULL)
 		*energy = HB_ENG_MAX + 1.0;
@@ -1216,7 +1217,9 @@ static int water_mediated_hbond_compute_energy_and_gradient(int hbe, mol_atom *
 	if ((d_wp < 2.6) || (d_wp > 3.6))
 		return 0;
 
-	hbeng_HOH_bspline_value_deriv(d_wp, energy, &dE_dr);
+	hbeng_HOH_bspline_value_deriv(d_wp, &e, &dE_dr);
+	if (energy != NULL)
+		*energy = e;
 
 	if (!comp_grad)
 		return 1;
@@ -1449,7 +1452,7 @@ static double get_pairwise_hbondeng(mol_atom * atoms_hydro, int hydro_id,
 		ka2 = hydro_id;
 	}
 
-	ka3 = exta(ka1, ka2, ags->excl_list, ags->pd1, ags->pd2, ags->ndm);
+	ka3 = exta_rows(ka1, ka2, ags->excl_offs, ags->excl_pairs);
 
 	if (ka3 > 0)
 		return 0;
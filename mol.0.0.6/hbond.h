@@ -34,6 +34,8 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //#define USE_LONG_DOUBLE
 #define NON_POSITIVE_POLY
 
+// hbond has no single precision mode: MOL_NB_MIXED (nbsimd.h) does
+// not apply to it.
 #ifdef USE_LONG_DOUBLE
    #define FLOAT long double
 #else
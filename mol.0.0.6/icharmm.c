@@ -1226,6 +1226,10 @@ void fixed_init(struct atomgrp *ag)
 	ag->nangact = 0;
 	ag->nbact = 0;
 	ag->nactives = 0;
+	if (ag->btab != NULL) {
+		free_agbtab(ag->btab);
+		ag->btab = NULL;
+	}
 }
 
 void fixed_update(struct atomgrp *ag, int nlist, int *list)
@@ -1354,6 +1358,8 @@ void fixed_update(struct atomgrp *ag, int nlist, int *list)
 								*));
 	else
 		free(ag->impact);
+// flattened copy for the bonded kernels
+	init_agbtab(ag);
 }
 
 void fixed_update_nolist(struct atomgrp *ag)
@@ -1480,6 +1486,8 @@ void fixed_update_nolist(struct atomgrp *ag)
 								*));
 	else
 		free(ag->impact);
+// flattened copy for the bonded kernels
+	init_agbtab(ag);
 }
 
 /*Light version to read only bond info*/
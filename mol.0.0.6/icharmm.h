@@ -126,7 +126,8 @@ void chkacevolumes(char* buffer, int nat, char* atnam, double* acevolumes);
 
 void read_ff_charmm(const char* psffile, char* prmfile, char* rtffile, struct atomgrp* ag);
 /**
-       update fixed atom index and bonded active structures. list contains indices of fixed atoms
+       update fixed atom index and bonded active structures (and the flattened
+       copy ag->btab, see btab.h). list contains indices of fixed atoms
 */
 void fixed_update(struct atomgrp* ag, int nlist, int* list);
 void fixed_update_nolist(struct atomgrp *ag);
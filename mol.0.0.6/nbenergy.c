@@ -29,11 +29,13 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include _MOL_INCLUDE_
 
 #define MAXPAIR 36
-#define CCELEC 332.0716
 
 void test_nbgrads(struct atomgrp *ag, double d, struct nblist *nblst,
 		  int n03, int *list03)
@@ -159,6 +161,13 @@ void vdwengs03(const double f, const double rc,
 	struct atom *a1, *a2;
 	const double rc2 = rc * rc;
 
+	if (mol_simd_level() != MOL_SIMD_NONE) {
+		struct nbview v;
+		nbview_atoms(&v, ag, 1);
+		(*ven) += vdw03_simd(&v, n03, list03, f, rc);
+		return;
+	}
+
 	for (i = 0; i < n03; i++) {
 		i1 = list03[2 * i];
 		i2 = list03[2 * i + 1];
@@ -206,6 +215,107 @@ void vdwengs03(const double f, const double rc,
 	}
 }
 
+#ifdef _OPENMP
+//! Per thread view: atom data from ag, gradients into the buffer g.
+static void nbview_thread(struct nbview *v, const struct atomgrp *ag,
+			  double *g)
+{
+	nbview_atoms(v, ag, 0);
+	v->gx = g;
+	v->gy = g + 1;
+	v->gz = g + 2;
+	v->gs = 3;
+}
+
+//! Copy of the float view vf0 with the gradients of the thread view v.
+static void nbviewf_thread(struct nbviewf *vf, const struct nbviewf *vf0,
+			   const struct nbview *v)
+{
+	*vf = *vf0;
+	vf->gx = v->gx;
+	vf->gy = v->gy;
+	vf->gz = v->gz;
+	vf->gs = v->gs;
+}
+
+//! Threaded vdweng, first atoms are dealt to threads in fixed chunks.
+static void vdweng_omp(const struct atomgrp *const restrict ag,
+		       double *restrict ven,
+		       const struct nblist *const restrict nblst, int nthreads)
+{
+	const int natoms = ag->natoms;
+	const double rc = nblst->nbcof;
+	double *tg = mol_thread_grads_alloc(nthreads, natoms);
+	double *ten = _mol_calloc(nthreads, sizeof(double));
+	struct nbviewf vf;
+	float *fb = NULL;
+	if (mol_nb_precision() == MOL_NB_MIXED)
+		fb = nbviewf_atoms(&vf, ag);
+
+#pragma omp parallel num_threads(nthreads)
+	{
+		int i;
+		const int tid = omp_get_thread_num();
+		double en = 0.0;
+		struct nbview v;
+		struct nbviewf tvf;
+		nbview_thread(&v, ag, tg + (size_t) tid * 3 * natoms);
+		if (fb)
+			nbviewf_thread(&tvf, &vf, &v);
+
+#pragma omp for schedule(static, 16)
+		for (i = 0; i < nblst->nfat; i++)
+			en += fb ? vdw_rows_mixed(&tvf, nblst, i, i + 1, rc) :
+			    vdw_rows_simd(&v, nblst, i, i + 1, rc);
+		ten[tid] = en;
+	}
+	mol_thread_grads_reduce(ag->atoms, natoms, nthreads, tg);
+	(*ven) += mol_thread_sum(nthreads, ten);
+	free(fb);
+	free(ten);
+	free(tg);
+}
+
+//! Threaded eleng, same partitioning as vdweng_omp.
+static void eleng_omp(struct atomgrp *ag, double eps, double *een,
+		      struct nblist *nblst, int nthreads)
+{
+	const int natoms = ag->natoms;
+	const double pf = CCELEC / eps;
+	const double rc = nblst->nbcof;
+	double *tg = mol_thread_grads_alloc(nthreads, natoms);
+	double *ten = _mol_calloc(nthreads, sizeof(double));
+	struct nbviewf vf;
+	float *fb = NULL;
+	if (mol_nb_precision() == MOL_NB_MIXED)
+		fb = nbviewf_atoms(&vf, ag);
+
+#pragma omp parallel num_threads(nthreads)
+	{
+		int i;
+		const int tid = omp_get_thread_num();
+		double en = 0.0;
+		struct nbview v;
+		struct nbviewf tvf;
+		nbview_thread(&v, ag, tg + (size_t) tid * 3 * natoms);
+		if (fb)
+			nbviewf_thread(&tvf, &vf, &v);
+
+#pragma omp for schedule(static, 16)
+		for (i = 0; i < nblst->nfat; i++)
+			en += fb ? ele_rows_mixed(&tvf, nblst, i, i + 1, pf,
+						  rc) :
+			    ele_rows_simd(&v, nblst, i, i + 1, pf, rc);
+		ten[tid] = en;
+	}
+	mol_thread_grads_reduce(ag->atoms, natoms, nthreads, tg);
+	(*een) += mol_thread_sum(nthreads, ten);
+	free(fb);
+	free(ten);
+	free(tg);
+}
+#endif
+
 void vdweng(const struct atomgrp *const restrict ag, double *restrict ven,
 	    const struct nblist *const restrict nblst)
 {
@@ -217,6 +327,26 @@ void vdweng(const struct atomgrp *const restrict ag, double *restrict ven,
 	const double rc = nblst->nbcof;
 	const double rc2 = rc * rc;
 
+#ifdef _OPENMP
+	if (nblst->npairs >= MOL_PARALLEL_MIN_PAIRS && mol_num_threads() > 1) {
+		vdweng_omp(ag, ven, nblst, mol_num_threads());
+		return;
+	}
+#endif
+	if (mol_nb_precision() == MOL_NB_MIXED) {
+		struct nbviewf vf;
+		float *fb = nbviewf_atoms(&vf, ag);
+		(*ven) += vdw_rows_mixed(&vf, nblst, 0, nblst->nfat, rc);
+		free(fb);
+		return;
+	}
+	if (mol_simd_level() != MOL_SIMD_NONE) {
+		struct nbview v;
+		nbview_atoms(&v, ag, 0);
+		(*ven) += vdw_rows_simd(&v, nblst, 0, nblst->nfat, rc);
+		return;
+	}
+
 	for (i = 0; i < nblst->nfat; i++) {
 		i1 = nblst->ifat[i];
 		a1 = &(ag->atoms[i1]);
@@ -365,6 +495,27 @@ void eleng(struct atomgrp *ag, double eps, double *een, struct nblist *nblst)
 	double rc = nblst->nbcof;
 	double rc_squared = rc * rc;
 	double rc2 = 1.0 / (rc_squared);
+
+#ifdef _OPENMP
+	if (nblst->npairs >= MOL_PARALLEL_MIN_PAIRS && mol_num_threads() > 1) {
+		eleng_omp(ag, eps, een, nblst, mol_num_threads());
+		return;
+	}
+#endif
+	if (mol_nb_precision() == MOL_NB_MIXED) {
+		struct nbviewf vf;
+		float *fb = nbviewf_atoms(&vf, ag);
+		(*een) += ele_rows_mixed(&vf, nblst, 0, nblst->nfat, pf, rc);
+		free(fb);
+		return;
+	}
+	if (mol_simd_level() != MOL_SIMD_NONE) {
+		struct nbview v;
+		nbview_atoms(&v, ag, 0);
+		(*een) += ele_rows_simd(&v, nblst, 0, nblst->nfat, pf, rc);
+		return;
+	}
+
 	for (i = 0; i < nblst->nfat; i++) {
 		i1 = nblst->ifat[i];
 		a1 = &(ag->atoms[i1]);
@@ -403,13 +554,169 @@ void eleng(struct atomgrp *ag, double eps, double *een, struct nblist *nblst)
 	}
 }
 
-void destroy_nblist(struct nblist *nblst)
+//! vdweng over the packed view soa, gradients go to soa->gx/gy/gz.
+/*! Same switched Lennard-Jones form as vdweng; coordinates and
+    parameters are read from the contiguous arrays of init_agsoa
+    instead of struct atom. Call agsoa_grads_to_atoms afterwards
+    to fold the gradients back into the atoms. */
+void vdweng_soa(struct agsoa *restrict soa, double *restrict ven,
+		const struct nblist *const restrict nblst)
 {
-	int i;
+	int i, i1, n2, j, i2;
+	const int *p;
+	double ei, ri, x1, y1, z1, dx, dy, dz, eij;
+	double d2, Rd12, Rd6, Rr12, Rr6, dr6;
+	double rij, dven, g, gx1, gy1, gz1;
+	double en = 0.0;
+	const double *const restrict x = soa->x;
+	const double *const restrict y = soa->y;
+	const double *const restrict z = soa->z;
+	const double *const restrict eps = soa->eps;
+	const double *const restrict rminh = soa->rminh;
+	double *const restrict gx = soa->gx;
+	double *const restrict gy = soa->gy;
+	double *const restrict gz = soa->gz;
+	const double rc = nblst->nbcof;
+	const double rc2 = rc * rc;
+
+	if (mol_simd_level() != MOL_SIMD_NONE) {
+		struct nbview v;
+		nbview_soa(&v, soa);
+		(*ven) += vdw_rows_simd(&v, nblst, 0, nblst->nfat, rc);
+		return;
+	}
+
+	for (i = 0; i < nblst->nfat; i++) {
+		i1 = nblst->ifat[i];
+		ei = eps[i1];
+		ri = rminh[i1];
+		x1 = x[i1];
+		y1 = y[i1];
+		z1 = z[i1];
+		gx1 = gy1 = gz1 = 0.0;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		for (j = 0; j < n2; j++) {
+			i2 = p[j];
+			dx = x1 - x[i2];
+			dy = y1 - y[i2];
+			dz = z1 - z[i2];
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 < rc2) {
+				eij = ei * eps[i2];
+				rij = ri + rminh[i2];
+				rij *= rij;
+
+				Rd6 = rij / d2;
+				Rd6 = Rd6 * Rd6 * Rd6;
+				Rd12 = Rd6 * Rd6;
+				Rr6 = rij / rc2;
+				Rr6 = Rr6 * Rr6 * Rr6;
+				Rr12 = Rr6 * Rr6;
+				dr6 = d2 / rc2;
+				dr6 = dr6 * dr6 * dr6;
+
+				en += eij * (Rd12 - 2 * Rd6 +
+					     Rr6 * (4.0 - 2 * dr6) +
+					     Rr12 * (2 * dr6 - 3.0));
+				dven =
+				    -eij * 12 * (-Rd12 + Rd6 +
+						 dr6 * (Rr12 - Rr6)) / d2;
+				g = dven * dx;
+				gx1 += g;
+				gx[i2] -= g;
+				g = dven * dy;
+				gy1 += g;
+				gy[i2] -= g;
+				g = dven * dz;
+				gz1 += g;
+				gz[i2] -= g;
+			}
+		}
+		gx[i1] += gx1;
+		gy[i1] += gy1;
+		gz[i1] += gz1;
+	}
+	(*ven) += en;
+}
+
+//! eleng over the packed view soa, gradients go to soa->gx/gy/gz.
+void eleng_soa(struct agsoa *restrict soa, double eps, double *restrict een,
+	       const struct nblist *const restrict nblst)
+{
+	int i, j, i1, n2, i2;
+	const int *p;
+	double dx, dy, dz;
+	double d2, d1, g, ch1, ch2, x1, y1, z1;
+	double esh, desh, gx1, gy1, gz1;
+	double en = 0.0;
+	const double *const restrict x = soa->x;
+	const double *const restrict y = soa->y;
+	const double *const restrict z = soa->z;
+	const double *const restrict chrg = soa->chrg;
+	double *const restrict gx = soa->gx;
+	double *const restrict gy = soa->gy;
+	double *const restrict gz = soa->gz;
+
+	const double pf = CCELEC / eps;
+	const double rc = nblst->nbcof;
+	const double rc_squared = rc * rc;
+	const double rc2 = 1.0 / (rc_squared);
+
+	if (mol_simd_level() != MOL_SIMD_NONE) {
+		struct nbview v;
+		nbview_soa(&v, soa);
+		(*een) += ele_rows_simd(&v, nblst, 0, nblst->nfat, pf, rc);
+		return;
+	}
+
 	for (i = 0; i < nblst->nfat; i++) {
-		if (nblst->nsat[i] > 0)
-			free(nblst->isat[i]);
+		i1 = nblst->ifat[i];
+		ch1 = pf * chrg[i1];
+		x1 = x[i1];
+		y1 = y[i1];
+		z1 = z[i1];
+		gx1 = gy1 = gz1 = 0.0;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		for (j = 0; j < n2; j++) {
+			i2 = p[j];
+			dx = x1 - x[i2];
+			dy = y1 - y[i2];
+			dz = z1 - z[i2];
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 < rc_squared) {
+				d1 = sqrt(d2);
+				esh = 1.0 - d1 / rc;
+				esh *= esh / d1;
+				desh = (1.0 / d2 - rc2) / d1;
+				ch2 = chrg[i2] * ch1;
+				en += ch2 * esh;
+				g = ch2 * desh * dx;
+				gx1 += g;
+				gx[i2] -= g;
+				g = ch2 * desh * dy;
+				gy1 += g;
+				gy[i2] -= g;
+				g = ch2 * desh * dz;
+				gz1 += g;
+				gz[i2] -= g;
+			}
+		}
+		gx[i1] += gx1;
+		gy[i1] += gy1;
+		gz[i1] += gz1;
 	}
+	(*een) += en;
+}
+
+void destroy_nblist(struct nblist *nblst)
+{
+	free(nblst->rank);
+	free(nblst->order);
+	free(nblst->pairs);
+	free(nblst->nbrs);
+	free(nblst->offs);
 	free(nblst->isat);
 	free(nblst->nsat);
 	free(nblst->ifat);
@@ -422,77 +729,151 @@ void free_nblist(struct nblist *nblst)
 	free(nblst);
 }
 
-//! Generate a nonbonded list nblst from cluster and cube subdivisions and exclusion list arrays.
-/*! To generate nblist
-    1. Loop over the filled cubes
-    2. Loop over linked clusters in the first cube
-    3. Loop over neighboring cubes including first cube.
-    4. Loop through the linked list clusters of the second cube.
-    5. Go only for pairs of clusters which are closer than an nbcut plus lagest distance from any atom to the
-       geometry center of cluster 1 plus the largest distance of the cluster 2
-    6. For the pair of clusters icl1 and icl2 go through all pairs of their atoms
-    7. Write the pair to the list if the distance between clusters is less than nbcut minus largest dist of
-       cluster one minus largest dist of cluster two.
-    8. Check the atomic pair distance  if the condition in the step 7 is not true
-    9. Write the pair if distance less than nonbonded cutoff.
+//! Make room for at least need ints in *buf.
+/*! Capacity only grows, by doubling, so a list that is rebuilt many
+    times settles on one allocation. */
+static void nblist_reserve(int **buf, int *cap, int need)
+{
+	int ncap = *cap;
+	if (need <= ncap)
+		return;
+	if (ncap < 1024)
+		ncap = 1024;
+	while (ncap < need)
+		ncap *= 2;
+	*buf = _mol_realloc(*buf, ncap * sizeof(int));
+	*cap = ncap;
+}
 
-    The structure of the nblist is:
-    number of first atoms,
-    array of first atom indices,
-    array of numbers of second atoms for each first one,
-    array of pointers to arrays of all second atoms,
-    arrays of all second atoms. */
+//! Size the per first atom arrays of nblst for natoms atoms.
+static void nblist_reserve_rows(struct nblist *nblst, int natoms)
+{
+	if (natoms <= nblst->fat_cap && nblst->offs != NULL)
+		return;
+	nblst->ifat = _mol_realloc(nblst->ifat, natoms * sizeof(int));
+	nblst->nsat = _mol_realloc(nblst->nsat, natoms * sizeof(int));
+	nblst->isat = _mol_realloc(nblst->isat, natoms * sizeof(int *));
+	nblst->offs = _mol_realloc(nblst->offs, (natoms + 1) * sizeof(int));
+	nblst->fat_cap = natoms;
+}
 
-void gen_nblist(struct atomgrp *ag, struct cubeset *cust,
-		struct clusterset *clst, int *excl_list, int **pd1, int **pd2,
-		int ndm, struct nblist *nblst)
+//! LSD radix sort of the n keys a in passes bytes, tmp holds n keys.
+/*! Sorted keys end up back in a if passes is even, in tmp if odd. */
+static void nblist_radix_sort(unsigned int *a, unsigned int *tmp, int n,
+			      int passes)
 {
-	int i, j, ic1, ic2, icl1, icl2;
-	int k1, k2, ak1, ak2, ka1, ka2, ka3, ip;
-	double mdc1, mdc2, dna, dda, dx, dy, dz, d;
-	double x1, x2, y1, y2, z1, z2, nbcut;
-	double dd, dista;
+	int p, j, c[256];
+	unsigned int *src = a, *dst = tmp, *t;
+	for (p = 0; p < passes; p++) {
+		const int sh = 8 * p;
+		for (j = 0; j < 256; j++)
+			c[j] = 0;
+		for (j = 0; j < n; j++)
+			c[(src[j] >> sh) & 0xff]++;
+		for (j = 1; j < 256; j++)
+			c[j] += c[j - 1];
+		for (j = n - 1; j >= 0; j--)
+			dst[--c[(src[j] >> sh) & 0xff]] = src[j];
+		t = src;
+		src = dst;
+		dst = t;
+	}
+}
 
-	int natoms = ag->natoms;
+//! Sort the second atoms of every row by nblst->rank.
+/*! Each row is replaced by the ranks of its atoms, radix sorted and
+    mapped back through nblst->order. Rows are independent, so they
+    are sorted in parallel with OpenMP. */
+static void nblist_sort_rows(struct nblist *nblst, int natoms)
+{
+	const int *rank = nblst->rank;
+	const int *order = nblst->order;
+	int i, passes = 1;
+
+	while (passes < 4 && (natoms - 1) >> (8 * passes) > 0)
+		passes++;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(mol_num_threads())
+#endif
+	{
+		int j, n, nmax = 0;
+		int *row;
+		unsigned int *keys = NULL, *sorted;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+		for (i = 0; i < nblst->nfat; i++) {
+			row = nblst->nbrs + nblst->offs[i];
+			n = nblst->offs[i + 1] - nblst->offs[i];
+			if (n > nmax) {
+				nmax = n;
+				keys = _mol_realloc(keys,
+						    2 * nmax * sizeof(unsigned int));
+			}
+			for (j = 0; j < n; j++)
+				keys[j] = rank[row[j]];
+			nblist_radix_sort(keys, keys + n, n, passes);
+			sorted = (passes % 2 == 0) ? keys : keys + n;
+			for (j = 0; j < n; j++)
+				row[j] = order[sorted[j]];
+		}
+		free(keys);
+	}
+}
 
-	int *ifat;
-	double nbcuts;
-	int ntotp;
-/* prepare nonbond list arrays. */
-	int *p;
+//! Point isat of every row into the flat nbrs array.
+/*! Has to be repeated whenever nbrs may have moved. For a spatially
+    ordered list the rows are sorted by rank first. */
+static void nblist_link_rows(struct nblist *nblst, int natoms)
+{
+	int i;
+	if (nblst->rank != NULL)
+		nblist_sort_rows(nblst, natoms);
 	for (i = 0; i < nblst->nfat; i++) {
-		if ((nblst->nsat[i]) > 0)
-			free(nblst->isat[i]);
-	}
-	nblst->nfat = 0;
-	nblst->ifat = _mol_realloc(nblst->ifat, natoms * sizeof(int));
-	nblst->nsat = _mol_realloc(nblst->nsat, natoms * sizeof(int));
-	nblst->isat = _mol_realloc(nblst->isat, natoms * sizeof(int *));
-//ifat is temporal
-	ifat = _mol_malloc(natoms * sizeof(int));
-	for (i = 0; i < natoms; i++) {
-		nblst->nsat[i] = 0;
-		nblst->ifat[i] = -1;
-		ifat[i] = -1;
+		nblst->nsat[i] = nblst->offs[i + 1] - nblst->offs[i];
+		nblst->isat[i] = nblst->nbrs + nblst->offs[i];
 	}
+	nblst->npairs = nblst->offs[nblst->nfat];
+}
 
-	nbcut = nblst->nbcut;
-	nbcuts = nbcut * nbcut;
+//! Walk the cube and cluster subdivisions and collect nonbonded pairs.
+/*! Steps 1-9 of gen_nblist for the filled cubes ifcubes[cf..cl-1].
+    A surviving pair ka1<ka2 is
+    - appended to *pairs (capacity *pairs_cap) if cnt and pos are NULL,
+    - counted in cnt[ka1] if cnt is given,
+    - written to nblst->nbrs[pos[ka1]++] if pos is given.
+    Returns the number of pairs found. Only reads ag, cust and clst,
+    so disjoint cube ranges can be swept concurrently. */
+static int nblist_sweep(struct atomgrp *ag, struct cubeset *cust,
+			struct clusterset *clst, const int *excl_offs,
+			const int *excl_pairs, struct nblist *nblst, int cf,
+			int cl, int **pairs, int *pairs_cap, int *cnt,
+			int *pos)
+{
+	int i, j, ic1, ic2, icl1, icl2;
+	int k1, k2, ak1, ak2, ka1, ka2;
+	double mdc1, mdc2, dna, dda, dx, dy, dz, d;
+	double x1, x2, y1, y2, z1, z2, dd, dista;
+	const double nbcut = nblst->nbcut;
+	const double nbcuts = nbcut * nbcut;
+	struct cluster *c1, *c2;
+	int np = 0;
 
 /* loop over the filled cubes. */
-	for (i = 0; i < cust->nfcubes; i++) {
+	for (i = cf; i < cl; i++) {
 		ic1 = cust->ifcubes[i];
 		icl1 = cust->cubes[ic1].hstincube;
 /* loop over all clusters in cube1. */
 		while (icl1 >= 0) {
-			mdc1 = clst->clusters[icl1].mdc;
-			x1 = clst->clusters[icl1].gcent[0];
-			y1 = clst->clusters[icl1].gcent[1];
-			z1 = clst->clusters[icl1].gcent[2];
+			c1 = &(clst->clusters[icl1]);
+			mdc1 = c1->mdc;
+			x1 = c1->gcent[0];
+			y1 = c1->gcent[1];
+			z1 = c1->gcent[2];
 /* loop over neighboring cubes including cube1. */
 			for (j = -1; j < cust->cubes[ic1].nncubes; j++) {
 				if (j == -1)	// cube-self part
-					icl2 = clst->clusters[icl1].nextincube;
+					icl2 = c1->nextincube;
 				else	// cube-neighbor cube part
 				{
 					ic2 = cust->cubes[ic1].icubes[j];
@@ -500,473 +881,354 @@ void gen_nblist(struct atomgrp *ag, struct cubeset *cust,
 				}
 /* second loop over clusters. */
 				while (icl2 >= 0) {
-					mdc2 = clst->clusters[icl2].mdc;
-					x2 = clst->clusters[icl2].gcent[0];
-					y2 = clst->clusters[icl2].gcent[1];
-					z2 = clst->clusters[icl2].gcent[2];
+					c2 = &(clst->clusters[icl2]);
+					mdc2 = c2->mdc;
+					x2 = c2->gcent[0];
+					y2 = c2->gcent[1];
+					z2 = c2->gcent[2];
 					dx = x1 - x2;
-					dx *= dx;
 					dy = y1 - y2;
-					dy *= dy;
 					dz = z1 - z2;
-					dz *= dz;
-					d = dx + dy + dz;
+					d = dx * dx + dy * dy + dz * dz;
 					dna = nbcut - mdc1 - mdc2;
 					dna *= dna;
 					dda = nbcut + mdc1 + mdc2;
 					dda *= dda;
-					if (d <= dda) {
+					icl2 = c2->nextincube;
+					if (d > dda)
+						continue;
 /* for clusters icl1 and icl2 go through all pairs of their atoms. */
-						for (k1 = 0;
-						     k1 <
-						     clst->clusters[icl1].
-						     natoms; k1++) {
-							ak1 =
-							    clst->
-							    clusters[icl1].
-							    iatom[k1];
-							for (k2 = 0;
-							     k2 <
-							     clst->
-							     clusters[icl2].
-							     natoms; k2++) {
-								ak2 =
-								    clst->
-								    clusters
-								    [icl2].
-								    iatom[k2];
-								if (ag->
-								    atoms[ak1].
-								    fixed +
-								    ag->
-								    atoms[ak2].
-								    fixed == 2)
-									continue;
-								if (ak1 < ak2) {
-									ka1 =
-									    ak1;
-									ka2 =
-									    ak2;
-								} else {
-									ka1 =
-									    ak2;
-									ka2 =
-									    ak1;
-								}
+					for (k1 = 0; k1 < c1->natoms; k1++) {
+						ak1 = c1->iatom[k1];
+						for (k2 = 0; k2 < c2->natoms; k2++) {
+							ak2 = c2->iatom[k2];
+							if (ag->atoms[ak1].fixed +
+							    ag->atoms[ak2].fixed == 2)
+								continue;
+							if (ak1 < ak2) {
+								ka1 = ak1;
+								ka2 = ak2;
+							} else {
+								ka1 = ak2;
+								ka2 = ak1;
+							}
 /* check the exclusion table. */
-								ka3 =
-								    exta(ka1,
-									 ka2,
-									 excl_list,
-									 pd1,
-									 pd2,
-									 ndm);
-								if (ka3 > 0)
-									continue;
+							if (exta_rows(ka1, ka2, excl_offs,
+								      excl_pairs) > 0)
+								continue;
 /* check distances of distant atom pairs (d>dna). */
-								if (d > dna) {
-									dista =
-									    0.0;
-									dd = ag->atoms[ka1].X - ag->atoms[ka2].X;
-									dista +=
-									    dd *
-									    dd;
-									dd = ag->atoms[ka1].Y - ag->atoms[ka2].Y;
-									dista +=
-									    dd *
-									    dd;
-									dd = ag->atoms[ka1].Z - ag->atoms[ka2].Z;
-									dista +=
-									    dd *
-									    dd;
-									if (dista > nbcuts)
-										continue;
-								}
-/* write a successful atom pair to a nonbond list structure. */
-								if (ifat[ka1] ==
-								    -1) {
-									nblst->
-									    ifat
-									    [nblst->
-									     nfat]
-									    =
-									    ka1;
-									ifat[ka1] = nblst->nfat;
-									nblst->
-									    isat
-									    [nblst->
-									     nfat]
-									    =
-									    _mol_malloc
-									    ((natoms - ka1 - 1) * sizeof(int));
-									(nblst->
-									 nfat)++;
-								}
-								ip = ifat[ka1];
-								p = nblst->
-								    isat[ip];
-								p[nblst->
-								  nsat[ip]] =
-							     ka2;
-								(nblst->
-								 nsat[ip])++;
+							if (d > dna) {
+								dd = ag->atoms[ka1].X - ag->atoms[ka2].X;
+								dista = dd * dd;
+								dd = ag->atoms[ka1].Y - ag->atoms[ka2].Y;
+								dista += dd * dd;
+								dd = ag->atoms[ka1].Z - ag->atoms[ka2].Z;
+								dista += dd * dd;
+								if (dista > nbcuts)
+									continue;
+							}
+/* record a successful atom pair. */
+							if (pos != NULL) {
+								nblst->nbrs[pos[ka1]++] = ka2;
+							} else if (cnt != NULL) {
+								cnt[ka1]++;
+							} else {
+								nblist_reserve(pairs, pairs_cap,
+									       2 * (np + 1));
+								(*pairs)[2 * np] = ka1;
+								(*pairs)[2 * np + 1] = ka2;
 							}
+							np++;
 						}
 					}
-					icl2 = clst->clusters[icl2].nextincube;
 				}
 			}
-			icl1 = clst->clusters[icl1].nextincube;
+			icl1 = c1->nextincube;
 		}
 	}
-/* cleanup, total pair calculation. */
-	ntotp = 0;
-	free(ifat);
-	if (nblst->nfat > 0) {
-		nblst->ifat =
-		    _mol_realloc(nblst->ifat, (nblst->nfat) * sizeof(int));
-		nblst->nsat =
-		    _mol_realloc(nblst->nsat, (nblst->nfat) * sizeof(int));
-		nblst->isat =
-		    _mol_realloc(nblst->isat, (nblst->nfat) * sizeof(int *));
-	}
-
-	for (i = 0; i < nblst->nfat; i++) {
-		ntotp += nblst->nsat[i];
-		nblst->isat[i] =
-		    _mol_realloc(nblst->isat[i],
-				 (nblst->nsat[i]) * sizeof(int));
-	}
-	nblst->npairs = ntotp;
+	return np;
 }
 
-void gen_nblist_new(struct atomgrp *ag, struct cubeset *cust,
-		    struct clusterset *clst, int *excl_list, int **pd1,
-		    int **pd2, int ndm, struct nblist *nblst)
+//! Turn per atom pair counts cnt into the row layout of nblst.
+/*! Rows are stored in increasing order of the first atom, or in
+    nblst->order if the list is spatially ordered. On return
+    nblst->offs holds the row offsets and pos[a] the start of the row
+    of atom a in nbrs (or -1 if a is not a first atom). */
+static void nblist_rows_from_counts(int natoms, const int *cnt, int *pos,
+				    struct nblist *nblst)
 {
-	int i, j, ic1, ic2, icl1, icl2;
-	int k1, k2, ak1, ak2, ka1, ka2, ka3, ip;
-	double mdc1, mdc2, dna, dda, dx, dy, dz, d;
-	double x1, x2, y1, y2, z1, z2, nbcut;
-	double dd, dista;
+	int k, i, n = 0;
+	nblst->nfat = 0;
+	for (k = 0; k < natoms; k++) {
+		i = (nblst->order != NULL) ? nblst->order[k] : k;
+		if (cnt[i] == 0) {
+			pos[i] = -1;
+			continue;
+		}
+		pos[i] = n;
+		nblst->ifat[nblst->nfat] = i;
+		nblst->offs[nblst->nfat] = n;
+		(nblst->nfat)++;
+		n += cnt[i];
+	}
+	nblst->offs[nblst->nfat] = n;
+	nblist_reserve(&(nblst->nbrs), &(nblst->nbrs_cap), n);
+}
 
-	int natoms = ag->natoms;
+//! Sort the np pairs of nblst->pairs into the rows of nblst.
+/*! Stable counting sort on the first atom, so pairs keep their
+    relative order within a row. */
+static void nblist_rows_from_pairs(int natoms, int np, struct nblist *nblst)
+{
+	int i;
+	int *cnt = _mol_calloc(natoms, sizeof(int));
+	int *pos = _mol_malloc(natoms * sizeof(int));
+	for (i = 0; i < np; i++)
+		cnt[nblst->pairs[2 * i]]++;
+	nblist_rows_from_counts(natoms, cnt, pos, nblst);
+	for (i = 0; i < np; i++)
+		nblst->nbrs[pos[nblst->pairs[2 * i]]++] =
+		    nblst->pairs[2 * i + 1];
+	nblist_link_rows(nblst, natoms);
+	free(pos);
+	free(cnt);
+}
 
-	int *ifat;
-	double nbcuts;
-	int ntotp;
-//prepare nonbond list arrays
-	int *p;
-	for (i = 0; i < nblst->nfat; i++) {
-		if ((nblst->nsat[i]) > 0)
-			free(nblst->isat[i]);
+#ifdef _OPENMP
+//! Threaded gen_nblist, filled cubes are split into fragments.
+/*! The filled cubes are cut into NBLST_PARALLEL_FRAGS * nthreads
+    contiguous ranges, each swept into its own pair fragment by
+    whichever thread picks it up. Fragments are then dealt to threads
+    in contiguous blocks, every thread counts the rows of its block,
+    and the pairs are scattered into nbrs with row starts prefixed in
+    fragment order. Pairs end up in the same order as in the serial
+    sweep, so the list is identical to gen_nblist on one thread. */
+static void gen_nblist_omp(struct atomgrp *ag, struct cubeset *cust,
+			   struct clusterset *clst, const int *excl_offs,
+			   const int *excl_pairs, struct nblist *nblst,
+			   int nthreads)
+{
+	const int natoms = ag->natoms;
+	int nfrags = NBLST_PARALLEL_FRAGS * nthreads;
+	int i, t, n;
+	int *np, *fcap, **frag, *cnt, *tot, *pos;
+
+	if (nfrags > cust->nfcubes)
+		nfrags = cust->nfcubes;
+	np = _mol_calloc(nfrags, sizeof(int));
+	fcap = _mol_calloc(nfrags, sizeof(int));
+	frag = _mol_calloc(nfrags, sizeof(int *));
+	cnt = _mol_calloc((size_t) nthreads * natoms, sizeof(int));
+	tot = _mol_malloc(natoms * sizeof(int));
+	pos = _mol_malloc(natoms * sizeof(int));
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+	for (i = 0; i < nfrags; i++) {
+		const int cf = (int)((long)cust->nfcubes * i / nfrags);
+		const int cl = (int)((long)cust->nfcubes * (i + 1) / nfrags);
+		np[i] = nblist_sweep(ag, cust, clst, excl_offs, excl_pairs,
+				     nblst, cf, cl, &(frag[i]), &(fcap[i]),
+				     NULL, NULL);
+	}
+
+/* per thread row counts of a contiguous block of fragments. */
+#pragma omp parallel for private(i) schedule(static, 1) num_threads(nthreads)
+	for (t = 0; t < nthreads; t++) {
+		int f, *tcnt = cnt + (size_t) t * natoms;
+		for (f = nfrags * t / nthreads; f < nfrags * (t + 1) / nthreads;
+		     f++)
+			for (i = 0; i < np[f]; i++)
+				tcnt[frag[f][2 * i]]++;
+	}
+
+/* row layout from the summed counts, thread starts within each row. */
+	for (i = 0; i < natoms; i++) {
+		for (n = 0, t = 0; t < nthreads; t++)
+			n += cnt[(size_t) t * natoms + i];
+		tot[i] = n;
 	}
-	nblst->nfat = 0;
-	nblst->ifat = _mol_realloc(nblst->ifat, natoms * sizeof(int));
-	nblst->nsat = _mol_realloc(nblst->nsat, natoms * sizeof(int));
-	nblst->isat = _mol_realloc(nblst->isat, natoms * sizeof(int *));
-//ifat is temporal
-	ifat = _mol_malloc(natoms * sizeof(int));
+	nblist_rows_from_counts(natoms, tot, pos, nblst);
 	for (i = 0; i < natoms; i++) {
-		nblst->nsat[i] = 0;
-		nblst->ifat[i] = -1;
-		ifat[i] = -1;
+		if (pos[i] < 0)
+			continue;
+		for (n = pos[i], t = 0; t < nthreads; t++) {
+			int c = cnt[(size_t) t * natoms + i];
+			cnt[(size_t) t * natoms + i] = n;
+			n += c;
+		}
 	}
 
-	nbcut = nblst->nbcut;
-	nbcuts = nbcut * nbcut;
+/* scatter the fragments into the rows. */
+#pragma omp parallel for private(i) schedule(static, 1) num_threads(nthreads)
+	for (t = 0; t < nthreads; t++) {
+		int f, *tpos = cnt + (size_t) t * natoms;
+		for (f = nfrags * t / nthreads; f < nfrags * (t + 1) / nthreads;
+		     f++)
+			for (i = 0; i < np[f]; i++)
+				nblst->nbrs[tpos[frag[f][2 * i]]++] =
+				    frag[f][2 * i + 1];
+	}
+	nblist_link_rows(nblst, natoms);
+
+	for (i = 0; i < nfrags; i++)
+		free(frag[i]);
+	free(pos);
+	free(tot);
+	free(cnt);
+	free(frag);
+	free(fcap);
+	free(np);
+}
+#endif
 
-//loop over the filled cubes
-	for (i = 0; i < cust->nfcubes; i++) {
-		ic1 = cust->ifcubes[i];
-		icl1 = cust->cubes[ic1].hstincube;
-//loop over all clusters in cube1
-		while (icl1 >= 0) {
-			mdc1 = clst->clusters[icl1].mdc;
-			x1 = clst->clusters[icl1].gcent[0];
-			y1 = clst->clusters[icl1].gcent[1];
-			z1 = clst->clusters[icl1].gcent[2];
-//loop over neighboring cubes including cube1
-			for (j = -1; j < cust->cubes[ic1].nncubes; j++) {
-				if (j == -1)	// cube-self part
-					icl2 = clst->clusters[icl1].nextincube;
-				else	// cube-neighbor cube part
-				{
-					ic2 = cust->cubes[ic1].icubes[j];
-					icl2 = cust->cubes[ic2].hstincube;
-				}
-//second loop over clusters
-				while (icl2 >= 0) {
-					mdc2 = clst->clusters[icl2].mdc;
-					x2 = clst->clusters[icl2].gcent[0];
-					y2 = clst->clusters[icl2].gcent[1];
-					z2 = clst->clusters[icl2].gcent[2];
-					dx = x1 - x2;
-					dx *= dx;
-					dy = y1 - y2;
-					dy *= dy;
-					dz = z1 - z2;
-					dz *= dz;
-					d = dx + dy + dz;
-					dna = nbcut - mdc1 - mdc2;
-					dna *= dna;
-					dda = nbcut + mdc1 + mdc2;
-					dda *= dda;
-					if (d <= dda) {
-//for clusters icl1 and icl2 go through all pairs of their atoms
-						for (k1 = 0;
-						     k1 <
-						     clst->clusters[icl1].
-						     natoms; k1++) {
-							ak1 =
-							    clst->
-							    clusters[icl1].
-							    iatom[k1];
-							for (k2 = 0;
-							     k2 <
-							     clst->
-							     clusters[icl2].
-							     natoms; k2++) {
-								ak2 =
-								    clst->
-								    clusters
-								    [icl2].
-								    iatom[k2];
-								if (ag->
-								    atoms[ak1].
-								    fixed +
-								    ag->
-								    atoms[ak2].
-								    fixed == 2)
-									continue;
-								if (ak1 < ak2) {
-									ka1 =
-									    ak1;
-									ka2 =
-									    ak2;
-								} else {
-									ka1 =
-									    ak2;
-									ka2 =
-									    ak1;
-								}
-//check the exclusion table
-								ka3 =
-								    exta(ka1,
-									 ka2,
-									 excl_list,
-									 pd1,
-									 pd2,
-									 ndm);
-								if (ka3 > 0)
-									continue;
-//check distances of distant atom pairs (d>dna)
-								if (d > dna) {
-									dista =
-									    0.0;
-									dd = ag->atoms[ka1].X - ag->atoms[ka2].X;
-									dista +=
-									    dd *
-									    dd;
-									dd = ag->atoms[ka1].Y - ag->atoms[ka2].Y;
-									dista +=
-									    dd *
-									    dd;
-									dd = ag->atoms[ka1].Z - ag->atoms[ka2].Z;
-									dista +=
-									    dd *
-									    dd;
-									if (dista > nbcuts)
-										continue;
-								}
-//write a successful atom pair to a nonbond list structure
-								if (ifat[ka1] ==
-								    -1) {
-//                                nblst->ifat[nblst->nfat]=ka1;
-									ifat[ka1] = nblst->nfat;
-//                                nblst->isat[nblst->nfat]=_mol_malloc((natoms-ka1-1)*sizeof(int));
-									(nblst->
-									 nfat)++;
-								}
-								ip = ifat[ka1];
-//                             p=nblst->isat[ip];
-//                             p[nblst->nsat[ip]]=ka2;
-								(nblst->
-								 nsat[ip])++;
-							}
-						}
-					}
-					icl2 = clst->clusters[icl2].nextincube;
-				}
-			}
-			icl1 = clst->clusters[icl1].nextincube;
-		}
-	}
+//! Generate a nonbonded list nblst from cluster and cube subdivisions and exclusion list arrays.
+/*! To generate nblist
+    1. Loop over the filled cubes
+    2. Loop over linked clusters in the first cube
+    3. Loop over neighboring cubes including first cube.
+    4. Loop through the linked list clusters of the second cube.
+    5. Go only for pairs of clusters which are closer than an nbcut plus lagest distance from any atom to the
+       geometry center of cluster 1 plus the largest distance of the cluster 2
+    6. For the pair of clusters icl1 and icl2 go through all pairs of their atoms
+    7. Write the pair to the list if the distance between clusters is less than nbcut minus largest dist of
+       cluster one minus largest dist of cluster two.
+    8. Check the atomic pair distance  if the condition in the step 7 is not true
+    9. Write the pair if distance less than nonbonded cutoff.
 
-	for (i = 0; i < natoms; i++) {
-		ip = ifat[i];
-		if (ip > -1) {
-			if (nblst->nsat[ip] > 0)
-				nblst->isat[ip] =
-				    _mol_malloc(nblst->nsat[ip] * sizeof(int));
-			nblst->nsat[ip] = 0;
-		}
-		nblst->ifat[i] = -1;
-		ifat[i] = -1;
-	}
-	nblst->nfat = 0;
+    The structure of the nblist is compressed sparse row (CSR):
+    number of first atoms,
+    array of first atom indices (increasing),
+    array of row offsets offs into the flat array nbrs of all second atoms,
+    array of numbers of second atoms for each first one,
+    array of pointers isat[i] = nbrs + offs[i] kept for existing loops.
+
+    The pairs found by the sweep are collected in the scratch array
+    nblst->pairs and sorted into rows by a stable counting sort, so the
+    geometry is visited once. All arrays are kept between calls and only
+    grow, so repeated updates do not go through the allocator.
+
+    With OpenMP and at least NBLST_PARALLEL_MIN_CUBES filled cubes the
+    sweep is split over threads (gen_nblist_omp), giving the same list. */
+void gen_nblist_rows(struct atomgrp *ag, struct cubeset *cust,
+		     struct clusterset *clst, const int *excl_offs,
+		     const int *excl_pairs, struct nblist *nblst)
+{
+	int np;
+	int natoms = ag->natoms;
 
-//loop over the filled cubes
-	for (i = 0; i < cust->nfcubes; i++) {
-		ic1 = cust->ifcubes[i];
-		icl1 = cust->cubes[ic1].hstincube;
-//loop over all clusters in cube1
-		while (icl1 >= 0) {
-			mdc1 = clst->clusters[icl1].mdc;
-			x1 = clst->clusters[icl1].gcent[0];
-			y1 = clst->clusters[icl1].gcent[1];
-			z1 = clst->clusters[icl1].gcent[2];
-//loop over neighboring cubes including cube1
-			for (j = -1; j < cust->cubes[ic1].nncubes; j++) {
-				if (j == -1)	// cube-self part
-					icl2 = clst->clusters[icl1].nextincube;
-				else	// cube-neighbor cube part
-				{
-					ic2 = cust->cubes[ic1].icubes[j];
-					icl2 = cust->cubes[ic2].hstincube;
-				}
-//second loop over clusters
-				while (icl2 >= 0) {
-					mdc2 = clst->clusters[icl2].mdc;
-					x2 = clst->clusters[icl2].gcent[0];
-					y2 = clst->clusters[icl2].gcent[1];
-					z2 = clst->clusters[icl2].gcent[2];
-					dx = x1 - x2;
-					dx *= dx;
-					dy = y1 - y2;
-					dy *= dy;
-					dz = z1 - z2;
-					dz *= dz;
-					d = dx + dy + dz;
-					dna = nbcut - mdc1 - mdc2;
-					dna *= dna;
-					dda = nbcut + mdc1 + mdc2;
-					dda *= dda;
-					if (d <= dda) {
-//for clusters icl1 and icl2 go through all pairs of their atoms
-						for (k1 = 0;
-						     k1 <
-						     clst->clusters[icl1].
-						     natoms; k1++) {
-							ak1 =
-							    clst->
-							    clusters[icl1].
-							    iatom[k1];
-							for (k2 = 0;
-							     k2 <
-							     clst->
-							     clusters[icl2].
-							     natoms; k2++) {
-								ak2 =
-								    clst->
-								    clusters
-								    [icl2].
-								    iatom[k2];
-								if (ag->
-								    atoms[ak1].
-								    fixed +
-								    ag->
-								    atoms[ak2].
-								    fixed == 2)
-									continue;
-								if (ak1 < ak2) {
-									ka1 =
-									    ak1;
-									ka2 =
-									    ak2;
-								} else {
-									ka1 =
-									    ak2;
-									ka2 =
-									    ak1;
-								}
-//check the exclusion table
-								ka3 =
-								    exta(ka1,
-									 ka2,
-									 excl_list,
-									 pd1,
-									 pd2,
-									 ndm);
-								if (ka3 > 0)
-									continue;
-//check distances of distant atom pairs (d>dna)
-								if (d > dna) {
-									dista =
-									    0.0;
-									dd = ag->atoms[ka1].X - ag->atoms[ka2].X;
-									dista +=
-									    dd *
-									    dd;
-									dd = ag->atoms[ka1].Y - ag->atoms[ka2].Y;
-									dista +=
-									    dd *
-									    dd;
-									dd = ag->atoms[ka1].Z - ag->atoms[ka2].Z;
-									dista +=
-									    dd *
-									    dd;
-									if (dista > nbcuts)
-										continue;
-								}
-//write a successful atom pair to a nonbond list structure
-								if (ifat[ka1] ==
-								    -1) {
-									nblst->
-									    ifat
-									    [nblst->
-									     nfat]
-									    =
-									    ka1;
-									ifat[ka1] = nblst->nfat;
-//                                nblst->isat[nblst->nfat]=_mol_malloc((natoms-ka1-1)*sizeof(int));
-									(nblst->
-									 nfat)++;
-								}
-								ip = ifat[ka1];
-								p = nblst->
-								    isat[ip];
-								p[nblst->
-								  nsat[ip]] =
-							     ka2;
-								(nblst->
-								 nsat[ip])++;
-							}
-						}
-					}
-					icl2 = clst->clusters[icl2].nextincube;
-				}
-			}
-			icl1 = clst->clusters[icl1].nextincube;
-		}
-	}
-//cleanup, total pair calculation
-	ntotp = 0;
-	free(ifat);
-	if (nblst->nfat > 0) {
-		nblst->ifat =
-		    _mol_realloc(nblst->ifat, (nblst->nfat) * sizeof(int));
-		nblst->nsat =
-		    _mol_realloc(nblst->nsat, (nblst->nfat) * sizeof(int));
-		nblst->isat =
-		    _mol_realloc(nblst->isat, (nblst->nfat) * sizeof(int *));
+	nblist_reserve_rows(nblst, natoms);
+#ifdef _OPENMP
+	if (cust->nfcubes >= NBLST_PARALLEL_MIN_CUBES
+	    && mol_num_threads() > 1) {
+		gen_nblist_omp(ag, cust, clst, excl_offs, excl_pairs, nblst,
+			       mol_num_threads());
+		return;
 	}
+#endif
+	np = nblist_sweep(ag, cust, clst, excl_offs, excl_pairs, nblst,
+			  0, cust->nfcubes, &(nblst->pairs),
+			  &(nblst->pairs_cap), NULL, NULL);
+	nblist_rows_from_pairs(natoms, np, nblst);
+}
 
-	for (i = 0; i < nblst->nfat; i++) {
-		ntotp += nblst->nsat[i];
-//           nblst->isat[i]=_mol_realloc(nblst->isat[i],(nblst->nsat[i])*sizeof(int));
-	}
-	nblst->npairs = ntotp;
+//! Two pass variant of gen_nblist_rows.
+/*! The geometry is swept twice, first to count the pairs of every
+    first atom and then to write them in place, so no pair scratch
+    array is needed. Uses less memory than gen_nblist at the cost
+    of a second sweep. */
+void gen_nblist_new_rows(struct atomgrp *ag, struct cubeset *cust,
+			 struct clusterset *clst, const int *excl_offs,
+			 const int *excl_pairs, struct nblist *nblst)
+{
+	int natoms = ag->natoms;
+	int *cnt, *pos;
+
+	nblist_reserve_rows(nblst, natoms);
+	cnt = _mol_calloc(natoms, sizeof(int));
+	pos = _mol_malloc(natoms * sizeof(int));
+	nblist_sweep(ag, cust, clst, excl_offs, excl_pairs, nblst,
+		     0, cust->nfcubes, NULL, NULL, cnt, NULL);
+	nblist_rows_from_counts(natoms, cnt, pos, nblst);
+	nblist_sweep(ag, cust, clst, excl_offs, excl_pairs, nblst,
+		     0, cust->nfcubes, NULL, NULL, NULL, pos);
+	nblist_link_rows(nblst, natoms);
+	free(pos);
+	free(cnt);
+}
+
+//! Exclusion rows of ag built from its bonds, as init_nblst does.
+static void ag_excl_rows(struct atomgrp *ag, int **excl_offs,
+			 int **excl_pairs)
+{
+	int *list01 = _mol_malloc(2 * (ag->nbonds) * sizeof(int));
+	int *na01 = _mol_malloc((ag->natoms) * sizeof(int));
+	int **pna01 = _mol_malloc((ag->natoms) * sizeof(int *));
+	int *na02 = _mol_malloc((ag->natoms) * sizeof(int));
+	int **pna02 = _mol_malloc((ag->natoms) * sizeof(int *));
+	int n02, n03;
+	int *list02, *list03;
+
+	comp_list01(ag, list01, na01, pna01);
+	comp_n23(ag->natoms, na01, pna01, &n02, &n03);
+	list02 = _mol_malloc(2 * n02 * sizeof(int));
+	list03 = _mol_malloc(2 * n03 * sizeof(int));
+	comp_list02(ag->natoms, na01, pna01, na02, pna02, &n02, list02);
+	comp_list03(ag->natoms, na01, pna01, list03);
+	trim_list03(ag->natoms, na01, pna01, na02, pna02, &n03, list03);
+	excl_rows(ag->natoms, na01, pna01, n02, list02, n03, list03,
+		  excl_offs, excl_pairs);
+	free(list03);
+	free(list02);
+	free(pna02);
+	free(na02);
+	free(pna01);
+	free(na01);
+	free(list01);
+}
+
+//! Exclusion rows of the legacy excl_tab table, or of the bonds of ag
+//! when init_nblst left the table out (ndm -1).
+static void gen_nblist_excl(struct atomgrp *ag, int *excl_list, int **pd1,
+			    int **pd2, int ndm, int **excl_offs,
+			    int **excl_pairs)
+{
+	if (ndm < 0)
+		ag_excl_rows(ag, excl_offs, excl_pairs);
+	else
+		excl_tab_rows(ag->natoms, excl_list, pd1, pd2, ndm,
+			      excl_offs, excl_pairs);
+}
+
+//! gen_nblist_rows with exclusions from a legacy excl_tab table.
+/*! The table is converted by excl_tab_rows on every call; keep the
+    rows of the agsetup (update_nblst) for repeated updates. Without
+    a table (ndm -1, see NBLST_EXCL_TAB_MAX) the rows are rebuilt
+    from the bonds of ag. */
+void gen_nblist(struct atomgrp *ag, struct cubeset *cust,
+		struct clusterset *clst, int *excl_list, int **pd1, int **pd2,
+		int ndm, struct nblist *nblst)
+{
+	int *excl_offs, *excl_pairs;
+
+	gen_nblist_excl(ag, excl_list, pd1, pd2, ndm, &excl_offs,
+			&excl_pairs);
+	gen_nblist_rows(ag, cust, clst, excl_offs, excl_pairs, nblst);
+	free(excl_pairs);
+	free(excl_offs);
+}
+
+//! gen_nblist_new_rows with exclusions from a legacy excl_tab table.
+void gen_nblist_new(struct atomgrp *ag, struct cubeset *cust,
+		    struct clusterset *clst, int *excl_list, int **pd1,
+		    int **pd2, int ndm, struct nblist *nblst)
+{
+	int *excl_offs, *excl_pairs;
+
+	gen_nblist_excl(ag, excl_list, pd1, pd2, ndm, &excl_offs,
+			&excl_pairs);
+	gen_nblist_new_rows(ag, cust, clst, excl_offs, excl_pairs, nblst);
+	free(excl_pairs);
+	free(excl_offs);
 }
 
 void free_cubeset(struct cubeset *cust)
@@ -1680,6 +1942,132 @@ void excl_dims(int natoms, int *na01, int **pna01,
 	}
 }
 
+//! Add the pair i<j of kind kind to the exclusion rows being filled.
+static void excl_rows_put(int i, int j, int kind, const int *offs,
+			  int *fill, int *pairs)
+{
+	if (i > j) {
+		int t = i;
+		i = j;
+		j = t;
+	}
+	pairs[offs[i] + fill[i]++] = (j << 2) | kind;
+}
+
+//! Create the exclusion rows excl_offs/excl_pairs.
+/*! Row i, excl_pairs[excl_offs[i]..excl_offs[i+1]-1], holds the atoms
+    j > i connected to i through 1, 2 or 3 bonds, sorted, as j << 2
+    with the number of bonds in the low two bits. A pair listed with
+    several kinds keeps the largest, as the later writes in excl_tab.
+    The rows only hold existing pairs, so the size is independent of
+    how far apart connected atoms are numbered. Both arrays are
+    allocated here and freed with the agsetup. */
+void excl_rows(int natoms, int *na01, int **pna01,
+	       int n02, int *list02, int n03, int *list03,
+	       int **excl_offs, int **excl_pairs)
+{
+	int i, j, k, n, e, *p;
+	int *offs = _mol_calloc(natoms + 1, sizeof(int));
+	int *fill = _mol_calloc(natoms, sizeof(int));
+	int *pairs;
+
+/* count the pairs of every lower atom. */
+	for (i = 0; i < natoms; i++) {
+		p = pna01[i];
+		for (k = 0; k < na01[i]; k++)
+			if (p[k] > i)
+				offs[i + 1]++;
+	}
+	for (i = 0; i < n02; i++) {
+		j = list02[2 * i];
+		k = list02[2 * i + 1];
+		offs[(j < k ? j : k) + 1]++;
+	}
+	for (i = 0; i < n03; i++) {
+		j = list03[2 * i];
+		k = list03[2 * i + 1];
+		offs[(j < k ? j : k) + 1]++;
+	}
+	for (i = 0; i < natoms; i++)
+		offs[i + 1] += offs[i];
+	pairs = _mol_malloc((offs[natoms] > 0 ? offs[natoms] : 1) *
+			    sizeof(int));
+
+/* fill in the order of excl_tab, bonds first. */
+	for (i = 0; i < natoms; i++) {
+		p = pna01[i];
+		for (k = 0; k < na01[i]; k++)
+			if (p[k] > i)
+				excl_rows_put(i, p[k], 1, offs, fill, pairs);
+	}
+	for (i = 0; i < n02; i++)
+		excl_rows_put(list02[2 * i], list02[2 * i + 1], 2, offs, fill,
+			      pairs);
+	for (i = 0; i < n03; i++)
+		excl_rows_put(list03[2 * i], list03[2 * i + 1], 3, offs, fill,
+			      pairs);
+
+/* sort every row and merge repeated pairs keeping the largest kind. */
+	n = 0;
+	for (i = 0; i < natoms; i++) {
+		const int b = offs[i], m = fill[i];
+		for (j = b + 1; j < b + m; j++) {
+			e = pairs[j];
+			for (k = j - 1; k >= b && pairs[k] > e; k--)
+				pairs[k + 1] = pairs[k];
+			pairs[k + 1] = e;
+		}
+		offs[i] = n;
+		for (j = b; j < b + m; j++) {
+			if (n > offs[i] && (pairs[n - 1] >> 2) == (pairs[j] >> 2))
+				pairs[n - 1] = pairs[j];
+			else
+				pairs[n++] = pairs[j];
+		}
+	}
+	offs[natoms] = n;
+	free(fill);
+	*excl_offs = offs;
+	*excl_pairs = pairs;
+}
+
+//! Exclusion rows of a legacy table built by excl_tab.
+/*! Reads the ndm atoms above each atom through exta, so the rows
+    match excl_rows for the same connectivity. Both arrays are
+    allocated here. There are no rows to read when init_nblst left
+    the table out (ndm -1); that is an error, as in exta. */
+void excl_tab_rows(int natoms, int *excl_list, int **pd1, int **pd2, int ndm,
+		   int **excl_offs, int **excl_pairs)
+{
+	int i, j, k, n = 0, cap = natoms + 1;
+	int *offs, *pairs;
+
+	if (ndm < 0) {
+		printf("excl_tab_rows: ERROR no exclusion table, use the "
+		       "rows of the agsetup\n");
+		exit(EXIT_FAILURE);
+	}
+	offs = _mol_malloc((natoms + 1) * sizeof(int));
+	pairs = _mol_malloc(cap * sizeof(int));
+
+	for (i = 0; i < natoms; i++) {
+		offs[i] = n;
+		for (j = i + 1; j < natoms && j <= i + ndm; j++) {
+			k = exta(i, j, excl_list, pd1, pd2, ndm);
+			if (k == 0)
+				continue;
+			if (n == cap) {
+				cap *= 2;
+				pairs = _mol_realloc(pairs, cap * sizeof(int));
+			}
+			pairs[n++] = j << 2 | k;
+		}
+	}
+	offs[natoms] = n;
+	*excl_offs = offs;
+	*excl_pairs = pairs;
+}
+
 //! Evaluate if a pair of atoms should be excluded from nonbonded list.
 /*! Based on connectivity data in exclusion list excl_list/pd1/pd2. */
 int exta(int a1, int a2, int *excl_list, int **pd1, int **pd2, int ndm)
@@ -1690,6 +2078,10 @@ int exta(int a1, int a2, int *excl_list, int **pd1, int **pd2, int ndm)
 		printf("exta: ERROR a1<=a2\n");
 		exit(EXIT_FAILURE);
 	}
+	if (ndm < 0) {
+		printf("exta: ERROR no exclusion table, use exta_rows\n");
+		exit(EXIT_FAILURE);
+	}
 	if (i >= ndm)
 		return 0;
 	if (i < 10)
@@ -1803,6 +2195,8 @@ void destroy_agsetup(struct agsetup *ags)
 	free(ags->excl_list);
 	free(ags->pd1);
 	free(ags->pd2);
+	free(ags->excl_pairs);
+	free(ags->excl_offs);
 	free(ags->listf03);
 	free(ags->list03);
 	free(ags->list02);
@@ -1828,30 +2222,52 @@ void free_agsetup(struct agsetup *ags)
     distribution of the clusters between cubes of nonbonded cutoff length with some padding.
     The speedup of the list generation is achieved by searching only neighbouring cubes and
     by using mostly cluster-cluster distances instead of atom-atom ones.
+
+    The forcefield cutoff is NBLST_DEFAULT_NBCOF and the list is built
+    NBLST_DEFAULT_SKIN further out, see init_nblst_cutoff.
     */
 void init_nblst(struct atomgrp *ag, struct agsetup *ags)
+{
+	init_nblst_cutoff(ag, ags, NBLST_DEFAULT_NBCOF, NBLST_DEFAULT_SKIN);
+}
+
+//! init_nblst with the forcefield cutoff nbcof and the list skin.
+/*! Pairs are listed up to nbcut = nbcof + skin, and check_clusterupdate
+    rebuilds the list once an atom has moved by more than skin / 2.
+    A larger skin means more pairs per atom but fewer rebuilds. The cube
+    length of gen_cubeset follows nbcut, and the ACE switching window
+    shrinks with nbcof (ace_switch_init). */
+void init_nblst_cutoff(struct atomgrp *ag, struct agsetup *ags,
+		       double nbcof, double skin)
 {
 	int *list01 = _mol_malloc(2 * (ag->nbonds) * sizeof(int));
 	int *na01 = _mol_malloc((ag->natoms) * sizeof(int));
 	int **pna01 = _mol_malloc((ag->natoms) * sizeof(int *));
 	int *na02 = _mol_malloc((ag->natoms) * sizeof(int));
 	int **pna02 = _mol_malloc((ag->natoms) * sizeof(int *));
-	int i, j;
+	int j;
 	int n02, n03, nf03;
 	int *list02;
 	int *list03;
 	int *listf03;
+	int *excl_offs;
+	int *excl_pairs;
 	int nd1, nd2, ndm;
+	long ntab;
 	int *atmind;
-	int *excl_list;
-	int **pd1;
-	int **pd2;
+	int *excl_list = NULL;
+	int **pd1 = NULL;
+	int **pd2 = NULL;
 	int *clust;
 	int nclust;
 	struct clusterset *clst;
 	struct nblist *nblst;
-	double nbcut;
-	double nbcof;
+
+	if (nbcof <= 0.0 || skin < 0.0) {
+		print_error("init_nblst_cutoff: invalid cutoff %lf or skin %lf\n",
+			    nbcof, skin);
+		exit(EXIT_FAILURE);
+	}
 	// Calculate a list of atoms connected by two bonds list02.
 
 	// Calculate a one dimensional bonded list list01 for the atomgroup ag.
@@ -1886,27 +2302,30 @@ void init_nblst(struct atomgrp *ag, struct agsetup *ags)
 		listf03 = _mol_realloc(listf03, 2 * nf03 * sizeof(int));
 	else
 		listf03 = _mol_realloc(listf03, 2 * sizeof(int));
+	// Create the exclusion rows.
+	/* For every atom the sorted list of higher numbered atoms connected
+	   to it through 1, 2, or 3 bonds, see exta_rows(). */
+	excl_rows(ag->natoms, na01, pna01,
+		  n02, list02, n03, list03, &excl_offs, &excl_pairs);
+	// Create the legacy exclusion table (excl_list) for exta().
+	/* Its size grows with how far apart connected atoms are numbered,
+	   so it is left out (ndm -1) above NBLST_EXCL_TAB_MAX ints per atom.
+	   The nonbonded list only reads the rows. */
 	atmind = _mol_malloc(2 * (ag->natoms) * sizeof(int));
-	// Evaluate dimensions of the exclusion list.
-	/* The dimensions of the exclusion
-	   list relate to how close the connected atoms are
-	   in terms of their numbers. */
 	excl_dims(ag->natoms, na01, pna01,
 		  n02, list02, n03, list03, &nd1, &nd2, &ndm, atmind);
-
-	i = 10 * ((ag->natoms) + nd1 + 1) + (nd2 + 1) * (ndm - 20);
-	excl_list = _mol_malloc(i * sizeof(int));
-	pd1 = (int **)_mol_malloc((ag->natoms) * sizeof(int *));
-	pd2 = (int **)_mol_malloc((ag->natoms) * sizeof(int *));
-	// Create an exclusion list (excl_list).
-	/* Exclusion list is a compact array of numbers coding connected through 1,
-	   2, or 3 bonds pairs of atoms. It is used later by the function exta() to
-	   quickly evaluate if a pair is excluded. The compactness of the exclusion
-	   list relates to the convention, that connected atoms are generally close
-	   to each other by the numbering. */
-	excl_tab(ag->natoms, na01, pna01,
-		 n02, list02, n03, list03,
-		 nd1, nd2, ndm, atmind, excl_list, pd1, pd2);
+	ntab = 10L * ((ag->natoms) + nd1 + 1) + (nd2 + 1L) * (ndm - 20);
+	if (ntab <= NBLST_EXCL_TAB_MAX * ((ag->natoms) + 1L)) {
+		excl_list = _mol_malloc(ntab * sizeof(int));
+		pd1 = (int **)_mol_malloc((ag->natoms) * sizeof(int *));
+		pd2 = (int **)_mol_malloc((ag->natoms) * sizeof(int *));
+		excl_tab(ag->natoms, na01, pna01,
+			 n02, list02, n03, list03,
+			 nd1, nd2, ndm, atmind, excl_list, pd1, pd2);
+	} else {
+		ndm = -1;
+	}
+	free(atmind);
 	// Pack connectivity data into nonbonded list ags structure.
 	/* Assemble all lists pointers and dimensions. */
 	ags->list02 = list02;
@@ -1915,20 +2334,21 @@ void init_nblst(struct atomgrp *ag, struct agsetup *ags)
 	ags->n02 = n02;
 	ags->n03 = n03;
 	ags->nf03 = nf03;
+	ags->excl_offs = excl_offs;
+	ags->excl_pairs = excl_pairs;
 	ags->ndm = ndm;
 	ags->excl_list = excl_list;
 	ags->pd1 = pd1;
 	ags->pd2 = pd2;
 
 	// Free temporal storage and data.
-	/* 01 and 02 lists and temporal atmind go. */
+	/* 01 and 02 lists go. */
 	free(pna01);
 	free(na01);
 	free(list01);
 
 	free(pna02);
 	free(na02);
-	free(atmind);
 //***************Generating cluster------------------------
 	clust = _mol_malloc((ag->natoms) * sizeof(int));
 	// Assign atoms to clusters based on three bonds connectivity.
@@ -1955,20 +2375,116 @@ void init_nblst(struct atomgrp *ag, struct agsetup *ags)
 	free(clust);
 
 	nblst = _mol_malloc(sizeof(struct nblist));
-	nbcut = 13.0;
-	nbcof = 12.0;
-	nblst->nbcut = nbcut;
+	nblst->nbcut = nbcof + skin;
 	nblst->nbcof = nbcof;
 	nblst->crds = _mol_malloc(3 * (ag->natoms) * sizeof(float));
+	nblst->npairs = 0;
 	nblst->nfat = 0;
 	nblst->ifat = _mol_malloc((ag->natoms) * sizeof(int));
 	nblst->nsat = _mol_malloc((ag->natoms) * sizeof(int));
 	for (j = 0; j < (ag->natoms); j++)
 		nblst->nsat[j] = 0;
 	nblst->isat = _mol_malloc((ag->natoms) * sizeof(int *));
+	nblst->offs = _mol_malloc((ag->natoms + 1) * sizeof(int));
+	nblst->offs[0] = 0;
+	nblst->fat_cap = ag->natoms;
+	nblst->nbrs = NULL;
+	nblst->nbrs_cap = 0;
+	nblst->pairs = NULL;
+	nblst->pairs_cap = 0;
+	nblst->order = NULL;
+	nblst->rank = NULL;
 	ags->nblst = nblst;
 }
 
+//! Spread the low 10 bits of v to every third bit.
+static unsigned int morton_spread(unsigned int v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+struct morton_key {
+	unsigned int key;
+	int icl;
+};
+
+static int morton_key_cmp(const void *a, const void *b)
+{
+	const struct morton_key *ka = a, *kb = b;
+	if (ka->key != kb->key)
+		return (ka->key > kb->key) - (ka->key < kb->key);
+	return ka->icl - kb->icl;
+}
+
+//! Put the atoms of nblst into the Morton order of their clusters.
+/*! Cluster centers from findmarg are binned on a 1024^3 grid over
+    their bounding box and sorted by the interleaved bits of the bin,
+    ties kept in cluster order. The atoms of a cluster stay together.
+    Fills nblst->order (position -> atom) and nblst->rank (atom ->
+    position). */
+static void nblist_spatial_order(const struct clusterset *clst,
+				 struct nblist *nblst)
+{
+	int i, j, k, n = 0;
+	double lo[3], hi[3], span = 0.0, s;
+	struct morton_key *mk =
+	    _mol_malloc(clst->nclusters * sizeof(struct morton_key));
+
+	for (j = 0; j < 3; j++)
+		lo[j] = hi[j] = clst->clusters[0].gcent[j];
+	for (i = 1; i < clst->nclusters; i++) {
+		for (j = 0; j < 3; j++) {
+			if (clst->clusters[i].gcent[j] < lo[j])
+				lo[j] = clst->clusters[i].gcent[j];
+			if (clst->clusters[i].gcent[j] > hi[j])
+				hi[j] = clst->clusters[i].gcent[j];
+		}
+	}
+	for (j = 0; j < 3; j++)
+		if (hi[j] - lo[j] > span)
+			span = hi[j] - lo[j];
+	s = (span > 0.0) ? 1023.0 / span : 0.0;
+	for (i = 0; i < clst->nclusters; i++) {
+		const double *c = clst->clusters[i].gcent;
+		mk[i].key = morton_spread((unsigned int)((c[0] - lo[0]) * s)) |
+		    (morton_spread((unsigned int)((c[1] - lo[1]) * s)) << 1) |
+		    (morton_spread((unsigned int)((c[2] - lo[2]) * s)) << 2);
+		mk[i].icl = i;
+	}
+	qsort(mk, clst->nclusters, sizeof(struct morton_key), morton_key_cmp);
+	for (i = 0; i < clst->nclusters; i++) {
+		const struct cluster *c = &(clst->clusters[mk[i].icl]);
+		for (j = 0; j < c->natoms; j++) {
+			k = c->iatom[j];
+			nblst->order[n] = k;
+			nblst->rank[k] = n++;
+		}
+	}
+	free(mk);
+}
+
+void nblst_spatial_order(struct atomgrp *ag, struct agsetup *ags, int on)
+{
+	struct nblist *nblst = ags->nblst;
+	if (on && nblst->order == NULL) {
+		nblst->order = _mol_malloc(ag->natoms * sizeof(int));
+		nblst->rank = _mol_malloc(ag->natoms * sizeof(int));
+	} else if (!on && nblst->order != NULL) {
+		free(nblst->order);
+		free(nblst->rank);
+		nblst->order = NULL;
+		nblst->rank = NULL;
+	} else {
+		return;
+	}
+	update_nblst(ag, ags);
+}
+
 //! Spatial part of the nblist generation altorithm
 /*! See comments to init_nblst function. This part is performed
     periodically when atom coordinates change sufficiently. 
@@ -1989,6 +2505,8 @@ void update_nblst(struct atomgrp *ag, struct agsetup *ags)
 	// Access margin size of future cubes.
 	/* sum of nblist cutoff and margin size gives the cubesize. */
 	findmarg(ag, ags->clst);
+	if (ags->nblst->order != NULL)
+		nblist_spatial_order(ags->clst, ags->nblst);
 
 	cust = _mol_malloc(sizeof(struct cubeset));
 	// Generate a set of cubes cust based on the clusterset ags->clst.
@@ -2020,8 +2538,8 @@ void update_nblst(struct atomgrp *ag, struct agsetup *ags)
 	   array of numbers of second atoms for each first one
 	   array of pointers to arrays of all second atoms
 	   arrays of all second atoms. */
-	gen_nblist(ag, cust, ags->clst, ags->excl_list, ags->pd1, ags->pd2,
-		   ags->ndm, ags->nblst);
+	gen_nblist_rows(ag, cust, ags->clst, ags->excl_offs,
+			ags->excl_pairs, ags->nblst);
 	free_cubeset(cust);
 	free(cust);
 
@@ -2047,7 +2565,6 @@ int check_clusterupdate(struct atomgrp *ag, struct agsetup *ags)
 		    (ags->nblst->crds[3 * j + 2] -
 		     ag->atoms[j].Z) * (ags->nblst->crds[3 * j + 2] -
 					ag->atoms[j].Z);
-		delta = delta * delta;
 		if (delta > delta0) {
 			flag = 1;
 			break;
@@ -2061,6 +2578,156 @@ int check_clusterupdate(struct atomgrp *ag, struct agsetup *ags)
 	}
 }
 
+//! Rebuild the rows of the atoms flagged in amoved.
+/*! Pairs between two unflagged atoms are kept. Every flagged cluster
+    is then matched against all other clusters, with current centers
+    from findmarg, and its atom pairs within nbcut are added. A pair
+    with an unflagged atom b gets the extra margin disp[b], b's
+    displacement since its own snapshot. b can still move by up to
+    skin/2 from that snapshot, so the pair stays valid until one of
+    the two atoms is refreshed again. */
+static void nblist_refresh_rows(struct atomgrp *ag, struct agsetup *ags,
+				const char *clmoved, const char *amoved,
+				const double *disp)
+{
+	int i, j, k1, k2, ak1, ak2, ka1, ka2, ic1, ic2, np = 0;
+	struct nblist *nblst = ags->nblst;
+	struct clusterset *clst = ags->clst;
+	struct cluster *c1, *c2;
+	const double nbcut = nblst->nbcut;
+	double maxdisp = 0.0, dx, dy, dz, d, dcl, cut;
+
+	for (i = 0; i < ag->natoms; i++)
+		if (!amoved[i] && disp[i] > maxdisp)
+			maxdisp = disp[i];
+	findmarg(ag, clst);
+
+/* keep the pairs of atoms that did not move. */
+	for (i = 0; i < nblst->nfat; i++) {
+		ka1 = nblst->ifat[i];
+		if (amoved[ka1])
+			continue;
+		for (j = 0; j < nblst->nsat[i]; j++) {
+			ka2 = nblst->isat[i][j];
+			if (amoved[ka2])
+				continue;
+			nblist_reserve(&(nblst->pairs), &(nblst->pairs_cap),
+				       2 * (np + 1));
+			nblst->pairs[2 * np] = ka1;
+			nblst->pairs[2 * np + 1] = ka2;
+			np++;
+		}
+	}
+/* add the pairs of the moved clusters, each cluster pair once. */
+	for (ic1 = 0; ic1 < clst->nclusters; ic1++) {
+		if (!clmoved[ic1])
+			continue;
+		c1 = &(clst->clusters[ic1]);
+		for (ic2 = 0; ic2 < clst->nclusters; ic2++) {
+			if (ic2 == ic1 || (clmoved[ic2] && ic2 < ic1))
+				continue;
+			c2 = &(clst->clusters[ic2]);
+			dx = c1->gcent[0] - c2->gcent[0];
+			dy = c1->gcent[1] - c2->gcent[1];
+			dz = c1->gcent[2] - c2->gcent[2];
+			dcl = nbcut + maxdisp + c1->mdc + c2->mdc;
+			if (dx * dx + dy * dy + dz * dz > dcl * dcl)
+				continue;
+			for (k1 = 0; k1 < c1->natoms; k1++) {
+				ak1 = c1->iatom[k1];
+				for (k2 = 0; k2 < c2->natoms; k2++) {
+					ak2 = c2->iatom[k2];
+					if (ag->atoms[ak1].fixed +
+					    ag->atoms[ak2].fixed == 2)
+						continue;
+					if (ak1 < ak2) {
+						ka1 = ak1;
+						ka2 = ak2;
+					} else {
+						ka1 = ak2;
+						ka2 = ak1;
+					}
+					if (exta_rows(ka1, ka2, ags->excl_offs,
+						      ags->excl_pairs) > 0)
+						continue;
+					dx = ag->atoms[ak1].X - ag->atoms[ak2].X;
+					dy = ag->atoms[ak1].Y - ag->atoms[ak2].Y;
+					dz = ag->atoms[ak1].Z - ag->atoms[ak2].Z;
+					d = dx * dx + dy * dy + dz * dz;
+					cut = nbcut + (amoved[ak2] ? 0.0 : disp[ak2]);
+					if (d > cut * cut)
+						continue;
+					nblist_reserve(&(nblst->pairs),
+						       &(nblst->pairs_cap),
+						       2 * (np + 1));
+					nblst->pairs[2 * np] = ka1;
+					nblst->pairs[2 * np + 1] = ka2;
+					np++;
+				}
+			}
+		}
+	}
+	nblist_rows_from_pairs(ag->natoms, np, nblst);
+/* new snapshot for the refreshed atoms only. */
+	for (i = 0; i < ag->natoms; i++) {
+		if (!amoved[i])
+			continue;
+		nblst->crds[3 * i] = ag->atoms[i].X;
+		nblst->crds[3 * i + 1] = ag->atoms[i].Y;
+		nblst->crds[3 * i + 2] = ag->atoms[i].Z;
+	}
+}
+
+//! Incremental variant of check_clusterupdate.
+/*! Displacements since the last snapshot are tracked per cluster: a
+    cluster has moved when any of its atoms moved by more than half
+    the skin nbcut - nbcof. If no cluster moved nothing is done. If up
+    to NBLST_REFRESH_MAX_FRAC of the clusters moved only their rows are
+    rebuilt (nblist_refresh_rows), otherwise update_nblst is called.
+    Returns 1 if the list changed, so per pair data such as the ACE
+    arrays (ace_updatenblst) has to be refreshed, 0 otherwise. */
+int check_clusterupdate_incremental(struct atomgrp *ag, struct agsetup *ags)
+{
+	int i, j, k, nmoved = 0;
+	const struct clusterset *clst = ags->clst;
+	const float *crds = ags->nblst->crds;
+	double h, dx, dy, dz;
+	double *disp = _mol_malloc(ag->natoms * sizeof(double));
+	char *amoved = _mol_calloc(ag->natoms, sizeof(char));
+	char *clmoved = _mol_calloc(clst->nclusters, sizeof(char));
+
+	h = fabs(ags->nblst->nbcut - ags->nblst->nbcof) / 2.0;
+	for (i = 0; i < ag->natoms; i++) {
+		dx = crds[3 * i] - ag->atoms[i].X;
+		dy = crds[3 * i + 1] - ag->atoms[i].Y;
+		dz = crds[3 * i + 2] - ag->atoms[i].Z;
+		disp[i] = sqrt(dx * dx + dy * dy + dz * dz);
+	}
+	for (i = 0; i < clst->nclusters; i++) {
+		for (j = 0; j < clst->clusters[i].natoms; j++) {
+			if (disp[clst->clusters[i].iatom[j]] > h) {
+				clmoved[i] = 1;
+				nmoved++;
+				break;
+			}
+		}
+		if (!clmoved[i])
+			continue;
+		for (j = 0; j < clst->clusters[i].natoms; j++) {
+			k = clst->clusters[i].iatom[j];
+			amoved[k] = 1;
+		}
+	}
+	if (nmoved > NBLST_REFRESH_MAX_FRAC * clst->nclusters)
+		update_nblst(ag, ags);
+	else if (nmoved > 0)
+		nblist_refresh_rows(ag, ags, clmoved, amoved, disp);
+	free(clmoved);
+	free(amoved);
+	free(disp);
+	return nmoved > 0;
+}
+
 void give_012(struct atomgrp *ag, struct agsetup *ags,
 	      int *na012, int **la012, int *nf012, int **lf012)
 {
@@ -2308,17 +2975,13 @@ void vdweng_octree_single_mol(OCTREE_PARAMS * octpar, double *energy)
 						int k;
 
 						if (ai < aj)
-							k = exta(ai, aj,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(ai, aj,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 						else
-							k = exta(aj, ai,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(aj, ai,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 
 						if (k > 0)
 							continue;	/* ignore atom pairs within three bond distance */
@@ -2443,17 +3106,13 @@ void vdweng_octree_single_mol(OCTREE_PARAMS * octpar, double *energy)
 						int k;
 
 						if (ai < aj)
-							k = exta(ai, aj,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(ai, aj,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 						else
-							k = exta(aj, ai,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(aj, ai,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 
 						if (k > 0)
 							continue;	/* ignore atom pairs within three bond distance */
@@ -2645,17 +3304,13 @@ void eleng_octree_single_mol(OCTREE_PARAMS * octpar, double *energy)
 						int k;
 
 						if (ai < aj)
-							k = exta(ai, aj,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(ai, aj,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 						else
-							k = exta(aj, ai,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(aj, ai,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 
 						if (k > 0)
 							continue;	/* ignore atom pairs within three bond distance */
@@ -2764,17 +3419,13 @@ void eleng_octree_single_mol(OCTREE_PARAMS * octpar, double *energy)
 						int k;
 
 						if (ai < aj)
-							k = exta(ai, aj,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(ai, aj,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 						else
-							k = exta(aj, ai,
-								 ags->excl_list,
-								 ags->pd1,
-								 ags->pd2,
-								 ags->ndm);
+							k = exta_rows(aj, ai,
+								      ags->excl_offs,
+								      ags->excl_pairs);
 
 						if (k > 0)
 							continue;	/* ignore atom pairs within three bond distance */
@@ -27,6 +27,7 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #ifndef _MOL_NBENERGY_H_
 #define _MOL_NBENERGY_H_
+#include <math.h>
 
 /** \file nbenergy.h
         This file contains  functions
@@ -34,6 +35,15 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 	and mantaining nonbonded lists
 */
 
+#ifndef CCELEC
+#define CCELEC 332.0716
+#endif
+
+/* terms of the fused nonbonded evaluator nbeng, see gbsa.h */
+#define NBENG_VDW  1
+#define NBENG_ELEC 2
+#define NBENG_ACE  4
+
 struct cluster
 {
 	int natoms; /**<number of atoms in the cluster */
@@ -73,10 +83,18 @@ struct nblist
         int nfat;     /**< number of first atoms in pairs */
         int *ifat;    /**< index of first atom */
         int *nsat;    /**< number of second atoms for each first */
-        int **isat;   /**< pointer to the array of second atoms */
+        int **isat;   /**< pointer to the array of second atoms, isat[i] == nbrs + offs[i] */
+        int *nbrs;    /**< second atoms of all first atoms, stored row after row (CSR) */
+        int *offs;    /**< start of row i in nbrs, nfat+1 entries, offs[nfat] == npairs */
+        int nbrs_cap; /**< allocated length of nbrs */
+        int fat_cap;  /**< allocated length of ifat, nsat and isat */
+        int *pairs;   /**< scratch pair array of gen_nblist, kept between updates */
+        int pairs_cap;/**< allocated length of pairs */
 	double nbcut; /**< nonbond list cutoff length */
         double nbcof; /**< forcefield cutoff length */
         float *crds;  /**< coordinates at nblist generation */
+        int *order;   /**< atoms in spatial (Morton) order, NULL for index order */
+        int *rank;    /**< position of each atom in order, rank[order[k]] == k */
 };
 //Wrapper for nonbonded list
 struct agsetup{
@@ -84,13 +102,48 @@ struct agsetup{
     int *list02;
     int *list03;
     int *listf03;//Fixed 03 list
-    int *excl_list;
+    int *excl_list;//Legacy exclusion table, see excl_tab; NULL and ndm -1 when too large
     int** pd1;
     int** pd2;
     struct nblist *nblst;
     struct clusterset *clst;
+    int *excl_offs;//Exclusion rows, see excl_rows
+    int *excl_pairs;
 };
 
+//! Switched Lennard-Jones energy of one pair, derivative over r in *dven.
+/*! eij is the product of the epsilons, rij the squared sum of the rmin
+    halves, d2 the squared distance and rc2 the squared cutoff. */
+_mol_sinline double vdw_pair(double eij, double rij, double d2, double rc2,
+			     double *dven)
+{
+	double Rd6, Rd12, Rr6, Rr12, dr6;
+	Rd6 = rij / d2;
+	Rd6 = Rd6 * Rd6 * Rd6;
+	Rd12 = Rd6 * Rd6;
+	Rr6 = rij / rc2;
+	Rr6 = Rr6 * Rr6 * Rr6;
+	Rr12 = Rr6 * Rr6;
+	dr6 = d2 / rc2;
+	dr6 = dr6 * dr6 * dr6;
+	*dven = -eij * 12 * (-Rd12 + Rd6 + dr6 * (Rr12 - Rr6)) / d2;
+	return eij * (Rd12 - 2 * Rd6 + Rr6 * (4.0 - 2 * dr6) +
+		      Rr12 * (2 * dr6 - 3.0));
+}
+
+//! Shifted distance dependent Coulomb energy of one pair.
+/*! ch is the charge product (including the prefactor), rc the cutoff
+    and rc2i its inverse square; derivative over r in *desh. */
+_mol_sinline double ele_pair(double ch, double d2, double rc, double rc2i,
+			     double *desh)
+{
+	double d1 = sqrt(d2);
+	double esh = 1.0 - d1 / rc;
+	esh *= esh / d1;
+	*desh = ch * (1.0 / d2 - rc2i) / d1;
+	return ch * esh;
+}
+
 void destroy_agsetup(struct agsetup* ags);
 void free_agsetup(struct agsetup* ags);
 
@@ -112,12 +165,32 @@ void elengs03(double f, double rc, struct atomgrp *ag, double eps, double* een,
 
 void eleng(struct atomgrp *ag, double eps, double* een, struct nblist *nblst);
 
+/* vdweng and eleng reading the packed view of init_agsoa, see soa.h */
+void vdweng_soa(struct agsoa * restrict soa, double* restrict ven, const struct nblist * const restrict nblst);
+
+void eleng_soa(struct agsoa * restrict soa, double eps, double* restrict een, const struct nblist * const restrict nblst);
+
 void destroy_nblist(struct nblist *nblst);
 void free_nblist(struct nblist *nblst);
 
+/* gen_nblist runs threaded from this many filled cubes on */
+#define NBLST_PARALLEL_MIN_CUBES 64
+/* cube ranges per thread of the threaded gen_nblist, for load balance */
+#define NBLST_PARALLEL_FRAGS 4
+void gen_nblist_rows(struct atomgrp *ag, struct cubeset *cust, struct clusterset *clst,
+                const int *excl_offs, const int *excl_pairs, struct nblist *nblst);
+
+void gen_nblist_new_rows(struct atomgrp *ag, struct cubeset *cust, struct clusterset *clst,
+                const int *excl_offs, const int *excl_pairs, struct nblist *nblst);
+
+/* the same lists from a legacy excl_tab table, or from the bonds of ag
+   when init_nblst left it out (ndm -1) */
 void gen_nblist(struct atomgrp *ag, struct cubeset *cust, struct clusterset *clst,
                 int *excl_list, int **pd1, int **pd2, int ndm, struct nblist *nblst);
 
+void gen_nblist_new(struct atomgrp *ag, struct cubeset *cust, struct clusterset *clst,
+                int *excl_list, int **pd1, int **pd2, int ndm, struct nblist *nblst);
+
 void free_cubeset(struct cubeset *cust);
 
 void gen_cubeset(double nbcut, struct clusterset *clst, struct cubeset *cust);
@@ -159,6 +232,29 @@ void excl_dims(int natoms, int *na01, int **pna01,
 
 int exta(int a1, int a2, int *excl_list, int **pd1, int **pd2, int ndm);
 
+void excl_rows(int natoms, int *na01, int **pna01,
+               int n02, int *list02, int n03, int *list03,
+               int **excl_offs, int **excl_pairs);
+
+void excl_tab_rows(int natoms, int *excl_list, int **pd1, int **pd2, int ndm,
+                   int **excl_offs, int **excl_pairs);
+
+//! Number of bonds (1-3) between atoms a1 < a2, 0 if not excluded.
+/*! Scans the sorted exclusion row of a1 built by excl_rows, which
+    holds a few entries whatever the atom numbering. */
+_mol_sinline int exta_rows(int a1, int a2, const int *excl_offs,
+                           const int *excl_pairs)
+{
+        const int key = a2 << 2;
+        const int *p = excl_pairs + excl_offs[a1];
+        const int *e = excl_pairs + excl_offs[a1 + 1];
+        for (; p < e; p++) {
+                if (*p >= key)
+                        return (*p < key + 4) ? (*p & 3) : 0;
+        }
+        return 0;
+}
+
 /*
 #ifdef _BGL_
 
@@ -188,12 +284,35 @@ void excl_tab(int natoms, int *na01, int **pna01,
 /* extract non fixed 03 list */
 void fix_list03(struct atomgrp *ag, int n03, int* list03,
                                     int *nf03, int *listf03);
+/* init_nblst skips the legacy excl_tab table above this many ints per atom */
+#define NBLST_EXCL_TAB_MAX 64
+/* default forcefield cutoff and list skin of init_nblst */
+#define NBLST_DEFAULT_NBCOF 12.0
+#define NBLST_DEFAULT_SKIN 1.0
 //Wrapper for nblist initialisation
 void init_nblst(struct atomgrp* ag, struct agsetup* ags);
+//nblist initialisation with forcefield cutoff nbcof, listed up to nbcof+skin
+void init_nblst_cutoff(struct atomgrp* ag, struct agsetup* ags,
+                       double nbcof, double skin);
 //Wrapper for nblist update
 void update_nblst(struct atomgrp* ag, struct agsetup* ags);
+/*
+   Switch the spatial ordering of nblist rows on or off and rebuild the list.
+   When on, every update_nblst puts the clusters into Morton order of their
+   centers, rows follow that order and second atoms within a row are sorted
+   by it, so consecutive rows touch overlapping, nearby atoms. Atom indices
+   in the list are unchanged, ags->nblst->order and rank map between the
+   two orders. Pairs are stored once with the lower atom index first, as in
+   the unordered list.
+*/
+void nblst_spatial_order(struct atomgrp* ag, struct agsetup* ags, int on);
 //Updating nblist if atoms moved enough
 int check_clusterupdate(struct atomgrp* ag,struct agsetup* ags);
+/* largest fraction of moved clusters refreshed row by row by
+   check_clusterupdate_incremental, above it the list is rebuilt */
+#define NBLST_REFRESH_MAX_FRAC 0.25
+//Updating only the nblist rows of clusters that moved enough
+int check_clusterupdate_incremental(struct atomgrp* ag, struct agsetup* ags);
 /*create 012 fixed/active lists for ace*/
 void give_012(struct atomgrp* ag, struct agsetup* ags,
               int* na012, int** la012, int* nf012, int** lf012);
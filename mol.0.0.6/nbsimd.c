@@ -0,0 +1,1557 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+
+#include _MOL_INCLUDE_
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(_WIN32)
+#define MOL_SIMD_X86
+#include <immintrin.h>
+#define MOL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define MOL_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#endif
+
+static int nb_precision = MOL_NB_DOUBLE;
+static int simd_cap = -1;	/* user cap, -1 none */
+static int simd_detected = -1;	/* cpu level, -1 not yet detected */
+
+enum mol_simd_level mol_simd_level(void)
+{
+	int level;
+	if (simd_detected < 0) {
+		level = MOL_SIMD_NONE;
+#ifdef MOL_SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")
+		    && __builtin_cpu_supports("fma"))
+			level = MOL_SIMD_AVX2;
+		if (level == MOL_SIMD_AVX2
+		    && __builtin_cpu_supports("avx512f"))
+			level = MOL_SIMD_AVX512;
+#endif
+		simd_detected = level;
+	}
+	level = simd_detected;
+	if (simd_cap >= 0 && simd_cap < level)
+		level = simd_cap;
+	return (enum mol_simd_level)level;
+}
+
+void mol_simd_set_level(int level)
+{
+	simd_cap = level;
+}
+
+enum mol_nb_precision mol_nb_precision(void)
+{
+	return (enum mol_nb_precision)nb_precision;
+}
+
+void mol_nb_set_precision(enum mol_nb_precision prec)
+{
+	nb_precision = prec;
+}
+
+void nbview_atoms(struct nbview *v, const struct atomgrp *ag, int use03)
+{
+	mol_atom *a = ag->atoms;
+	v->x = &(a[0].X);
+	v->y = &(a[0].Y);
+	v->z = &(a[0].Z);
+	v->eps = use03 ? &(a[0].eps03) : &(a[0].eps);
+	v->rminh = use03 ? &(a[0].rminh03) : &(a[0].rminh);
+	v->chrg = &(a[0].chrg);
+	v->s = sizeof(mol_atom) / sizeof(double);
+	v->gx = &(a[0].GX);
+	v->gy = &(a[0].GY);
+	v->gz = &(a[0].GZ);
+	v->gs = v->s;
+}
+
+void nbview_soa(struct nbview *v, struct agsoa *soa)
+{
+	v->x = soa->x;
+	v->y = soa->y;
+	v->z = soa->z;
+	v->eps = soa->eps;
+	v->rminh = soa->rminh;
+	v->chrg = soa->chrg;
+	v->s = 1;
+	v->gx = soa->gx;
+	v->gy = soa->gy;
+	v->gz = soa->gz;
+	v->gs = 1;
+}
+
+float *nbviewf_atoms(struct nbviewf *v, const struct atomgrp *ag)
+{
+	int i;
+	const int n = ag->natoms;
+	mol_atom *a = ag->atoms;
+	float *b = _mol_malloc(6 * (size_t) n * sizeof(float));
+	float *x = b, *y = b + n, *z = b + 2 * n;
+	float *eps = b + 3 * n, *rminh = b + 4 * n, *chrg = b + 5 * n;
+	for (i = 0; i < n; i++) {
+		x[i] = a[i].X;
+		y[i] = a[i].Y;
+		z[i] = a[i].Z;
+		eps[i] = a[i].eps;
+		rminh[i] = a[i].rminh;
+		chrg[i] = a[i].chrg;
+	}
+	v->x = x;
+	v->y = y;
+	v->z = z;
+	v->eps = eps;
+	v->rminh = rminh;
+	v->chrg = chrg;
+	v->gx = &(a[0].GX);
+	v->gy = &(a[0].GY);
+	v->gz = &(a[0].GZ);
+	v->gs = sizeof(mol_atom) / sizeof(double);
+	return b;
+}
+
+/* scalar versions over a view, also used for loop remainders */
+
+static double vdw_pair_view(const struct nbview *v, int i2, double ei,
+			    double ri, double dx, double dy, double dz,
+			    double rc2, double *g1)
+{
+	const int o2 = i2 * v->s;
+	const int q2 = i2 * v->gs;
+	double d2 = dx * dx + dy * dy + dz * dz;
+	double rij, dven, en;
+	if (d2 >= rc2)
+		return 0.0;
+	rij = ri + v->rminh[o2];
+	en = vdw_pair(ei * v->eps[o2], rij * rij, d2, rc2, &dven);
+	g1[0] += dven * dx;
+	g1[1] += dven * dy;
+	g1[2] += dven * dz;
+	v->gx[q2] -= dven * dx;
+	v->gy[q2] -= dven * dy;
+	v->gz[q2] -= dven * dz;
+	return en;
+}
+
+static double ele_pair_view(const struct nbview *v, int i2, double ch1,
+			    double dx, double dy, double dz, double rc,
+			    double rc2i, double *g1)
+{
+	const int q2 = i2 * v->gs;
+	double d2 = dx * dx + dy * dy + dz * dz;
+	double desh, en;
+	if (d2 >= rc * rc)
+		return 0.0;
+	en = ele_pair(ch1 * v->chrg[i2 * v->s], d2, rc, rc2i, &desh);
+	g1[0] += desh * dx;
+	g1[1] += desh * dy;
+	g1[2] += desh * dz;
+	v->gx[q2] -= desh * dx;
+	v->gy[q2] -= desh * dy;
+	v->gz[q2] -= desh * dz;
+	return en;
+}
+
+static double vdw_rows_scalar(const struct nbview *v,
+			      const struct nblist *nblst, int row0, int row1,
+			      double rc, int j0)
+{
+	int i, j, i1, i2, o1;
+	double en = 0.0, g1[3];
+	const double rc2 = rc * rc;
+	for (i = row0; i < row1; i++) {
+		i1 = nblst->ifat[i];
+		o1 = i1 * v->s;
+		g1[0] = g1[1] = g1[2] = 0.0;
+		for (j = j0; j < nblst->nsat[i]; j++) {
+			i2 = nblst->isat[i][j];
+			en += vdw_pair_view(v, i2, v->eps[o1],
+					    v->rminh[o1],
+					    v->x[o1] - v->x[i2 * v->s],
+					    v->y[o1] - v->y[i2 * v->s],
+					    v->z[o1] - v->z[i2 * v->s], rc2, g1);
+		}
+		v->gx[i1 * v->gs] += g1[0];
+		v->gy[i1 * v->gs] += g1[1];
+		v->gz[i1 * v->gs] += g1[2];
+	}
+	return en;
+}
+
+static double ele_rows_scalar(const struct nbview *v,
+			      const struct nblist *nblst, int row0, int row1,
+			      double pf, double rc, int j0)
+{
+	int i, j, i1, i2, o1;
+	double en = 0.0, g1[3];
+	const double rc2i = 1.0 / (rc * rc);
+	for (i = row0; i < row1; i++) {
+		i1 = nblst->ifat[i];
+		o1 = i1 * v->s;
+		g1[0] = g1[1] = g1[2] = 0.0;
+		for (j = j0; j < nblst->nsat[i]; j++) {
+			i2 = nblst->isat[i][j];
+			en += ele_pair_view(v, i2, pf * v->chrg[o1],
+					    v->x[o1] - v->x[i2 * v->s],
+					    v->y[o1] - v->y[i2 * v->s],
+					    v->z[o1] - v->z[i2 * v->s], rc,
+					    rc2i, g1);
+		}
+		v->gx[i1 * v->gs] += g1[0];
+		v->gy[i1 * v->gs] += g1[1];
+		v->gz[i1 * v->gs] += g1[2];
+	}
+	return en;
+}
+
+static double vdw03_scalar(const struct nbview *v, int i0, int n03,
+			   const int *list03, double f, double rc)
+{
+	int i, i1, i2, o1, o2;
+	double en = 0.0, dx, dy, dz, d2, rij, dven;
+	const double rc2 = rc * rc;
+	for (i = i0; i < n03; i++) {
+		i1 = list03[2 * i];
+		i2 = list03[2 * i + 1];
+		if (i1 == i2)
+			continue;
+		o1 = i1 * v->s;
+		o2 = i2 * v->s;
+		dx = v->x[o1] - v->x[o2];
+		dy = v->y[o1] - v->y[o2];
+		dz = v->z[o1] - v->z[o2];
+		d2 = dx * dx + dy * dy + dz * dz;
+		rij = v->rminh[o1] + v->rminh[o2];
+		en += vdw_pair(f * v->eps[o1] * v->eps[o2], rij * rij, d2,
+			       rc2, &dven);
+		v->gx[i1 * v->gs] += dven * dx;
+		v->gy[i1 * v->gs] += dven * dy;
+		v->gz[i1 * v->gs] += dven * dz;
+		v->gx[i2 * v->gs] -= dven * dx;
+		v->gy[i2 * v->gs] -= dven * dy;
+		v->gz[i2 * v->gs] -= dven * dz;
+	}
+	return en;
+}
+
+/* leaf-pair rows of the packed octree kernels, views with stride 1 */
+
+//! 1 if bit b of the exclusion row is set.
+_mol_sinline int excl_bit(const unsigned long long *row, int b)
+{
+	return (int)((row[b >> 6] >> (b & 63)) & 1);
+}
+
+//! Excluded pairs closer than this (squared) are skipped, as in nbenergy.c.
+#define LEAF_EXCL_D2 20.0
+
+static double vdw_leaf_row_scalar(const struct nbview *vm, int i,
+				  const struct nbview *vs, int ja, int jb,
+				  int j0, const unsigned long long *row,
+				  double rc2, double *g1)
+{
+	int j;
+	double en = 0.0, dx, dy, dz, d2, rij, dven;
+	const double xi = vm->x[i], yi = vm->y[i], zi = vm->z[i];
+	const double ei = vm->eps[i], ri = vm->rminh[i];
+	for (j = ja; j < jb; j++) {
+		dx = xi - vs->x[j];
+		dy = yi - vs->y[j];
+		dz = zi - vs->z[j];
+		d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 >= rc2)
+			continue;
+		if (row != NULL && d2 < LEAF_EXCL_D2 && excl_bit(row, j - j0))
+			continue;
+		rij = ri + vs->rminh[j];
+		en += vdw_pair(ei * vs->eps[j], rij * rij, d2, rc2, &dven);
+		g1[0] += dven * dx;
+		g1[1] += dven * dy;
+		g1[2] += dven * dz;
+		vs->gx[j] -= dven * dx;
+		vs->gy[j] -= dven * dy;
+		vs->gz[j] -= dven * dz;
+	}
+	return en;
+}
+
+static double ele_leaf_row_scalar(const struct nbview *vm, int i,
+				  const struct nbview *vs, int ja, int jb,
+				  int j0, const unsigned long long *row,
+				  double pf, double rc, double *g1)
+{
+	int j;
+	double en = 0.0, dx, dy, dz, d2, desh;
+	const double xi = vm->x[i], yi = vm->y[i], zi = vm->z[i];
+	const double ch1 = pf * vm->chrg[i];
+	const double rc2 = rc * rc, rc2i = 1.0 / rc2;
+	for (j = ja; j < jb; j++) {
+		dx = xi - vs->x[j];
+		dy = yi - vs->y[j];
+		dz = zi - vs->z[j];
+		d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 >= rc2)
+			continue;
+		if (row != NULL && d2 < LEAF_EXCL_D2 && excl_bit(row, j - j0))
+			continue;
+		en += ele_pair(ch1 * vs->chrg[j], d2, rc, rc2i, &desh);
+		g1[0] += desh * dx;
+		g1[1] += desh * dy;
+		g1[2] += desh * dz;
+		vs->gx[j] -= desh * dx;
+		vs->gy[j] -= desh * dy;
+		vs->gz[j] -= desh * dz;
+	}
+	return en;
+}
+
+/* mixed precision, float pair terms summed in double */
+
+static double vdw_rows_mixed_scalar(const struct nbviewf *v,
+				    const struct nblist *nblst, int row0,
+				    int row1, double rc, int j0)
+{
+	int i, j, i1, i2, q2;
+	double en = 0.0, g1[3];
+	float dx, dy, dz, d2, rij, dven;
+	const float rc2 = rc * rc, rc2i = 1.0 / (rc * rc);
+	for (i = row0; i < row1; i++) {
+		i1 = nblst->ifat[i];
+		g1[0] = g1[1] = g1[2] = 0.0;
+		for (j = j0; j < nblst->nsat[i]; j++) {
+			i2 = nblst->isat[i][j];
+			dx = v->x[i1] - v->x[i2];
+			dy = v->y[i1] - v->y[i2];
+			dz = v->z[i1] - v->z[i2];
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 >= rc2)
+				continue;
+			rij = v->rminh[i1] + v->rminh[i2];
+			en += vdw_pairf(v->eps[i1] * v->eps[i2], rij * rij, d2,
+					rc2i, &dven);
+			q2 = i2 * v->gs;
+			g1[0] += dven * dx;
+			g1[1] += dven * dy;
+			g1[2] += dven * dz;
+			v->gx[q2] -= dven * dx;
+			v->gy[q2] -= dven * dy;
+			v->gz[q2] -= dven * dz;
+		}
+		v->gx[i1 * v->gs] += g1[0];
+		v->gy[i1 * v->gs] += g1[1];
+		v->gz[i1 * v->gs] += g1[2];
+	}
+	return en;
+}
+
+static double ele_rows_mixed_scalar(const struct nbviewf *v,
+				    const struct nblist *nblst, int row0,
+				    int row1, double pf, double rc, int j0)
+{
+	int i, j, i1, i2, q2;
+	double en = 0.0, g1[3];
+	float dx, dy, dz, d2, ch1, desh;
+	const float rc2 = rc * rc, rci = 1.0 / rc, rc2i = 1.0 / (rc * rc);
+	for (i = row0; i < row1; i++) {
+		i1 = nblst->ifat[i];
+		ch1 = pf * v->chrg[i1];
+		g1[0] = g1[1] = g1[2] = 0.0;
+		for (j = j0; j < nblst->nsat[i]; j++) {
+			i2 = nblst->isat[i][j];
+			dx = v->x[i1] - v->x[i2];
+			dy = v->y[i1] - v->y[i2];
+			dz = v->z[i1] - v->z[i2];
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 >= rc2)
+				continue;
+			en += ele_pairf(ch1 * v->chrg[i2], d2, rci, rc2i,
+					&desh);
+			q2 = i2 * v->gs;
+			g1[0] += desh * dx;
+			g1[1] += desh * dy;
+			g1[2] += desh * dz;
+			v->gx[q2] -= desh * dx;
+			v->gy[q2] -= desh * dy;
+			v->gz[q2] -= desh * dz;
+		}
+		v->gx[i1 * v->gs] += g1[0];
+		v->gy[i1 * v->gs] += g1[1];
+		v->gz[i1 * v->gs] += g1[2];
+	}
+	return en;
+}
+
+#ifdef MOL_SIMD_X86
+
+/* ---------------------------- AVX2 + FMA ---------------------------- */
+
+MOL_TARGET_AVX2 static inline double hsum_avx2(__m256d v)
+{
+	__m128d lo = _mm256_castpd256_pd128(v);
+	__m128d hi = _mm256_extractf128_pd(v, 1);
+	lo = _mm_add_pd(lo, hi);
+	hi = _mm_unpackhi_pd(lo, lo);
+	return _mm_cvtsd_f64(_mm_add_sd(lo, hi));
+}
+
+//! Switched LJ for 4 pairs, returns the masked energy, dven in *dv.
+MOL_TARGET_AVX2 static inline __m256d vdw4_avx2(__m256d eij, __m256d rij,
+						__m256d d2, __m256d rc2i,
+						__m256d mask, __m256d * dv)
+{
+	const __m256d two = _mm256_set1_pd(2.0);
+	const __m256d three = _mm256_set1_pd(3.0);
+	const __m256d four = _mm256_set1_pd(4.0);
+	const __m256d m12 = _mm256_set1_pd(-12.0);
+	__m256d id2 = _mm256_div_pd(_mm256_set1_pd(1.0), d2);
+	__m256d Rd6 = _mm256_mul_pd(rij, id2);
+	__m256d Rr6 = _mm256_mul_pd(rij, rc2i);
+	__m256d dr6 = _mm256_mul_pd(d2, rc2i);
+	__m256d Rd12, Rr12, e, t;
+	Rd6 = _mm256_mul_pd(_mm256_mul_pd(Rd6, Rd6), Rd6);
+	Rd12 = _mm256_mul_pd(Rd6, Rd6);
+	Rr6 = _mm256_mul_pd(_mm256_mul_pd(Rr6, Rr6), Rr6);
+	Rr12 = _mm256_mul_pd(Rr6, Rr6);
+	dr6 = _mm256_mul_pd(_mm256_mul_pd(dr6, dr6), dr6);
+	/* Rd12 - 2 Rd6 + Rr6 (4 - 2 dr6) + Rr12 (2 dr6 - 3) */
+	e = _mm256_fnmadd_pd(two, Rd6, Rd12);
+	e = _mm256_fmadd_pd(Rr6, _mm256_fnmadd_pd(two, dr6, four), e);
+	e = _mm256_fmadd_pd(Rr12, _mm256_fmsub_pd(two, dr6, three), e);
+	e = _mm256_mul_pd(eij, e);
+	/* -12 eij (Rd6 - Rd12 + dr6 (Rr12 - Rr6)) / d2 */
+	t = _mm256_fmadd_pd(dr6, _mm256_sub_pd(Rr12, Rr6),
+			    _mm256_sub_pd(Rd6, Rd12));
+	t = _mm256_mul_pd(_mm256_mul_pd(m12, eij), _mm256_mul_pd(t, id2));
+	*dv = _mm256_and_pd(mask, t);
+	return _mm256_and_pd(mask, e);
+}
+
+//! Shifted Coulomb for 4 pairs, returns the masked energy, desh in *dv.
+MOL_TARGET_AVX2 static inline __m256d ele4_avx2(__m256d ch, __m256d d2,
+						__m256d rci, __m256d rc2i,
+						__m256d mask, __m256d * dv)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	__m256d d1 = _mm256_sqrt_pd(d2);
+	__m256d id1 = _mm256_div_pd(one, d1);
+	__m256d t = _mm256_fnmadd_pd(d1, rci, one);
+	__m256d e = _mm256_mul_pd(ch, _mm256_mul_pd(_mm256_mul_pd(t, t), id1));
+	t = _mm256_sub_pd(_mm256_mul_pd(id1, id1), rc2i);
+	*dv = _mm256_and_pd(mask, _mm256_mul_pd(ch, _mm256_mul_pd(t, id1)));
+	return _mm256_and_pd(mask, e);
+}
+
+MOL_TARGET_AVX2 static double vdw_rows_avx2(const struct nbview *v,
+					    const struct nblist *nblst,
+					    int row0, int row1, double rc)
+{
+	int i, j, k, i1, o1, q1, n2;
+	const int *p;
+	double en = 0.0, tg[3][4];
+	const double rc2 = rc * rc;
+	const __m256d vrc2 = _mm256_set1_pd(rc2);
+	const __m256d vrc2i = _mm256_set1_pd(1.0 / rc2);
+	const __m128i vs = _mm_set1_epi32(v->s);
+	for (i = row0; i < row1; i++) {
+		__m256d x1, y1, z1, ei, ri, ven, g1x, g1y, g1z;
+		i1 = nblst->ifat[i];
+		o1 = i1 * v->s;
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm256_set1_pd(v->x[o1]);
+		y1 = _mm256_set1_pd(v->y[o1]);
+		z1 = _mm256_set1_pd(v->z[o1]);
+		ei = _mm256_set1_pd(v->eps[o1]);
+		ri = _mm256_set1_pd(v->rminh[o1]);
+		ven = g1x = g1y = g1z = _mm256_setzero_pd();
+		for (j = 0; j + 4 <= n2; j += 4) {
+			__m256d dx, dy, dz, d2, mask, eij, rij, dv;
+			__m128i idx =
+			    _mm_mullo_epi32(_mm_loadu_si128
+					    ((const __m128i *)(p + j)), vs);
+			dx = _mm256_sub_pd(x1, _mm256_i32gather_pd(v->x, idx, 8));
+			dy = _mm256_sub_pd(y1, _mm256_i32gather_pd(v->y, idx, 8));
+			dz = _mm256_sub_pd(z1, _mm256_i32gather_pd(v->z, idx, 8));
+			d2 = _mm256_fmadd_pd(dx, dx,
+					     _mm256_fmadd_pd(dy, dy,
+							     _mm256_mul_pd(dz,
+									   dz)));
+			mask = _mm256_cmp_pd(d2, vrc2, _CMP_LT_OQ);
+			if (_mm256_movemask_pd(mask) == 0)
+				continue;
+			eij = _mm256_mul_pd(ei,
+					    _mm256_i32gather_pd(v->eps, idx, 8));
+			rij = _mm256_add_pd(ri,
+					    _mm256_i32gather_pd(v->rminh, idx,
+								8));
+			rij = _mm256_mul_pd(rij, rij);
+			ven = _mm256_add_pd(ven,
+					    vdw4_avx2(eij, rij, d2, vrc2i, mask,
+						      &dv));
+			dx = _mm256_mul_pd(dv, dx);
+			dy = _mm256_mul_pd(dv, dy);
+			dz = _mm256_mul_pd(dv, dz);
+			g1x = _mm256_add_pd(g1x, dx);
+			g1y = _mm256_add_pd(g1y, dy);
+			g1z = _mm256_add_pd(g1z, dz);
+			_mm256_storeu_pd(tg[0], dx);
+			_mm256_storeu_pd(tg[1], dy);
+			_mm256_storeu_pd(tg[2], dz);
+			for (k = 0; k < 4; k++) {
+				const int q2 = p[j + k] * v->gs;
+				v->gx[q2] -= tg[0][k];
+				v->gy[q2] -= tg[1][k];
+				v->gz[q2] -= tg[2][k];
+			}
+		}
+		v->gx[q1] += hsum_avx2(g1x);
+		v->gy[q1] += hsum_avx2(g1y);
+		v->gz[q1] += hsum_avx2(g1z);
+		en += hsum_avx2(ven);
+		if (j < n2)
+			en += vdw_rows_scalar(v, nblst, i, i + 1, rc, j);
+	}
+	return en;
+}
+
+MOL_TARGET_AVX2 static double ele_rows_avx2(const struct nbview *v,
+					    const struct nblist *nblst,
+					    int row0, int row1, double pf,
+					    double rc)
+{
+	int i, j, k, i1, o1, q1, n2;
+	const int *p;
+	double en = 0.0, tg[3][4];
+	const __m256d vrc2 = _mm256_set1_pd(rc * rc);
+	const __m256d vrc2i = _mm256_set1_pd(1.0 / (rc * rc));
+	const __m256d vrci = _mm256_set1_pd(1.0 / rc);
+	const __m128i vs = _mm_set1_epi32(v->s);
+	for (i = row0; i < row1; i++) {
+		__m256d x1, y1, z1, ch1, ven, g1x, g1y, g1z;
+		i1 = nblst->ifat[i];
+		o1 = i1 * v->s;
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm256_set1_pd(v->x[o1]);
+		y1 = _mm256_set1_pd(v->y[o1]);
+		z1 = _mm256_set1_pd(v->z[o1]);
+		ch1 = _mm256_set1_pd(pf * v->chrg[o1]);
+		ven = g1x = g1y = g1z = _mm256_setzero_pd();
+		for (j = 0; j + 4 <= n2; j += 4) {
+			__m256d dx, dy, dz, d2, mask, ch, dv;
+			__m128i idx =
+			    _mm_mullo_epi32(_mm_loadu_si128
+					    ((const __m128i *)(p + j)), vs);
+			dx = _mm256_sub_pd(x1, _mm256_i32gather_pd(v->x, idx, 8));
+			dy = _mm256_sub_pd(y1, _mm256_i32gather_pd(v->y, idx, 8));
+			dz = _mm256_sub_pd(z1, _mm256_i32gather_pd(v->z, idx, 8));
+			d2 = _mm256_fmadd_pd(dx, dx,
+					     _mm256_fmadd_pd(dy, dy,
+							     _mm256_mul_pd(dz,
+									   dz)));
+			mask = _mm256_cmp_pd(d2, vrc2, _CMP_LT_OQ);
+			if (_mm256_movemask_pd(mask) == 0)
+				continue;
+			ch = _mm256_mul_pd(ch1,
+					   _mm256_i32gather_pd(v->chrg, idx, 8));
+			ven = _mm256_add_pd(ven,
+					    ele4_avx2(ch, d2, vrci, vrc2i, mask,
+						      &dv));
+			dx = _mm256_mul_pd(dv, dx);
+			dy = _mm256_mul_pd(dv, dy);
+			dz = _mm256_mul_pd(dv, dz);
+			g1x = _mm256_add_pd(g1x, dx);
+			g1y = _mm256_add_pd(g1y, dy);
+			g1z = _mm256_add_pd(g1z, dz);
+			_mm256_storeu_pd(tg[0], dx);
+			_mm256_storeu_pd(tg[1], dy);
+			_mm256_storeu_pd(tg[2], dz);
+			for (k = 0; k < 4; k++) {
+				const int q2 = p[j + k] * v->gs;
+				v->gx[q2] -= tg[0][k];
+				v->gy[q2] -= tg[1][k];
+				v->gz[q2] -= tg[2][k];
+			}
+		}
+		v->gx[q1] += hsum_avx2(g1x);
+		v->gy[q1] += hsum_avx2(g1y);
+		v->gz[q1] += hsum_avx2(g1z);
+		en += hsum_avx2(ven);
+		if (j < n2)
+			en += ele_rows_scalar(v, nblst, i, i + 1, pf, rc, j);
+	}
+	return en;
+}
+
+MOL_TARGET_AVX2 static double vdw03_avx2(const struct nbview *v, int n03,
+					 const int *list03, double f,
+					 double rc)
+{
+	int i, k;
+	double en = 0.0, tg[3][4];
+	int i1s[4], i2s[4];
+	const __m256d vrc2i = _mm256_set1_pd(1.0 / (rc * rc));
+	const __m256d vf = _mm256_set1_pd(f);
+	const __m128i vs = _mm_set1_epi32(v->s);
+	const __m256i deint = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256d ven = _mm256_setzero_pd();
+	for (i = 0; i + 4 <= n03; i += 4) {
+		__m256d dx, dy, dz, d2, mask, eij, rij, dv;
+		__m256i pr =
+		    _mm256_permutevar8x32_epi32(_mm256_loadu_si256
+						((const __m256i *)(list03 +
+								   2 * i)),
+						deint);
+		__m128i a1 = _mm256_castsi256_si128(pr);
+		__m128i a2 = _mm256_extracti128_si256(pr, 1);
+		__m128i o1 = _mm_mullo_epi32(a1, vs);
+		__m128i o2 = _mm_mullo_epi32(a2, vs);
+		/* lanes with i1 == i2 are skipped as in vdwengs03 */
+		mask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64
+					   (_mm_xor_si128
+					    (_mm_cmpeq_epi32(a1, a2),
+					     _mm_set1_epi32(-1))));
+		dx = _mm256_sub_pd(_mm256_i32gather_pd(v->x, o1, 8),
+				   _mm256_i32gather_pd(v->x, o2, 8));
+		dy = _mm256_sub_pd(_mm256_i32gather_pd(v->y, o1, 8),
+				   _mm256_i32gather_pd(v->y, o2, 8));
+		dz = _mm256_sub_pd(_mm256_i32gather_pd(v->z, o1, 8),
+				   _mm256_i32gather_pd(v->z, o2, 8));
+		d2 = _mm256_fmadd_pd(dx, dx,
+				     _mm256_fmadd_pd(dy, dy,
+						     _mm256_mul_pd(dz, dz)));
+		/* keep masked lanes finite */
+		d2 = _mm256_blendv_pd(_mm256_set1_pd(1.0), d2, mask);
+		eij = _mm256_mul_pd(vf,
+				    _mm256_mul_pd(_mm256_i32gather_pd
+						  (v->eps, o1, 8),
+						  _mm256_i32gather_pd(v->eps,
+								      o2, 8)));
+		rij = _mm256_add_pd(_mm256_i32gather_pd(v->rminh, o1, 8),
+				    _mm256_i32gather_pd(v->rminh, o2, 8));
+		rij = _mm256_mul_pd(rij, rij);
+		ven = _mm256_add_pd(ven,
+				    vdw4_avx2(eij, rij, d2, vrc2i, mask, &dv));
+		_mm256_storeu_pd(tg[0], _mm256_mul_pd(dv, dx));
+		_mm256_storeu_pd(tg[1], _mm256_mul_pd(dv, dy));
+		_mm256_storeu_pd(tg[2], _mm256_mul_pd(dv, dz));
+		_mm_storeu_si128((__m128i *) i1s, a1);
+		_mm_storeu_si128((__m128i *) i2s, a2);
+		/* an atom can appear in several lanes, scatter one by one */
+		for (k = 0; k < 4; k++) {
+			const int q1 = i1s[k] * v->gs;
+			const int q2 = i2s[k] * v->gs;
+			v->gx[q1] += tg[0][k];
+			v->gy[q1] += tg[1][k];
+			v->gz[q1] += tg[2][k];
+			v->gx[q2] -= tg[0][k];
+			v->gy[q2] -= tg[1][k];
+			v->gz[q2] -= tg[2][k];
+		}
+	}
+	en = hsum_avx2(ven);
+	return en + vdw03_scalar(v, i, n03, list03, f, rc);
+}
+
+//! Lane mask of the 4 exclusion bits of row from bit b on, b + 3 in the row.
+MOL_TARGET_AVX2 static inline __m256d excl_mask4_avx2(const unsigned long long
+						      *row, int b)
+{
+	unsigned long long w = row[b >> 6] >> (b & 63);
+	if ((b & 63) > 60)
+		w |= row[(b >> 6) + 1] << (64 - (b & 63));
+	return _mm256_castsi256_pd(_mm256_set_epi64x(-(long long)((w >> 3) & 1),
+						     -(long long)((w >> 2) & 1),
+						     -(long long)((w >> 1) & 1),
+						     -(long long)(w & 1)));
+}
+
+//! Drops from mask the excluded lanes of row (if any) closer than sqrt(20).
+MOL_TARGET_AVX2 static inline __m256d leaf_mask_avx2(__m256d d2, __m256d vrc2,
+						     const unsigned long long
+						     *row, int b)
+{
+	__m256d mask = _mm256_cmp_pd(d2, vrc2, _CMP_LT_OQ);
+	if (row != NULL) {
+		__m256d xm = _mm256_and_pd(excl_mask4_avx2(row, b),
+					   _mm256_cmp_pd(d2,
+							 _mm256_set1_pd
+							 (LEAF_EXCL_D2),
+							 _CMP_LT_OQ));
+		mask = _mm256_andnot_pd(xm, mask);
+	}
+	return mask;
+}
+
+MOL_TARGET_AVX2 static double vdw_leaf_row_avx2(const struct nbview *vm, int i,
+						const struct nbview *vs, int ja,
+						int jb, int j0,
+						const unsigned long long *row,
+						double rc, double *g1)
+{
+	int j;
+	const double rc2 = rc * rc;
+	const __m256d vrc2 = _mm256_set1_pd(rc2);
+	const __m256d vrc2i = _mm256_set1_pd(1.0 / rc2);
+	const __m256d x1 = _mm256_set1_pd(vm->x[i]);
+	const __m256d y1 = _mm256_set1_pd(vm->y[i]);
+	const __m256d z1 = _mm256_set1_pd(vm->z[i]);
+	const __m256d ei = _mm256_set1_pd(vm->eps[i]);
+	const __m256d ri = _mm256_set1_pd(vm->rminh[i]);
+	__m256d ven, g1x, g1y, g1z;
+	ven = g1x = g1y = g1z = _mm256_setzero_pd();
+	for (j = ja; j + 4 <= jb; j += 4) {
+		__m256d dx, dy, dz, d2, mask, eij, rij, dv;
+		dx = _mm256_sub_pd(x1, _mm256_loadu_pd(vs->x + j));
+		dy = _mm256_sub_pd(y1, _mm256_loadu_pd(vs->y + j));
+		dz = _mm256_sub_pd(z1, _mm256_loadu_pd(vs->z + j));
+		d2 = _mm256_fmadd_pd(dx, dx,
+				     _mm256_fmadd_pd(dy, dy,
+						     _mm256_mul_pd(dz, dz)));
+		mask = leaf_mask_avx2(d2, vrc2, row, j - j0);
+		if (_mm256_movemask_pd(mask) == 0)
+			continue;
+		eij = _mm256_mul_pd(ei, _mm256_loadu_pd(vs->eps + j));
+		rij = _mm256_add_pd(ri, _mm256_loadu_pd(vs->rminh + j));
+		rij = _mm256_mul_pd(rij, rij);
+		ven = _mm256_add_pd(ven,
+				    vdw4_avx2(eij, rij, d2, vrc2i, mask, &dv));
+		dx = _mm256_mul_pd(dv, dx);
+		dy = _mm256_mul_pd(dv, dy);
+		dz = _mm256_mul_pd(dv, dz);
+		g1x = _mm256_add_pd(g1x, dx);
+		g1y = _mm256_add_pd(g1y, dy);
+		g1z = _mm256_add_pd(g1z, dz);
+		/* static atoms are contiguous, update their gradients in place */
+		_mm256_storeu_pd(vs->gx + j,
+				 _mm256_sub_pd(_mm256_loadu_pd(vs->gx + j), dx));
+		_mm256_storeu_pd(vs->gy + j,
+				 _mm256_sub_pd(_mm256_loadu_pd(vs->gy + j), dy));
+		_mm256_storeu_pd(vs->gz + j,
+				 _mm256_sub_pd(_mm256_loadu_pd(vs->gz + j), dz));
+	}
+	g1[0] += hsum_avx2(g1x);
+	g1[1] += hsum_avx2(g1y);
+	g1[2] += hsum_avx2(g1z);
+	return hsum_avx2(ven) + vdw_leaf_row_scalar(vm, i, vs, j, jb, j0, row,
+						    rc2, g1);
+}
+
+MOL_TARGET_AVX2 static double ele_leaf_row_avx2(const struct nbview *vm, int i,
+						const struct nbview *vs, int ja,
+						int jb, int j0,
+						const unsigned long long *row,
+						double pf, double rc,
+						double *g1)
+{
+	int j;
+	const __m256d vrc2 = _mm256_set1_pd(rc * rc);
+	const __m256d vrc2i = _mm256_set1_pd(1.0 / (rc * rc));
+	const __m256d vrci = _mm256_set1_pd(1.0 / rc);
+	const __m256d x1 = _mm256_set1_pd(vm->x[i]);
+	const __m256d y1 = _mm256_set1_pd(vm->y[i]);
+	const __m256d z1 = _mm256_set1_pd(vm->z[i]);
+	const __m256d ch1 = _mm256_set1_pd(pf * vm->chrg[i]);
+	__m256d ven, g1x, g1y, g1z;
+	ven = g1x = g1y = g1z = _mm256_setzero_pd();
+	for (j = ja; j + 4 <= jb; j += 4) {
+		__m256d dx, dy, dz, d2, mask, ch, dv;
+		dx = _mm256_sub_pd(x1, _mm256_loadu_pd(vs->x + j));
+		dy = _mm256_sub_pd(y1, _mm256_loadu_pd(vs->y + j));
+		dz = _mm256_sub_pd(z1, _mm256_loadu_pd(vs->z + j));
+		d2 = _mm256_fmadd_pd(dx, dx,
+				     _mm256_fmadd_pd(dy, dy,
+						     _mm256_mul_pd(dz, dz)));
+		mask = leaf_mask_avx2(d2, vrc2, row, j - j0);
+		if (_mm256_movemask_pd(mask) == 0)
+			continue;
+		ch = _mm256_mul_pd(ch1, _mm256_loadu_pd(vs->chrg + j));
+		ven = _mm256_add_pd(ven,
+				    ele4_avx2(ch, d2, vrci, vrc2i, mask, &dv));
+		dx = _mm256_mul_pd(dv, dx);
+		dy = _mm256_mul_pd(dv, dy);
+		dz = _mm256_mul_pd(dv, dz);
+		g1x = _mm256_add_pd(g1x, dx);
+		g1y = _mm256_add_pd(g1y, dy);
+		g1z = _mm256_add_pd(g1z, dz);
+		_mm256_storeu_pd(vs->gx + j,
+				 _mm256_sub_pd(_mm256_loadu_pd(vs->gx + j), dx));
+		_mm256_storeu_pd(vs->gy + j,
+				 _mm256_sub_pd(_mm256_loadu_pd(vs->gy + j), dy));
+		_mm256_storeu_pd(vs->gz + j,
+				 _mm256_sub_pd(_mm256_loadu_pd(vs->gz + j), dz));
+	}
+	g1[0] += hsum_avx2(g1x);
+	g1[1] += hsum_avx2(g1y);
+	g1[2] += hsum_avx2(g1z);
+	return hsum_avx2(ven) + ele_leaf_row_scalar(vm, i, vs, j, jb, j0, row,
+						    pf, rc, g1);
+}
+
+/* mixed precision: 8 float lanes, sums widened to 2 x 4 doubles */
+
+//! acc += lo and hi halves of the 8 floats f, as doubles.
+MOL_TARGET_AVX2 static inline __m256d widen_add_avx2(__m256d acc, __m256 f)
+{
+	acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+	return _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+}
+
+//! Switched LJ for 8 float pairs, see vdw4_avx2.
+MOL_TARGET_AVX2 static inline __m256 vdw8f_avx2(__m256 eij, __m256 rij,
+						__m256 d2, __m256 rc2i,
+						__m256 mask, __m256 * dv)
+{
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	const __m256 four = _mm256_set1_ps(4.0f);
+	const __m256 m12 = _mm256_set1_ps(-12.0f);
+	__m256 id2 = _mm256_div_ps(_mm256_set1_ps(1.0f), d2);
+	__m256 Rd6 = _mm256_mul_ps(rij, id2);
+	__m256 Rr6 = _mm256_mul_ps(rij, rc2i);
+	__m256 dr6 = _mm256_mul_ps(d2, rc2i);
+	__m256 Rd12, Rr12, e, t;
+	Rd6 = _mm256_mul_ps(_mm256_mul_ps(Rd6, Rd6), Rd6);
+	Rd12 = _mm256_mul_ps(Rd6, Rd6);
+	Rr6 = _mm256_mul_ps(_mm256_mul_ps(Rr6, Rr6), Rr6);
+	Rr12 = _mm256_mul_ps(Rr6, Rr6);
+	dr6 = _mm256_mul_ps(_mm256_mul_ps(dr6, dr6), dr6);
+	e = _mm256_fnmadd_ps(two, Rd6, Rd12);
+	e = _mm256_fmadd_ps(Rr6, _mm256_fnmadd_ps(two, dr6, four), e);
+	e = _mm256_fmadd_ps(Rr12, _mm256_fmsub_ps(two, dr6, three), e);
+	e = _mm256_mul_ps(eij, e);
+	t = _mm256_fmadd_ps(dr6, _mm256_sub_ps(Rr12, Rr6),
+			    _mm256_sub_ps(Rd6, Rd12));
+	t = _mm256_mul_ps(_mm256_mul_ps(m12, eij), _mm256_mul_ps(t, id2));
+	*dv = _mm256_and_ps(mask, t);
+	return _mm256_and_ps(mask, e);
+}
+
+//! Shifted Coulomb for 8 float pairs, see ele4_avx2.
+MOL_TARGET_AVX2 static inline __m256 ele8f_avx2(__m256 ch, __m256 d2,
+						__m256 rci, __m256 rc2i,
+						__m256 mask, __m256 * dv)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 d1 = _mm256_sqrt_ps(d2);
+	__m256 id1 = _mm256_div_ps(one, d1);
+	__m256 t = _mm256_fnmadd_ps(d1, rci, one);
+	__m256 e = _mm256_mul_ps(ch, _mm256_mul_ps(_mm256_mul_ps(t, t), id1));
+	t = _mm256_sub_ps(_mm256_mul_ps(id1, id1), rc2i);
+	*dv = _mm256_and_ps(mask, _mm256_mul_ps(ch, _mm256_mul_ps(t, id1)));
+	return _mm256_and_ps(mask, e);
+}
+
+//! Folds the 8 lane gradients of one block into i1 sums and i2 atoms.
+MOL_TARGET_AVX2 static inline void grads8f_avx2(const struct nbviewf *v,
+						const int *p, __m256 dv,
+						__m256 dx, __m256 dy,
+						__m256 dz, __m256d * g1)
+{
+	int k;
+	float tg[3][8];
+	dx = _mm256_mul_ps(dv, dx);
+	dy = _mm256_mul_ps(dv, dy);
+	dz = _mm256_mul_ps(dv, dz);
+	g1[0] = widen_add_avx2(g1[0], dx);
+	g1[1] = widen_add_avx2(g1[1], dy);
+	g1[2] = widen_add_avx2(g1[2], dz);
+	_mm256_storeu_ps(tg[0], dx);
+	_mm256_storeu_ps(tg[1], dy);
+	_mm256_storeu_ps(tg[2], dz);
+	for (k = 0; k < 8; k++) {
+		const int q2 = p[k] * v->gs;
+		v->gx[q2] -= tg[0][k];
+		v->gy[q2] -= tg[1][k];
+		v->gz[q2] -= tg[2][k];
+	}
+}
+
+MOL_TARGET_AVX2 static double vdw_rows_mixed_avx2(const struct nbviewf *v,
+						  const struct nblist *nblst,
+						  int row0, int row1, double rc)
+{
+	int i, j, i1, q1, n2;
+	const int *p;
+	double en = 0.0;
+	const __m256 vrc2 = _mm256_set1_ps(rc * rc);
+	const __m256 vrc2i = _mm256_set1_ps(1.0 / (rc * rc));
+	for (i = row0; i < row1; i++) {
+		__m256 x1, y1, z1, ei, ri;
+		__m256d ven, g1[3];
+		i1 = nblst->ifat[i];
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm256_set1_ps(v->x[i1]);
+		y1 = _mm256_set1_ps(v->y[i1]);
+		z1 = _mm256_set1_ps(v->z[i1]);
+		ei = _mm256_set1_ps(v->eps[i1]);
+		ri = _mm256_set1_ps(v->rminh[i1]);
+		ven = g1[0] = g1[1] = g1[2] = _mm256_setzero_pd();
+		for (j = 0; j + 8 <= n2; j += 8) {
+			__m256 dx, dy, dz, d2, mask, eij, rij, dv;
+			__m256i idx =
+			    _mm256_loadu_si256((const __m256i *)(p + j));
+			dx = _mm256_sub_ps(x1, _mm256_i32gather_ps(v->x, idx, 4));
+			dy = _mm256_sub_ps(y1, _mm256_i32gather_ps(v->y, idx, 4));
+			dz = _mm256_sub_ps(z1, _mm256_i32gather_ps(v->z, idx, 4));
+			d2 = _mm256_fmadd_ps(dx, dx,
+					     _mm256_fmadd_ps(dy, dy,
+							     _mm256_mul_ps(dz,
+									   dz)));
+			mask = _mm256_cmp_ps(d2, vrc2, _CMP_LT_OQ);
+			if (_mm256_movemask_ps(mask) == 0)
+				continue;
+			eij = _mm256_mul_ps(ei,
+					    _mm256_i32gather_ps(v->eps, idx, 4));
+			rij = _mm256_add_ps(ri,
+					    _mm256_i32gather_ps(v->rminh, idx,
+								4));
+			rij = _mm256_mul_ps(rij, rij);
+			ven = widen_add_avx2(ven,
+					     vdw8f_avx2(eij, rij, d2, vrc2i,
+							mask, &dv));
+			grads8f_avx2(v, p + j, dv, dx, dy, dz, g1);
+		}
+		v->gx[q1] += hsum_avx2(g1[0]);
+		v->gy[q1] += hsum_avx2(g1[1]);
+		v->gz[q1] += hsum_avx2(g1[2]);
+		en += hsum_avx2(ven);
+		if (j < n2)
+			en += vdw_rows_mixed_scalar(v, nblst, i, i + 1, rc, j);
+	}
+	return en;
+}
+
+MOL_TARGET_AVX2 static double ele_rows_mixed_avx2(const struct nbviewf *v,
+						  const struct nblist *nblst,
+						  int row0, int row1,
+						  double pf, double rc)
+{
+	int i, j, i1, q1, n2;
+	const int *p;
+	double en = 0.0;
+	const __m256 vrc2 = _mm256_set1_ps(rc * rc);
+	const __m256 vrc2i = _mm256_set1_ps(1.0 / (rc * rc));
+	const __m256 vrci = _mm256_set1_ps(1.0 / rc);
+	for (i = row0; i < row1; i++) {
+		__m256 x1, y1, z1, ch1;
+		__m256d ven, g1[3];
+		i1 = nblst->ifat[i];
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm256_set1_ps(v->x[i1]);
+		y1 = _mm256_set1_ps(v->y[i1]);
+		z1 = _mm256_set1_ps(v->z[i1]);
+		ch1 = _mm256_set1_ps(pf * v->chrg[i1]);
+		ven = g1[0] = g1[1] = g1[2] = _mm256_setzero_pd();
+		for (j = 0; j + 8 <= n2; j += 8) {
+			__m256 dx, dy, dz, d2, mask, ch, dv;
+			__m256i idx =
+			    _mm256_loadu_si256((const __m256i *)(p + j));
+			dx = _mm256_sub_ps(x1, _mm256_i32gather_ps(v->x, idx, 4));
+			dy = _mm256_sub_ps(y1, _mm256_i32gather_ps(v->y, idx, 4));
+			dz = _mm256_sub_ps(z1, _mm256_i32gather_ps(v->z, idx, 4));
+			d2 = _mm256_fmadd_ps(dx, dx,
+					     _mm256_fmadd_ps(dy, dy,
+							     _mm256_mul_ps(dz,
+									   dz)));
+			mask = _mm256_cmp_ps(d2, vrc2, _CMP_LT_OQ);
+			if (_mm256_movemask_ps(mask) == 0)
+				continue;
+			ch = _mm256_mul_ps(ch1,
+					   _mm256_i32gather_ps(v->chrg, idx, 4));
+			ven = widen_add_avx2(ven,
+					     ele8f_avx2(ch, d2, vrci, vrc2i,
+							mask, &dv));
+			grads8f_avx2(v, p + j, dv, dx, dy, dz, g1);
+		}
+		v->gx[q1] += hsum_avx2(g1[0]);
+		v->gy[q1] += hsum_avx2(g1[1]);
+		v->gz[q1] += hsum_avx2(g1[2]);
+		en += hsum_avx2(ven);
+		if (j < n2)
+			en += ele_rows_mixed_scalar(v, nblst, i, i + 1, pf, rc,
+						    j);
+	}
+	return en;
+}
+
+/* ----------------------------- AVX-512F ----------------------------- */
+
+//! Switched LJ for 8 pairs, energy and dven are zero outside mask m.
+MOL_TARGET_AVX512 static inline __m512d vdw8_avx512(__m512d eij,
+						    __m512d rij, __m512d d2,
+						    __m512d rc2i, __mmask8 m,
+						    __m512d * dv)
+{
+	const __m512d two = _mm512_set1_pd(2.0);
+	const __m512d three = _mm512_set1_pd(3.0);
+	const __m512d four = _mm512_set1_pd(4.0);
+	const __m512d m12 = _mm512_set1_pd(-12.0);
+	__m512d id2 = _mm512_div_pd(_mm512_set1_pd(1.0), d2);
+	__m512d Rd6 = _mm512_mul_pd(rij, id2);
+	__m512d Rr6 = _mm512_mul_pd(rij, rc2i);
+	__m512d dr6 = _mm512_mul_pd(d2, rc2i);
+	__m512d Rd12, Rr12, e, t;
+	Rd6 = _mm512_mul_pd(_mm512_mul_pd(Rd6, Rd6), Rd6);
+	Rd12 = _mm512_mul_pd(Rd6, Rd6);
+	Rr6 = _mm512_mul_pd(_mm512_mul_pd(Rr6, Rr6), Rr6);
+	Rr12 = _mm512_mul_pd(Rr6, Rr6);
+	dr6 = _mm512_mul_pd(_mm512_mul_pd(dr6, dr6), dr6);
+	e = _mm512_fnmadd_pd(two, Rd6, Rd12);
+	e = _mm512_fmadd_pd(Rr6, _mm512_fnmadd_pd(two, dr6, four), e);
+	e = _mm512_fmadd_pd(Rr12, _mm512_fmsub_pd(two, dr6, three), e);
+	e = _mm512_mul_pd(eij, e);
+	t = _mm512_fmadd_pd(dr6, _mm512_sub_pd(Rr12, Rr6),
+			    _mm512_sub_pd(Rd6, Rd12));
+	t = _mm512_mul_pd(_mm512_mul_pd(m12, eij), _mm512_mul_pd(t, id2));
+	*dv = _mm512_maskz_mov_pd(m, t);
+	return _mm512_maskz_mov_pd(m, e);
+}
+
+//! Shifted Coulomb for 8 pairs, energy and desh are zero outside mask m.
+MOL_TARGET_AVX512 static inline __m512d ele8_avx512(__m512d ch, __m512d d2,
+						    __m512d rci, __m512d rc2i,
+						    __mmask8 m, __m512d * dv)
+{
+	const __m512d one = _mm512_set1_pd(1.0);
+	__m512d d1 = _mm512_sqrt_pd(d2);
+	__m512d id1 = _mm512_div_pd(one, d1);
+	__m512d t = _mm512_fnmadd_pd(d1, rci, one);
+	__m512d e = _mm512_mul_pd(ch, _mm512_mul_pd(_mm512_mul_pd(t, t), id1));
+	t = _mm512_sub_pd(_mm512_mul_pd(id1, id1), rc2i);
+	*dv = _mm512_maskz_mov_pd(m, _mm512_mul_pd(ch, _mm512_mul_pd(t, id1)));
+	return _mm512_maskz_mov_pd(m, e);
+}
+
+//! Subtract g from the gradients of the second atoms of one row block.
+/*! Second atoms of a row are distinct, so gather/scatter cannot collide. */
+MOL_TARGET_AVX512 static inline void scatter8_avx512(const struct nbview *v,
+						     __m256i gidx,
+						     __m512d gx, __m512d gy,
+						     __m512d gz)
+{
+	__m512d t;
+	t = _mm512_i32gather_pd(gidx, v->gx, 8);
+	_mm512_i32scatter_pd(v->gx, gidx, _mm512_sub_pd(t, gx), 8);
+	t = _mm512_i32gather_pd(gidx, v->gy, 8);
+	_mm512_i32scatter_pd(v->gy, gidx, _mm512_sub_pd(t, gy), 8);
+	t = _mm512_i32gather_pd(gidx, v->gz, 8);
+	_mm512_i32scatter_pd(v->gz, gidx, _mm512_sub_pd(t, gz), 8);
+}
+
+MOL_TARGET_AVX512 static double vdw_rows_avx512(const struct nbview *v,
+						const struct nblist *nblst,
+						int row0, int row1, double rc)
+{
+	int i, j, i1, o1, q1, n2;
+	const int *p;
+	double en = 0.0;
+	const double rc2 = rc * rc;
+	const __m512d vrc2 = _mm512_set1_pd(rc2);
+	const __m512d vrc2i = _mm512_set1_pd(1.0 / rc2);
+	const __m256i vs = _mm256_set1_epi32(v->s);
+	const __m256i vgs = _mm256_set1_epi32(v->gs);
+	for (i = row0; i < row1; i++) {
+		__m512d x1, y1, z1, ei, ri, ven, g1x, g1y, g1z;
+		i1 = nblst->ifat[i];
+		o1 = i1 * v->s;
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm512_set1_pd(v->x[o1]);
+		y1 = _mm512_set1_pd(v->y[o1]);
+		z1 = _mm512_set1_pd(v->z[o1]);
+		ei = _mm512_set1_pd(v->eps[o1]);
+		ri = _mm512_set1_pd(v->rminh[o1]);
+		ven = g1x = g1y = g1z = _mm512_setzero_pd();
+		for (j = 0; j + 8 <= n2; j += 8) {
+			__m512d dx, dy, dz, d2, eij, rij, dv;
+			__mmask8 m;
+			__m256i a2 =
+			    _mm256_loadu_si256((const __m256i *)(p + j));
+			__m256i idx = _mm256_mullo_epi32(a2, vs);
+			dx = _mm512_sub_pd(x1, _mm512_i32gather_pd(idx, v->x, 8));
+			dy = _mm512_sub_pd(y1, _mm512_i32gather_pd(idx, v->y, 8));
+			dz = _mm512_sub_pd(z1, _mm512_i32gather_pd(idx, v->z, 8));
+			d2 = _mm512_fmadd_pd(dx, dx,
+					     _mm512_fmadd_pd(dy, dy,
+							     _mm512_mul_pd(dz,
+									   dz)));
+			m = _mm512_cmp_pd_mask(d2, vrc2, _CMP_LT_OQ);
+			if (m == 0)
+				continue;
+			eij = _mm512_mul_pd(ei,
+					    _mm512_i32gather_pd(idx, v->eps, 8));
+			rij = _mm512_add_pd(ri,
+					    _mm512_i32gather_pd(idx, v->rminh,
+								8));
+			rij = _mm512_mul_pd(rij, rij);
+			ven = _mm512_add_pd(ven,
+					    vdw8_avx512(eij, rij, d2, vrc2i, m,
+							&dv));
+			dx = _mm512_mul_pd(dv, dx);
+			dy = _mm512_mul_pd(dv, dy);
+			dz = _mm512_mul_pd(dv, dz);
+			g1x = _mm512_add_pd(g1x, dx);
+			g1y = _mm512_add_pd(g1y, dy);
+			g1z = _mm512_add_pd(g1z, dz);
+			scatter8_avx512(v, _mm256_mullo_epi32(a2, vgs), dx, dy,
+					dz);
+		}
+		v->gx[q1] += _mm512_reduce_add_pd(g1x);
+		v->gy[q1] += _mm512_reduce_add_pd(g1y);
+		v->gz[q1] += _mm512_reduce_add_pd(g1z);
+		en += _mm512_reduce_add_pd(ven);
+		if (j < n2)
+			en += vdw_rows_scalar(v, nblst, i, i + 1, rc, j);
+	}
+	return en;
+}
+
+MOL_TARGET_AVX512 static double ele_rows_avx512(const struct nbview *v,
+						const struct nblist *nblst,
+						int row0, int row1, double pf,
+						double rc)
+{
+	int i, j, i1, o1, q1, n2;
+	const int *p;
+	double en = 0.0;
+	const __m512d vrc2 = _mm512_set1_pd(rc * rc);
+	const __m512d vrc2i = _mm512_set1_pd(1.0 / (rc * rc));
+	const __m512d vrci = _mm512_set1_pd(1.0 / rc);
+	const __m256i vs = _mm256_set1_epi32(v->s);
+	const __m256i vgs = _mm256_set1_epi32(v->gs);
+	for (i = row0; i < row1; i++) {
+		__m512d x1, y1, z1, ch1, ven, g1x, g1y, g1z;
+		i1 = nblst->ifat[i];
+		o1 = i1 * v->s;
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm512_set1_pd(v->x[o1]);
+		y1 = _mm512_set1_pd(v->y[o1]);
+		z1 = _mm512_set1_pd(v->z[o1]);
+		ch1 = _mm512_set1_pd(pf * v->chrg[o1]);
+		ven = g1x = g1y = g1z = _mm512_setzero_pd();
+		for (j = 0; j + 8 <= n2; j += 8) {
+			__m512d dx, dy, dz, d2, ch, dv;
+			__mmask8 m;
+			__m256i a2 =
+			    _mm256_loadu_si256((const __m256i *)(p + j));
+			__m256i idx = _mm256_mullo_epi32(a2, vs);
+			dx = _mm512_sub_pd(x1, _mm512_i32gather_pd(idx, v->x, 8));
+			dy = _mm512_sub_pd(y1, _mm512_i32gather_pd(idx, v->y, 8));
+			dz = _mm512_sub_pd(z1, _mm512_i32gather_pd(idx, v->z, 8));
+			d2 = _mm512_fmadd_pd(dx, dx,
+					     _mm512_fmadd_pd(dy, dy,
+							     _mm512_mul_pd(dz,
+									   dz)));
+			m = _mm512_cmp_pd_mask(d2, vrc2, _CMP_LT_OQ);
+			if (m == 0)
+				continue;
+			ch = _mm512_mul_pd(ch1,
+					   _mm512_i32gather_pd(idx, v->chrg, 8));
+			ven = _mm512_add_pd(ven,
+					    ele8_avx512(ch, d2, vrci, vrc2i, m,
+							&dv));
+			dx = _mm512_mul_pd(dv, dx);
+			dy = _mm512_mul_pd(dv, dy);
+			dz = _mm512_mul_pd(dv, dz);
+			g1x = _mm512_add_pd(g1x, dx);
+			g1y = _mm512_add_pd(g1y, dy);
+			g1z = _mm512_add_pd(g1z, dz);
+			scatter8_avx512(v, _mm256_mullo_epi32(a2, vgs), dx, dy,
+					dz);
+		}
+		v->gx[q1] += _mm512_reduce_add_pd(g1x);
+		v->gy[q1] += _mm512_reduce_add_pd(g1y);
+		v->gz[q1] += _mm512_reduce_add_pd(g1z);
+		en += _mm512_reduce_add_pd(ven);
+		if (j < n2)
+			en += ele_rows_scalar(v, nblst, i, i + 1, pf, rc, j);
+	}
+	return en;
+}
+
+/* mixed precision: 16 float lanes, sums widened to 2 x 8 doubles */
+
+//! acc += lo and hi halves of the 16 floats f, as doubles.
+MOL_TARGET_AVX512 static inline __m512d widen_add_avx512(__m512d acc,
+							 __m512 f)
+{
+	__m256 hi =
+	    _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(f), 1));
+	acc = _mm512_add_pd(acc, _mm512_cvtps_pd(_mm512_castps512_ps256(f)));
+	return _mm512_add_pd(acc, _mm512_cvtps_pd(hi));
+}
+
+//! Switched LJ for 16 float pairs, see vdw8_avx512.
+MOL_TARGET_AVX512 static inline __m512 vdw16f_avx512(__m512 eij, __m512 rij,
+						     __m512 d2, __m512 rc2i,
+						     __mmask16 m, __m512 * dv)
+{
+	const __m512 two = _mm512_set1_ps(2.0f);
+	const __m512 three = _mm512_set1_ps(3.0f);
+	const __m512 four = _mm512_set1_ps(4.0f);
+	const __m512 m12 = _mm512_set1_ps(-12.0f);
+	__m512 id2 = _mm512_div_ps(_mm512_set1_ps(1.0f), d2);
+	__m512 Rd6 = _mm512_mul_ps(rij, id2);
+	__m512 Rr6 = _mm512_mul_ps(rij, rc2i);
+	__m512 dr6 = _mm512_mul_ps(d2, rc2i);
+	__m512 Rd12, Rr12, e, t;
+	Rd6 = _mm512_mul_ps(_mm512_mul_ps(Rd6, Rd6), Rd6);
+	Rd12 = _mm512_mul_ps(Rd6, Rd6);
+	Rr6 = _mm512_mul_ps(_mm512_mul_ps(Rr6, Rr6), Rr6);
+	Rr12 = _mm512_mul_ps(Rr6, Rr6);
+	dr6 = _mm512_mul_ps(_mm512_mul_ps(dr6, dr6), dr6);
+	e = _mm512_fnmadd_ps(two, Rd6, Rd12);
+	e = _mm512_fmadd_ps(Rr6, _mm512_fnmadd_ps(two, dr6, four), e);
+	e = _mm512_fmadd_ps(Rr12, _mm512_fmsub_ps(two, dr6, three), e);
+	e = _mm512_mul_ps(eij, e);
+	t = _mm512_fmadd_ps(dr6, _mm512_sub_ps(Rr12, Rr6),
+			    _mm512_sub_ps(Rd6, Rd12));
+	t = _mm512_mul_ps(_mm512_mul_ps(m12, eij), _mm512_mul_ps(t, id2));
+	*dv = _mm512_maskz_mov_ps(m, t);
+	return _mm512_maskz_mov_ps(m, e);
+}
+
+//! Shifted Coulomb for 16 float pairs, see ele8_avx512.
+MOL_TARGET_AVX512 static inline __m512 ele16f_avx512(__m512 ch, __m512 d2,
+						     __m512 rci, __m512 rc2i,
+						     __mmask16 m, __m512 * dv)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	__m512 d1 = _mm512_sqrt_ps(d2);
+	__m512 id1 = _mm512_div_ps(one, d1);
+	__m512 t = _mm512_fnmadd_ps(d1, rci, one);
+	__m512 e = _mm512_mul_ps(ch, _mm512_mul_ps(_mm512_mul_ps(t, t), id1));
+	t = _mm512_sub_ps(_mm512_mul_ps(id1, id1), rc2i);
+	*dv = _mm512_maskz_mov_ps(m, _mm512_mul_ps(ch, _mm512_mul_ps(t, id1)));
+	return _mm512_maskz_mov_ps(m, e);
+}
+
+//! Folds the 16 lane gradients of one block into i1 sums and i2 atoms.
+MOL_TARGET_AVX512 static inline void grads16f_avx512(const struct nbviewf *v,
+						     __m512i a2, __m512 dv,
+						     __m512 dx, __m512 dy,
+						     __m512 dz, __m512d * g1)
+{
+	const __m256i vgs = _mm256_set1_epi32(v->gs);
+	__m256i lo = _mm256_mullo_epi32(_mm512_castsi512_si256(a2), vgs);
+	__m256i hi = _mm256_mullo_epi32(_mm512_extracti64x4_epi64(a2, 1), vgs);
+	__m512d t;
+	int c;
+	__m512 f[3];
+	double *g[3];
+	f[0] = _mm512_mul_ps(dv, dx);
+	f[1] = _mm512_mul_ps(dv, dy);
+	f[2] = _mm512_mul_ps(dv, dz);
+	g[0] = v->gx;
+	g[1] = v->gy;
+	g[2] = v->gz;
+	for (c = 0; c < 3; c++) {
+		__m512d flo = _mm512_cvtps_pd(_mm512_castps512_ps256(f[c]));
+		__m512d fhi =
+		    _mm512_cvtps_pd(_mm256_castpd_ps
+				    (_mm512_extractf64x4_pd
+				     (_mm512_castps_pd(f[c]), 1)));
+		g1[c] = _mm512_add_pd(g1[c], _mm512_add_pd(flo, fhi));
+		t = _mm512_i32gather_pd(lo, g[c], 8);
+		_mm512_i32scatter_pd(g[c], lo, _mm512_sub_pd(t, flo), 8);
+		t = _mm512_i32gather_pd(hi, g[c], 8);
+		_mm512_i32scatter_pd(g[c], hi, _mm512_sub_pd(t, fhi), 8);
+	}
+}
+
+MOL_TARGET_AVX512 static double vdw_rows_mixed_avx512(const struct nbviewf
+						      *v,
+						      const struct nblist
+						      *nblst, int row0,
+						      int row1, double rc)
+{
+	int i, j, i1, q1, n2;
+	const int *p;
+	double en = 0.0;
+	const __m512 vrc2 = _mm512_set1_ps(rc * rc);
+	const __m512 vrc2i = _mm512_set1_ps(1.0 / (rc * rc));
+	for (i = row0; i < row1; i++) {
+		__m512 x1, y1, z1, ei, ri;
+		__m512d ven, g1[3];
+		i1 = nblst->ifat[i];
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm512_set1_ps(v->x[i1]);
+		y1 = _mm512_set1_ps(v->y[i1]);
+		z1 = _mm512_set1_ps(v->z[i1]);
+		ei = _mm512_set1_ps(v->eps[i1]);
+		ri = _mm512_set1_ps(v->rminh[i1]);
+		ven = g1[0] = g1[1] = g1[2] = _mm512_setzero_pd();
+		for (j = 0; j + 16 <= n2; j += 16) {
+			__m512 dx, dy, dz, d2, eij, rij, dv;
+			__mmask16 m;
+			__m512i idx = _mm512_loadu_si512((const void *)(p + j));
+			dx = _mm512_sub_ps(x1, _mm512_i32gather_ps(idx, v->x, 4));
+			dy = _mm512_sub_ps(y1, _mm512_i32gather_ps(idx, v->y, 4));
+			dz = _mm512_sub_ps(z1, _mm512_i32gather_ps(idx, v->z, 4));
+			d2 = _mm512_fmadd_ps(dx, dx,
+					     _mm512_fmadd_ps(dy, dy,
+							     _mm512_mul_ps(dz,
+									   dz)));
+			m = _mm512_cmp_ps_mask(d2, vrc2, _CMP_LT_OQ);
+			if (m == 0)
+				continue;
+			eij = _mm512_mul_ps(ei,
+					    _mm512_i32gather_ps(idx, v->eps, 4));
+			rij = _mm512_add_ps(ri,
+					    _mm512_i32gather_ps(idx, v->rminh,
+								4));
+			rij = _mm512_mul_ps(rij, rij);
+			ven = widen_add_avx512(ven,
+					       vdw16f_avx512(eij, rij, d2,
+							     vrc2i, m, &dv));
+			grads16f_avx512(v, idx, dv, dx, dy, dz, g1);
+		}
+		v->gx[q1] += _mm512_reduce_add_pd(g1[0]);
+		v->gy[q1] += _mm512_reduce_add_pd(g1[1]);
+		v->gz[q1] += _mm512_reduce_add_pd(g1[2]);
+		en += _mm512_reduce_add_pd(ven);
+		if (j < n2)
+			en += vdw_rows_mixed_scalar(v, nblst, i, i + 1, rc, j);
+	}
+	return en;
+}
+
+MOL_TARGET_AVX512 static double ele_rows_mixed_avx512(const struct nbviewf
+						      *v,
+						      const struct nblist
+						      *nblst, int row0,
+						      int row1, double pf,
+						      double rc)
+{
+	int i, j, i1, q1, n2;
+	const int *p;
+	double en = 0.0;
+	const __m512 vrc2 = _mm512_set1_ps(rc * rc);
+	const __m512 vrc2i = _mm512_set1_ps(1.0 / (rc * rc));
+	const __m512 vrci = _mm512_set1_ps(1.0 / rc);
+	for (i = row0; i < row1; i++) {
+		__m512 x1, y1, z1, ch1;
+		__m512d ven, g1[3];
+		i1 = nblst->ifat[i];
+		q1 = i1 * v->gs;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		x1 = _mm512_set1_ps(v->x[i1]);
+		y1 = _mm512_set1_ps(v->y[i1]);
+		z1 = _mm512_set1_ps(v->z[i1]);
+		ch1 = _mm512_set1_ps(pf * v->chrg[i1]);
+		ven = g1[0] = g1[1] = g1[2] = _mm512_setzero_pd();
+		for (j = 0; j + 16 <= n2; j += 16) {
+			__m512 dx, dy, dz, d2, ch, dv;
+			__mmask16 m;
+			__m512i idx = _mm512_loadu_si512((const void *)(p + j));
+			dx = _mm512_sub_ps(x1, _mm512_i32gather_ps(idx, v->x, 4));
+			dy = _mm512_sub_ps(y1, _mm512_i32gather_ps(idx, v->y, 4));
+			dz = _mm512_sub_ps(z1, _mm512_i32gather_ps(idx, v->z, 4));
+			d2 = _mm512_fmadd_ps(dx, dx,
+					     _mm512_fmadd_ps(dy, dy,
+							     _mm512_mul_ps(dz,
+									   dz)));
+			m = _mm512_cmp_ps_mask(d2, vrc2, _CMP_LT_OQ);
+			if (m == 0)
+				continue;
+			ch = _mm512_mul_ps(ch1,
+					   _mm512_i32gather_ps(idx, v->chrg, 4));
+			ven = widen_add_avx512(ven,
+					       ele16f_avx512(ch, d2, vrci,
+							     vrc2i, m, &dv));
+			grads16f_avx512(v, idx, dv, dx, dy, dz, g1);
+		}
+		v->gx[q1] += _mm512_reduce_add_pd(g1[0]);
+		v->gy[q1] += _mm512_reduce_add_pd(g1[1]);
+		v->gz[q1] += _mm512_reduce_add_pd(g1[2]);
+		en += _mm512_reduce_add_pd(ven);
+		if (j < n2)
+			en += ele_rows_mixed_scalar(v, nblst, i, i + 1, pf, rc,
+						    j);
+	}
+	return en;
+}
+
+#endif				/* MOL_SIMD_X86 */
+
+double vdw_rows_simd(const struct nbview *v, const struct nblist *nblst,
+		     int row0, int row1, double rc)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+		return vdw_rows_avx512(v, nblst, row0, row1, rc);
+	case MOL_SIMD_AVX2:
+		return vdw_rows_avx2(v, nblst, row0, row1, rc);
+#endif
+	default:
+		return vdw_rows_scalar(v, nblst, row0, row1, rc, 0);
+	}
+}
+
+double ele_rows_simd(const struct nbview *v, const struct nblist *nblst,
+		     int row0, int row1, double pf, double rc)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+		return ele_rows_avx512(v, nblst, row0, row1, pf, rc);
+	case MOL_SIMD_AVX2:
+		return ele_rows_avx2(v, nblst, row0, row1, pf, rc);
+#endif
+	default:
+		return ele_rows_scalar(v, nblst, row0, row1, pf, rc, 0);
+	}
+}
+
+double vdw03_simd(const struct nbview *v, int n03, const int *list03,
+		  double f, double rc)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+	case MOL_SIMD_AVX2:
+		return vdw03_avx2(v, n03, list03, f, rc);
+#endif
+	default:
+		return vdw03_scalar(v, 0, n03, list03, f, rc);
+	}
+}
+
+double vdw_rows_mixed(const struct nbviewf *v, const struct nblist *nblst,
+		      int row0, int row1, double rc)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+		return vdw_rows_mixed_avx512(v, nblst, row0, row1, rc);
+	case MOL_SIMD_AVX2:
+		return vdw_rows_mixed_avx2(v, nblst, row0, row1, rc);
+#endif
+	default:
+		return vdw_rows_mixed_scalar(v, nblst, row0, row1, rc, 0);
+	}
+}
+
+double ele_rows_mixed(const struct nbviewf *v, const struct nblist *nblst,
+		      int row0, int row1, double pf, double rc)
+{
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+		return ele_rows_mixed_avx512(v, nblst, row0, row1, pf, rc);
+	case MOL_SIMD_AVX2:
+		return ele_rows_mixed_avx2(v, nblst, row0, row1, pf, rc);
+#endif
+	default:
+		return ele_rows_mixed_scalar(v, nblst, row0, row1, pf, rc, 0);
+	}
+}
+
+/*
+	Runs row(i, ja, jb) over the static ranges of each moving atom i
+	of a leaf pair: j0..j1-1, or j0..jf-1 and max(jf, i + 1)..j1-1
+	when both leaves are the same.
+*/
+#define LEAF_ROWS(row_call)						\
+	for (i = i0; i < i1; i++) {					\
+		const unsigned long long *row =			\
+		    (excl != NULL) ? excl + (size_t) (i - i0) * nw : NULL;	\
+		double g1[3] = { 0.0, 0.0, 0.0 };			\
+		int ja = j0, jb = j1;					\
+		if (tri) {						\
+			jb = jf;					\
+			en += row_call;					\
+			ja = (i + 1 > jf) ? i + 1 : jf;			\
+			jb = j1;					\
+		}							\
+		en += row_call;						\
+		vm->gx[i] += g1[0];					\
+		vm->gy[i] += g1[1];					\
+		vm->gz[i] += g1[2];					\
+	}
+
+double vdw_leaf_simd(const struct nbview *vm, int i0, int i1,
+		     const struct nbview *vs, int j0, int jf, int j1,
+		     int tri, const unsigned long long *excl, int nw,
+		     double rc)
+{
+	int i;
+	double en = 0.0;
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+	case MOL_SIMD_AVX2:
+		LEAF_ROWS(vdw_leaf_row_avx2(vm, i, vs, ja, jb, j0, row, rc, g1));
+		break;
+#endif
+	default:
+		LEAF_ROWS(vdw_leaf_row_scalar
+			  (vm, i, vs, ja, jb, j0, row, rc * rc, g1));
+	}
+	return en;
+}
+
+double ele_leaf_simd(const struct nbview *vm, int i0, int i1,
+		     const struct nbview *vs, int j0, int jf, int j1,
+		     int tri, const unsigned long long *excl, int nw,
+		     double pf, double rc)
+{
+	int i;
+	double en = 0.0;
+	switch (mol_simd_level()) {
+#ifdef MOL_SIMD_X86
+	case MOL_SIMD_AVX512:
+	case MOL_SIMD_AVX2:
+		LEAF_ROWS(ele_leaf_row_avx2
+			  (vm, i, vs, ja, jb, j0, row, pf, rc, g1));
+		break;
+#endif
+	default:
+		LEAF_ROWS(ele_leaf_row_scalar
+			  (vm, i, vs, ja, jb, j0, row, pf, rc, g1));
+	}
+	return en;
+}
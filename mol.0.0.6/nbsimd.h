@@ -0,0 +1,191 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_NBSIMD_H_
+#define _MOL_NBSIMD_H_
+
+/** \file nbsimd.h
+	Vectorized pair loops for the switched Lennard-Jones and
+	distance dependent Coulomb terms of vdweng, vdwengs03 and
+	eleng. The instruction set is picked at run time (AVX-512F,
+	AVX2+FMA, or none); when none is available, or on non-x86
+	builds, the callers keep using their scalar loops.
+
+	The kernels read atom data through a strided view, so the
+	same code serves struct atom arrays (stride sizeof(struct atom))
+	and the packed arrays of soa.h (stride 1).
+
+	In MOL_NB_MIXED precision the vdweng, eleng and aceeng pair
+	terms are computed in single precision from a float copy of
+	the atom data, while energies and gradients are still summed
+	in double.
+*/
+
+enum mol_simd_level {
+	MOL_SIMD_NONE = 0,
+	MOL_SIMD_AVX2 = 1,
+	MOL_SIMD_AVX512 = 2
+};
+
+/**
+	Strided view of the per-atom fields used by the pair kernels.
+	Field k of atom i is at base[i * s] (coordinates, parameters)
+	or base[i * gs] (gradients); all strides are in doubles.
+*/
+struct nbview
+{
+	const double *x, *y, *z;
+	const double *eps, *rminh, *chrg;
+	int s;
+	double *gx, *gy, *gz;
+	int gs;
+};
+
+enum mol_nb_precision {
+	MOL_NB_DOUBLE = 0,	/**< all pair math in double */
+	MOL_NB_MIXED = 1	/**< float pair math, double accumulation */
+};
+
+/**
+	Precision of the nonbonded pair terms, MOL_NB_DOUBLE by default.
+	Like mol_simd_set_level(), mol_nb_set_precision() sets unlocked
+	process-wide state read by every kernel call: set both before
+	any threaded scoring starts, never while kernels are running.
+	hbondeng has no mixed mode and always runs in double.
+*/
+enum mol_nb_precision mol_nb_precision(void);
+void mol_nb_set_precision(enum mol_nb_precision prec);
+
+/** instruction set used by the kernels, detected on first call */
+enum mol_simd_level mol_simd_level(void);
+
+/**
+	Caps the instruction set at level (never above what the cpu
+	supports); a negative level restores detection.
+*/
+void mol_simd_set_level(int level);
+
+/** view over ag->atoms; with use03 eps03/rminh03 replace eps/rminh */
+void nbview_atoms(struct nbview *v, const struct atomgrp *ag, int use03);
+
+/** view over the packed arrays of init_agsoa */
+void nbview_soa(struct nbview *v, struct agsoa *soa);
+
+/**
+	Single precision view of the atoms, read with stride 1.
+	Gradients still go to the double fields at stride gs.
+*/
+struct nbviewf
+{
+	const float *x, *y, *z;
+	const float *eps, *rminh, *chrg;
+	double *gx, *gy, *gz;
+	int gs;
+};
+
+/**
+	Fills v with a float copy of X, Y, Z, eps, rminh and chrg of
+	ag->atoms, gradients pointing at GX, GY, GZ. Returns the block
+	holding the copy, to be released with free.
+*/
+float *nbviewf_atoms(struct nbviewf *v, const struct atomgrp *ag);
+
+/**
+	vdweng over rows row0..row1-1 of nblst, rc is the cutoff.
+	Gradients are accumulated through v, the energy is returned.
+*/
+double vdw_rows_simd(const struct nbview *v, const struct nblist *nblst,
+                     int row0, int row1, double rc);
+
+/**
+	eleng over rows row0..row1-1 of nblst, pf is CCELEC/eps.
+*/
+double ele_rows_simd(const struct nbview *v, const struct nblist *nblst,
+                     int row0, int row1, double pf, double rc);
+
+//! vdw_pair in single precision, rc2i is 1/rc^2.
+_mol_sinline float vdw_pairf(float eij, float rij, float d2, float rc2i,
+			     float *dven)
+{
+	float Rd6 = rij / d2, Rr6 = rij * rc2i, dr6 = d2 * rc2i, Rd12, Rr12;
+	Rd6 = Rd6 * Rd6 * Rd6;
+	Rd12 = Rd6 * Rd6;
+	Rr6 = Rr6 * Rr6 * Rr6;
+	Rr12 = Rr6 * Rr6;
+	dr6 = dr6 * dr6 * dr6;
+	*dven = -eij * 12.0f * (-Rd12 + Rd6 + dr6 * (Rr12 - Rr6)) / d2;
+	return eij * (Rd12 - 2.0f * Rd6 + Rr6 * (4.0f - 2.0f * dr6) +
+		      Rr12 * (2.0f * dr6 - 3.0f));
+}
+
+//! ele_pair in single precision, rci is 1/rc and rc2i 1/rc^2.
+_mol_sinline float ele_pairf(float ch, float d2, float rci, float rc2i,
+			     float *desh)
+{
+	float d1 = sqrtf(d2);
+	float id1 = 1.0f / d1;
+	float esh = 1.0f - d1 * rci;
+	*desh = ch * (id1 * id1 - rc2i) * id1;
+	return ch * esh * esh * id1;
+}
+
+/** vdw_rows_simd in mixed precision */
+double vdw_rows_mixed(const struct nbviewf *v, const struct nblist *nblst,
+                      int row0, int row1, double rc);
+
+/** ele_rows_simd in mixed precision */
+double ele_rows_mixed(const struct nbviewf *v, const struct nblist *nblst,
+                      int row0, int row1, double pf, double rc);
+
+/**
+	vdwengs03 over the n03 pairs of list03 (v built with use03).
+*/
+double vdw03_simd(const struct nbview *v, int n03, const int *list03,
+                  double f, double rc);
+
+/**
+	Leaf-pair block of the packed octree kernels: atoms i0..i1-1 of
+	vm against atoms j0..j1-1 of vs, both views with stride 1. With
+	tri set both leaves are the same one and atoms from jf on (the
+	nonfixed ones) are only paired with i when j > i. excl, if not
+	NULL, holds nw words per row i - i0; bit j - j0 of a row marks
+	an excluded pair, skipped when closer than sqrt(20) as in
+	vdweng_octree_single_mol. Gradients are accumulated through the
+	views, the energy is returned.
+*/
+double vdw_leaf_simd(const struct nbview *vm, int i0, int i1,
+                     const struct nbview *vs, int j0, int jf, int j1,
+                     int tri, const unsigned long long *excl, int nw,
+                     double rc);
+
+/** eleng counterpart of vdw_leaf_simd, pf is CCELEC/eps */
+double ele_leaf_simd(const struct nbview *vm, int i0, int i1,
+                     const struct nbview *vs, int j0, int jf, int j1,
+                     int tri, const unsigned long long *excl, int nw,
+                     double pf, double rc);
+
+#endif
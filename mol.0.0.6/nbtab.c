@@ -0,0 +1,401 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include _MOL_INCLUDE_
+
+//! Hermite coefficients of one interval.
+/*! f0, f1 are the energies and d0, d1 the derivatives over r^2 at the
+    ends of an interval of width h; the cubic is in t = (s - s_k) / h. */
+static void nbtab_interval(double *c, double f0, double f1, double d0,
+			   double d1, double h)
+{
+	d0 *= h;
+	d1 *= h;
+	c[0] = f0;
+	c[1] = d0;
+	c[2] = 3.0 * (f1 - f0) - 2.0 * d0 - d1;
+	c[3] = 2.0 * (f0 - f1) + d0 + d1;
+}
+
+//! Spline table of the switched LJ for eij, rij (squared rmin sum).
+static double *nbtab_vdw_table(const struct nbtab *tab, double eij,
+			       double rij)
+{
+	int k;
+	const double h = 1.0 / tab->dsi;
+	const double rc2 = tab->rc * tab->rc;
+	double f0, f1, d0, d1, dven;
+	double *c = _mol_malloc(4 * tab->npts * sizeof(double));
+
+	f0 = vdw_pair(eij, rij, tab->s0, rc2, &dven);
+	d0 = -0.5 * dven;
+	for (k = 0; k < tab->npts; k++) {
+		const double s1 = tab->s0 + (k + 1) * h;
+		f1 = vdw_pair(eij, rij, s1, rc2, &dven);
+		d1 = -0.5 * dven;
+		nbtab_interval(c + 4 * k, f0, f1, d0, d1, h);
+		f0 = f1;
+		d0 = d1;
+	}
+	return c;
+}
+
+//! Spline table of the shifted Coulomb shape, charge product 1.
+static double *nbtab_ele_table(const struct nbtab *tab)
+{
+	int k;
+	const double h = 1.0 / tab->dsi;
+	const double rc2i = 1.0 / (tab->rc * tab->rc);
+	double f0, f1, d0, d1, desh;
+	double *c = _mol_malloc(4 * tab->npts * sizeof(double));
+
+	f0 = ele_pair(1.0, tab->s0, tab->rc, rc2i, &desh);
+	d0 = -0.5 * desh;
+	for (k = 0; k < tab->npts; k++) {
+		const double s1 = tab->s0 + (k + 1) * h;
+		f1 = ele_pair(1.0, s1, tab->rc, rc2i, &desh);
+		d1 = -0.5 * desh;
+		nbtab_interval(c + 4 * k, f0, f1, d0, d1, h);
+		f0 = f1;
+		d0 = d1;
+	}
+	return c;
+}
+
+struct nbtab *nbtab_create(const struct atomgrp *ag, double rc, int terms,
+			   int npts)
+{
+	int i, j, t, *rep;
+	struct nbtab *tab;
+
+	if (npts < 1 || rc * rc <= NBTAB_S0) {
+		print_error("nbtab_create: need npts > 0 and rc^2 > %g, "
+			    "got npts %d rc %g\n", NBTAB_S0, npts, rc);
+		return NULL;
+	}
+	tab = _mol_calloc(1, sizeof(struct nbtab));
+	tab->terms = terms;
+	tab->npts = npts;
+	tab->rc = rc;
+	tab->s0 = NBTAB_S0;
+	tab->dsi = npts / (rc * rc - NBTAB_S0);
+	tab->nftypes = 1;
+	for (i = 0; i < ag->natoms; i++)
+		if (ag->atoms[i].atom_ftypen >= tab->nftypes)
+			tab->nftypes = ag->atoms[i].atom_ftypen + 1;
+	tab->itype = _mol_malloc(tab->nftypes * sizeof(int));
+	for (i = 0; i < tab->nftypes; i++)
+		tab->itype[i] = -1;
+
+/* number the atom types in use, rep[t] is an atom of table type t. */
+	rep = _mol_malloc(tab->nftypes * sizeof(int));
+	for (i = 0; i < ag->natoms; i++) {
+		const struct atom *a = &(ag->atoms[i]);
+		t = tab->itype[a->atom_ftypen];
+		if (t < 0) {
+			t = tab->ntypes++;
+			tab->itype[a->atom_ftypen] = t;
+			rep[t] = i;
+		} else if ((terms & NBTAB_VDW)
+			   && (a->eps != ag->atoms[rep[t]].eps
+			       || a->rminh != ag->atoms[rep[t]].rminh)) {
+			print_error("nbtab_create: atoms %d and %d of type %d "
+				    "differ in eps or rminh\n", rep[t], i,
+				    a->atom_ftypen);
+			free(rep);
+			free_nbtab(tab);
+			return NULL;
+		}
+	}
+
+	if (terms & NBTAB_VDW) {
+		tab->vdw =
+		    _mol_calloc(tab->ntypes * tab->ntypes, sizeof(double *));
+		for (i = 0; i < tab->ntypes; i++) {
+			const struct atom *ai = &(ag->atoms[rep[i]]);
+			for (j = i; j < tab->ntypes; j++) {
+				const struct atom *aj = &(ag->atoms[rep[j]]);
+				double rij = ai->rminh + aj->rminh;
+				tab->vdw[i * tab->ntypes + j] =
+				    nbtab_vdw_table(tab, ai->eps * aj->eps,
+						    rij * rij);
+				tab->vdw[j * tab->ntypes + i] =
+				    tab->vdw[i * tab->ntypes + j];
+			}
+		}
+	}
+	if (terms & NBTAB_ELE)
+		tab->ele = nbtab_ele_table(tab);
+	free(rep);
+	return tab;
+}
+
+void destroy_nbtab(struct nbtab *tab)
+{
+	int i, j;
+	if (tab->vdw != NULL) {
+		for (i = 0; i < tab->ntypes; i++)
+			for (j = i; j < tab->ntypes; j++)
+				free(tab->vdw[i * tab->ntypes + j]);
+		free(tab->vdw);
+	}
+	free(tab->ele);
+	free(tab->itype);
+}
+
+void free_nbtab(struct nbtab *tab)
+{
+	destroy_nbtab(tab);
+	free(tab);
+}
+
+//! Value and derivative over r^2 (times -2, as dven) of a table at s.
+/*! u is (s - s0) * dsi, the position of s in knot spacings. */
+_mol_sinline double nbtab_eval(const double *c, int npts, double dsi,
+			       double u, double *dven)
+{
+	int k = (int)u;
+	double t;
+	if (k >= npts)
+		k = npts - 1;
+	t = u - k;
+	c += 4 * k;
+	*dven = -2.0 * dsi * (c[1] + t * (2.0 * c[2] + 3.0 * t * c[3]));
+	return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+}
+
+//! vdweng_tab over rows row0..row1-1, gradients through v.
+static double vdw_tab_rows(const struct atomgrp *ag, const struct nbview *v,
+			   const struct nblist *nblst, int row0, int row1,
+			   const struct nbtab *tab)
+{
+	int i, j, i1, i2, n2;
+	const int *p;
+	const int s = v->s, gs = v->gs;
+	const double *x = v->x, *y = v->y, *z = v->z;
+	double *gx = v->gx, *gy = v->gy, *gz = v->gz;
+	const mol_atom *atoms = ag->atoms;
+	const int *itype = tab->itype;
+	const double rc2 = nblst->nbcof * nblst->nbcof;
+	const double s0 = tab->s0, dsi = tab->dsi;
+	const int nt = tab->ntypes, npts = tab->npts;
+	double x1, y1, z1, dx, dy, dz, d2, dven, g, rij, en = 0.0;
+	double gx1, gy1, gz1;
+	const double *const *row;
+
+	for (i = row0; i < row1; i++) {
+		i1 = nblst->ifat[i];
+		row = (const double *const *)tab->vdw +
+		    nt * itype[atoms[i1].atom_ftypen];
+		x1 = x[i1 * s];
+		y1 = y[i1 * s];
+		z1 = z[i1 * s];
+		gx1 = gy1 = gz1 = 0.0;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		for (j = 0; j < n2; j++) {
+			i2 = p[j];
+			dx = x1 - x[i2 * s];
+			dy = y1 - y[i2 * s];
+			dz = z1 - z[i2 * s];
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 >= rc2)
+				continue;
+			if (d2 >= s0) {
+				en += nbtab_eval(row[itype[atoms[i2].atom_ftypen]],
+						 npts, dsi, (d2 - s0) * dsi,
+						 &dven);
+			} else {
+				rij = v->rminh[i1 * s] + v->rminh[i2 * s];
+				en += vdw_pair(v->eps[i1 * s] * v->eps[i2 * s],
+					       rij * rij, d2, rc2, &dven);
+			}
+			g = dven * dx;
+			gx1 += g;
+			gx[i2 * gs] -= g;
+			g = dven * dy;
+			gy1 += g;
+			gy[i2 * gs] -= g;
+			g = dven * dz;
+			gz1 += g;
+			gz[i2 * gs] -= g;
+		}
+		gx[i1 * gs] += gx1;
+		gy[i1 * gs] += gy1;
+		gz[i1 * gs] += gz1;
+	}
+	return en;
+}
+
+//! eleng_tab over rows row0..row1-1, gradients through v.
+static double ele_tab_rows(const struct nbview *v, const struct nblist *nblst,
+			   int row0, int row1, const struct nbtab *tab,
+			   double pf)
+{
+	int i, j, i1, i2, n2;
+	const int *p;
+	const int s = v->s, gs = v->gs;
+	const double *x = v->x, *y = v->y, *z = v->z, *chrg = v->chrg;
+	double *gx = v->gx, *gy = v->gy, *gz = v->gz;
+	const double rc = nblst->nbcof;
+	const double rc2 = rc * rc, rc2i = 1.0 / rc2;
+	const double s0 = tab->s0, dsi = tab->dsi;
+	const int npts = tab->npts;
+	double x1, y1, z1, dx, dy, dz, d2, desh, g, ch1, ch, en = 0.0;
+	double gx1, gy1, gz1;
+
+	for (i = row0; i < row1; i++) {
+		i1 = nblst->ifat[i];
+		ch1 = pf * chrg[i1 * s];
+		x1 = x[i1 * s];
+		y1 = y[i1 * s];
+		z1 = z[i1 * s];
+		gx1 = gy1 = gz1 = 0.0;
+		n2 = nblst->nsat[i];
+		p = nblst->isat[i];
+		for (j = 0; j < n2; j++) {
+			i2 = p[j];
+			dx = x1 - x[i2 * s];
+			dy = y1 - y[i2 * s];
+			dz = z1 - z[i2 * s];
+			d2 = dx * dx + dy * dy + dz * dz;
+			if (d2 >= rc2)
+				continue;
+			ch = ch1 * chrg[i2 * s];
+			if (d2 >= s0) {
+				en += ch * nbtab_eval(tab->ele, npts, dsi,
+						      (d2 - s0) * dsi, &desh);
+				desh *= ch;
+			} else {
+				en += ele_pair(ch, d2, rc, rc2i, &desh);
+			}
+			g = desh * dx;
+			gx1 += g;
+			gx[i2 * gs] -= g;
+			g = desh * dy;
+			gy1 += g;
+			gy[i2 * gs] -= g;
+			g = desh * dz;
+			gz1 += g;
+			gz[i2 * gs] -= g;
+		}
+		gx[i1 * gs] += gx1;
+		gy[i1 * gs] += gy1;
+		gz[i1 * gs] += gz1;
+	}
+	return en;
+}
+
+//! Rows row0..row1-1 of term (NBTAB_VDW or NBTAB_ELE), pf as in eleng_tab.
+static double nbtab_rows(const struct atomgrp *ag, const struct nbview *v,
+			 const struct nblist *nblst, int row0, int row1,
+			 const struct nbtab *tab, int term, double pf)
+{
+	if (term == NBTAB_ELE)
+		return ele_tab_rows(v, nblst, row0, row1, tab, pf);
+	return vdw_tab_rows(ag, v, nblst, row0, row1, tab);
+}
+
+#ifdef _OPENMP
+//! Threaded nbtab_rows, rows dealt out as in vdweng_omp.
+static void nbtab_omp(const struct atomgrp *ag, double *en_out,
+		      const struct nblist *nblst, const struct nbtab *tab,
+		      int term, double pf, int nthreads)
+{
+	const int natoms = ag->natoms;
+	double *tg = mol_thread_grads_alloc(nthreads, natoms);
+	double *ten = _mol_calloc(nthreads, sizeof(double));
+
+#pragma omp parallel num_threads(nthreads)
+	{
+		const int tid = omp_get_thread_num();
+		double *g = tg + (size_t) tid * 3 * natoms;
+		double en = 0.0;
+		int i;
+		struct nbview v;
+		nbview_atoms(&v, ag, 0);
+		v.gx = g;
+		v.gy = g + 1;
+		v.gz = g + 2;
+		v.gs = 3;
+
+#pragma omp for schedule(static, 16)
+		for (i = 0; i < nblst->nfat; i++)
+			en += nbtab_rows(ag, &v, nblst, i, i + 1, tab, term,
+					 pf);
+		ten[tid] = en;
+	}
+	mol_thread_grads_reduce(ag->atoms, natoms, nthreads, tg);
+	(*en_out) += mol_thread_sum(nthreads, ten);
+	free(ten);
+	free(tg);
+}
+#endif
+
+//! Table path of term for vdweng_tab and eleng_tab.
+static void nbtab_eng(const struct atomgrp *ag, double *en,
+		      const struct nblist *nblst, const struct nbtab *tab,
+		      int term, double pf)
+{
+	struct nbview v;
+
+#ifdef _OPENMP
+	if (nblst->npairs >= MOL_PARALLEL_MIN_PAIRS && mol_num_threads() > 1) {
+		nbtab_omp(ag, en, nblst, tab, term, pf, mol_num_threads());
+		return;
+	}
+#endif
+	nbview_atoms(&v, ag, 0);
+	(*en) += nbtab_rows(ag, &v, nblst, 0, nblst->nfat, tab, term, pf);
+}
+
+void vdweng_tab(const struct atomgrp *ag, double *ven,
+		const struct nblist *nblst, const struct nbtab *tab)
+{
+	if (tab->vdw == NULL || tab->rc != nblst->nbcof) {
+		vdweng(ag, ven, nblst);
+		return;
+	}
+	nbtab_eng(ag, ven, nblst, tab, NBTAB_VDW, 0.0);
+}
+
+void eleng_tab(struct atomgrp *ag, double eps, double *een,
+	       struct nblist *nblst, const struct nbtab *tab)
+{
+	if (tab->ele == NULL || tab->rc != nblst->nbcof) {
+		eleng(ag, eps, een, nblst);
+		return;
+	}
+	nbtab_eng(ag, een, nblst, tab, NBTAB_ELE, CCELEC / eps);
+}
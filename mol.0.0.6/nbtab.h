@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_NBTAB_H_
+#define _MOL_NBTAB_H_
+
+/** \file nbtab.h
+	Tabulated pair potentials for vdweng and eleng.
+
+	At setup the switched Lennard-Jones energy of every pair of
+	atom types and the shifted distance dependent Coulomb shape
+	are sampled on a uniform grid in r^2 and stored as cubic
+	Hermite splines (energy and derivative at every knot), so a
+	pair costs one table lookup and a cubic in place of the
+	powers and divisions of the analytic kernels.
+
+	Tables cover r^2 from NBTAB_S0 to the cutoff squared, closer
+	pairs fall back to the analytic formulas.
+
+	Each term is tabulated only when its bit is passed to
+	nbtab_create. Calling vdweng_tab or eleng_tab with a table
+	holding the term selects the table path, whatever
+	mol_simd_level() and mol_nb_precision() say; the tables are
+	always evaluated in double on the scalar pair loop.
+*/
+
+/** terms to tabulate, bits of nbtab_create's terms */
+#define NBTAB_VDW 1
+#define NBTAB_ELE 2
+
+/** default number of spline intervals per table */
+#define NBTAB_DEFAULT_NPTS 2048
+/** lower end of the tables in A^2 */
+#define NBTAB_S0 1.0
+
+struct nbtab
+{
+	int terms; /**< NBTAB_VDW and/or NBTAB_ELE */
+	int npts; /**< spline intervals per table */
+	double rc; /**< cutoff the tables were built for */
+	double s0; /**< r^2 of the first knot */
+	double dsi; /**< inverse of the knot spacing in r^2 */
+	int nftypes; /**< length of itype */
+	int *itype; /**< table type of each atom_ftypen, -1 if unused */
+	int ntypes; /**< number of table types */
+	double **vdw; /**< ntypes*ntypes tables of 4*npts spline coefficients, symmetric pairs share one */
+	double *ele; /**< 4*npts coefficients of the Coulomb shape, without charges */
+};
+
+/**
+	Builds the tables selected by terms for the atom types of ag
+	and cutoff rc, with npts intervals per table. For NBTAB_VDW atoms
+	of the same atom_ftypen must share eps and rminh; npts must be
+	positive and
+	rc^2 above NBTAB_S0; otherwise returns NULL with an error
+	printed.
+*/
+struct nbtab *nbtab_create(const struct atomgrp *ag, double rc, int terms,
+                           int npts);
+void destroy_nbtab(struct nbtab *tab);
+void free_nbtab(struct nbtab *tab);
+
+/**
+	vdweng through tab, threaded like vdweng. Calls vdweng when tab
+	has no vdW tables or was built for another cutoff.
+*/
+void vdweng_tab(const struct atomgrp *ag, double *ven,
+                const struct nblist *nblst, const struct nbtab *tab);
+
+/**
+	eleng through tab, same threading and fallback (to eleng) as
+	vdweng_tab.
+*/
+void eleng_tab(struct atomgrp *ag, double eps, double *een,
+               struct nblist *nblst, const struct nbtab *tab);
+
+#endif
@@ -31,6 +31,9 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifdef _WIN32
 #define inline
@@ -623,6 +626,7 @@ int build_octree_excluding_fixed_atoms(OCTREE * octree, int max_leaf_size,
 	octree->max_leaf_size = max_leaf_size;
 	octree->max_leaf_dim = max_leaf_dim;
 	octree->atoms = ag->atoms;
+	octree->natoms = ag->natoms;
 
 	init_free_node_server(octree);
 
@@ -1445,28 +1449,22 @@ void destroy_octree(OCTREE * octree)
 }
 
 /**
-   This function returns the sum of the pairwise interaction values between the atoms stored in 
-   the two octrees octpar->octree_static and octpar->octree_moving using the distance cutoff
-   values and other parameters stored in *octpar.
+   Returns 1 if no atom pair of 'static_node' and 'moving_node' can lie within the
+   distance cutoff stored in *octpar, i.e., the node pair can be skipped.
 */
-double accumulate_excluding_far(OCTREE_PARAMS * octpar)
+static int far_node_pair(OCTREE_PARAMS * octpar,
+			 OCTREE_NODE * static_node,
+			 OCTREE_NODE * moving_node)
 {
-	OCTREE_NODE *static_node =
-	    &(octpar->octree_static->nodes[octpar->node_static]);
-	OCTREE_NODE *moving_node =
-	    &(octpar->octree_moving->nodes[octpar->node_moving]);
-	double energy;
-	int i, j;
-
 	if (moving_node->nfixed == moving_node->n)
-		return 0;
+		return 1;
 
 	if (octpar->trans == NULL) {
 		if (!within_distance_cutoff
 		    (static_node->lx, static_node->ly, static_node->lz,
 		     static_node->dim, moving_node->lx, moving_node->ly,
 		     moving_node->lz, moving_node->dim, octpar->approx_cutoff))
-			return 0;
+			return 1;
 	} else {
 		double sumRad =
 		    HALF_SQRT_THREE * (static_node->dim + moving_node->dim);
@@ -1493,9 +1491,29 @@ double accumulate_excluding_far(OCTREE_PARAMS * octpar)
 		d2 = dx * dx + dy * dy + dz * dz;
 
 		if (d2 >= maxD2)
-			return 0;
+			return 1;
 	}
 
+	return 0;
+}
+
+/**
+   This function returns the sum of the pairwise interaction values between the atoms stored in 
+   the two octrees octpar->octree_static and octpar->octree_moving using the distance cutoff
+   values and other parameters stored in *octpar.
+*/
+double accumulate_excluding_far(OCTREE_PARAMS * octpar)
+{
+	OCTREE_NODE *static_node =
+	    &(octpar->octree_static->nodes[octpar->node_static]);
+	OCTREE_NODE *moving_node =
+	    &(octpar->octree_moving->nodes[octpar->node_moving]);
+	double energy;
+	int i, j;
+
+	if (far_node_pair(octpar, static_node, moving_node))
+		return 0;
+
 	energy = 0;
 
 	if (static_node->leaf) {
@@ -1576,3 +1594,706 @@ double octree_accumulation_excluding_far(OCTREE * octree_static,
 
 	return accumulate_excluding_far(&octpar);
 }
+
+/**
+   Collects into *pairs the node pairs of the subtrees rooted at octpar->node_static and
+   octpar->node_moving that are not culled and hold at most OCTREE_PARALLEL_GRAIN atom
+   pairs (or are both leaves). Evaluating each collected pair with accumulate_excluding_far()
+   and summing gives the same value as evaluating the two roots.
+*/
+static void collect_node_pairs(OCTREE_PARAMS * octpar, int **pairs,
+			       int *npairs, int *pairs_cap)
+{
+	int ns = octpar->node_static, nm = octpar->node_moving;
+	OCTREE_NODE *static_node = &(octpar->octree_static->nodes[ns]);
+	OCTREE_NODE *moving_node = &(octpar->octree_moving->nodes[nm]);
+	int i, j;
+
+	if (far_node_pair(octpar, static_node, moving_node))
+		return;
+
+	if ((static_node->leaf && moving_node->leaf)
+	    || (double)static_node->n * (moving_node->n - moving_node->nfixed)
+	    <= OCTREE_PARALLEL_GRAIN) {
+		if (*npairs == *pairs_cap) {
+			*pairs_cap = (*pairs_cap > 0) ? 2 * *pairs_cap : 256;
+			*pairs =
+			    (int *)_mol_realloc(*pairs,
+						2 * *pairs_cap * sizeof(int));
+		}
+		(*pairs)[2 * *npairs] = ns;
+		(*pairs)[2 * *npairs + 1] = nm;
+		(*npairs)++;
+		return;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (!static_node->leaf) {
+			if (static_node->c_ptr[i] < 0)
+				continue;
+			ns = static_node->c_ptr[i];
+		} else if (i > 0)
+			break;
+		for (j = 0; j < 8; j++) {
+			if (!moving_node->leaf) {
+				if (moving_node->c_ptr[j] < 0)
+					continue;
+				nm = moving_node->c_ptr[j];
+			} else if (j > 0)
+				break;
+			octpar->node_static = ns;
+			octpar->node_moving = nm;
+			collect_node_pairs(octpar, pairs, npairs, pairs_cap);
+		}
+	}
+}
+
+/**
+   Copies atom 'a' of 'src' into 'dst' with its gradient set to zero unless mark[ a ] already
+   equals 'stamp', and sets it.
+*/
+static void copy_marked_atom(mol_atom * dst, const mol_atom * src, int a,
+			     int *mark, int stamp)
+{
+	if (mark[a] == stamp)
+		return;
+	mark[a] = stamp;
+	dst[a] = src[a];
+	dst[a].GX = dst[a].GY = dst[a].GZ = 0;
+}
+
+/**
+   Copies into 'dst' the atoms of 'octree' under the node 'node_id' as copy_marked_atom()
+   does, with the hydrogen bond base atoms they refer to, which hbondeng_octree_single_mol()
+   reads and moves as well.
+*/
+static void copy_subtree_atoms(mol_atom * dst, const OCTREE * octree,
+			       int node_id, int *mark, int stamp)
+{
+	const OCTREE_NODE *node = &(octree->nodes[node_id]);
+	const mol_atom *src = octree->atoms;
+	int i;
+
+	if (!node->leaf) {
+		for (i = 0; i < 8; i++)
+			if (node->c_ptr[i] >= 0)
+				copy_subtree_atoms(dst, octree, node->c_ptr[i],
+						   mark, stamp);
+		return;
+	}
+
+	for (i = 0; i < node->n; i++) {
+		int a = node->indices[i];
+		int b = src[a].base, b2 = src[a].base2;
+
+		copy_marked_atom(dst, src, a, mark, stamp);
+		if (b >= 0 && b < octree->natoms)
+			copy_marked_atom(dst, src, b, mark, stamp);
+		if (b2 >= 0 && b2 < octree->natoms)
+			copy_marked_atom(dst, src, b2, mark, stamp);
+	}
+}
+
+/**
+   Moves the gradients of the atoms of 'src' marked with 'stamp' into the 3 * natoms block 'tg',
+   whose other entries are left at zero.
+*/
+static void store_marked_grads(double *tg, const mol_atom * src, int natoms,
+			       const int *mark, int stamp)
+{
+	int i;
+
+	for (i = 0; i < natoms; i++) {
+		if (mark[i] != stamp)
+			continue;
+		tg[3 * i] = src[i].GX;
+		tg[3 * i + 1] = src[i].GY;
+		tg[3 * i + 2] = src[i].GZ;
+	}
+}
+
+/**
+   Threaded version of octree_accumulation_excluding_far() with the same parameters and result.
+   The dual-tree recursion is unrolled down to node pairs holding at most OCTREE_PARALLEL_GRAIN
+   atom pairs, which are split into mol_num_threads() consecutive chunks evaluated in parallel.
+   Each chunk works on a private copy of the atoms under its node pairs only and keeps its own
+   gradient block; the blocks are folded back into the atoms in chunk order and the energies
+   summed in node pair order, so for a given thread count the result is the same on every run.
+   'proc_func_params' is shared between the threads and must not be written to by
+   'processing_function' (e.g., pass a NULL engcat to hbondeng_octree_single_mol()), which may
+   only touch the atoms of its two nodes and their hydrogen bond base atoms.
+   Falls back to octree_accumulation_excluding_far() when only one thread is available.
+*/
+double octree_accumulation_excluding_far_parallel(OCTREE * octree_static,
+						  OCTREE * octree_moving,
+						  double dist_cutoff,
+						  double approx_cutoff,
+						  int fixed_cull, double *trans,
+						  void *proc_func_params,
+						  void (*processing_function)
+						  (OCTREE_PARAMS *, double *))
+{
+	OCTREE_PARAMS octpar;
+	int nchunks = mol_num_threads();
+	int shared_atoms = (octree_static->atoms == octree_moving->atoms);
+	int *pairs = NULL, npairs = 0, pairs_cap = 0;
+	double *pair_en, *sgrads, *mgrads = NULL;
+	double energy = 0;
+	int c, k;
+
+	if (nchunks < 2)
+		return octree_accumulation_excluding_far(octree_static,
+							 octree_moving,
+							 dist_cutoff,
+							 approx_cutoff,
+							 fixed_cull, trans,
+							 proc_func_params,
+							 processing_function);
+
+	octpar.octree_static = octree_static;
+	octpar.node_static = 0;
+
+	octpar.octree_moving = octree_moving;
+	octpar.node_moving = 0;
+
+	octpar.dist_cutoff = dist_cutoff;
+	octpar.approx_cutoff = approx_cutoff;
+	octpar.fixed_cull = fixed_cull;
+	octpar.trans = trans;
+	octpar.proc_func_params = proc_func_params;
+	octpar.processing_function = processing_function;
+
+	collect_node_pairs(&octpar, &pairs, &npairs, &pairs_cap);
+	if (npairs < 2 * nchunks) {
+		freeMem(pairs);
+		octpar.node_static = 0;
+		octpar.node_moving = 0;
+		return accumulate_excluding_far(&octpar);
+	}
+
+	pair_en = (double *)_mol_malloc(npairs * sizeof(double));
+	sgrads = mol_thread_grads_alloc(nchunks, octree_static->natoms);
+	if (!shared_atoms)
+		mgrads = mol_thread_grads_alloc(nchunks, octree_moving->natoms);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nchunks) private(c)
+#endif
+	{
+		OCTREE stree = *octree_static, mtree = *octree_moving;
+		OCTREE_PARAMS tpar = octpar;
+		int *smark, *mmark;
+		int p;
+
+		stree.atoms =
+		    (mol_atom *) _mol_malloc(stree.natoms * sizeof(mol_atom));
+		smark = (int *)_mol_malloc(stree.natoms * sizeof(int));
+		for (p = 0; p < stree.natoms; p++)
+			smark[p] = -1;
+		if (shared_atoms) {
+			mtree.atoms = stree.atoms;
+			mmark = smark;
+		} else {
+			mtree.atoms =
+			    (mol_atom *) _mol_malloc(mtree.natoms *
+						     sizeof(mol_atom));
+			mmark = (int *)_mol_malloc(mtree.natoms * sizeof(int));
+			for (p = 0; p < mtree.natoms; p++)
+				mmark[p] = -1;
+		}
+		tpar.octree_static = &stree;
+		tpar.octree_moving = &mtree;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static, 1)
+#endif
+		for (c = 0; c < nchunks; c++) {
+			int p0 = (int)((long)npairs * c / nchunks);
+			int p1 = (int)((long)npairs * (c + 1) / nchunks);
+
+			for (p = p0; p < p1; p++) {
+				copy_subtree_atoms(stree.atoms, octree_static,
+						   pairs[2 * p], smark, c);
+				copy_subtree_atoms(mtree.atoms, octree_moving,
+						   pairs[2 * p + 1], mmark, c);
+			}
+			for (p = p0; p < p1; p++) {
+				tpar.node_static = pairs[2 * p];
+				tpar.node_moving = pairs[2 * p + 1];
+				pair_en[p] = accumulate_excluding_far(&tpar);
+			}
+			store_marked_grads(sgrads +
+					   3 * (size_t) c * stree.natoms,
+					   stree.atoms, stree.natoms, smark, c);
+			if (!shared_atoms)
+				store_marked_grads(mgrads +
+						   3 * (size_t) c *
+						   mtree.natoms, mtree.atoms,
+						   mtree.natoms, mmark, c);
+		}
+
+		if (!shared_atoms) {
+			freeMem(mtree.atoms);
+			freeMem(mmark);
+		}
+		freeMem(stree.atoms);
+		freeMem(smark);
+	}
+
+	mol_thread_grads_reduce(octree_static->atoms, octree_static->natoms,
+				nchunks, sgrads);
+	if (!shared_atoms)
+		mol_thread_grads_reduce(octree_moving->atoms,
+					octree_moving->natoms, nchunks,
+					mgrads);
+
+	for (k = 0; k < npairs; k++)
+		energy += pair_en[k];
+
+	freeMem(pairs);
+	freeMem(pair_en);
+	freeMem(sgrads);
+	freeMem(mgrads);
+
+	return energy;
+}
+
+/**
+   Recursively places the nodes of the subtree of 'src' rooted at 'node_id' into 'dst'
+   as seen after applying the 3 x 4 transformation matrix 'trans'. Each node becomes the
+   smallest axis-aligned cube containing its transformed cube; 'ext' is the largest row sum
+   of absolute values of the rotational part of 'trans'.
+*/
+static void transform_octree_nodes(int node_id, const OCTREE * src, OCTREE * dst,
+				   double *trans, double ext)
+{
+	const OCTREE_NODE *snode = &(src->nodes[node_id]);
+	OCTREE_NODE *dnode = &(dst->nodes[node_id]);
+	double half_dim = 0.5 * snode->dim;
+	double cx, cy, cz;
+	int i;
+
+	transform_point(snode->lx + half_dim, snode->ly + half_dim,
+			snode->lz + half_dim, trans, &cx, &cy, &cz);
+
+	half_dim *= ext;
+	dnode->lx = cx - half_dim;
+	dnode->ly = cy - half_dim;
+	dnode->lz = cz - half_dim;
+	dnode->dim = 2 * half_dim;
+
+	if (!snode->leaf)
+		for (i = 0; i < 8; i++)
+			if (snode->c_ptr[i] >= 0)
+				transform_octree_nodes(snode->c_ptr[i], src,
+						       dst, trans, ext);
+}
+
+/**
+   Batched version of octree_accumulation_excluding_far() for rigid-body scoring of
+   'ntrans' poses of the molecule stored in 'octree_moving'. 'trans' holds 'ntrans'
+   consecutive 3 x 4 transformation matrices, and energies[ k ] receives the sum of
+   the pairwise interaction values for the k-th matrix, matching a call of
+   octree_accumulation_excluding_far() with that matrix up to rounding.
+
+   For each pose the moving atoms and the moving octree node boxes are transformed
+   once into a private copy, so leaf-leaf kernels run on pretransformed coordinates
+   instead of transforming every moving atom for every static leaf it meets. Poses
+   are distributed over mol_num_threads() threads. Gradients written by
+   'processing_function' go to private atom copies and are discarded, so the atoms
+   of both octrees are left untouched; 'proc_func_params' is shared between threads
+   and must not be written to (e.g., its engcat should be NULL).
+*/
+void octree_accumulation_excluding_far_batch(OCTREE * octree_static,
+					     OCTREE * octree_moving,
+					     double dist_cutoff, int fixed_cull,
+					     int ntrans, double *trans,
+					     void *proc_func_params,
+					     void (*processing_function)
+					     (OCTREE_PARAMS *, double *),
+					     double *energies)
+{
+#ifdef _OPENMP
+#pragma omp parallel num_threads(mol_num_threads())
+#endif
+	{
+		OCTREE stree = *octree_static, mtree = *octree_moving;
+		OCTREE_PARAMS octpar;
+		int i, k;
+
+		stree.atoms =
+		    (mol_atom *) _mol_malloc(stree.natoms * sizeof(mol_atom));
+		for (i = 0; i < stree.natoms; i++)
+			stree.atoms[i] = octree_static->atoms[i];
+		mtree.atoms =
+		    (mol_atom *) _mol_malloc(mtree.natoms * sizeof(mol_atom));
+		for (i = 0; i < mtree.natoms; i++)
+			mtree.atoms[i] = octree_moving->atoms[i];
+		mtree.nodes =
+		    (OCTREE_NODE *) _mol_malloc(mtree.num_nodes *
+						sizeof(OCTREE_NODE));
+		for (i = 0; i < mtree.num_nodes; i++)
+			mtree.nodes[i] = octree_moving->nodes[i];
+
+		octpar.octree_static = &stree;
+		octpar.octree_moving = &mtree;
+		octpar.dist_cutoff = dist_cutoff;
+		octpar.approx_cutoff = dist_cutoff;
+		octpar.fixed_cull = fixed_cull;
+		octpar.trans = NULL;
+		octpar.proc_func_params = proc_func_params;
+		octpar.processing_function = processing_function;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+		for (k = 0; k < ntrans; k++) {
+			double *t = trans + 12 * k;
+			double ext = 0;
+
+			for (i = 0; i < 3; i++)
+				ext = octree_max(ext, fabs(t[4 * i])
+						 + fabs(t[4 * i + 1])
+						 + fabs(t[4 * i + 2]));
+
+			for (i = 0; i < mtree.natoms; i++) {
+				mol_atom *a = &(octree_moving->atoms[i]);
+
+				transform_point(a->X, a->Y, a->Z, t,
+						&(mtree.atoms[i].X),
+						&(mtree.atoms[i].Y),
+						&(mtree.atoms[i].Z));
+			}
+			transform_octree_nodes(0, octree_moving, &mtree, t, ext);
+
+			octpar.node_static = 0;
+			octpar.node_moving = 0;
+			energies[k] = accumulate_excluding_far(&octpar);
+		}
+
+		freeMem(stree.atoms);
+		freeMem(mtree.atoms);
+		freeMem(mtree.nodes);
+	}
+}
+
+/**
+   Adds to 'mp' a charge 'q' displaced by < dx, dy, dz > from the expansion center.
+*/
+static void multipole_add_charge(OCTREE_MULTIPOLE * mp, double q, double dx,
+				 double dy, double dz)
+{
+	double d2 = dx * dx + dy * dy + dz * dz;
+
+	mp->q += q;
+
+	mp->px += q * dx;
+	mp->py += q * dy;
+	mp->pz += q * dz;
+
+	mp->qxx += 0.5 * q * (3 * dx * dx - d2);
+	mp->qyy += 0.5 * q * (3 * dy * dy - d2);
+	mp->qzz += 0.5 * q * (3 * dz * dz - d2);
+	mp->qxy += 1.5 * q * dx * dy;
+	mp->qxz += 1.5 * q * dx * dz;
+	mp->qyz += 1.5 * q * dy * dz;
+}
+
+/**
+   Adds to 'mp' the expansion 'cmp' moved from its center to the center of 'mp',
+   < sx, sy, sz > being the position of the old center relative to the new one.
+*/
+static void multipole_add_shifted(OCTREE_MULTIPOLE * mp,
+				  const OCTREE_MULTIPOLE * cmp, double sx,
+				  double sy, double sz)
+{
+	double q = cmp->q;
+	double ps = cmp->px * sx + cmp->py * sy + cmp->pz * sz;
+	double s2 = sx * sx + sy * sy + sz * sz;
+
+	mp->q += q;
+
+	mp->px += cmp->px + q * sx;
+	mp->py += cmp->py + q * sy;
+	mp->pz += cmp->pz + q * sz;
+
+	mp->qxx += cmp->qxx + 3 * cmp->px * sx - ps + 0.5 * q * (3 * sx * sx - s2);
+	mp->qyy += cmp->qyy + 3 * cmp->py * sy - ps + 0.5 * q * (3 * sy * sy - s2);
+	mp->qzz += cmp->qzz + 3 * cmp->pz * sz - ps + 0.5 * q * (3 * sz * sz - s2);
+	mp->qxy += cmp->qxy + 1.5 * (cmp->px * sy + cmp->py * sx) + 1.5 * q * sx * sy;
+	mp->qxz += cmp->qxz + 1.5 * (cmp->px * sz + cmp->pz * sx) + 1.5 * q * sx * sz;
+	mp->qyz += cmp->qyz + 1.5 * (cmp->py * sz + cmp->pz * sy) + 1.5 * q * sy * sz;
+}
+
+/**
+   Computes the expansions of the subtree of 'octree' rooted at 'node_id' bottom-up.
+*/
+static void compute_node_multipoles(int node_id, OCTREE * octree,
+				    OCTREE_MULTIPOLE * mp)
+{
+	OCTREE_NODE *node = &(octree->nodes[node_id]);
+	OCTREE_MULTIPOLE *m = &(mp[2 * node_id]);
+	double h = 0.5 * node->dim;
+	double cx = node->lx + h, cy = node->ly + h, cz = node->lz + h;
+	int i, k;
+
+	for (k = 0; k < 2; k++) {
+		m[k].q = m[k].px = m[k].py = m[k].pz = 0;
+		m[k].qxx = m[k].qyy = m[k].qzz = 0;
+		m[k].qxy = m[k].qxz = m[k].qyz = 0;
+	}
+
+	if (node->leaf) {
+		for (i = 0; i < node->n; i++) {
+			mol_atom *atom = &(octree->atoms[node->indices[i]]);
+
+			multipole_add_charge(&(m[i >= node->nfixed]),
+					     atom->chrg, atom->X - cx,
+					     atom->Y - cy, atom->Z - cz);
+		}
+		return;
+	}
+
+	for (i = 0; i < 8; i++)
+		if (node->c_ptr[i] >= 0) {
+			int c = node->c_ptr[i];
+			OCTREE_NODE *cnode = &(octree->nodes[c]);
+			double ch = 0.5 * cnode->dim;
+
+			compute_node_multipoles(c, octree, mp);
+			for (k = 0; k < 2; k++)
+				multipole_add_shifted(&(m[k]), &(mp[2 * c + k]),
+						      cnode->lx + ch - cx,
+						      cnode->ly + ch - cy,
+						      cnode->lz + ch - cz);
+		}
+}
+
+OCTREE_MULTIPOLE *octree_multipoles(OCTREE * octree)
+{
+	OCTREE_MULTIPOLE *mp =
+	    (OCTREE_MULTIPOLE *) _mol_malloc(2 * octree->num_nodes *
+					     sizeof(OCTREE_MULTIPOLE));
+
+	compute_node_multipoles(0, octree, mp);
+
+	return mp;
+}
+
+/**
+   Adds to *phi the potential of the expansion 'mp' truncated after 'order' at
+   < rx, ry, rz > from its center, and its gradient to 'grad'.
+*/
+static void multipole_potential(const OCTREE_MULTIPOLE * mp, int order,
+				double rx, double ry, double rz, double *phi,
+				double *grad)
+{
+	double ir2 = 1 / (rx * rx + ry * ry + rz * rz);
+	double ir1 = sqrt(ir2);
+	double ir3 = ir1 * ir2;
+
+	*phi += mp->q * ir1;
+	grad[0] -= mp->q * ir3 * rx;
+	grad[1] -= mp->q * ir3 * ry;
+	grad[2] -= mp->q * ir3 * rz;
+
+	if (order >= 1) {
+		double pr = mp->px * rx + mp->py * ry + mp->pz * rz;
+		double ir5 = ir3 * ir2;
+
+		*phi += pr * ir3;
+		grad[0] += mp->px * ir3 - 3 * pr * ir5 * rx;
+		grad[1] += mp->py * ir3 - 3 * pr * ir5 * ry;
+		grad[2] += mp->pz * ir3 - 3 * pr * ir5 * rz;
+
+		if (order >= 2) {
+			double tx = mp->qxx * rx + mp->qxy * ry + mp->qxz * rz;
+			double ty = mp->qxy * rx + mp->qyy * ry + mp->qyz * rz;
+			double tz = mp->qxz * rx + mp->qyz * ry + mp->qzz * rz;
+			double rtr = rx * tx + ry * ty + rz * tz;
+			double ir7 = ir5 * ir2;
+
+			*phi += rtr * ir5;
+			grad[0] += 2 * tx * ir5 - 5 * rtr * ir7 * rx;
+			grad[1] += 2 * ty * ir5 - 5 * rtr * ir7 * ry;
+			grad[2] += 2 * tz * ir5 - 5 * rtr * ir7 * rz;
+		}
+	}
+}
+
+/** state of the far-field traversal for one atom */
+typedef struct {
+	OCTREE *octree;
+	const OCTREE_MULTIPOLE *mp;
+	/* exclusions of the pairs inside the cutoff, NULL for none */
+	const struct agsetup *ags;
+	double rc2, irc, irc2, theta2;
+	int order;
+	/* the atom, its index in octree->atoms ( -1 if another molecule ) and position */
+	int ai;
+	double x, y, z;
+	/* potentials of the fixed and nonfixed charges and their gradients */
+	double phi[2], grad[2][3];
+} FAR_FIELD_PARAMS;
+
+/**
+   Adds to ffp->phi the potentials at < ffp->x, ffp->y, ffp->z > of the charges under 'node_id':
+   plain Coulomb for charges farther than the cutoff, using node expansions where the Barnes-Hut
+   criterion holds, and 1 / r minus the shifted ( 1 - r / rc )^2 / r of eleng_octree_single_mol(),
+   that is 2 / rc - r / rc^2, for the nonexcluded charges inside it.
+*/
+static void accumulate_far_field(int node_id, FAR_FIELD_PARAMS * ffp)
+{
+	OCTREE_NODE *node = &(ffp->octree->nodes[node_id]);
+	double h = 0.5 * node->dim;
+	double rx = ffp->x - (node->lx + h);
+	double ry = ffp->y - (node->ly + h);
+	double rz = ffp->z - (node->lz + h);
+	int i;
+
+	if (node->n == 0)
+		return;
+
+	/* whole node beyond the cutoff and small enough as seen from the atom */
+	if (min_pt2bx_dist2(node->lx, node->ly, node->lz, node->dim,
+			    ffp->x, ffp->y, ffp->z) >= ffp->rc2
+	    && node->dim * node->dim <
+	    ffp->theta2 * (rx * rx + ry * ry + rz * rz)) {
+		for (i = 0; i < 2; i++)
+			multipole_potential(&(ffp->mp[2 * node_id + i]),
+					    ffp->order, rx, ry, rz,
+					    &(ffp->phi[i]), ffp->grad[i]);
+		return;
+	}
+
+	if (!node->leaf) {
+		for (i = 0; i < 8; i++)
+			if (node->c_ptr[i] >= 0)
+				accumulate_far_field(node->c_ptr[i], ffp);
+		return;
+	}
+
+	/* leaf too close for its expansions: exact sum over its atoms */
+	for (i = 0; i < node->n; i++) {
+		int aj = node->indices[i];
+		mol_atom *atom_j = &(ffp->octree->atoms[aj]);
+		int k = (i >= node->nfixed);
+		double dx = ffp->x - atom_j->X;
+		double dy = ffp->y - atom_j->Y;
+		double dz = ffp->z - atom_j->Z;
+		double d2 = dx * dx + dy * dy + dz * dz;
+		double id1, q;
+
+		if (d2 < ffp->rc2) {
+			if (aj == ffp->ai)
+				continue;
+
+			/* same exclusions as the near field */
+			if ((ffp->ags != NULL) && (d2 < 20)
+			    && (exta_rows(ffp->ai < aj ? ffp->ai : aj,
+					  ffp->ai < aj ? aj : ffp->ai,
+					  ffp->ags->excl_offs,
+					  ffp->ags->excl_pairs) > 0))
+				continue;
+
+			id1 = 1 / sqrt(d2);
+			ffp->phi[k] += atom_j->chrg * (2 * ffp->irc - d2 * id1 * ffp->irc2);
+			q = atom_j->chrg * ffp->irc2 * id1;
+			ffp->grad[k][0] -= q * dx;
+			ffp->grad[k][1] -= q * dy;
+			ffp->grad[k][2] -= q * dz;
+			continue;
+		}
+
+		id1 = 1 / sqrt(d2);
+		q = atom_j->chrg * id1;
+		ffp->phi[k] += q;
+		q *= id1 * id1;
+		ffp->grad[k][0] -= q * dx;
+		ffp->grad[k][1] -= q * dy;
+		ffp->grad[k][2] -= q * dz;
+	}
+}
+
+/** appends the nonfixed atoms under 'node_id' to 'list' */
+static void collect_nonfixed_atoms(int node_id, OCTREE * octree, int *list,
+				   int *n)
+{
+	OCTREE_NODE *node = &(octree->nodes[node_id]);
+	int i;
+
+	if (node->leaf) {
+		for (i = node->nfixed; i < node->n; i++)
+			list[(*n)++] = node->indices[i];
+		return;
+	}
+
+	for (i = 0; i < 8; i++)
+		if (node->c_ptr[i] >= 0)
+			collect_nonfixed_atoms(node->c_ptr[i], octree, list, n);
+}
+
+double eleng_octree_far_field(OCTREE * octree_static,
+			      OCTREE_MULTIPOLE * mp_static,
+			      OCTREE * octree_moving, double *trans,
+			      struct agsetup *ags, double eps, double rc,
+			      double theta, int order)
+{
+	double pf = CCELEC / eps;
+	int same = (octree_static->atoms == octree_moving->atoms);
+	/* within one molecule every nonfixed pair is visited from both ends */
+	double wnf = same ? 0.5 : 1;
+	int nmoving = octree_moving->nodes[0].n + 1;
+	int *list = (int *)_mol_malloc(nmoving * sizeof(int));
+	double *en = (double *)_mol_malloc(nmoving * sizeof(double));
+	double energy = 0;
+	int n = 0;
+	int k;
+
+	collect_nonfixed_atoms(0, octree_moving, list, &n);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64) num_threads(mol_num_threads())
+#endif
+	for (k = 0; k < n; k++) {
+		FAR_FIELD_PARAMS ffp;
+		mol_atom *atom_i = &(octree_moving->atoms[list[k]]);
+		double f = pf * atom_i->chrg;
+
+		ffp.octree = octree_static;
+		ffp.mp = mp_static;
+		ffp.ags = same ? ags : NULL;
+		ffp.rc2 = rc * rc;
+		ffp.irc = 1 / rc;
+		ffp.irc2 = ffp.irc * ffp.irc;
+		ffp.theta2 = theta * theta;
+		ffp.order = order;
+		ffp.ai = same ? list[k] : -1;
+		ffp.x = atom_i->X;
+		ffp.y = atom_i->Y;
+		ffp.z = atom_i->Z;
+		if (trans != NULL)
+			transform_point(ffp.x, ffp.y, ffp.z, trans, &ffp.x,
+					&ffp.y, &ffp.z);
+		ffp.phi[0] = ffp.phi[1] = 0;
+		ffp.grad[0][0] = ffp.grad[0][1] = ffp.grad[0][2] = 0;
+		ffp.grad[1][0] = ffp.grad[1][1] = ffp.grad[1][2] = 0;
+
+		accumulate_far_field(0, &ffp);
+
+		en[k] = f * (ffp.phi[0] + wnf * ffp.phi[1]);
+
+		/* the atom feels the full force of both kinds of charges */
+		atom_i->GX -= f * (ffp.grad[0][0] + ffp.grad[1][0]);
+		atom_i->GY -= f * (ffp.grad[0][1] + ffp.grad[1][1]);
+		atom_i->GZ -= f * (ffp.grad[0][2] + ffp.grad[1][2]);
+	}
+
+	for (k = 0; k < n; k++)
+		energy += en[k];
+
+	freeMem(list);
+	freeMem(en);
+
+	return energy;
+}
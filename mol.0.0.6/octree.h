@@ -55,6 +55,9 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /** return 0 if a < b, 1 otherwise */
 #define zeroIfLess( a, b ) ( ( ( a ) < ( b ) ) ? 0 : 1 )
 
+/** largest number of atom pairs under a node pair evaluated as one task by the threaded accumulation */
+#define OCTREE_PARALLEL_GRAIN 16384
+
 /*
 #ifndef RECURSION_DEPTH
    #define RECURSION_DEPTH 50
@@ -127,6 +130,18 @@ typedef struct
 } OCTREE;
 
 
+/**
+   Cartesian multipole expansion of the charges under an octree node about the center of the
+   node: total charge, dipole and traceless quadrupole sum( q * ( 3 d d^T - |d|^2 I ) / 2 ).
+*/
+typedef struct
+{
+        double q;
+        double px, py, pz;
+        double qxx, qyy, qzz, qxy, qxz, qyz;
+} OCTREE_MULTIPOLE;
+
+
 /** stores parameters for evaluating various energy functions using octrees */
 typedef struct OPAR
 {
@@ -308,6 +323,56 @@ double octree_accumulation_excluding_far( OCTREE *octree_static, OCTREE *octree_
                                           void *proc_func_params,
                                           void ( * processing_function )( OCTREE_PARAMS *, double * ) );
                                           
+/**
+   Threaded version of octree_accumulation_excluding_far() taking the same parameters. Node pairs
+   holding at most OCTREE_PARALLEL_GRAIN atom pairs are split into one chunk per thread, each
+   evaluated on a copy of the atoms under its node pairs, and energies and gradients are reduced
+   in a fixed order, so a given thread count always gives the same result. 'proc_func_params' is
+   shared by all threads and must be read-only.
+*/
+double octree_accumulation_excluding_far_parallel( OCTREE *octree_static, OCTREE *octree_moving,
+                                                   double dist_cutoff, double approx_cutoff, int fixed_cull, double *trans,
+                                                   void *proc_func_params,
+                                                   void ( * processing_function )( OCTREE_PARAMS *, double * ) );
+
+/**
+   Batched rigid-body version of octree_accumulation_excluding_far(): 'trans' holds 'ntrans'
+   consecutive 3 x 4 transformation matrices for the molecule stored in 'octree_moving', and
+   energies[ k ] receives the accumulated interaction value for the k-th one. Poses are scored
+   in parallel on pretransformed private copies of the moving atoms and octree nodes; gradients
+   are not accumulated into either molecule, and 'proc_func_params' must be read-only.
+*/
+void octree_accumulation_excluding_far_batch( OCTREE *octree_static, OCTREE *octree_moving,
+                                              double dist_cutoff, int fixed_cull, int ntrans, double *trans,
+                                              void *proc_func_params,
+                                              void ( * processing_function )( OCTREE_PARAMS *, double * ),
+                                              double *energies );
+
+/**
+   Returns a newly allocated array of 2 * octree->num_nodes expansions of the charges in 'octree':
+   entry 2 * i holds the fixed and entry 2 * i + 1 the nonfixed atoms under node i. Children are
+   shifted into their parents, so the whole array costs O( N ) and must be recomputed after
+   atoms move. The caller frees it with freeMem().
+*/
+OCTREE_MULTIPOLE *octree_multipoles( OCTREE *octree );
+
+/**
+   Far-field complement of an electrostatics evaluation with octree_accumulation_excluding_far()
+   and eleng_octree_single_mol() at cutoff 'rc': the two add up to the plain Coulomb energy
+   ( dielectric 'eps' ) of the pairs between the nonfixed atoms of 'octree_moving' ( transformed
+   by 'trans' if not NULL ) and all atoms of 'octree_static', with no jump in energy or gradient
+   when a pair crosses 'rc'. Returns that of the pairs at least 'rc' apart plus, for the pairs
+   inside 'rc', 1 / r minus the shifted ( 1 - r / rc )^2 / r of the near field, and adds its
+   gradient to the moving atoms. When both octrees hold the same molecule each pair is counted
+   once, 'rc' must be positive and pairs excluded in 'ags' ( may be NULL ) are skipped as in the
+   near field. 'mp_static' comes from octree_multipoles( octree_static ). A static node beyond
+   'rc' is replaced by its expansion up to 'order' ( 0 monopole, 1 dipole, 2 quadrupole ) when its
+   size is below 'theta' times its distance ( Barnes-Hut ), giving O( N log N ) work.
+*/
+double eleng_octree_far_field( OCTREE *octree_static, OCTREE_MULTIPOLE *mp_static,
+                               OCTREE *octree_moving, double *trans, struct agsetup *ags,
+                               double eps, double rc, double theta, int order );
+
 /**
    Free the memory allocated to the OCTREE data structure pointed to by 'octree'.
 */
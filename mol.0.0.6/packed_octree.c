@@ -0,0 +1,807 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+
+#include _MOL_INCLUDE_
+
+/** largest float not above v */
+static float float_floor(double v)
+{
+	float f = (float)v;
+
+	if (f > v)
+		f = nextafterf(f, -FLT_MAX);
+	return f;
+}
+
+/** smallest float not below v */
+static float float_ceil(double v)
+{
+	float f = (float)v;
+
+	if (f < v)
+		f = nextafterf(f, FLT_MAX);
+	return f;
+}
+
+/**
+   Sets the float bounds of 'pnode' to the smallest float cube containing the
+   cube of the source node 'snode'.
+*/
+static void pack_node_bounds(PACKED_OCTREE_NODE * pnode,
+			     const OCTREE_NODE * snode)
+{
+	double ext;
+
+	pnode->lx = float_floor(snode->lx);
+	pnode->ly = float_floor(snode->ly);
+	pnode->lz = float_floor(snode->lz);
+
+	ext = snode->lx + snode->dim - pnode->lx;
+	if (snode->ly + snode->dim - pnode->ly > ext)
+		ext = snode->ly + snode->dim - pnode->ly;
+	if (snode->lz + snode->dim - pnode->lz > ext)
+		ext = snode->lz + snode->dim - pnode->lz;
+	pnode->dim = float_ceil(ext);
+}
+
+/**
+   Copies the atoms of the source leaf of 'pnode' into the packed arrays.
+   Returns 0 if nothing changed, 1 if only coordinates or parameters
+   changed and 3 if the leaf now holds other atoms.
+*/
+static int pack_leaf_atoms(PACKED_OCTREE * packed, PACKED_OCTREE_NODE * pnode)
+{
+	const OCTREE_NODE *snode = &(packed->octree->nodes[pnode->src]);
+	int dirty = 0;
+	int i;
+
+	for (i = 0; i < pnode->n; i++) {
+		int k = pnode->start + i;
+		int ai = snode->indices[i];
+		mol_atom *atom = &(packed->octree->atoms[ai]);
+
+		if (packed->atom[k] != ai || packed->x[k] != atom->X
+		    || packed->y[k] != atom->Y || packed->z[k] != atom->Z
+		    || packed->eps[k] != atom->eps
+		    || packed->rminh[k] != atom->rminh
+		    || packed->chrg[k] != atom->chrg) {
+			if (packed->atom[k] != ai)
+				dirty = 3;
+			packed->x[k] = atom->X;
+			packed->y[k] = atom->Y;
+			packed->z[k] = atom->Z;
+			packed->eps[k] = atom->eps;
+			packed->rminh[k] = atom->rminh;
+			packed->chrg[k] = atom->chrg;
+			packed->atom[k] = ai;
+			dirty |= 1;
+		}
+	}
+
+	return dirty;
+}
+
+/** counts the nodes of the subtree of 'octree' rooted at 'node_id' */
+static int count_subtree_nodes(const OCTREE * octree, int node_id)
+{
+	const OCTREE_NODE *node = &(octree->nodes[node_id]);
+	int n = 1;
+	int i;
+
+	if (!node->leaf)
+		for (i = 0; i < 8; i++)
+			if (node->c_ptr[i] >= 0)
+				n += count_subtree_nodes(octree,
+							 node->c_ptr[i]);
+	return n;
+}
+
+/**
+   Packs the subtree rooted at source node 'node_id' depth-first, taking the next
+   free packed node from *next_node and its atoms from *next_atom onwards.
+   Returns the index of the packed node.
+*/
+static int pack_subtree(PACKED_OCTREE * packed, int node_id, int *next_node,
+			int *next_atom)
+{
+	const OCTREE_NODE *snode = &(packed->octree->nodes[node_id]);
+	int p = (*next_node)++;
+	PACKED_OCTREE_NODE *pnode = &(packed->nodes[p]);
+	int i;
+
+	pack_node_bounds(pnode, snode);
+	pnode->start = *next_atom;
+	pnode->n = snode->n;
+	pnode->nfixed = snode->nfixed;
+	pnode->leaf = snode->leaf;
+	pnode->src = node_id;
+
+	for (i = 0; i < 8; i++)
+		pnode->c_ptr[i] = -1;
+
+	if (snode->leaf) {
+		for (i = 0; i < pnode->n; i++)
+			packed->atom[pnode->start + i] = -1;
+		pack_leaf_atoms(packed, pnode);
+		*next_atom += pnode->n;
+	} else
+		for (i = 0; i < 8; i++)
+			if (snode->c_ptr[i] >= 0) {
+				pnode->c_ptr[i] =
+				    pack_subtree(packed, snode->c_ptr[i],
+						 next_node, next_atom);
+			}
+
+	return p;
+}
+
+int pack_octree(PACKED_OCTREE * packed, OCTREE * octree)
+{
+	int n = octree->nodes[0].n;
+	int next_node = 0, next_atom = 0;
+
+	packed->octree = octree;
+	packed->num_nodes = count_subtree_nodes(octree, 0);
+	packed->natoms = n;
+
+	packed->nodes =
+	    (PACKED_OCTREE_NODE *) _mol_malloc(packed->num_nodes *
+					       sizeof(PACKED_OCTREE_NODE));
+	packed->x = (double *)_mol_malloc(9 * (n > 0 ? n : 1) * sizeof(double));
+	packed->y = packed->x + n;
+	packed->z = packed->y + n;
+	packed->eps = packed->z + n;
+	packed->rminh = packed->eps + n;
+	packed->chrg = packed->rminh + n;
+	packed->gx = packed->chrg + n;
+	packed->gy = packed->gx + n;
+	packed->gz = packed->gy + n;
+	packed->atom = (int *)_mol_malloc((n > 0 ? n : 1) * sizeof(int));
+
+	packed->excl_ags = NULL;
+	packed->excl_offs = NULL;
+	packed->excl_leaf = NULL;
+	packed->excl_mask = NULL;
+	packed->excl_bits = NULL;
+
+	pack_subtree(packed, 0, &next_node, &next_atom);
+
+	if (next_atom != n) {
+		print_error("octree node counts do not match its leaves");
+		destroy_packed_octree(packed);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+   Returns 1 if the subtree rooted at packed node 'p' still has the shape and
+   atom counts of the corresponding source subtree.
+*/
+static int same_shape(const PACKED_OCTREE * packed, int p)
+{
+	const PACKED_OCTREE_NODE *pnode = &(packed->nodes[p]);
+	const OCTREE_NODE *snode = &(packed->octree->nodes[pnode->src]);
+	int i;
+
+	if (snode->n != pnode->n || snode->nfixed != pnode->nfixed
+	    || snode->leaf != pnode->leaf)
+		return 0;
+
+	if (!pnode->leaf)
+		for (i = 0; i < 8; i++) {
+			if ((snode->c_ptr[i] >= 0) != (pnode->c_ptr[i] >= 0))
+				return 0;
+			if (pnode->c_ptr[i] >= 0
+			    && (packed->nodes[pnode->c_ptr[i]].src !=
+				snode->c_ptr[i]
+				|| !same_shape(packed, pnode->c_ptr[i])))
+				return 0;
+		}
+
+	return 1;
+}
+
+int repack_octree(PACKED_OCTREE * packed)
+{
+	struct agsetup *ags = packed->excl_ags;
+	int nrepacked = 0, moved = 0;
+	int i;
+
+	if (!same_shape(packed, 0)) {
+		OCTREE *octree = packed->octree;
+
+		destroy_packed_octree(packed);
+		if (!pack_octree(packed, octree))
+			return 0;
+		if (ags != NULL && !pack_octree_exclusions(packed, ags))
+			return 0;
+		for (i = 0; i < packed->num_nodes; i++)
+			nrepacked += packed->nodes[i].leaf;
+		return nrepacked;
+	}
+
+	for (i = 0; i < packed->num_nodes; i++) {
+		PACKED_OCTREE_NODE *pnode = &(packed->nodes[i]);
+
+		pack_node_bounds(pnode, &(packed->octree->nodes[pnode->src]));
+		if (pnode->leaf) {
+			int dirty = pack_leaf_atoms(packed, pnode);
+
+			nrepacked += (dirty != 0);
+			moved |= dirty & 2;
+		}
+	}
+
+	/* the masks only depend on which atoms each leaf holds */
+	if (moved && ags != NULL && !pack_octree_exclusions(packed, ags))
+		return 0;
+
+	return nrepacked;
+}
+
+/** one excluded pair: row 'i' of leaf 'm' against column 'j' of leaf 's' */
+struct leaf_excl {
+	int m, s, i, j;
+};
+
+static int leaf_excl_cmp(const void *a, const void *b)
+{
+	const struct leaf_excl *x = (const struct leaf_excl *)a;
+	const struct leaf_excl *y = (const struct leaf_excl *)b;
+
+	if (x->m != y->m)
+		return (x->m < y->m) ? -1 : 1;
+	if (x->s != y->s)
+		return (x->s < y->s) ? -1 : 1;
+	return 0;
+}
+
+/** frees the exclusion masks of 'packed' */
+static void free_packed_exclusions(PACKED_OCTREE * packed)
+{
+	freeMem(packed->excl_offs);
+	freeMem(packed->excl_leaf);
+	freeMem(packed->excl_mask);
+	freeMem(packed->excl_bits);
+	packed->excl_offs = NULL;
+	packed->excl_leaf = NULL;
+	packed->excl_mask = NULL;
+	packed->excl_bits = NULL;
+	packed->excl_ags = NULL;
+}
+
+int pack_octree_exclusions(PACKED_OCTREE * packed, struct agsetup *ags)
+{
+	int natoms = packed->octree->natoms;
+	int *pos, *leaf;
+	struct leaf_excl *ex;
+	int nex = 0, nentries = 0, nwords = 0;
+	int a1, e, i, k;
+
+	free_packed_exclusions(packed);
+
+	/* packed position and leaf of every atom */
+	pos = (int *)_mol_malloc((natoms > 0 ? natoms : 1) * sizeof(int));
+	leaf = (int *)_mol_malloc((packed->natoms > 0 ? packed->natoms : 1) *
+				  sizeof(int));
+	for (i = 0; i < natoms; i++)
+		pos[i] = -1;
+	for (k = 0; k < packed->natoms; k++)
+		pos[packed->atom[k]] = k;
+	for (i = 0; i < packed->num_nodes; i++)
+		if (packed->nodes[i].leaf)
+			for (k = 0; k < packed->nodes[i].n; k++)
+				leaf[packed->nodes[i].start + k] = i;
+
+	/* every excluded pair in both orders */
+	for (a1 = 0; a1 < natoms; a1++)
+		if (pos[a1] >= 0)
+			for (e = ags->excl_offs[a1]; e < ags->excl_offs[a1 + 1];
+			     e++)
+				if ((ags->excl_pairs[e] & 3)
+				    && pos[ags->excl_pairs[e] >> 2] >= 0)
+					nex += 2;
+
+	ex = (struct leaf_excl *)_mol_malloc((nex > 0 ? nex : 1) *
+					     sizeof(struct leaf_excl));
+	nex = 0;
+	for (a1 = 0; a1 < natoms; a1++)
+		if (pos[a1] >= 0)
+			for (e = ags->excl_offs[a1]; e < ags->excl_offs[a1 + 1];
+			     e++) {
+				int p1 = pos[a1], p2;
+
+				if (!(ags->excl_pairs[e] & 3))
+					continue;
+				p2 = pos[ags->excl_pairs[e] >> 2];
+				if (p2 < 0)
+					continue;
+				ex[nex].m = leaf[p1];
+				ex[nex].s = leaf[p2];
+				ex[nex].i = p1 - packed->nodes[leaf[p1]].start;
+				ex[nex].j = p2 - packed->nodes[leaf[p2]].start;
+				nex++;
+				ex[nex].m = leaf[p2];
+				ex[nex].s = leaf[p1];
+				ex[nex].i = p2 - packed->nodes[leaf[p2]].start;
+				ex[nex].j = p1 - packed->nodes[leaf[p1]].start;
+				nex++;
+			}
+
+	qsort(ex, nex, sizeof(struct leaf_excl), leaf_excl_cmp);
+
+	/* one entry, and one mask, per distinct leaf pair */
+	for (k = 0; k < nex; k++)
+		if (k == 0 || leaf_excl_cmp(&ex[k], &ex[k - 1])) {
+			nwords +=
+			    packed->nodes[ex[k].m].n *
+			    ((packed->nodes[ex[k].s].n + 63) / 64);
+			nentries++;
+		}
+
+	packed->excl_offs =
+	    (int *)_mol_calloc(packed->num_nodes + 1, sizeof(int));
+	packed->excl_leaf =
+	    (int *)_mol_malloc((nentries > 0 ? nentries : 1) * sizeof(int));
+	packed->excl_mask =
+	    (int *)_mol_malloc((nentries > 0 ? nentries : 1) * sizeof(int));
+	packed->excl_bits =
+	    (unsigned long long *)_mol_calloc(nwords > 0 ? nwords : 1,
+					      sizeof(unsigned long long));
+
+	nentries = 0;
+	nwords = 0;
+	for (k = 0; k < nex; k++) {
+		int nw = (packed->nodes[ex[k].s].n + 63) / 64;
+
+		if (k == 0 || leaf_excl_cmp(&ex[k], &ex[k - 1])) {
+			packed->excl_offs[ex[k].m + 1]++;
+			packed->excl_leaf[nentries] = ex[k].s;
+			packed->excl_mask[nentries] = nwords;
+			nwords += packed->nodes[ex[k].m].n * nw;
+			nentries++;
+		}
+		packed->excl_bits[packed->excl_mask[nentries - 1] +
+				  ex[k].i * nw + ex[k].j / 64] |=
+		    1ULL << (ex[k].j % 64);
+	}
+	for (i = 0; i < packed->num_nodes; i++)
+		packed->excl_offs[i + 1] += packed->excl_offs[i];
+
+	packed->excl_ags = ags;
+
+	freeMem(pos);
+	freeMem(leaf);
+	freeMem(ex);
+
+	return 1;
+}
+
+void destroy_packed_octree(PACKED_OCTREE * packed)
+{
+	free_packed_exclusions(packed);
+	freeMem(packed->nodes);
+	freeMem(packed->x);
+	freeMem(packed->atom);
+	packed->nodes = NULL;
+	packed->x = NULL;
+	packed->atom = NULL;
+	packed->num_nodes = 0;
+	packed->natoms = 0;
+}
+
+/**
+   Packed counterpart of accumulate_excluding_far() without a transformation matrix.
+*/
+static double accumulate_packed_excluding_far(PACKED_OCTREE_PARAMS * octpar)
+{
+	PACKED_OCTREE_NODE *static_node =
+	    &(octpar->octree_static->nodes[octpar->node_static]);
+	PACKED_OCTREE_NODE *moving_node =
+	    &(octpar->octree_moving->nodes[octpar->node_moving]);
+	double energy;
+	int i, j;
+
+	if (moving_node->nfixed == moving_node->n)
+		return 0;
+
+	if (!within_distance_cutoff
+	    (static_node->lx, static_node->ly, static_node->lz,
+	     static_node->dim, moving_node->lx, moving_node->ly,
+	     moving_node->lz, moving_node->dim, octpar->dist_cutoff))
+		return 0;
+
+	energy = 0;
+
+	if (static_node->leaf) {
+		if (moving_node->leaf)
+			octpar->processing_function(octpar, &energy);
+		else {
+			for (j = 0; j < 8; j++)
+				if (moving_node->c_ptr[j] >= 0) {
+					octpar->node_moving =
+					    moving_node->c_ptr[j];
+					energy +=
+					    accumulate_packed_excluding_far
+					    (octpar);
+				}
+		}
+	} else {
+		if (moving_node->leaf) {
+			for (i = 0; i < 8; i++)
+				if (static_node->c_ptr[i] >= 0) {
+					octpar->node_static =
+					    static_node->c_ptr[i];
+					energy +=
+					    accumulate_packed_excluding_far
+					    (octpar);
+				}
+		} else {
+			for (i = 0; i < 8; i++)
+				if (static_node->c_ptr[i] >= 0)
+					for (j = 0; j < 8; j++)
+						if (moving_node->c_ptr[j] >= 0) {
+							octpar->node_static =
+							    static_node->
+							    c_ptr[i];
+							octpar->node_moving =
+							    moving_node->
+							    c_ptr[j];
+							energy +=
+							    accumulate_packed_excluding_far
+							    (octpar);
+						}
+		}
+	}
+
+	return energy;
+}
+
+/** zeroes the packed gradients of 'packed' */
+static void zero_packed_grads(PACKED_OCTREE * packed)
+{
+	int i;
+
+	for (i = 0; i < packed->natoms; i++)
+		packed->gx[i] = packed->gy[i] = packed->gz[i] = 0;
+}
+
+/** adds the packed gradients of 'packed' to the gradients of its atoms */
+static void packed_grads_to_atoms(PACKED_OCTREE * packed)
+{
+	mol_atom *atoms = packed->octree->atoms;
+	int i;
+
+	for (i = 0; i < packed->natoms; i++) {
+		mol_atom *atom = &(atoms[packed->atom[i]]);
+
+		atom->GX += packed->gx[i];
+		atom->GY += packed->gy[i];
+		atom->GZ += packed->gz[i];
+	}
+}
+
+double packed_octree_accumulation_excluding_far(PACKED_OCTREE * octree_static,
+						PACKED_OCTREE * octree_moving,
+						double dist_cutoff,
+						void *proc_func_params,
+						void (*processing_function)
+						(PACKED_OCTREE_PARAMS *,
+						 double *))
+{
+	PACKED_OCTREE_PARAMS octpar;
+	double energy;
+
+	octpar.octree_static = octree_static;
+	octpar.node_static = 0;
+
+	octpar.octree_moving = octree_moving;
+	octpar.node_moving = 0;
+
+	octpar.dist_cutoff = dist_cutoff;
+	octpar.proc_func_params = proc_func_params;
+	octpar.processing_function = processing_function;
+
+	zero_packed_grads(octree_static);
+	if (octree_moving != octree_static)
+		zero_packed_grads(octree_moving);
+
+	energy = accumulate_packed_excluding_far(&octpar);
+
+	packed_grads_to_atoms(octree_static);
+	if (octree_moving != octree_static)
+		packed_grads_to_atoms(octree_moving);
+
+	return energy;
+}
+
+/** view with stride 1 over the packed arrays of 'packed' */
+static void packed_nbview(struct nbview *v, PACKED_OCTREE * packed)
+{
+	v->x = packed->x;
+	v->y = packed->y;
+	v->z = packed->z;
+	v->eps = packed->eps;
+	v->rminh = packed->rminh;
+	v->chrg = packed->chrg;
+	v->s = 1;
+	v->gx = packed->gx;
+	v->gy = packed->gy;
+	v->gz = packed->gz;
+	v->gs = 1;
+}
+
+/**
+   Returns the exclusion mask rows of the nonfixed atoms of leaf 'm' against leaf 's'
+   of 'packed', with the row length in words in *nw, or NULL if the two leaves share
+   no excluded pair.
+*/
+static const unsigned long long *leaf_pair_mask(const PACKED_OCTREE * packed,
+						int m, int s, int *nw)
+{
+	int k;
+
+	*nw = (packed->nodes[s].n + 63) / 64;
+	for (k = packed->excl_offs[m]; k < packed->excl_offs[m + 1]; k++)
+		if (packed->excl_leaf[k] == s)
+			return packed->excl_bits + packed->excl_mask[k]
+			    + packed->nodes[m].nfixed * *nw;
+	return NULL;
+}
+
+/**
+   End of the static range paired with the nonfixed atoms of leaf 'mnode' when both
+   leaves come from the same packed octree: nonfixed-nonfixed pairs are counted once,
+   from the leaf packed first, so a static leaf packed before 'mnode' only contributes
+   its fixed atoms.
+*/
+static int leaf_pair_end(const PACKED_OCTREE_NODE * snode,
+			 const PACKED_OCTREE_NODE * mnode)
+{
+	if (snode->start >= mnode->start)
+		return snode->start + snode->n;
+	return snode->start + snode->nfixed;
+}
+
+void vdweng_packed_octree_single_mol(PACKED_OCTREE_PARAMS * octpar,
+				     double *energy)
+{
+	PACKED_OCTREE *ps = octpar->octree_static;
+	PACKED_OCTREE *pm = octpar->octree_moving;
+
+	OCTREE_PARAMS *prms = (OCTREE_PARAMS *) octpar->proc_func_params;
+	struct agsetup *ags = prms->ags;
+
+	PACKED_OCTREE_NODE *snode = &(ps->nodes[octpar->node_static]);
+	PACKED_OCTREE_NODE *mnode = &(pm->nodes[octpar->node_moving]);
+
+	double rc2 = octpar->dist_cutoff * octpar->dist_cutoff;
+
+	const int *satom = ps->atom;
+	const double *sx = ps->x, *sy = ps->y, *sz = ps->z;
+	double *sgx = ps->gx, *sgy = ps->gy, *sgz = ps->gz;
+	const double *seps = ps->eps, *srminh = ps->rminh;
+
+	int s0 = snode->start, s1 = snode->start + snode->n;
+	int sf = snode->start + snode->nfixed;
+
+	double en = 0;
+	int i, j;
+
+	/* same packed octree with precomputed exclusion masks: vectorized leaf-pair block */
+	if (ps == pm && ps->excl_ags != NULL) {
+		struct nbview v;
+		int nw;
+		const unsigned long long *excl =
+		    leaf_pair_mask(ps, octpar->node_moving, octpar->node_static,
+				   &nw);
+
+		packed_nbview(&v, ps);
+		*energy =
+		    vdw_leaf_simd(&v, mnode->start + mnode->nfixed,
+				  mnode->start + mnode->n, &v, s0, sf,
+				  leaf_pair_end(snode, mnode), snode == mnode,
+				  excl, nw, octpar->dist_cutoff);
+		return;
+	}
+
+	/* iterate through the nonfixed atoms of the moving leaf */
+	for (i = mnode->start + mnode->nfixed; i < mnode->start + mnode->n; i++) {
+		int ai = pm->atom[i];
+		double x = pm->x[i], y = pm->y[i], z = pm->z[i];
+		double e_i = pm->eps[i], r_i = pm->rminh[i];
+		double gx = 0, gy = 0, gz = 0;
+
+		if (min_pt2bx_dist2(snode->lx, snode->ly, snode->lz,
+				    snode->dim, x, y, z) >= rc2)
+			continue;
+
+		/* stream through the atoms of the static leaf */
+		for (j = s0; j < s1; j++) {
+			int aj = satom[j];
+			double dx, dy, dz, d2;
+			double r_ij, dven, g;
+
+			if ((j >= sf) && (aj <= ai))
+				continue;	/* avoid double-counting nonfixed-nonfixed interactions */
+
+			dx = sx[j] - x;
+			dy = sy[j] - y;
+			dz = sz[j] - z;
+			d2 = dx * dx + dy * dy + dz * dz;
+
+			if (d2 >= rc2)
+				continue;
+
+			/* if too close check for bonds */
+			if (d2 < 20
+			    && ((ai < aj) ?
+				exta_rows(ai, aj, ags->excl_offs,
+					  ags->excl_pairs) :
+				exta_rows(aj, ai, ags->excl_offs,
+					  ags->excl_pairs)) > 0)
+				continue;
+
+			r_ij = r_i + srminh[j];
+			en += vdw_pair(e_i * seps[j], r_ij * r_ij, d2, rc2,
+				       &dven);
+
+			/* dx points from the moving to the static atom */
+			g = dven * dx;
+			gx -= g;
+			sgx[j] += g;
+
+			g = dven * dy;
+			gy -= g;
+			sgy[j] += g;
+
+			g = dven * dz;
+			gz -= g;
+			sgz[j] += g;
+		}
+
+		pm->gx[i] += gx;
+		pm->gy[i] += gy;
+		pm->gz[i] += gz;
+	}
+
+	*energy = en;
+}
+
+void eleng_packed_octree_single_mol(PACKED_OCTREE_PARAMS * octpar,
+				    double *energy)
+{
+	PACKED_OCTREE *ps = octpar->octree_static;
+	PACKED_OCTREE *pm = octpar->octree_moving;
+
+	OCTREE_PARAMS *prms = (OCTREE_PARAMS *) octpar->proc_func_params;
+	struct agsetup *ags = prms->ags;
+
+	PACKED_OCTREE_NODE *snode = &(ps->nodes[octpar->node_static]);
+	PACKED_OCTREE_NODE *mnode = &(pm->nodes[octpar->node_moving]);
+
+	double pf = CCELEC / prms->eps;
+	double rc = octpar->dist_cutoff;
+	double rc2 = rc * rc;
+	double irc2 = 1 / rc2;
+
+	const int *satom = ps->atom;
+	const double *sx = ps->x, *sy = ps->y, *sz = ps->z;
+	double *sgx = ps->gx, *sgy = ps->gy, *sgz = ps->gz;
+	const double *schrg = ps->chrg;
+
+	int s0 = snode->start, s1 = snode->start + snode->n;
+	int sf = snode->start + snode->nfixed;
+
+	double en = 0;
+	int i, j;
+
+	/* same packed octree with precomputed exclusion masks: vectorized leaf-pair block */
+	if (ps == pm && ps->excl_ags != NULL) {
+		struct nbview v;
+		int nw;
+		const unsigned long long *excl =
+		    leaf_pair_mask(ps, octpar->node_moving, octpar->node_static,
+				   &nw);
+
+		packed_nbview(&v, ps);
+		*energy =
+		    ele_leaf_simd(&v, mnode->start + mnode->nfixed,
+				  mnode->start + mnode->n, &v, s0, sf,
+				  leaf_pair_end(snode, mnode), snode == mnode,
+				  excl, nw, pf, rc);
+		return;
+	}
+
+	/* iterate through the nonfixed atoms of the moving leaf */
+	for (i = mnode->start + mnode->nfixed; i < mnode->start + mnode->n; i++) {
+		int ai = pm->atom[i];
+		double x = pm->x[i], y = pm->y[i], z = pm->z[i];
+		double c_i = pf * pm->chrg[i];
+		double gx = 0, gy = 0, gz = 0;
+
+		if (min_pt2bx_dist2(snode->lx, snode->ly, snode->lz,
+				    snode->dim, x, y, z) >= rc2)
+			continue;
+
+		/* stream through the atoms of the static leaf */
+		for (j = s0; j < s1; j++) {
+			int aj = satom[j];
+			double dx, dy, dz, d2, desh, g;
+
+			if ((j >= sf) && (aj <= ai))
+				continue;	/* avoid double-counting nonfixed-nonfixed interactions */
+
+			dx = sx[j] - x;
+			dy = sy[j] - y;
+			dz = sz[j] - z;
+			d2 = dx * dx + dy * dy + dz * dz;
+
+			if (d2 >= rc2)
+				continue;
+
+			/* if too close check for bonds */
+			if (d2 < 20
+			    && ((ai < aj) ?
+				exta_rows(ai, aj, ags->excl_offs,
+					  ags->excl_pairs) :
+				exta_rows(aj, ai, ags->excl_offs,
+					  ags->excl_pairs)) > 0)
+				continue;
+
+			en += ele_pair(c_i * schrg[j], d2, rc, irc2, &desh);
+
+			g = desh * dx;
+			gx -= g;
+			sgx[j] += g;
+
+			g = desh * dy;
+			gy -= g;
+			sgy[j] += g;
+
+			g = desh * dz;
+			gz -= g;
+			sgz[j] += g;
+		}
+
+		pm->gx[i] += gx;
+		pm->gy[i] += gy;
+		pm->gz[i] += gz;
+	}
+
+	*energy = en;
+}
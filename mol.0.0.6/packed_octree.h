@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_PACKED_OCTREE_H_
+#define _MOL_PACKED_OCTREE_H_
+
+/** \file packed_octree.h
+    A read-mostly copy of an OCTREE laid out for streaming leaf-pair loops.
+    Nodes are stored in depth-first order with children visited in c_ptr
+    order, which is Morton (z-order) since get_child_id packs the octant
+    bits as z, y, x. The atoms of every subtree therefore occupy one
+    contiguous range of the packed arrays, with the fixed atoms first
+    inside each leaf, and a leaf pair is processed by scanning two ranges
+    of plain arrays instead of following indices into struct atom.
+*/
+
+/** stores the properties of a packed octree node */
+typedef struct
+{
+        /** minimum x, y and z co-ordinates of the cube, rounded down to float */
+        float lx, ly, lz;
+        /** dimension of the cube, rounded up so the float cube contains the original one */
+        float dim;
+
+        /** index of the first packed atom under this node */
+        int start;
+        /** number of atoms under this node */
+        int n;
+        /** number of fixed atoms under this node (listed first if this node is a leaf) */
+        int nfixed;
+        /** 1 if this node is a leaf, 0 otherwise */
+        int leaf;
+        /** indices of the packed child nodes, -1 if absent */
+        int c_ptr[ 8 ];
+        /** index of the node in the source octree */
+        int src;
+} PACKED_OCTREE_NODE;
+
+/** stores a packed copy of an octree and of the atom data used by the nonbonded kernels */
+typedef struct
+{
+        /** the octree this copy was packed from */
+        OCTREE *octree;
+
+        /** nodes in depth-first Morton order, nodes[ 0 ] being the root */
+        PACKED_OCTREE_NODE *nodes;
+        /** number of packed nodes */
+        int num_nodes;
+
+        /** number of packed atoms (the atoms under the root) */
+        int natoms;
+        /** packed coordinates */
+        double *x, *y, *z;
+        /** packed vdw and charge parameters */
+        double *eps, *rminh, *chrg;
+        /** packed gradients, added back to the atoms by the accumulation */
+        double *gx, *gy, *gz;
+        /** index in octree->atoms of each packed atom */
+        int *atom;
+
+        /** setup the exclusion masks were built from, NULL if there are none */
+        struct agsetup *excl_ags;
+        /** entries excl_offs[ k ] .. excl_offs[ k + 1 ] - 1 list the leaves sharing excluded pairs with node k */
+        int *excl_offs;
+        /** partner leaf of each entry, increasing within a node */
+        int *excl_leaf;
+        /** offset in excl_bits of the mask of each entry */
+        int *excl_mask;
+        /** masks: for each atom of the node a row of ( m + 63 ) / 64 words, bit j set if it
+            is excluded from atom j of the partner leaf of m atoms */
+        unsigned long long *excl_bits;
+} PACKED_OCTREE;
+
+/** stores parameters for evaluating energy functions over packed octrees */
+typedef struct POPAR
+{
+        /** packed octree containing the static molecule */
+        PACKED_OCTREE *octree_static;
+        /** index of the current node in the static octree */
+        int node_static;
+        /** packed octree containing the moving molecule */
+        PACKED_OCTREE *octree_moving;
+        /** index of the current node in the moving octree */
+        int node_moving;
+
+        /** distance cutoff for pairwise interaction evaluation */
+        double dist_cutoff;
+
+        /** pointer to data to be passed as parameters to the interaction evaluation function */
+        void *proc_func_params;
+        /** user-defined leaf-pair interaction evaluation function */
+        void ( * processing_function )( struct POPAR *, double * );
+} PACKED_OCTREE_PARAMS;
+
+/**
+   Packs the octree pointed to by 'octree' into 'packed'. Returns 1 on success.
+   The packed copy must be refreshed with repack_octree() whenever the atoms move or
+   their eps, rminh or chrg change.
+*/
+int pack_octree( PACKED_OCTREE *packed, OCTREE *octree );
+
+/**
+   Brings 'packed' up to date with its octree, typically after update_octree() or
+   reorganize_octree(). If the tree shape is unchanged only the dirty leaves, those
+   whose atoms, coordinates or parameters changed, are re-packed in place; otherwise the whole
+   octree is packed again. Returns the number of leaves re-packed.
+*/
+int repack_octree( PACKED_OCTREE *packed );
+
+/**
+   Precomputes for every pair of leaves of 'packed' sharing 1-2, 1-3 or 1-4 pairs of 'ags' a
+   bit mask of those pairs, so that the packed kernels can skip the exclusion lookups for all
+   other leaf pairs. The masks are rebuilt by repack_octree(). Returns 1 on success.
+*/
+int pack_octree_exclusions( PACKED_OCTREE *packed, struct agsetup *ags );
+
+/**
+   Free the memory allocated to the PACKED_OCTREE data structure pointed to by 'packed'.
+*/
+void destroy_packed_octree( PACKED_OCTREE *packed );
+
+/**
+   Packed counterpart of octree_accumulation_excluding_far() without a transformation matrix.
+   Returns the sum of the leaf-pair interaction values between 'octree_static' and 'octree_moving'
+   computed by 'processing_function'. The packed gradients are zeroed first and added to the
+   gradients of the atoms at the end.
+*/
+double packed_octree_accumulation_excluding_far( PACKED_OCTREE *octree_static, PACKED_OCTREE *octree_moving,
+                                                 double dist_cutoff, void *proc_func_params,
+                                                 void ( * processing_function )( PACKED_OCTREE_PARAMS *, double * ) );
+
+/**
+   Packed counterpart of vdweng_octree_single_mol(): 'octpar->proc_func_params' points to an
+   OCTREE_PARAMS whose ags provides the exclusions, and both octrees are packed from the same
+   molecule as described there. When both are the same packed octree with exclusion masks the
+   leaf pairs go through vdw_leaf_simd(), otherwise through a scalar loop.
+*/
+void vdweng_packed_octree_single_mol( PACKED_OCTREE_PARAMS *octpar, double *energy );
+
+/**
+   Packed counterpart of eleng_octree_single_mol(), the OCTREE_PARAMS passed through
+   'octpar->proc_func_params' also provides eps.
+*/
+void eleng_packed_octree_single_mol( PACKED_OCTREE_PARAMS *octpar, double *energy );
+
+#endif
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include _MOL_INCLUDE_
+
+int mol_num_threads(void)
+{
+#ifdef _OPENMP
+	if (omp_in_parallel())
+		return 1;
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+double *mol_thread_grads_alloc(int nthreads, int natoms)
+{
+	return _mol_calloc((size_t) nthreads * 3 * natoms, sizeof(double));
+}
+
+void mol_thread_grads_reduce(mol_atom * atoms, int natoms, int nthreads,
+			     const double *tg)
+{
+	int i, t;
+	const int n = natoms;
+	const size_t stride = 3 * (size_t) n;
+
+#ifdef _OPENMP
+#pragma omp parallel for private(t) schedule(static) num_threads(nthreads)
+#endif
+	for (i = 0; i < n; i++) {
+		double gx = 0.0, gy = 0.0, gz = 0.0;
+		for (t = 0; t < nthreads; t++) {
+			const double *g = tg + t * stride + 3 * i;
+			gx += g[0];
+			gy += g[1];
+			gz += g[2];
+		}
+		atoms[i].GX += gx;
+		atoms[i].GY += gy;
+		atoms[i].GZ += gz;
+	}
+}
+
+double mol_thread_sum(int nthreads, const double *en)
+{
+	int t;
+	double s = 0.0;
+	for (t = 0; t < nthreads; t++)
+		s += en[t];
+	return s;
+}
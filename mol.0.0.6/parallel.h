@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_PARALLEL_H_
+#define _MOL_PARALLEL_H_
+
+/** \file parallel.h
+	Helpers shared by the threaded energy kernels.
+	Threading is enabled when the library is compiled with
+	OpenMP (make openmp, or cmake -DLIBMOL_OPENMP=ON); without
+	it every helper behaves as if a single thread was running.
+
+	Threaded kernels accumulate gradients into private per-thread
+	buffers and fold them into the atoms in thread order, so the
+	result is bit-reproducible for a fixed number of threads.
+*/
+
+/** smallest number of pairs worth spreading over threads */
+#define MOL_PARALLEL_MIN_PAIRS 4096
+
+/** number of threads a kernel started here would use, 1 inside a parallel region */
+int mol_num_threads(void);
+
+/**
+	Allocates nthreads zeroed blocks of 3*natoms doubles,
+	block t holds x,y,z gradients of thread t interleaved per atom.
+*/
+double *mol_thread_grads_alloc(int nthreads, int natoms);
+
+/**
+	Adds the per-thread gradient blocks tg to GX, GY, GZ of the
+	natoms atoms, summing threads in increasing order.
+*/
+void mol_thread_grads_reduce(mol_atom *atoms, int natoms, int nthreads, const double *tg);
+
+/** sums en[0..nthreads-1] in increasing order */
+double mol_thread_sum(int nthreads, const double *en);
+
+#endif
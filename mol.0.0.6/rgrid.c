@@ -0,0 +1,370 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include _MOL_INCLUDE_
+
+//! Clamp v to the map range.
+static float rgrid_clamp(double v)
+{
+	if (v > RGRID_ECAP)
+		return RGRID_ECAP;
+	if (v < -RGRID_ECAP)
+		return -RGRID_ECAP;
+	return v;
+}
+
+//! Sample the receptor sums at the grid points of slice k.
+static void rgrid_slice(struct rgrid *grid, const struct rec_cells *cells,
+			const double *teps, const double *trminh, int k)
+{
+	int i, j, t, cx, cy, cz;
+	const struct atom *ra = cells->ag->atoms;
+	const double rc = grid->rc, rc2 = rc * rc, rc2i = 1.0 / rc2;
+	const double pf = CCELEC / grid->eps;
+	const double is2 = 1.0 / (2.0 * RGRID_DSOLV_SIGMA * RGRID_DSOLV_SIGMA);
+	double *ev = _mol_malloc((grid->ntypes + 1) * sizeof(double));
+
+	for (j = 0; j < grid->ny; j++)
+		for (i = 0; i < grid->nx; i++) {
+			const int p = (k * grid->ny + j) * grid->nx + i;
+			const double x = grid->ox + i * grid->h;
+			const double y = grid->oy + j * grid->h;
+			const double z = grid->oz + k * grid->h;
+			int x0 = (int)floor((x - cells->ox) / rc) - 1;
+			int y0 = (int)floor((y - cells->oy) / rc) - 1;
+			int z0 = (int)floor((z - cells->oz) / rc) - 1;
+			double ee = 0.0, ds = 0.0;
+
+			for (t = 0; t < grid->ntypes; t++)
+				ev[t] = 0.0;
+			for (cz = (z0 > 0 ? z0 : 0);
+			     cz <= z0 + 2 && cz < cells->nz; cz++)
+				for (cy = (y0 > 0 ? y0 : 0);
+				     cy <= y0 + 2 && cy < cells->ny; cy++)
+					for (cx = (x0 > 0 ? x0 : 0);
+					     cx <= x0 + 2 && cx < cells->nx;
+					     cx++) {
+						const int c =
+						    (cz * cells->ny +
+						     cy) * cells->nx + cx;
+						int l;
+						for (l = cells->offs[c];
+						     l < cells->offs[c + 1];
+						     l++) {
+							const struct atom *a =
+							    &(ra
+							      [cells->atoms
+							       [l]]);
+							double dx = x - a->X;
+							double dy = y - a->Y;
+							double dz = z - a->Z;
+							double d2 =
+							    dx * dx + dy * dy +
+							    dz * dz;
+							double dv;
+							if (d2 >= rc2)
+								continue;
+							if (d2 < 1e-4)
+								d2 = 1e-4;
+							for (t = 0;
+							     t < grid->ntypes;
+							     t++) {
+								double rij =
+								    trminh[t] +
+								    a->rminh;
+								ev[t] +=
+								    vdw_pair
+								    (teps[t] *
+								     a->eps,
+								     rij * rij,
+								     d2, rc2,
+								     &dv);
+							}
+							ee += ele_pair(pf *
+								       a->chrg,
+								       d2, rc,
+								       rc2i,
+								       &dv);
+							ds += a->acevolume *
+							    exp(-d2 * is2);
+						}
+					}
+			for (t = 0; t < grid->ntypes; t++)
+				grid->vdw[t][p] = rgrid_clamp(ev[t]);
+			if (grid->ele != NULL)
+				grid->ele[p] = rgrid_clamp(ee);
+			if (grid->dsolv != NULL)
+				grid->dsolv[p] = rgrid_clamp(ds);
+		}
+	free(ev);
+}
+
+struct rgrid *rgrid_create(const struct atomgrp *rec,
+			   const struct atomgrp *lig, const double *lo,
+			   const double *hi, double h, double rc, double eps,
+			   int terms)
+{
+	int i, t, k, npts, *rep;
+	double *teps, *trminh;
+	struct rec_cells *cells;
+	struct rgrid *grid;
+
+	if (!(h > 0) || !(rc > 0) || hi[0] < lo[0] || hi[1] < lo[1]
+	    || hi[2] < lo[2]) {
+		print_error("rgrid_create: invalid box, spacing %f or cutoff "
+			    "%f\n", h, rc);
+		return NULL;
+	}
+	grid = _mol_calloc(1, sizeof(struct rgrid));
+	grid->terms = terms;
+	grid->h = h;
+	grid->rc = rc;
+	grid->eps = eps;
+	grid->ox = lo[0];
+	grid->oy = lo[1];
+	grid->oz = lo[2];
+	grid->nx = (int)ceil((hi[0] - lo[0]) / h) + 1;
+	grid->ny = (int)ceil((hi[1] - lo[1]) / h) + 1;
+	grid->nz = (int)ceil((hi[2] - lo[2]) / h) + 1;
+	npts = grid->nx * grid->ny * grid->nz;
+
+/* number the ligand atom types, rep[t] is an atom of map t */
+	grid->nftypes = 1;
+	for (i = 0; i < lig->natoms; i++)
+		if (lig->atoms[i].atom_ftypen >= grid->nftypes)
+			grid->nftypes = lig->atoms[i].atom_ftypen + 1;
+	grid->itype = _mol_malloc(grid->nftypes * sizeof(int));
+	for (i = 0; i < grid->nftypes; i++)
+		grid->itype[i] = -1;
+	rep = _mol_malloc(grid->nftypes * sizeof(int));
+	if (terms & RGRID_VDW) {
+		for (i = 0; i < lig->natoms; i++) {
+			const struct atom *a = &(lig->atoms[i]);
+			t = grid->itype[a->atom_ftypen];
+			if (t < 0) {
+				t = grid->ntypes++;
+				grid->itype[a->atom_ftypen] = t;
+				rep[t] = i;
+			} else if (a->eps != lig->atoms[rep[t]].eps
+				   || a->rminh != lig->atoms[rep[t]].rminh) {
+				print_error("rgrid_create: atoms %d and %d of "
+					    "type %d differ in eps or rminh\n",
+					    rep[t], i, a->atom_ftypen);
+				free(rep);
+				free_rgrid(grid);
+				return NULL;
+			}
+		}
+	}
+	teps = _mol_malloc((grid->ntypes + 1) * sizeof(double));
+	trminh = _mol_malloc((grid->ntypes + 1) * sizeof(double));
+	grid->vdw = _mol_calloc(grid->ntypes + 1, sizeof(float *));
+	for (t = 0; t < grid->ntypes; t++) {
+		teps[t] = lig->atoms[rep[t]].eps;
+		trminh[t] = lig->atoms[rep[t]].rminh;
+		grid->vdw[t] = _mol_malloc(npts * sizeof(float));
+	}
+	free(rep);
+	if (terms & RGRID_ELE)
+		grid->ele = _mol_malloc(npts * sizeof(float));
+	if (terms & RGRID_DSOLV)
+		grid->dsolv = _mol_malloc(npts * sizeof(float));
+
+	cells = rec_cells_create(rec, rc);
+	if (cells == NULL) {
+		free(teps);
+		free(trminh);
+		free_rgrid(grid);
+		return NULL;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(mol_num_threads())
+#endif
+	for (k = 0; k < grid->nz; k++)
+		rgrid_slice(grid, cells, teps, trminh, k);
+	free_rec_cells(cells);
+	free(teps);
+	free(trminh);
+	return grid;
+}
+
+void destroy_rgrid(struct rgrid *grid)
+{
+	int t;
+	if (grid->vdw != NULL)
+		for (t = 0; t < grid->ntypes; t++)
+			free(grid->vdw[t]);
+	free(grid->vdw);
+	free(grid->itype);
+	free(grid->ele);
+	free(grid->dsolv);
+	grid->vdw = NULL;
+	grid->itype = NULL;
+	grid->ele = NULL;
+	grid->dsolv = NULL;
+}
+
+void free_rgrid(struct rgrid *grid)
+{
+	destroy_rgrid(grid);
+	free(grid);
+}
+
+//! Trilinear interpolation of map at the cell p with fractions t.
+/*! Returns the value, its derivatives over the fractions go to d. */
+static double rgrid_lerp(const float *map, int p, int nx, int nxy,
+			 const double *t, double *d)
+{
+	const double c000 = map[p], c100 = map[p + 1];
+	const double c010 = map[p + nx], c110 = map[p + nx + 1];
+	const double c001 = map[p + nxy], c101 = map[p + nxy + 1];
+	const double c011 = map[p + nxy + nx], c111 = map[p + nxy + nx + 1];
+	const double ux = 1.0 - t[0], uy = 1.0 - t[1], uz = 1.0 - t[2];
+	const double c00 = c000 * ux + c100 * t[0];
+	const double c10 = c010 * ux + c110 * t[0];
+	const double c01 = c001 * ux + c101 * t[0];
+	const double c11 = c011 * ux + c111 * t[0];
+	const double c0 = c00 * uy + c10 * t[1];
+	const double c1 = c01 * uy + c11 * t[1];
+
+	d[0] = ((c100 - c000) * uy + (c110 - c010) * t[1]) * uz +
+	    ((c101 - c001) * uy + (c111 - c011) * t[1]) * t[2];
+	d[1] = (c10 - c00) * uz + (c11 - c01) * t[2];
+	d[2] = c1 - c0;
+	return c0 * uz + c1 * t[2];
+}
+
+int rgrid_check_types(const struct rgrid *grid, const struct atomgrp *ag)
+{
+	int i;
+
+	if (grid->ntypes == 0)
+		return 1;
+	for (i = 0; i < ag->natoms; i++) {
+		const int t = ag->atoms[i].atom_ftypen;
+		if (t < 0 || t >= grid->nftypes || grid->itype[t] < 0) {
+			print_error("rgrid: no vdW map for atom %d of type "
+				    "%d\n", i, t);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int rgrid_eng(const struct rgrid *grid, struct atomgrp *ag, double *ven,
+	      double *een, double *dsen)
+{
+	int i, k;
+	const int nx = grid->nx, nxy = grid->nx * grid->ny;
+	const double ih = 1.0 / grid->h;
+	double ev = 0.0, ee = 0.0, ed = 0.0;
+
+	if (ven != NULL && !rgrid_check_types(grid, ag))
+		return 0;
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		double f[3], t[3], d[3], g[3] = { 0.0, 0.0, 0.0 };
+		int c[3], p;
+		const int n[3] = { grid->nx, grid->ny, grid->nz };
+
+		f[0] = (a->X - grid->ox) * ih;
+		f[1] = (a->Y - grid->oy) * ih;
+		f[2] = (a->Z - grid->oz) * ih;
+		for (k = 0; k < 3; k++) {
+			if (!(f[k] >= 0.0) || f[k] >= n[k] - 1)
+				break;
+			c[k] = (int)f[k];
+			t[k] = f[k] - c[k];
+		}
+		if (k < 3)
+			continue;	/* outside the box */
+		p = (c[2] * grid->ny + c[1]) * nx + c[0];
+
+		if (ven != NULL && grid->ntypes > 0) {
+			const int m = grid->itype[a->atom_ftypen];
+			ev += rgrid_lerp(grid->vdw[m], p, nx, nxy, t, d);
+			for (k = 0; k < 3; k++)
+				g[k] += d[k];
+		}
+		if (een != NULL && grid->ele != NULL) {
+			ee += a->chrg * rgrid_lerp(grid->ele, p, nx, nxy, t,
+						   d);
+			for (k = 0; k < 3; k++)
+				g[k] += a->chrg * d[k];
+		}
+		if (dsen != NULL && grid->dsolv != NULL) {
+			const double s = RGRID_QSOLPAR * fabs(a->chrg);
+			ed += s * rgrid_lerp(grid->dsolv, p, nx, nxy, t, d);
+			for (k = 0; k < 3; k++)
+				g[k] += s * d[k];
+		}
+		a->GX -= g[0] * ih;
+		a->GY -= g[1] * ih;
+		a->GZ -= g[2] * ih;
+	}
+	if (ven != NULL)
+		(*ven) += ev;
+	if (een != NULL)
+		(*een) += ee;
+	if (dsen != NULL)
+		(*dsen) += ed;
+	return 1;
+}
+
+void rgrid_egfun(int ndim, double *inp, void *prms, double *en,
+		 double *grad)
+{
+	int i, j;
+	struct rgrid_minprms *mp = (struct rgrid_minprms *)prms;
+	struct atomgrp *ag = mp->ag;
+
+	if (inp != NULL) {
+		if (mp->rigid != NULL)
+			rigidbody2ag(inp, ag, mp->rigid);
+		else
+			array2ag(inp, ag);
+	}
+	zero_grads(ag);
+	*en = 0.0;
+	rgrid_eng(mp->grid, ag, en, en, en);
+	if (grad == NULL)
+		return;
+	if (mp->rigid != NULL) {
+		mol_rigidbody_grad(grad, ag, inp, mp->rigid->origin);
+		return;
+	}
+	for (j = 0; j < ndim / 3; j++) {
+		i = ag->activelist[j];
+		grad[3 * j] = -ag->atoms[i].GX;
+		grad[3 * j + 1] = -ag->atoms[i].GY;
+		grad[3 * j + 2] = -ag->atoms[i].GZ;
+	}
+}
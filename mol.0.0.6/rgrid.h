@@ -0,0 +1,126 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_RGRID_H_
+#define _MOL_RGRID_H_
+
+/** \file rgrid.h
+	Precomputed receptor maps for rigid receptor scoring.
+
+	The receptor's contribution to the energy of a ligand atom is
+	sampled once on a regular grid over a box: one switched
+	Lennard-Jones map per ligand atom type, the shifted Coulomb
+	potential of eleng, and a desolvation map. A ligand atom then
+	costs a trilinear interpolation of at most three maps, whatever
+	the size of the receptor. Gradients are the exact derivatives of
+	the interpolant, so minimizers see a consistent surface.
+
+	Desolvation follows the charge term of AutoDock 4: the map holds
+	sum_j V_j exp(-r^2 / (2 sigma^2)) over receptor acevolume V_j and a
+	ligand atom of charge q adds RGRID_QSOLPAR |q| times its value.
+
+	Maps are stored in single precision and clamped to RGRID_ECAP.
+	Atoms outside the box get no energy, so the box should reach the
+	cutoff beyond the region the ligand explores.
+*/
+
+/** maps to build, bits of rgrid_create's terms */
+#define RGRID_VDW 1
+#define RGRID_ELE 2
+#define RGRID_DSOLV 4
+
+/** default grid spacing in A */
+#define RGRID_DEFAULT_SPACING 0.375
+/** map values are clamped to [-RGRID_ECAP, RGRID_ECAP] */
+#define RGRID_ECAP 1000.0
+/** width of the desolvation gaussian in A */
+#define RGRID_DSOLV_SIGMA 3.6
+/** desolvation per unit charge and receptor volume */
+#define RGRID_QSOLPAR 0.01097
+
+struct rgrid
+{
+	int terms; /**< RGRID_VDW, RGRID_ELE and/or RGRID_DSOLV */
+	int nx, ny, nz; /**< grid points along each axis */
+	double ox, oy, oz; /**< first grid point */
+	double h; /**< grid spacing */
+	double rc; /**< cutoff of the receptor sums */
+	double eps; /**< dielectric the electrostatic map was built with */
+	int nftypes; /**< length of itype */
+	int *itype; /**< vdW map of each atom_ftypen, -1 if none */
+	int ntypes; /**< number of vdW maps */
+	float **vdw; /**< ntypes maps of nx*ny*nz values, x fastest */
+	float *ele; /**< electrostatic potential per unit charge */
+	float *dsolv; /**< desolvation map */
+};
+
+/**
+	Builds the maps selected by terms for the receptor rec over the
+	box lo..hi (x, y, z) with spacing h, cutoff rc and dielectric eps.
+	vdW maps are built for the atom types found in lig, whose atoms
+	of one atom_ftypen must share eps and rminh; returns NULL (with
+	an error printed) if they do not.
+*/
+struct rgrid *rgrid_create(const struct atomgrp *rec,
+                           const struct atomgrp *lig, const double *lo,
+                           const double *hi, double h, double rc,
+                           double eps, int terms);
+void destroy_rgrid(struct rgrid *grid);
+void free_rgrid(struct rgrid *grid);
+
+/**
+	Returns 1 if every atom of ag has a vdW map in grid (or grid has
+	none), else prints the first atom without one and returns 0.
+*/
+int rgrid_check_types(const struct rgrid *grid, const struct atomgrp *ag);
+
+/**
+	Adds the map energies of the atoms of ag to ven, een and dsen
+	(NULL skips a term) and their gradients to GX, GY, GZ. Returns 0,
+	adding nothing, if ven is given and rgrid_check_types fails.
+*/
+int rgrid_eng(const struct rgrid *grid, struct atomgrp *ag, double *ven,
+              double *een, double *dsen);
+
+/** parameters of rgrid_egfun */
+struct rgrid_minprms
+{
+	struct atomgrp *ag; /**< ligand, its active atoms are moved */
+	const struct rgrid *grid; /**< receptor maps */
+	struct rigidbody *rigid; /**< reference of a 6 dimensional rigid body input (from ag2rigidbody), NULL for cartesian */
+};
+
+/**
+	Energy and gradient callback for minimize_ag and the other
+	minimizers, scoring ag against the maps of grid; prms points to
+	a struct rgrid_minprms. The callback cannot report errors, so
+	check the ligand with rgrid_check_types before minimizing.
+*/
+void rgrid_egfun(int ndim, double *inp, void *prms, double *en,
+                 double *grad);
+
+#endif
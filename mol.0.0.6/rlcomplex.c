@@ -0,0 +1,453 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include _MOL_INCLUDE_
+
+//! Grow *buf of *cap elements of size sz to hold need, 1 if it grew.
+/*! Capacity at least doubles, so repeated ligands settle on one
+    allocation. */
+static int rlc_reserve(void **buf, int *cap, int need, size_t sz)
+{
+	int ncap = *cap;
+	if (need <= ncap && *buf != NULL)
+		return 0;
+	if (ncap < 16)
+		ncap = 16;
+	while (ncap < need)
+		ncap *= 2;
+	*buf = _mol_realloc(*buf, ncap * sz);
+	*cap = ncap;
+	return 1;
+}
+
+//! Copy of the n pointers of src, NULL for none.
+static void *rlc_dup_ptrs(void *src, int n, size_t sz)
+{
+	void *p;
+	if (n == 0)
+		return NULL;
+	p = _mol_malloc(n * sz);
+	memcpy(p, src, n * sz);
+	return p;
+}
+
+//! Point the receptor terms of cx->ag at its own atoms and terms.
+/*! Rederived from cx->rec, so this runs again whenever an array of
+    cx->ag is reallocated. */
+static void rlc_link_rec(struct rlcomplex *cx)
+{
+	int i, j;
+	const struct atomgrp *rec = cx->rec;
+	struct atomgrp *ag = cx->ag;
+
+	for (i = 0; i < cx->rec_nbonds; i++) {
+		ag->bonds[i].a0 = ag->atoms + (rec->bonds[i].a0 - rec->atoms);
+		ag->bonds[i].a1 = ag->atoms + (rec->bonds[i].a1 - rec->atoms);
+	}
+	for (i = 0; i < cx->rec_nangs; i++) {
+		ag->angs[i].a0 = ag->atoms + (rec->angs[i].a0 - rec->atoms);
+		ag->angs[i].a1 = ag->atoms + (rec->angs[i].a1 - rec->atoms);
+		ag->angs[i].a2 = ag->atoms + (rec->angs[i].a2 - rec->atoms);
+	}
+	for (i = 0; i < cx->rec_ntors; i++) {
+		ag->tors[i].a0 = ag->atoms + (rec->tors[i].a0 - rec->atoms);
+		ag->tors[i].a1 = ag->atoms + (rec->tors[i].a1 - rec->atoms);
+		ag->tors[i].a2 = ag->atoms + (rec->tors[i].a2 - rec->atoms);
+		ag->tors[i].a3 = ag->atoms + (rec->tors[i].a3 - rec->atoms);
+	}
+	for (i = 0; i < cx->rec_nimps; i++) {
+		ag->imps[i].a0 = ag->atoms + (rec->imps[i].a0 - rec->atoms);
+		ag->imps[i].a1 = ag->atoms + (rec->imps[i].a1 - rec->atoms);
+		ag->imps[i].a2 = ag->atoms + (rec->imps[i].a2 - rec->atoms);
+		ag->imps[i].a3 = ag->atoms + (rec->imps[i].a3 - rec->atoms);
+	}
+	for (i = 0; i < cx->nrec; i++) {
+		const struct atom *ra = &(rec->atoms[i]);
+		struct atom *a = &(ag->atoms[i]);
+		for (j = 0; j < a->nbonds; j++)
+			a->bonds[j] = ag->bonds + (ra->bonds[j] - rec->bonds);
+		for (j = 0; j < a->nangs; j++)
+			a->angs[j] = ag->angs + (ra->angs[j] - rec->angs);
+		for (j = 0; j < a->ntors; j++)
+			a->tors[j] = ag->tors + (ra->tors[j] - rec->tors);
+		for (j = 0; j < a->nimps; j++)
+			a->imps[j] = ag->imps + (ra->imps[j] - rec->imps);
+	}
+}
+
+//! Make room in cx->ag for natoms atoms and the given bonded terms.
+static void rlc_reserve_ag(struct rlcomplex *cx, int natoms, int nbonds,
+			   int nangs, int ntors, int nimps)
+{
+	struct atomgrp *ag = cx->ag;
+	struct nblist *nblst = cx->ags.nblst;
+	int moved = 0;
+
+	if (rlc_reserve((void **)&(ag->atoms), &(cx->atoms_cap), natoms,
+			sizeof(struct atom))) {
+		moved = 1;
+		if (nblst != NULL) {
+			cx->ags.excl_offs =
+			    _mol_realloc(cx->ags.excl_offs,
+					 (cx->atoms_cap + 1) * sizeof(int));
+			nblst->crds =
+			    _mol_realloc(nblst->crds,
+					 3 * cx->atoms_cap * sizeof(float));
+			if (nblst->order != NULL) {
+				nblst->order =
+				    _mol_realloc(nblst->order,
+						 cx->atoms_cap * sizeof(int));
+				nblst->rank =
+				    _mol_realloc(nblst->rank,
+						 cx->atoms_cap * sizeof(int));
+			}
+		}
+	}
+	moved |= rlc_reserve((void **)&(ag->bonds), &(cx->bonds_cap), nbonds,
+			     sizeof(struct atombond));
+	moved |= rlc_reserve((void **)&(ag->angs), &(cx->angs_cap), nangs,
+			     sizeof(struct atomangle));
+	moved |= rlc_reserve((void **)&(ag->tors), &(cx->tors_cap), ntors,
+			     sizeof(struct atomtorsion));
+	moved |= rlc_reserve((void **)&(ag->imps), &(cx->imps_cap), nimps,
+			     sizeof(struct atomimproper));
+	if (moved)
+		rlc_link_rec(cx);
+}
+
+//! Free the per atom term pointers of atoms [from, to) of cx->ag.
+static void rlc_free_atom_ptrs(struct rlcomplex *cx, int from, int to)
+{
+	int i;
+	for (i = from; i < to; i++) {
+		struct atom *a = &(cx->ag->atoms[i]);
+		free(a->bonds);
+		free(a->angs);
+		free(a->tors);
+		free(a->imps);
+		a->bonds = NULL;
+		a->angs = NULL;
+		a->tors = NULL;
+		a->imps = NULL;
+	}
+}
+
+//! Active atoms and terms of cx->ag, as fixed_update lists them.
+/*! The receptor is all fixed, so these are the ligand atoms and the
+    ligand terms behind the receptor's in every array. ag->btab is
+    rebuilt from them. */
+static void rlc_update_actives(struct rlcomplex *cx)
+{
+	int i;
+	struct atomgrp *ag = cx->ag;
+	int nlig = ag->natoms - cx->nrec;
+
+	free(ag->activelist);
+	free(ag->bact);
+	free(ag->angact);
+	free(ag->toract);
+	free(ag->impact);
+	ag->nactives = nlig;
+	ag->nbact = ag->nbonds - cx->rec_nbonds;
+	ag->nangact = ag->nangs - cx->rec_nangs;
+	ag->ntoract = ag->ntors - cx->rec_ntors;
+	ag->nimpact = ag->nimps - cx->rec_nimps;
+	ag->activelist = _mol_malloc((nlig + 1) * sizeof(int));
+	ag->bact = _mol_malloc((ag->nbact + 1) * sizeof(struct atombond *));
+	ag->angact =
+	    _mol_malloc((ag->nangact + 1) * sizeof(struct atomangle *));
+	ag->toract =
+	    _mol_malloc((ag->ntoract + 1) * sizeof(struct atomtorsion *));
+	ag->impact =
+	    _mol_malloc((ag->nimpact + 1) * sizeof(struct atomimproper *));
+	for (i = 0; i < nlig; i++)
+		ag->activelist[i] = cx->nrec + i;
+	for (i = 0; i < ag->nbact; i++)
+		ag->bact[i] = &(ag->bonds[cx->rec_nbonds + i]);
+	for (i = 0; i < ag->nangact; i++)
+		ag->angact[i] = &(ag->angs[cx->rec_nangs + i]);
+	for (i = 0; i < ag->ntoract; i++)
+		ag->toract[i] = &(ag->tors[cx->rec_ntors + i]);
+	for (i = 0; i < ag->nimpact; i++)
+		ag->impact[i] = &(ag->imps[cx->rec_nimps + i]);
+	init_agbtab(ag);
+}
+
+struct rlcomplex *rlcomplex_create(const struct atomgrp *rec, double nbcof,
+				   double skin)
+{
+	int i;
+	struct rlcomplex *cx;
+	struct atomgrp *ag;
+
+	if (rec->natoms < 1 || nbcof <= 0.0 || skin < 0.0) {
+		print_error("rlcomplex_create: %d receptor atoms, cutoff %lf, "
+			    "skin %lf\n", rec->natoms, nbcof, skin);
+		return NULL;
+	}
+	cx = _mol_calloc(1, sizeof(struct rlcomplex));
+	ag = _mol_calloc(1, sizeof(struct atomgrp));
+	cx->ag = ag;
+	cx->rec = rec;
+	cx->nrec = rec->natoms;
+	cx->nbcof = nbcof;
+	cx->skin = skin;
+	cx->rec_nbonds = rec->nbonds;
+	cx->rec_nangs = rec->nangs;
+	cx->rec_ntors = rec->ntors;
+	cx->rec_nimps = rec->nimps;
+
+	rlc_reserve_ag(cx, cx->nrec + RLCOMPLEX_LIG_CAP, rec->nbonds,
+		       rec->nangs, rec->ntors, rec->nimps);
+	memcpy(ag->atoms, rec->atoms, cx->nrec * sizeof(struct atom));
+	memcpy(ag->bonds, rec->bonds, rec->nbonds * sizeof(struct atombond));
+	memcpy(ag->angs, rec->angs, rec->nangs * sizeof(struct atomangle));
+	memcpy(ag->tors, rec->tors, rec->ntors * sizeof(struct atomtorsion));
+	memcpy(ag->imps, rec->imps,
+	       rec->nimps * sizeof(struct atomimproper));
+	for (i = 0; i < cx->nrec; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		a->bonds = rlc_dup_ptrs(a->bonds, a->nbonds,
+					sizeof(struct atombond *));
+		a->angs = rlc_dup_ptrs(a->angs, a->nangs,
+				       sizeof(struct atomangle *));
+		a->tors = rlc_dup_ptrs(a->tors, a->ntors,
+				       sizeof(struct atomtorsion *));
+		a->imps = rlc_dup_ptrs(a->imps, a->nimps,
+				       sizeof(struct atomimproper *));
+		a->ingrp = i;
+		a->fixed = 1;
+	}
+	rlc_link_rec(cx);
+
+	ag->natoms = cx->nrec;
+	ag->nbonds = rec->nbonds;
+	ag->nangs = rec->nangs;
+	ag->ntors = rec->ntors;
+	ag->nimps = rec->nimps;
+	ag->num_atom_types = rec->num_atom_types;
+	ag->prm = rec->prm;
+
+/* the receptor setup, kept at the head of every list of cx->ags */
+	init_nblst_cutoff(ag, &(cx->ags), nbcof, skin);
+	cx->rec_n02 = cx->list02_cap = cx->ags.n02;
+	cx->rec_n03 = cx->list03_cap = cx->ags.n03;
+	cx->rec_nexcl = cx->excl_cap = cx->ags.excl_offs[cx->nrec];
+	cx->rec_nclusters = cx->clusters_cap = cx->ags.clst->nclusters;
+/* the legacy exclusion table would not cover the ligand */
+	free(cx->ags.excl_list);
+	free(cx->ags.pd1);
+	free(cx->ags.pd2);
+	cx->ags.excl_list = NULL;
+	cx->ags.pd1 = NULL;
+	cx->ags.pd2 = NULL;
+	cx->ags.ndm = -1;
+	cx->ags.excl_offs =
+	    _mol_realloc(cx->ags.excl_offs, (cx->atoms_cap + 1) * sizeof(int));
+	cx->ags.nblst->crds =
+	    _mol_realloc(cx->ags.nblst->crds,
+			 3 * cx->atoms_cap * sizeof(float));
+	rlc_update_actives(cx);
+	return cx;
+}
+
+void rlcomplex_set_ligand(struct rlcomplex *cx, const struct atomgrp *lig)
+{
+	int i, j, nlig = lig->natoms, nrec = cx->nrec;
+	int natoms = nrec + nlig, nexcl, ncl;
+	int res_shift = cx->rec->atoms[nrec - 1].comb_res_seq + 100;
+	struct atomgrp *ag = cx->ag;
+	struct agsetup *ags = &(cx->ags);
+	struct atomgrp view;
+	struct agsetup ls;
+	struct atom *la;
+	struct atombond *lb;
+	struct atomangle *lan;
+	struct atomtorsion *lt;
+	struct atomimproper *li;
+
+	rlc_free_atom_ptrs(cx, nrec, ag->natoms);
+	rlc_reserve_ag(cx, natoms, cx->rec_nbonds + lig->nbonds,
+		       cx->rec_nangs + lig->nangs, cx->rec_ntors + lig->ntors,
+		       cx->rec_nimps + lig->nimps);
+	la = ag->atoms + nrec;
+	lb = ag->bonds + cx->rec_nbonds;
+	lan = ag->angs + cx->rec_nangs;
+	lt = ag->tors + cx->rec_ntors;
+	li = ag->imps + cx->rec_nimps;
+
+/* copy the ligand behind the receptor and point its terms at the copy */
+	memcpy(la, lig->atoms, nlig * sizeof(struct atom));
+	memcpy(lb, lig->bonds, lig->nbonds * sizeof(struct atombond));
+	memcpy(lan, lig->angs, lig->nangs * sizeof(struct atomangle));
+	memcpy(lt, lig->tors, lig->ntors * sizeof(struct atomtorsion));
+	memcpy(li, lig->imps, lig->nimps * sizeof(struct atomimproper));
+	for (i = 0; i < lig->nbonds; i++) {
+		lb[i].a0 = la + (lig->bonds[i].a0 - lig->atoms);
+		lb[i].a1 = la + (lig->bonds[i].a1 - lig->atoms);
+		lb[i].ai += nrec;
+		lb[i].aj += nrec;
+	}
+	for (i = 0; i < lig->nangs; i++) {
+		lan[i].a0 = la + (lig->angs[i].a0 - lig->atoms);
+		lan[i].a1 = la + (lig->angs[i].a1 - lig->atoms);
+		lan[i].a2 = la + (lig->angs[i].a2 - lig->atoms);
+	}
+	for (i = 0; i < lig->ntors; i++) {
+		lt[i].a0 = la + (lig->tors[i].a0 - lig->atoms);
+		lt[i].a1 = la + (lig->tors[i].a1 - lig->atoms);
+		lt[i].a2 = la + (lig->tors[i].a2 - lig->atoms);
+		lt[i].a3 = la + (lig->tors[i].a3 - lig->atoms);
+	}
+	for (i = 0; i < lig->nimps; i++) {
+		li[i].a0 = la + (lig->imps[i].a0 - lig->atoms);
+		li[i].a1 = la + (lig->imps[i].a1 - lig->atoms);
+		li[i].a2 = la + (lig->imps[i].a2 - lig->atoms);
+		li[i].a3 = la + (lig->imps[i].a3 - lig->atoms);
+	}
+	for (i = 0; i < nlig; i++) {
+		const struct atom *s = &(lig->atoms[i]);
+		struct atom *a = &(la[i]);
+		a->bonds = rlc_dup_ptrs(s->bonds, s->nbonds,
+					sizeof(struct atombond *));
+		for (j = 0; j < a->nbonds; j++)
+			a->bonds[j] = lb + (s->bonds[j] - lig->bonds);
+		a->angs = rlc_dup_ptrs(s->angs, s->nangs,
+				       sizeof(struct atomangle *));
+		for (j = 0; j < a->nangs; j++)
+			a->angs[j] = lan + (s->angs[j] - lig->angs);
+		a->tors = rlc_dup_ptrs(s->tors, s->ntors,
+				       sizeof(struct atomtorsion *));
+		for (j = 0; j < a->ntors; j++)
+			a->tors[j] = lt + (s->tors[j] - lig->tors);
+		a->imps = rlc_dup_ptrs(s->imps, s->nimps,
+				       sizeof(struct atomimproper *));
+		for (j = 0; j < a->nimps; j++)
+			a->imps[j] = li + (s->imps[j] - lig->imps);
+		a->ingrp = i;
+		a->fixed = 0;
+		a->atom_ftypen += cx->rec->num_atom_types;
+		a->comb_res_seq += res_shift;
+		if (a->base >= 0)	/* -1 is no base atom */
+			a->base += nrec;
+		if (a->base2 >= 0)
+			a->base2 += nrec;
+	}
+
+/* setup of the ligand alone, numbered from 0 */
+	memset(&view, 0, sizeof(view));
+	view.natoms = nlig;
+	view.atoms = la;
+	view.nbonds = lig->nbonds;
+	view.bonds = lb;
+	init_nblst_cutoff(&view, &ls, cx->nbcof, cx->skin);
+	for (i = 0; i < nlig; i++)
+		la[i].ingrp = nrec + i;
+
+/* append it to the receptor setup */
+	rlc_reserve((void **)&(ags->list02), &(cx->list02_cap),
+		    cx->rec_n02 + ls.n02, 2 * sizeof(int));
+	for (i = 0; i < 2 * ls.n02; i++)
+		ags->list02[2 * cx->rec_n02 + i] = ls.list02[i] + nrec;
+	ags->n02 = cx->rec_n02 + ls.n02;
+	rlc_reserve((void **)&(ags->list03), &(cx->list03_cap),
+		    cx->rec_n03 + ls.n03, 2 * sizeof(int));
+	for (i = 0; i < 2 * ls.n03; i++)
+		ags->list03[2 * cx->rec_n03 + i] = ls.list03[i] + nrec;
+	ags->n03 = cx->rec_n03 + ls.n03;
+/* receptor pairs are all fixed, so listf03 is the ligand's */
+	for (i = 0; i < 2 * ls.nf03; i++)
+		ls.listf03[i] += nrec;
+	free(ags->listf03);
+	ags->listf03 = ls.listf03;
+	ags->nf03 = ls.nf03;
+	ls.listf03 = NULL;
+
+	nexcl = ls.excl_offs[nlig];
+	rlc_reserve((void **)&(ags->excl_pairs), &(cx->excl_cap),
+		    cx->rec_nexcl + nexcl, sizeof(int));
+	for (i = 0; i <= nlig; i++)
+		ags->excl_offs[nrec + i] = cx->rec_nexcl + ls.excl_offs[i];
+	for (i = 0; i < nexcl; i++)
+		ags->excl_pairs[cx->rec_nexcl + i] =
+		    ls.excl_pairs[i] + (nrec << 2);
+
+	for (i = cx->rec_nclusters; i < ags->clst->nclusters; i++)
+		free(ags->clst->clusters[i].iatom);
+	ncl = ls.clst->nclusters;
+	rlc_reserve((void **)&(ags->clst->clusters), &(cx->clusters_cap),
+		    cx->rec_nclusters + ncl, sizeof(struct cluster));
+	for (i = 0; i < ncl; i++) {
+		struct cluster *c = &(ags->clst->clusters[cx->rec_nclusters + i]);
+		*c = ls.clst->clusters[i];
+		for (j = 0; j < c->natoms; j++)
+			c->iatom[j] += nrec;
+	}
+	ags->clst->nclusters = cx->rec_nclusters + ncl;
+	ls.clst->nclusters = 0;
+	destroy_agsetup(&ls);
+
+	ag->natoms = natoms;
+	ag->nbonds = cx->rec_nbonds + lig->nbonds;
+	ag->nangs = cx->rec_nangs + lig->nangs;
+	ag->ntors = cx->rec_ntors + lig->ntors;
+	ag->nimps = cx->rec_nimps + lig->nimps;
+	ag->num_atom_types = cx->rec->num_atom_types + lig->num_atom_types;
+	ags->nblst->nfat = 0;
+	ags->nblst->npairs = 0;
+	rlc_update_actives(cx);
+}
+
+void destroy_rlcomplex(struct rlcomplex *cx)
+{
+	rlc_free_atom_ptrs(cx, 0, cx->ag->natoms);
+	free(cx->ag->atoms);
+	free(cx->ag->bonds);
+	free(cx->ag->angs);
+	free(cx->ag->tors);
+	free(cx->ag->imps);
+	free(cx->ag->activelist);
+	free(cx->ag->bact);
+	free(cx->ag->angact);
+	free(cx->ag->toract);
+	free(cx->ag->impact);
+	if (cx->ag->btab != NULL)
+		free_agbtab(cx->ag->btab);
+	free(cx->ag);
+	cx->ag = NULL;
+	destroy_agsetup(&(cx->ags));
+}
+
+void free_rlcomplex(struct rlcomplex *cx)
+{
+	destroy_rlcomplex(cx);
+	free(cx);
+}
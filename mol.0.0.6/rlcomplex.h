@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_RLCOMPLEX_H_
+#define _MOL_RLCOMPLEX_H_
+
+/** \file rlcomplex.h
+	Receptor-ligand complexes for screening many ligands.
+
+	join_rec_lig_ff builds a new atom group for every ligand, copying
+	the receptor with all its bonded terms, and init_nblst then
+	redoes the exclusion lists and 1-4 clusters of the whole complex.
+	A struct rlcomplex keeps one complex alive instead: the receptor
+	part of its atom group and of its agsetup is built once by
+	rlcomplex_create, and rlcomplex_set_ligand only rewrites the
+	ligand tail behind it, so swapping ligands costs time in the
+	size of the ligand.
+
+	cx->ag is an ordinary atom group (receptor atoms first, then the
+	ligand's, as join_rec_lig_ff lays them out) and cx->ags its
+	agsetup, so update_nblst, the nonbonded, ACE and hbond energies
+	and the minimizers take them as they are. The receptor atoms are
+	marked fixed, which drops receptor-receptor pairs from the
+	nonbonded list; the ligand atoms and terms make up the active
+	lists (activelist, bact, ..., btab), as fixed_update would set
+	them. Hbond properties and bases of both molecules are
+	carried over, so mark donors and acceptors on rec and on each
+	ligand before passing them in.
+*/
+
+/** room for ligand atoms reserved by rlcomplex_create */
+#define RLCOMPLEX_LIG_CAP 128
+
+struct rlcomplex
+{
+	struct atomgrp *ag; /**< receptor atoms followed by those of the current ligand */
+	struct agsetup ags; /**< nonbonded setup of ag */
+	const struct atomgrp *rec; /**< receptor, only read */
+	int nrec; /**< receptor atoms, the ligand starts at ag->atoms[nrec] */
+	double nbcof, skin; /**< cutoff and list skin of ags */
+	int rec_nbonds, rec_nangs, rec_ntors, rec_nimps; /**< receptor terms heading the bonded arrays of ag */
+	int rec_n02, rec_n03, rec_nexcl, rec_nclusters; /**< receptor entries heading the lists of ags */
+	int atoms_cap, bonds_cap, angs_cap, tors_cap, imps_cap; /**< allocated lengths of the arrays of ag */
+	int list02_cap, list03_cap, excl_cap, clusters_cap; /**< allocated lengths of the lists of ags */
+};
+
+/**
+	Creates a complex of rec and no ligand, with the nonbonded setup
+	of init_nblst_cutoff(nbcof, skin). rec must outlive the complex;
+	atom names are shared with it, not copied. Returns NULL (with an
+	error printed) for an empty receptor or a cutoff init_nblst_cutoff
+	would reject.
+*/
+struct rlcomplex *rlcomplex_create(const struct atomgrp *rec, double nbcof,
+                                   double skin);
+
+/**
+	Replaces the ligand of cx by a copy of lig. Force field types and
+	residue numbers of the copy are shifted past the receptor's as in
+	join_rec_lig_ff; call update_nblst(cx->ag, &cx->ags) before
+	evaluating energies.
+*/
+void rlcomplex_set_ligand(struct rlcomplex *cx, const struct atomgrp *lig);
+
+void destroy_rlcomplex(struct rlcomplex *cx);
+void free_rlcomplex(struct rlcomplex *cx);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include _MOL_INCLUDE_
+
+//! Create the structure-of-arrays view for ag.
+/*! All nine arrays live in one block so that the view is a
+    single contiguous allocation; x is the base of the block. */
+void init_agsoa(struct atomgrp *ag)
+{
+	int n = ag->natoms;
+	struct agsoa *soa = ag->soa;
+	double *block;
+
+	if (soa == NULL) {
+		soa = _mol_calloc(1, sizeof(struct agsoa));
+		ag->soa = soa;
+	}
+	if (soa->natoms != n || soa->x == NULL) {
+		free(soa->x);
+		block = _mol_malloc(9 * (n > 0 ? n : 1) * sizeof(double));
+		soa->natoms = n;
+		soa->x = block;
+		soa->y = block + n;
+		soa->z = block + 2 * n;
+		soa->gx = block + 3 * n;
+		soa->gy = block + 4 * n;
+		soa->gz = block + 5 * n;
+		soa->eps = block + 6 * n;
+		soa->rminh = block + 7 * n;
+		soa->chrg = block + 8 * n;
+	}
+	agsoa_coords_from_atoms(ag);
+	agsoa_params_from_atoms(ag);
+	agsoa_zero_grads(ag);
+}
+
+void destroy_agsoa(struct agsoa *soa)
+{
+	free(soa->x);
+	soa->x = NULL;
+	soa->natoms = 0;
+}
+
+void free_agsoa(struct agsoa *soa)
+{
+	destroy_agsoa(soa);
+	free(soa);
+}
+
+void agsoa_coords_from_atoms(struct atomgrp *ag)
+{
+	int i;
+	struct agsoa *soa = ag->soa;
+	for (i = 0; i < soa->natoms; i++) {
+		soa->x[i] = ag->atoms[i].X;
+		soa->y[i] = ag->atoms[i].Y;
+		soa->z[i] = ag->atoms[i].Z;
+	}
+}
+
+void agsoa_coords_to_atoms(struct atomgrp *ag)
+{
+	int i;
+	struct agsoa *soa = ag->soa;
+	for (i = 0; i < soa->natoms; i++) {
+		ag->atoms[i].X = soa->x[i];
+		ag->atoms[i].Y = soa->y[i];
+		ag->atoms[i].Z = soa->z[i];
+	}
+}
+
+void agsoa_params_from_atoms(struct atomgrp *ag)
+{
+	int i;
+	struct agsoa *soa = ag->soa;
+	for (i = 0; i < soa->natoms; i++) {
+		soa->eps[i] = ag->atoms[i].eps;
+		soa->rminh[i] = ag->atoms[i].rminh;
+		soa->chrg[i] = ag->atoms[i].chrg;
+	}
+}
+
+void agsoa_zero_grads(struct atomgrp *ag)
+{
+	struct agsoa *soa = ag->soa;
+	memset(soa->gx, 0, 3 * soa->natoms * sizeof(double));
+}
+
+void agsoa_grads_to_atoms(struct atomgrp *ag)
+{
+	int i;
+	struct agsoa *soa = ag->soa;
+	for (i = 0; i < soa->natoms; i++) {
+		ag->atoms[i].GX += soa->gx[i];
+		ag->atoms[i].GY += soa->gy[i];
+		ag->atoms[i].GZ += soa->gz[i];
+	}
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_SOA_H_
+#define _MOL_SOA_H_
+
+/** \file soa.h
+	This file contains a packed structure-of-arrays view
+	of the coordinates, gradients and nonbonded parameters
+	of an atomgrp, and functions to keep it in sync with
+	the atoms.
+
+	The view is read by vdweng_soa and eleng_soa. The ACE,
+	bonded and hbond kernels still work on ag->atoms, so
+	sync the view back before calling them.
+*/
+
+/**
+	Contiguous per-atom arrays mirroring the fields of struct atom
+	that are touched by the nonbonded energy kernels.
+	Index i refers to ag->atoms[i].
+*/
+struct agsoa
+{
+	int natoms; /**< number of atoms in the view */
+	double *x, *y, *z; /**< coordinates */
+	double *gx, *gy, *gz; /**< gradients */
+	double *eps; /**< vdw epsilon (sqrt of well depth) */
+	double *rminh; /**< vdw rmin/2 */
+	double *chrg; /**< partial charge */
+};
+
+/**
+	Allocates ag->soa (if not present) and fills coordinates and
+	parameters from ag->atoms, gradients are zeroed.
+*/
+void init_agsoa(struct atomgrp *ag);
+
+void destroy_agsoa(struct agsoa *soa);
+void free_agsoa(struct agsoa *soa);
+
+/** copy X, Y, Z of all atoms into the view */
+void agsoa_coords_from_atoms(struct atomgrp *ag);
+/** copy x, y, z of the view back into the atoms */
+void agsoa_coords_to_atoms(struct atomgrp *ag);
+/** copy eps, rminh and chrg of all atoms into the view */
+void agsoa_params_from_atoms(struct atomgrp *ag);
+/** zero gx, gy, gz of the view */
+void agsoa_zero_grads(struct atomgrp *ag);
+/** add gx, gy, gz of the view to GX, GY, GZ of the atoms */
+void agsoa_grads_to_atoms(struct atomgrp *ag);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include _MOL_INCLUDE_
+
+//! Cell coordinate of x along one axis, clamped to [-1, n].
+static int ws_cell(double x, double o, double rc, int n)
+{
+	double c = floor((x - o) / rc);
+	if (c < -1)
+		return -1;
+	if (c > n)
+		return n;
+	return (int)c;
+}
+
+//! Appends receptor atom j to the pair list, 0 if it cannot grow.
+static int ws_push_pair(struct mol_workspace *ws, int j)
+{
+	if (ws->npairs == ws->pairs_cap) {
+		int cap = 2 * ws->pairs_cap + 1024;
+		int *p = realloc(ws->pairs, cap * sizeof(int));
+		if (p == NULL) {
+			print_error("mol_workspace_pose: out of memory for "
+				    "%d pairs\n", cap);
+			return 0;
+		}
+		ws->pairs = p;
+		ws->pairs_cap = cap;
+	}
+	ws->pairs[ws->npairs++] = j;
+	return 1;
+}
+
+struct rec_cells *rec_cells_create(const struct atomgrp *rec, double rc)
+{
+	int i, ncells, *cnt;
+	double hx, hy, hz;
+	struct rec_cells *cells;
+
+	if (rec->natoms < 1 || !(rc > 0)) {
+		print_error("rec_cells_create: empty receptor or cutoff %f\n",
+			    rc);
+		return NULL;
+	}
+	cells = calloc(1, sizeof(struct rec_cells));
+	if (cells == NULL) {
+		print_error("rec_cells_create: out of memory\n");
+		return NULL;
+	}
+	cells->ag = rec;
+	cells->rc = rc;
+	cells->ox = hx = rec->atoms[0].X;
+	cells->oy = hy = rec->atoms[0].Y;
+	cells->oz = hz = rec->atoms[0].Z;
+	for (i = 1; i < rec->natoms; i++) {
+		const struct atom *a = &(rec->atoms[i]);
+		cells->ox = fmin(cells->ox, a->X);
+		cells->oy = fmin(cells->oy, a->Y);
+		cells->oz = fmin(cells->oz, a->Z);
+		hx = fmax(hx, a->X);
+		hy = fmax(hy, a->Y);
+		hz = fmax(hz, a->Z);
+	}
+	cells->nx = (int)((hx - cells->ox) / rc) + 1;
+	cells->ny = (int)((hy - cells->oy) / rc) + 1;
+	cells->nz = (int)((hz - cells->oz) / rc) + 1;
+	ncells = cells->nx * cells->ny * cells->nz;
+
+	cells->offs = calloc(ncells + 1, sizeof(int));
+	cells->atoms = malloc(rec->natoms * sizeof(int));
+	cnt = calloc(ncells, sizeof(int));
+	if (cells->offs == NULL || cells->atoms == NULL || cnt == NULL) {
+		print_error("rec_cells_create: out of memory for %d cells\n",
+			    ncells);
+		free(cnt);
+		free_rec_cells(cells);
+		return NULL;
+	}
+
+/* counting sort of the atoms by cell */
+	for (i = 0; i < rec->natoms; i++) {
+		const struct atom *a = &(rec->atoms[i]);
+		int cx = ws_cell(a->X, cells->ox, rc, cells->nx - 1);
+		int cy = ws_cell(a->Y, cells->oy, rc, cells->ny - 1);
+		int cz = ws_cell(a->Z, cells->oz, rc, cells->nz - 1);
+		cells->offs[(cz * cells->ny + cy) * cells->nx + cx + 1]++;
+	}
+	for (i = 0; i < ncells; i++)
+		cells->offs[i + 1] += cells->offs[i];
+	for (i = 0; i < rec->natoms; i++) {
+		const struct atom *a = &(rec->atoms[i]);
+		int cx = ws_cell(a->X, cells->ox, rc, cells->nx - 1);
+		int cy = ws_cell(a->Y, cells->oy, rc, cells->ny - 1);
+		int cz = ws_cell(a->Z, cells->oz, rc, cells->nz - 1);
+		int c = (cz * cells->ny + cy) * cells->nx + cx;
+		cells->atoms[cells->offs[c] + cnt[c]++] = i;
+	}
+	free(cnt);
+	return cells;
+}
+
+void destroy_rec_cells(struct rec_cells *cells)
+{
+	free(cells->offs);
+	free(cells->atoms);
+	cells->offs = NULL;
+	cells->atoms = NULL;
+}
+
+void free_rec_cells(struct rec_cells *cells)
+{
+	destroy_rec_cells(cells);
+	free(cells);
+}
+
+struct mol_workspace *mol_workspace_create(int nlig)
+{
+	struct mol_workspace *ws = calloc(1, sizeof(struct mol_workspace));
+
+	if (ws == NULL) {
+		print_error("mol_workspace_create: out of memory\n");
+		return NULL;
+	}
+	ws->nlig = nlig;
+	ws->x = malloc(3 * nlig * sizeof(double));
+	ws->grad = malloc(3 * nlig * sizeof(double));
+	ws->offs = malloc((nlig + 1) * sizeof(int));
+	if (ws->x == NULL || ws->grad == NULL || ws->offs == NULL) {
+		print_error("mol_workspace_create: out of memory for %d atoms\n",
+			    nlig);
+		free_mol_workspace(ws);
+		return NULL;
+	}
+	return ws;
+}
+
+void destroy_mol_workspace(struct mol_workspace *ws)
+{
+	free(ws->x);
+	free(ws->grad);
+	free(ws->offs);
+	free(ws->pairs);
+	ws->x = ws->grad = NULL;
+	ws->offs = ws->pairs = NULL;
+	ws->npairs = ws->pairs_cap = 0;
+}
+
+void free_mol_workspace(struct mol_workspace *ws)
+{
+	destroy_mol_workspace(ws);
+	free(ws);
+}
+
+int mol_workspace_pose(struct mol_workspace *ws,
+		       const struct rec_cells *cells,
+		       const struct atomgrp *lig, double *trans)
+{
+	int i, cx, cy, cz;
+	const struct atom *ra = cells->ag->atoms;
+	double rc2 = cells->rc * cells->rc;
+
+	if (lig->natoms > ws->nlig) {
+		print_error("mol_workspace_pose: ligand of %d atoms, "
+			    "workspace holds %d\n", lig->natoms, ws->nlig);
+		return 0;
+	}
+	ws->npairs = 0;
+	for (i = 0; i < lig->natoms; i++) {
+		double x = lig->atoms[i].X, y = lig->atoms[i].Y, z =
+		    lig->atoms[i].Z;
+		int x0, x1, y0, y1, z0, z1;
+
+		if (trans != NULL)
+			transform_point(x, y, z, trans, &x, &y, &z);
+		ws->x[3 * i] = x;
+		ws->x[3 * i + 1] = y;
+		ws->x[3 * i + 2] = z;
+		ws->offs[i] = ws->npairs;
+
+		cx = ws_cell(x, cells->ox, cells->rc, cells->nx);
+		cy = ws_cell(y, cells->oy, cells->rc, cells->ny);
+		cz = ws_cell(z, cells->oz, cells->rc, cells->nz);
+		x0 = (cx > 0) ? cx - 1 : 0;
+		y0 = (cy > 0) ? cy - 1 : 0;
+		z0 = (cz > 0) ? cz - 1 : 0;
+		x1 = (cx + 1 < cells->nx) ? cx + 1 : cells->nx - 1;
+		y1 = (cy + 1 < cells->ny) ? cy + 1 : cells->ny - 1;
+		z1 = (cz + 1 < cells->nz) ? cz + 1 : cells->nz - 1;
+
+		for (cz = z0; cz <= z1; cz++)
+			for (cy = y0; cy <= y1; cy++)
+				for (cx = x0; cx <= x1; cx++) {
+					int c =
+					    (cz * cells->ny + cy) * cells->nx +
+					    cx;
+					int k;
+					for (k = cells->offs[c];
+					     k < cells->offs[c + 1]; k++) {
+						int j = cells->atoms[k];
+						double dx = x - ra[j].X;
+						double dy = y - ra[j].Y;
+						double dz = z - ra[j].Z;
+						if (dx * dx + dy * dy + dz * dz
+						    >= rc2)
+							continue;
+						if (!ws_push_pair(ws, j))
+							return 0;
+					}
+				}
+	}
+	ws->offs[lig->natoms] = ws->npairs;
+	return 1;
+}
+
+int mol_workspace_nbeng(struct mol_workspace *ws,
+			const struct rec_cells *cells,
+			const struct atomgrp *lig, double *trans,
+			double eps, double *ven, double *een)
+{
+	int i, k;
+	const struct atom *ra = cells->ag->atoms;
+	const double rc = cells->rc;
+	const double rc2 = rc * rc;
+	const double rc2i = 1.0 / rc2;
+	const double pf = CCELEC / eps;
+	double ev = 0.0, ee = 0.0;
+
+	if (!mol_workspace_pose(ws, cells, lig, trans))
+		return 0;
+
+	for (i = 0; i < lig->natoms; i++) {
+		const struct atom *a1 = &(lig->atoms[i]);
+		double x1 = ws->x[3 * i], y1 = ws->x[3 * i + 1], z1 =
+		    ws->x[3 * i + 2];
+		double ch1 = pf * a1->chrg;
+		double gx = 0.0, gy = 0.0, gz = 0.0;
+
+		for (k = ws->offs[i]; k < ws->offs[i + 1]; k++) {
+			const struct atom *a2 = &(ra[ws->pairs[k]]);
+			double dx = x1 - a2->X;
+			double dy = y1 - a2->Y;
+			double dz = z1 - a2->Z;
+			double d2 = dx * dx + dy * dy + dz * dz;
+			double rij = a1->rminh + a2->rminh;
+			double dven, desh, g;
+
+			ev += vdw_pair(a1->eps * a2->eps, rij * rij, d2, rc2,
+				       &dven);
+			ee += ele_pair(ch1 * a2->chrg, d2, rc, rc2i, &desh);
+			g = dven + desh;
+			gx += g * dx;
+			gy += g * dy;
+			gz += g * dz;
+		}
+		ws->grad[3 * i] = gx;
+		ws->grad[3 * i + 1] = gy;
+		ws->grad[3 * i + 2] = gz;
+	}
+	(*ven) += ev;
+	(*een) += ee;
+	return 1;
+}
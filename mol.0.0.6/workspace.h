@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2009-2012, Structural Bioinformatics Laboratory, Boston University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+- Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef _MOL_WORKSPACE_H_
+#define _MOL_WORKSPACE_H_
+
+/** \file workspace.h
+	Reentrant rigid-receptor vdW and electrostatic scoring.
+
+	The energy routines of nbenergy.c, hbond.c and gbsa.c write their
+	results into the atom group they are given (gradients in struct
+	atom, the flow network in ag->flow_struct, the ACE arrays of the
+	acesetup) and reuse the buffers of the nblist, so two threads can
+	never evaluate on the same group. This header does not change
+	them. It adds a separate scorer for the vdW and electrostatic
+	terms of many ligand poses against one rigid receptor:
+
+	- struct rec_cells is a cell index over the receptor atoms. It is
+	  built once and only read afterwards, so it, the receptor
+	  atomgrp and its prm may be shared by any number of threads.
+	- struct mol_workspace holds everything a pose evaluation writes:
+	  the posed ligand coordinates, the receptor-ligand pair list and
+	  the ligand gradient. Each thread owns one.
+
+	The ligand atomgrp is only read as well, so threads may also share
+	it and differ only by the pose they pass in. The buffers that grow
+	during scoring are reallocated without exiting: on failure an
+	error is printed and 0 or NULL returned, and the workspace can
+	still be freed.
+
+	Only these two terms are provided. Hbond, ACE and the bonded terms
+	have no reentrant form: score them with the usual routines on one
+	atom group (and its setups) per thread, e.g. one rlcomplex each.
+*/
+
+/** read-only cell index over the atoms of a receptor */
+struct rec_cells
+{
+	const struct atomgrp *ag; /**< receptor the cells were built for */
+	double rc; /**< cutoff, also the cell edge */
+	double ox, oy, oz; /**< lower corner of the grid */
+	int nx, ny, nz; /**< cells along each axis */
+	int *offs; /**< nx*ny*nz+1 offsets of the cells into atoms */
+	int *atoms; /**< receptor atom indices ordered by cell */
+};
+
+/** per thread scratch of a receptor-ligand evaluation */
+struct mol_workspace
+{
+	int nlig; /**< ligand atoms the buffers are sized for */
+	double *x; /**< 3*nlig posed ligand coordinates */
+	double *grad; /**< 3*nlig gradient over the posed ligand coordinates */
+	int *offs; /**< nlig+1 offsets of each ligand atom's pairs */
+	int *pairs; /**< receptor atoms within the cutoff of each ligand atom */
+	int npairs, pairs_cap; /**< length and capacity of pairs */
+};
+
+/**
+	Builds the cell index of rec for cutoff rc. Coordinates of rec
+	must not change while the index is in use. Returns NULL on
+	failure.
+*/
+struct rec_cells *rec_cells_create(const struct atomgrp *rec, double rc);
+void destroy_rec_cells(struct rec_cells *cells);
+void free_rec_cells(struct rec_cells *cells);
+
+/**
+	Allocates a workspace for ligands of up to nlig atoms, NULL on
+	failure.
+*/
+struct mol_workspace *mol_workspace_create(int nlig);
+void destroy_mol_workspace(struct mol_workspace *ws);
+void free_mol_workspace(struct mol_workspace *ws);
+
+/**
+	Places lig by the 3 x 4 matrix trans (as in octree.h, NULL for
+	none) into ws->x and collects into ws->offs/ws->pairs the
+	receptor atoms within cells->rc of every ligand atom. Returns 0
+	if the pair list could not be grown.
+*/
+int mol_workspace_pose(struct mol_workspace *ws,
+                       const struct rec_cells *cells,
+                       const struct atomgrp *lig, double *trans);
+
+/**
+	Receptor-ligand vdW and electrostatic energy of the pose, with
+	the same switched and shifted forms as vdweng and eleng (eps
+	scales the charges). Energies are added to ven and een; ws->grad
+	is overwritten with the gradients of the posed ligand atoms, in
+	the sign convention of GX/GY/GZ.
+	The receptor is held rigid and gets no gradient. Calls
+	mol_workspace_pose first; returns 0 if that fails.
+*/
+int mol_workspace_nbeng(struct mol_workspace *ws,
+                        const struct rec_cells *cells,
+                        const struct atomgrp *lig, double *trans,
+                        double eps, double *ven, double *een);
+
+#endif
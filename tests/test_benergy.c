@@ -3,16 +3,19 @@
 #include <check.h>
 #include <errno.h>
 #include <math.h>
+#include <string.h>
 
-#include "mol.0.0.6/benergy.h"
-#include "mol.0.0.6/pdb.h"
-#include "mol.0.0.6/icharmm.h"
+#include "mol.0.0.6.h"
+#include "test_util.h"
 
 struct atomgrp *test_ag;
 const double delta = 0.000001;
 const double tolerance = 0.1;
+const double DEGRA = 3.14159265358979323846 / 180.0;
 
-void check_grads(struct atomgrp *ag, double d, void (*efun)(struct atomgrp *, double*))
+// Finite difference check of every step-th atom, as check_b_grads
+void check_grads_step(struct atomgrp *ag, double d,
+                      void (*efun)(struct atomgrp *, double*), int step)
 {
         int n=ag->natoms, i;
         double en, en1, t;
@@ -21,7 +24,7 @@ void check_grads(struct atomgrp *ag, double d, void (*efun)(struct atomgrp *, do
         en=0;
         (*efun)(ag, &en);
 
-        for(i=0; i<n; i++)
+        for(i=0; i<n; i+=step)
         {
 //x
                 en1=0;
@@ -50,7 +53,7 @@ void check_grads(struct atomgrp *ag, double d, void (*efun)(struct atomgrp *, do
         (*efun)(ag, &en);
 
         char msg[256];
-        for(i=0; i<n; i++)
+        for(i=0; i<n; i+=step)
         {
           sprintf(msg,
                   "\n(atom: %d) calc: (%lf, %lf, %lf): numerical: (%lf, %lf, %lf)\n",
@@ -65,6 +68,117 @@ void check_grads(struct atomgrp *ag, double d, void (*efun)(struct atomgrp *, do
         free(fs);
 }
 
+void check_grads(struct atomgrp *ag, double d, void (*efun)(struct atomgrp *, double*))
+{
+        check_grads_step(ag, d, efun, 1);
+}
+
+// Chain of n atoms on a jittered helix with a bond, angle, torsion and
+// improper for every run of 2, 3 and 4 consecutive atoms, active lists
+// and btab from fixed_update_nolist.
+static struct atomgrp *make_bonded_ag(int n, unsigned int seed)
+{
+	int i;
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+	lcg_seed(seed);
+	ag->natoms = n;
+	ag->atoms = calloc(n, sizeof(struct atom));
+	for (i = 0; i < n; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		a->X = 1.2 * cos(1.75 * i) + 0.2 * lcg_uniform();
+		a->Y = 1.2 * sin(1.75 * i) + 0.2 * lcg_uniform();
+		a->Z = 0.9 * i + 0.2 * lcg_uniform();
+		a->ingrp = i;
+	}
+	ag->nbonds = n - 1;
+	ag->bonds = calloc(n, sizeof(struct atombond));
+	for (i = 0; i < n - 1; i++) {
+		ag->bonds[i].a0 = &(ag->atoms[i]);
+		ag->bonds[i].a1 = &(ag->atoms[i + 1]);
+		ag->bonds[i].ai = i;
+		ag->bonds[i].aj = i + 1;
+		ag->bonds[i].k = 200.0 + 200.0 * lcg_uniform();
+		ag->bonds[i].l0 = 1.4 + 0.2 * lcg_uniform();
+	}
+	ag->nangs = n - 2;
+	ag->angs = calloc(n, sizeof(struct atomangle));
+	for (i = 0; i < n - 2; i++) {
+		ag->angs[i].a0 = &(ag->atoms[i]);
+		ag->angs[i].a1 = &(ag->atoms[i + 1]);
+		ag->angs[i].a2 = &(ag->atoms[i + 2]);
+		ag->angs[i].k = 30.0 + 40.0 * lcg_uniform();
+		ag->angs[i].th0 = 100.0 + 20.0 * lcg_uniform();
+	}
+	ag->ntors = n - 3;
+	ag->tors = calloc(n, sizeof(struct atomtorsion));
+	ag->nimps = n - 3;
+	ag->imps = calloc(n, sizeof(struct atomimproper));
+	for (i = 0; i < n - 3; i++) {
+		ag->tors[i].a0 = ag->imps[i].a0 = &(ag->atoms[i]);
+		ag->tors[i].a1 = ag->imps[i].a1 = &(ag->atoms[i + 1]);
+		ag->tors[i].a2 = ag->imps[i].a2 = &(ag->atoms[i + 2]);
+		ag->tors[i].a3 = ag->imps[i].a3 = &(ag->atoms[i + 3]);
+		ag->tors[i].k = 0.2 + 2.0 * lcg_uniform();
+		ag->tors[i].d = (i % 2) ? 180.0 : 0.0;
+		ag->tors[i].n = 1 + i % 3;
+		ag->imps[i].k = 10.0 + 20.0 * lcg_uniform();
+		ag->imps[i].psi0 = 20.0 * lcg_uniform() - 10.0;
+	}
+	fixed_init(ag);
+	fixed_update_nolist(ag);
+	return ag;
+}
+
+static void free_bonded_ag(struct atomgrp *ag)
+{
+	free(ag->activelist);
+	if (ag->nbact > 0)
+		free(ag->bact);
+	if (ag->nangact > 0)
+		free(ag->angact);
+	if (ag->ntoract > 0)
+		free(ag->toract);
+	if (ag->nimpact > 0)
+		free(ag->impact);
+	free_agbtab(ag->btab);
+	free(ag->bonds);
+	free(ag->angs);
+	free(ag->tors);
+	free(ag->imps);
+	free(ag->atoms);
+	free(ag);
+}
+
+// Energy of efun on the active lists, ignoring ag->btab
+static double list_energy(struct atomgrp *ag,
+			  void (*efun) (struct atomgrp *, double *))
+{
+	struct agbtab *btab = ag->btab;
+	double en = 0.0;
+
+	ag->btab = NULL;
+	zero_grads(ag);
+	(*efun) (ag, &en);
+	ag->btab = btab;
+	return en;
+}
+
+// Energy of efun with ag->btab on nthreads threads, gradients into a
+// new *g
+static double btab_energy(struct atomgrp *ag,
+			  void (*efun) (struct atomgrp *, double *),
+			  int nthreads, double **g)
+{
+	int nt = set_threads(nthreads);
+	double en = 0.0;
+
+	zero_grads(ag);
+	(*efun) (ag, &en);
+	set_threads(nt);
+	*g = copy_grads(ag);
+	return en;
+}
+
 void setup(void)
 {
 	test_ag = read_pdb_nopar("1rei_nmin.pdb");
@@ -106,6 +220,291 @@ START_TEST(test_teng)
 }
 END_TEST
 
+// Compares energy and gradients of efun in both modes of mol_bonded_mode
+// and, if numeric, the trig-free gradients with finite differences
+void check_trigfree(struct atomgrp *ag, void (*efun)(struct atomgrp *, double*),
+                    int numeric)
+{
+        int n=ag->natoms, i;
+        double en=0, enf=0;
+        double *gs;
+
+        mol_bonded_set_mode(MOL_BONDED_TRIG);
+        zero_grads(ag);
+        (*efun)(ag, &en);
+        gs=copy_grads(ag);
+
+        mol_bonded_set_mode(MOL_BONDED_TRIGFREE);
+        zero_grads(ag);
+        (*efun)(ag, &enf);
+        ck_assert_msg(fabs(en - enf) <= 1e-9 * (1 + fabs(en)),
+                      "energy trig %lf trig-free %lf\n", en, enf);
+        for(i=0; i<n; i++)
+        {
+                ck_assert(fabs(ag->atoms[i].GX - gs[3*i]) < 1e-6 * (1 + fabs(gs[3*i])));
+                ck_assert(fabs(ag->atoms[i].GY - gs[3*i+1]) < 1e-6 * (1 + fabs(gs[3*i+1])));
+                ck_assert(fabs(ag->atoms[i].GZ - gs[3*i+2]) < 1e-6 * (1 + fabs(gs[3*i+2])));
+        }
+        if (numeric) {
+                zero_grads(ag);
+                check_grads(ag, delta, efun);
+        }
+
+        mol_bonded_set_mode(MOL_BONDED_TRIG);
+        free(gs);
+}
+
+START_TEST(test_aeng_trigfree)
+{
+	struct atomgrp *ag = make_bonded_ag(40, 5u);
+
+	check_trigfree(ag, aeng, 1);
+	free_bonded_ag(ag);
+}
+END_TEST
+
+START_TEST(test_teng_trigfree)
+{
+	struct atomgrp *ag = make_bonded_ag(40, 7u);
+
+	check_trigfree(ag, teng, 1);
+	free_bonded_ag(ag);
+}
+END_TEST
+
+// Angle 0-1-2 of a 4-atom chain bent to theta degrees, for equilibrium
+// angles of 110 and 180 degrees. Near 180 degrees the trig path takes
+// sin(acos(c)) of a cosine close to -1, the trig-free one the cross
+// product. Forward differences of 1e-6 A do not resolve the cusp of
+// the angle at 180 degrees, so the modes are only compared.
+START_TEST(test_aeng_trigfree_linear)
+{
+	const double theta[] = { 170.0, 179.0, 179.9, 179.99, 1.0, 0.5 };
+	const double th0[] = { 110.0, 180.0 };
+	struct atomgrp *ag = make_bonded_ag(4, 3u);
+	struct atom *a = ag->atoms;
+	int i, j;
+
+	for (i = 0; i < 6; i++) {
+		const double th = theta[i] * DEGRA;
+		a[1].X = a[1].Y = a[1].Z = 0.0;
+		a[0].X = 1.5 * cos(th);
+		a[0].Y = 1.5 * sin(th);
+		a[0].Z = 0.0;
+		a[2].X = 1.4;
+		a[2].Y = a[2].Z = 0.0;
+		a[3].X = 1.9;
+		a[3].Y = 0.3;
+		a[3].Z = 1.3;
+		for (j = 0; j < 2; j++) {
+			ag->angs[0].th0 = th0[j];
+			ag->angs[1].th0 = th0[j];
+			init_agbtab(ag);
+			check_trigfree(ag, aeng, 0);
+		}
+	}
+	free_bonded_ag(ag);
+}
+END_TEST
+
+// Torsion 0-1-2-3 of a 4-atom chain at exactly 0 and 180 degrees and
+// just off them, for periodicities 1 to 3 and phases 0, 180 and 60
+// degrees. Planar torsions put the trig path at atan2(0, x).
+START_TEST(test_teng_trigfree_planar)
+{
+	const double phi[] = { 0.0, 180.0, 1e-4, -1e-4, 180.0 - 1e-4 };
+	const double d[] = { 0.0, 180.0, 60.0 };
+	struct atomgrp *ag = make_bonded_ag(4, 3u);
+	struct atom *a = ag->atoms;
+	int i, j, n;
+
+	for (i = 0; i < 5; i++) {
+		const double p = phi[i] * DEGRA;
+		a[1].X = a[1].Y = a[1].Z = 0.0;
+		a[2].X = 1.5;
+		a[2].Y = a[2].Z = 0.0;
+		a[0].X = -0.5;
+		a[0].Y = 1.4;
+		a[0].Z = 0.0;
+		a[3].X = 2.0;
+		a[3].Y = (phi[i] == 180.0) ? -1.4 : 1.4 * cos(p);
+		a[3].Z = (phi[i] == 0.0 || phi[i] == 180.0) ? 0.0 :
+		    1.4 * sin(p);
+		for (j = 0; j < 3; j++) {
+			for (n = 1; n <= 3; n++) {
+				ag->tors[0].k = 1.5;
+				ag->tors[0].d = d[j];
+				ag->tors[0].n = n;
+				init_agbtab(ag);
+				check_trigfree(ag, teng, 1);
+			}
+		}
+	}
+	free_bonded_ag(ag);
+}
+END_TEST
+
+// A btab left behind by edited active lists is not used, and one
+// rebuilt by fixed_update_nolist is.
+START_TEST(test_btab_stale)
+{
+	void (*efun[4]) (struct atomgrp *, double *) = {
+		beng, aeng, teng, ieng};
+	struct atomgrp *ag = make_bonded_ag(40, 11u);
+	double en[4], en1;
+	int i, w;
+
+	ck_assert(agbtab_current(ag));
+	ck_assert_int_eq(ag->btab->nbonds, 39);
+	for (w = 0; w < 4; w++) {
+		en[w] = 0.0;
+		zero_grads(ag);
+		(*efun[w]) (ag, &en[w]);
+		ck_assert(fabs(en[w] - list_energy(ag, efun[w])) <
+			  1e-9 * (1 + fabs(en[w])));
+	}
+
+	ag->nbact -= 5;
+	ag->nangact -= 5;
+	ag->ntoract -= 5;
+	ag->nimpact -= 5;
+	ck_assert(!agbtab_current(ag));
+	for (w = 0; w < 4; w++) {
+		en1 = 0.0;
+		zero_grads(ag);
+		(*efun[w]) (ag, &en1);
+		ck_assert(en1 == list_energy(ag, efun[w]));
+		ck_assert(en1 != en[w]);
+	}
+	ag->nbact += 5;
+	ag->nangact += 5;
+	ag->ntoract += 5;
+	ag->nimpact += 5;
+	ck_assert(agbtab_current(ag));
+
+	for (i = 0; i < 20; i++)
+		ag->atoms[i].fixed = 1;
+	fixed_update_nolist(ag);
+	ck_assert(agbtab_current(ag));
+	ck_assert_int_eq(ag->btab->nbonds, 20);
+	for (w = 0; w < 4; w++) {
+		en1 = 0.0;
+		zero_grads(ag);
+		(*efun[w]) (ag, &en1);
+		ck_assert(fabs(en1 - list_energy(ag, efun[w])) <
+			  1e-9 * (1 + fabs(en1)));
+		ck_assert(en1 != en[w]);
+	}
+	free_bonded_ag(ag);
+}
+END_TEST
+
+// Past AGBTAB_PARALLEL_MIN_TERMS terms btab_eng deals blocks to
+// threads. On 4 threads it matches 1 thread and the active lists, and
+// repeats bitwise.
+START_TEST(test_btab_threads)
+{
+	void (*efun[4]) (struct atomgrp *, double *) = {
+		beng, aeng, teng, ieng};
+	struct atomgrp *ag = make_bonded_ag(AGBTAB_PARALLEL_MIN_TERMS + 500,
+					    23u);
+	const int n3 = 3 * ag->natoms;
+	double *g1, *g4, *g4b;
+	double en1, en4, en4b, enl, gmax;
+	int i, w;
+
+	ck_assert(agbtab_current(ag));
+	for (w = 0; w < 4; w++) {
+		en1 = btab_energy(ag, efun[w], 1, &g1);
+		en4 = btab_energy(ag, efun[w], 4, &g4);
+		en4b = btab_energy(ag, efun[w], 4, &g4b);
+		enl = list_energy(ag, efun[w]);
+		ck_assert_msg(fabs(en4 - en1) < 1e-9 * (1 + fabs(en1)),
+			      "\nterm %d 4 threads: %.12f 1 thread: %.12f\n",
+			      w, en4, en1);
+		ck_assert_msg(fabs(enl - en1) < 1e-9 * (1 + fabs(en1)),
+			      "\nterm %d lists: %.12f table: %.12f\n",
+			      w, enl, en1);
+		ck_assert(en4b == en4);
+		ck_assert(memcmp(g4b, g4, n3 * sizeof(double)) == 0);
+		gmax = 0.0;
+		for (i = 0; i < n3; i++)
+			gmax = fmax(gmax, fabs(g1[i]));
+		for (i = 0; i < n3; i++) {
+			const double gl[3] = { ag->atoms[i / 3].GX,
+				ag->atoms[i / 3].GY, ag->atoms[i / 3].GZ };
+			ck_assert_msg(fabs(g4[i] - g1[i]) < 1e-9 * (1 + gmax),
+				      "\nterm %d (atom: %d) 4 threads: %.12f "
+				      "1 thread: %.12f\n", w, i / 3, g4[i],
+				      g1[i]);
+			ck_assert(fabs(gl[i % 3] - g1[i]) < 1e-9 * (1 + gmax));
+		}
+		free(g1);
+		free(g4);
+		free(g4b);
+	}
+	free_bonded_ag(ag);
+}
+END_TEST
+
+// In trig-free mode the angle and torsion passes run four terms at a
+// time with AVX2; every SIMD level matches the scalar passes.
+START_TEST(test_bonded_simd)
+{
+	void (*efun[2]) (struct atomgrp *, double *) = { aeng, teng };
+	struct atomgrp *ag = make_bonded_ag(40, 13u);
+	const int n3 = 3 * ag->natoms;
+	double *g0, *g;
+	double en0, en;
+	int i, w, level;
+
+	mol_bonded_set_mode(MOL_BONDED_TRIGFREE);
+	for (w = 0; w < 2; w++) {
+		mol_simd_set_level(MOL_SIMD_NONE);
+		en0 = btab_energy(ag, efun[w], 1, &g0);
+		for (level = MOL_SIMD_AVX2; level <= MOL_SIMD_AVX512; level++) {
+			mol_simd_set_level(level);
+			en = btab_energy(ag, efun[w], 1, &g);
+			ck_assert_msg(fabs(en - en0) < 1e-12 * (1 + fabs(en0)),
+				      "\nterm %d level %d: %.15f scalar: %.15f\n",
+				      w, level, en, en0);
+			for (i = 0; i < n3; i++)
+				ck_assert_msg(fabs(g[i] - g0[i]) <
+					      1e-9 * (1 + fabs(g0[i])),
+					      "\nterm %d level %d (atom: %d): "
+					      "%.12f scalar: %.12f\n", w, level,
+					      i / 3, g[i], g0[i]);
+			free(g);
+		}
+		free(g0);
+	}
+	mol_simd_set_level(-1);
+	mol_bonded_set_mode(MOL_BONDED_TRIG);
+	free_bonded_ag(ag);
+}
+END_TEST
+
+// The threaded kernels, in both modes, pass check_grads on 4 threads
+// (every 20th atom, a full sweep of 2000 atoms is too slow).
+START_TEST(test_btab_threads_grads)
+{
+	void (*efun[4]) (struct atomgrp *, double *) = {
+		beng, aeng, teng, ieng};
+	struct atomgrp *ag = make_bonded_ag(AGBTAB_PARALLEL_MIN_TERMS + 100,
+					    29u);
+	int w, mode, nt = set_threads(4);
+
+	for (mode = MOL_BONDED_TRIG; mode <= MOL_BONDED_TRIGFREE; mode++) {
+		mol_bonded_set_mode(mode);
+		for (w = 0; w < 4; w++)
+			check_grads_step(ag, delta, efun[w], 20);
+	}
+	mol_bonded_set_mode(MOL_BONDED_TRIG);
+	set_threads(nt);
+	free_bonded_ag(ag);
+}
+END_TEST
+
 Suite *benergy_suite(void)
 {
 	Suite *suite = suite_create("benergy");
@@ -125,6 +524,19 @@ Suite *benergy_suite(void)
 
 	suite_add_tcase(suite, tcase);
 
+	// Groups built in the tests, no input files
+	TCase *tbuilt = tcase_create("built");
+	tcase_set_timeout(tbuilt, 20);
+	tcase_add_test(tbuilt, test_aeng_trigfree);
+	tcase_add_test(tbuilt, test_teng_trigfree);
+	tcase_add_test(tbuilt, test_aeng_trigfree_linear);
+	tcase_add_test(tbuilt, test_teng_trigfree_planar);
+	tcase_add_test(tbuilt, test_btab_stale);
+	tcase_add_test(tbuilt, test_btab_threads);
+	tcase_add_test(tbuilt, test_bonded_simd);
+	tcase_add_test(tbuilt, test_btab_threads_grads);
+	suite_add_tcase(suite, tbuilt);
+
 	return suite;
 }
 
@@ -0,0 +1,606 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_ag;
+struct agsetup test_ags;
+const double tolerance = 1e-9;
+
+// m^3 atoms on a jittered 2.8 A lattice, parameters in CHARMM ranges
+static struct atomgrp *make_nb_lattice(int m)
+{
+	int i;
+	struct atomgrp *ag = make_lattice_ag(m * m * m, 2.8, 0.5, 4242u);
+	for (i = 0; i < ag->natoms; i++) {
+		ag->atoms[i].eps03 = 0.5 * ag->atoms[i].eps;
+		ag->atoms[i].rminh03 = 0.9 * ag->atoms[i].rminh;
+	}
+	return ag;
+}
+
+// Energy and gradients of efun against en and g, relative to tol.
+static void check_result(struct atomgrp *ag, void (*efun) (double *),
+			 double en, const double *g, double tol)
+{
+	int i;
+	double en1 = 0, *g1;
+	char msg[256];
+
+	zero_grads(ag);
+	(*efun) (&en1);
+	g1 = copy_grads(ag);
+	sprintf(msg, "\nreference: %.12lf result: %.12lf\n", en, en1);
+	ck_assert_msg(fabs(en - en1) <= tol * (1 + fabs(en)), msg);
+	for (i = 0; i < 3 * ag->natoms; i++) {
+		sprintf(msg, "\n(atom: %d) reference: %lf result: %lf\n",
+			i / 3, g[i], g1[i]);
+		ck_assert_msg(fabs(g[i] - g1[i]) <= tol * (1 + fabs(g[i])),
+			      msg);
+	}
+	free(g1);
+}
+
+// Runs efun on nthreads threads (one without OpenMP).
+static double *run_threads(struct atomgrp *ag, void (*efun) (double *),
+			   int nthreads, double *en)
+{
+	int nt = set_threads(nthreads);
+	*en = 0;
+	zero_grads(ag);
+	(*efun) (en);
+	set_threads(nt);
+	return copy_grads(ag);
+}
+
+// Threaded efun matches one thread and repeats bit for bit.
+static void check_threads(struct atomgrp *ag, void (*efun) (double *))
+{
+	int i;
+	double en1, en4, en4b, *g1, *g4, *g4b;
+
+	g1 = run_threads(ag, efun, 1, &en1);
+	g4 = run_threads(ag, efun, 4, &en4);
+	g4b = run_threads(ag, efun, 4, &en4b);
+	ck_assert_msg(fabs(en1 - en4) <= tolerance * (1 + fabs(en1)),
+		      "\n1 thread: %.12lf 4 threads: %.12lf\n", en1, en4);
+	ck_assert(en4 == en4b);
+	for (i = 0; i < 3 * ag->natoms; i++) {
+		ck_assert_msg(fabs(g1[i] - g4[i]) <=
+			      tolerance * (1 + fabs(g1[i])), "\n(atom: %d) 1 thread: %lf 4 threads: %lf\n",
+			      i / 3, g1[i], g4[i]);
+		ck_assert(g4[i] == g4b[i]);
+	}
+	free(g1);
+	free(g4);
+	free(g4b);
+}
+
+// efun at every SIMD level matches the scalar loops.
+static void check_simd(struct atomgrp *ag, void (*efun) (double *))
+{
+	int level;
+	double en, *g;
+
+	mol_simd_set_level(MOL_SIMD_NONE);
+	en = 0;
+	zero_grads(ag);
+	(*efun) (&en);
+	g = copy_grads(ag);
+	for (level = MOL_SIMD_AVX2; level <= MOL_SIMD_AVX512; level++) {
+		mol_simd_set_level(level);
+		check_result(ag, efun, en, g, tolerance);
+	}
+	mol_simd_set_level(-1);
+	free(g);
+}
+
+static void vdw_efun(double *en)
+{
+	vdweng(test_ag, en, test_ags.nblst);
+}
+
+static void ele_efun(double *en)
+{
+	eleng(test_ag, 1.0, en, test_ags.nblst);
+}
+
+// 1-4 pairs of neighbours along x, scaled by 0.5
+static void vdw03_efun(double *en)
+{
+	const int m = 9;
+	int i, n03 = 0, *list03 = malloc(2 * test_ag->natoms * sizeof(int));
+	for (i = 0; i < test_ag->natoms; i++) {
+		if (i % m == m - 1)
+			continue;
+		list03[2 * n03] = i;
+		list03[2 * n03 + 1] = i + 1;
+		n03++;
+	}
+	vdwengs03(0.5, test_ags.nblst->nbcof, test_ag, en, n03, list03);
+	free(list03);
+}
+
+void setup(void)
+{
+	test_ag = make_nb_lattice(9);
+	init_nblst(test_ag, &test_ags);
+	update_nblst(test_ag, &test_ags);
+}
+
+void teardown(void)
+{
+	destroy_agsetup(&test_ags);
+	free_lattice_ag(test_ag);
+}
+
+// Test cases
+START_TEST(test_nblst_csr)
+{
+	const struct nblist *nblst = test_ags.nblst;
+	const int n = test_ag->natoms;
+	const double nbcut2 = nblst->nbcut * nblst->nbcut;
+	char *seen = calloc((size_t) n * n, 1);
+	int i, j, i1, i2, npairs = 0, nclose = 0;
+
+	ck_assert_int_eq(nblst->offs[0], 0);
+	ck_assert_int_eq(nblst->offs[nblst->nfat], nblst->npairs);
+	for (i = 0; i < nblst->nfat; i++) {
+		ck_assert(nblst->isat[i] == nblst->nbrs + nblst->offs[i]);
+		ck_assert_int_eq(nblst->nsat[i],
+				 nblst->offs[i + 1] - nblst->offs[i]);
+		i1 = nblst->ifat[i];
+		for (j = 0; j < nblst->nsat[i]; j++) {
+			i2 = nblst->isat[i][j];
+			ck_assert(i1 != i2);
+			ck_assert_msg(!seen[i1 * n + i2] && !seen[i2 * n + i1],
+				      "pair %d %d listed twice\n", i1, i2);
+			seen[i1 * n + i2] = 1;
+			npairs++;
+		}
+	}
+	ck_assert_int_eq(npairs, nblst->npairs);
+	// every pair within the list cutoff is there
+	for (i1 = 0; i1 < n; i1++) {
+		for (i2 = i1 + 1; i2 < n; i2++) {
+			double dx = test_ag->atoms[i1].X - test_ag->atoms[i2].X;
+			double dy = test_ag->atoms[i1].Y - test_ag->atoms[i2].Y;
+			double dz = test_ag->atoms[i1].Z - test_ag->atoms[i2].Z;
+			if (dx * dx + dy * dy + dz * dz >= nbcut2)
+				continue;
+			nclose++;
+			ck_assert_msg(seen[i1 * n + i2] || seen[i2 * n + i1],
+				      "pair %d %d missing\n", i1, i2);
+		}
+	}
+	ck_assert(nclose > 0);
+	free(seen);
+}
+END_TEST
+
+// vdweng and eleng over the list equal the all-pairs sums.
+START_TEST(test_nblst_allpairs)
+{
+	const int n = test_ag->natoms;
+	const double rc = test_ags.nblst->nbcof;
+	double ev = 0, ee = 0, d, *gv = calloc(3 * n, sizeof(double));
+	double *ge = calloc(3 * n, sizeof(double));
+	int i1, i2;
+
+	for (i1 = 0; i1 < n; i1++) {
+		const struct atom *a1 = &(test_ag->atoms[i1]);
+		for (i2 = i1 + 1; i2 < n; i2++) {
+			const struct atom *a2 = &(test_ag->atoms[i2]);
+			double dx = a1->X - a2->X;
+			double dy = a1->Y - a2->Y;
+			double dz = a1->Z - a2->Z;
+			double d2 = dx * dx + dy * dy + dz * dz;
+			double rij = a1->rminh + a2->rminh;
+			if (d2 >= rc * rc)
+				continue;
+			ev += vdw_pair(a1->eps * a2->eps, rij * rij, d2,
+				       rc * rc, &d);
+			gv[3 * i1] += d * dx;
+			gv[3 * i1 + 1] += d * dy;
+			gv[3 * i1 + 2] += d * dz;
+			gv[3 * i2] -= d * dx;
+			gv[3 * i2 + 1] -= d * dy;
+			gv[3 * i2 + 2] -= d * dz;
+			ee += ele_pair(CCELEC * a1->chrg * a2->chrg, d2, rc,
+				       1.0 / (rc * rc), &d);
+			ge[3 * i1] += d * dx;
+			ge[3 * i1 + 1] += d * dy;
+			ge[3 * i1 + 2] += d * dz;
+			ge[3 * i2] -= d * dx;
+			ge[3 * i2 + 1] -= d * dy;
+			ge[3 * i2 + 2] -= d * dz;
+		}
+	}
+	check_result(test_ag, vdw_efun, ev, gv, tolerance);
+	check_result(test_ag, ele_efun, ee, ge, tolerance);
+	free(gv);
+	free(ge);
+}
+END_TEST
+
+// Marks in seen the listed pairs closer than rc, returns their number.
+static int close_pairs(const struct atomgrp *ag, const struct nblist *nblst,
+		       double rc, char *seen)
+{
+	const int n = ag->natoms;
+	int i, j, i1, i2, k, nclose = 0;
+	for (i = 0; i < nblst->nfat; i++) {
+		i1 = nblst->ifat[i];
+		for (j = 0; j < nblst->nsat[i]; j++) {
+			double dx, dy, dz;
+			i2 = nblst->isat[i][j];
+			dx = ag->atoms[i1].X - ag->atoms[i2].X;
+			dy = ag->atoms[i1].Y - ag->atoms[i2].Y;
+			dz = ag->atoms[i1].Z - ag->atoms[i2].Z;
+			if (dx * dx + dy * dy + dz * dz >= rc * rc)
+				continue;
+			k = (i1 < i2) ? i1 * n + i2 : i2 * n + i1;
+			seen[k] = 1;
+			nclose++;
+		}
+	}
+	return nclose;
+}
+
+// Row refreshes after small moves keep the pairs of a full rebuild.
+START_TEST(test_nblst_incremental)
+{
+	const int n = test_ag->natoms;
+	const double rc = test_ags.nblst->nbcof;
+	struct agsetup ref;
+	char *seen = malloc((size_t) n * n);
+	char *seenref = malloc((size_t) n * n);
+	int step, k, i, nclose, nref;
+
+	for (step = 0; step < 10; step++) {
+		// move 5 atoms by 0.8 A, more than half the skin
+		for (k = 0; k < 5; k++) {
+			i = (int)(n * lcg_uniform());
+			test_ag->atoms[i].X += 0.8 * (2 * lcg_uniform() - 1);
+			test_ag->atoms[i].Y += 0.8 * (2 * lcg_uniform() - 1);
+			test_ag->atoms[i].Z += 0.8;
+		}
+		ck_assert_int_eq(check_clusterupdate_incremental
+				 (test_ag, &test_ags), 1);
+		init_nblst(test_ag, &ref);
+		update_nblst(test_ag, &ref);
+		memset(seen, 0, (size_t) n * n);
+		memset(seenref, 0, (size_t) n * n);
+		nclose = close_pairs(test_ag, test_ags.nblst, rc, seen);
+		nref = close_pairs(test_ag, ref.nblst, rc, seenref);
+		ck_assert_msg(nclose == nref,
+			      "\nstep %d: %d pairs, rebuild %d\n", step,
+			      nclose, nref);
+		ck_assert(memcmp(seen, seenref, (size_t) n * n) == 0);
+		destroy_agsetup(&ref);
+	}
+	ck_assert_int_eq(check_clusterupdate_incremental(test_ag, &test_ags),
+			 0);
+	free(seen);
+	free(seenref);
+}
+END_TEST
+
+// nblist of ag built on nthreads threads (one without OpenMP).
+static void build_threads(struct atomgrp *ag, struct agsetup *ags,
+			  int nthreads)
+{
+	int nt = set_threads(nthreads);
+	init_nblst(ag, ags);
+	update_nblst(ag, ags);
+	set_threads(nt);
+}
+
+// The list built over many filled cubes does not depend on threads.
+START_TEST(test_nblst_threads)
+{
+	struct atomgrp *ag = make_nb_lattice(20);
+	struct agsetup ags1, ags4;
+	const struct nblist *l1, *l4;
+
+	build_threads(ag, &ags1, 1);
+	build_threads(ag, &ags4, 4);
+	l1 = ags1.nblst;
+	l4 = ags4.nblst;
+	ck_assert_int_eq(l1->nfat, l4->nfat);
+	ck_assert_int_eq(l1->npairs, l4->npairs);
+	ck_assert(memcmp(l1->ifat, l4->ifat, l1->nfat * sizeof(int)) == 0);
+	ck_assert(memcmp(l1->nsat, l4->nsat, l1->nfat * sizeof(int)) == 0);
+	ck_assert(memcmp(l1->nbrs, l4->nbrs, l1->npairs * sizeof(int)) == 0);
+	destroy_agsetup(&ags1);
+	destroy_agsetup(&ags4);
+	free_lattice_ag(ag);
+}
+END_TEST
+
+// Morton ordered rows hold the same pairs and give the same energies.
+START_TEST(test_nblst_spatial_order)
+{
+	const int n = test_ag->natoms;
+	const double rc = test_ags.nblst->nbcof;
+	const struct nblist *nblst;
+	char *seen = calloc((size_t) n * n, 1);
+	char *seenord = calloc((size_t) n * n, 1);
+	double ev, ee, *gv, *ge;
+	int i, j, nclose;
+
+	ev = 0;
+	zero_grads(test_ag);
+	vdw_efun(&ev);
+	gv = copy_grads(test_ag);
+	ee = 0;
+	zero_grads(test_ag);
+	ele_efun(&ee);
+	ge = copy_grads(test_ag);
+	nclose = close_pairs(test_ag, test_ags.nblst, rc, seen);
+
+	nblst_spatial_order(test_ag, &test_ags, 1);
+	nblst = test_ags.nblst;
+	ck_assert(nblst->order != NULL && nblst->rank != NULL);
+	for (i = 0; i < n; i++)
+		ck_assert_int_eq(nblst->rank[nblst->order[i]], i);
+	for (i = 0; i < nblst->nfat; i++) {
+		const int r1 = nblst->rank[nblst->ifat[i]];
+		if (i > 0)
+			ck_assert(nblst->rank[nblst->ifat[i - 1]] < r1);
+		for (j = 0; j < nblst->nsat[i]; j++) {
+			ck_assert(nblst->ifat[i] < nblst->isat[i][j]);
+			if (j > 0)
+				ck_assert(nblst->rank[nblst->isat[i][j - 1]] <
+					  nblst->rank[nblst->isat[i][j]]);
+		}
+	}
+	ck_assert_int_eq(close_pairs(test_ag, nblst, rc, seenord), nclose);
+	ck_assert(memcmp(seen, seenord, (size_t) n * n) == 0);
+	check_result(test_ag, vdw_efun, ev, gv, tolerance);
+	check_result(test_ag, ele_efun, ee, ge, tolerance);
+
+	nblst_spatial_order(test_ag, &test_ags, 0);
+	ck_assert(test_ags.nblst->order == NULL);
+	free(seen);
+	free(seenord);
+	free(gv);
+	free(ge);
+}
+END_TEST
+
+START_TEST(test_vdweng_threads)
+{
+	check_threads(test_ag, vdw_efun);
+}
+END_TEST
+
+START_TEST(test_eleng_threads)
+{
+	check_threads(test_ag, ele_efun);
+}
+END_TEST
+
+START_TEST(test_vdweng_simd)
+{
+	check_simd(test_ag, vdw_efun);
+}
+END_TEST
+
+START_TEST(test_eleng_simd)
+{
+	check_simd(test_ag, ele_efun);
+}
+END_TEST
+
+START_TEST(test_vdwengs03_simd)
+{
+	check_simd(test_ag, vdw03_efun);
+}
+END_TEST
+
+// The exclusion rows agree with the legacy excl_tab table on every pair.
+START_TEST(test_excl_rows_tab)
+{
+	int i, j, nfar = 0;
+	struct atomgrp *ag = read_bonded_pdb("small01.pdb", 13);
+	struct agsetup ags;
+	int *offs, *pairs;
+
+	ck_assert_int_eq(ag->natoms, 35);
+	ck_assert(ag->nbonds > 30);
+	init_nblst(ag, &ags);
+	ck_assert(ags.ndm > 20);
+	ck_assert(ags.excl_list != NULL);
+	for (i = 0; i < ag->natoms; i++) {
+		for (j = i + 1; j < ag->natoms; j++) {
+			int k = exta(i, j, ags.excl_list, ags.pd1, ags.pd2, ags.ndm);
+			ck_assert_msg(k == exta_rows(i, j, ags.excl_offs,
+						     ags.excl_pairs),
+				      "pair %d %d", i, j);
+			if (k > 0 && j - i > 20)
+				nfar++;
+		}
+	}
+	ck_assert(nfar > 0);
+
+	excl_tab_rows(ag->natoms, ags.excl_list, ags.pd1, ags.pd2, ags.ndm,
+		      &offs, &pairs);
+	ck_assert(memcmp(offs, ags.excl_offs,
+			 (ag->natoms + 1) * sizeof(int)) == 0);
+	ck_assert(memcmp(pairs, ags.excl_pairs,
+			 offs[ag->natoms] * sizeof(int)) == 0);
+	free(offs);
+	free(pairs);
+	destroy_agsetup(&ags);
+	mol_atom_group_destroy(ag);
+}
+END_TEST
+
+// gen_nblist and gen_nblist_new, on the legacy table of ags or without
+// one, list what update_nblst does.
+static void check_gen_nblist(struct atomgrp *ag, struct agsetup *ags)
+{
+	int pass;
+	struct nblist *l;
+	int nfat, npairs, *ifat, *nsat, *nbrs;
+
+	update_nblst(ag, ags);
+	l = ags->nblst;
+	ck_assert(l->npairs > 0);
+	nfat = l->nfat;
+	npairs = l->npairs;
+	ifat = malloc(nfat * sizeof(int));
+	nsat = malloc(nfat * sizeof(int));
+	nbrs = malloc(npairs * sizeof(int));
+	memcpy(ifat, l->ifat, nfat * sizeof(int));
+	memcpy(nsat, l->nsat, nfat * sizeof(int));
+	memcpy(nbrs, l->nbrs, npairs * sizeof(int));
+	for (pass = 0; pass < 2; pass++) {
+		struct cubeset *cust = malloc(sizeof(struct cubeset));
+		gen_cubeset(l->nbcut, ags->clst, cust);
+		if (pass == 0)
+			gen_nblist(ag, cust, ags->clst, ags->excl_list,
+				   ags->pd1, ags->pd2, ags->ndm, l);
+		else
+			gen_nblist_new(ag, cust, ags->clst, ags->excl_list,
+				       ags->pd1, ags->pd2, ags->ndm, l);
+		free_cubeset(cust);
+		free(cust);
+		ck_assert_int_eq(l->nfat, nfat);
+		ck_assert_int_eq(l->npairs, npairs);
+		ck_assert(memcmp(l->ifat, ifat, nfat * sizeof(int)) == 0);
+		ck_assert(memcmp(l->nsat, nsat, nfat * sizeof(int)) == 0);
+		ck_assert(memcmp(l->nbrs, nbrs, npairs * sizeof(int)) == 0);
+	}
+	free(ifat);
+	free(nsat);
+	free(nbrs);
+}
+
+START_TEST(test_gen_nblist_tab)
+{
+	struct atomgrp *ag = read_bonded_pdb("small01.pdb", 13);
+	struct agsetup ags;
+
+	init_nblst(ag, &ags);
+	check_gen_nblist(ag, &ags);
+	destroy_agsetup(&ags);
+	mol_atom_group_destroy(ag);
+}
+END_TEST
+
+// A 3.8 A helix of n atoms numbered 7 k % n along the chain, so that
+// bonded atoms are far apart in numbering.
+static struct atomgrp *make_scrambled_chain(int n)
+{
+	int k;
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+	ag->natoms = n;
+	ag->atoms = calloc(n, sizeof(struct atom));
+	ag->nbonds = n - 1;
+	ag->bonds = calloc(n, sizeof(struct atombond));
+	for (k = 0; k < n; k++) {
+		struct atom *a = &(ag->atoms[7 * k % n]);
+		a->X = 2.3 * cos(1.745 * k);
+		a->Y = 2.3 * sin(1.745 * k);
+		a->Z = 1.5 * k;
+		a->ingrp = 7 * k % n;
+		a->bonds = calloc(2, sizeof(struct atombond *));
+	}
+	for (k = 0; k < n - 1; k++) {
+		struct atombond *b = &(ag->bonds[k]);
+		b->a0 = &(ag->atoms[7 * k % n]);
+		b->a1 = &(ag->atoms[7 * (k + 1) % n]);
+		b->ai = 7 * k % n;
+		b->aj = 7 * (k + 1) % n;
+		b->a0->bonds[b->a0->nbonds++] = b;
+		b->a1->bonds[b->a1->nbonds++] = b;
+	}
+	return ag;
+}
+
+// Above NBLST_EXCL_TAB_MAX ints per atom init_nblst leaves the legacy
+// table out; the lists still exclude every pair up to three bonds apart,
+// and gen_nblist rebuilds the same exclusions from the bonds.
+START_TEST(test_gen_nblist_cap)
+{
+	const int n = 300;
+	struct atomgrp *ag = make_scrambled_chain(n);
+	struct agsetup ags;
+	const struct nblist *l;
+	int i, j, k, nexcl = 0;
+
+	init_nblst(ag, &ags);
+	ck_assert_int_eq(ags.ndm, -1);
+	ck_assert(ags.excl_list == NULL);
+	check_gen_nblist(ag, &ags);
+	l = ags.nblst;
+	for (k = 0; k < n - 1; k++) {
+		const int a = ag->bonds[k].ai, b = ag->bonds[k].aj;
+		ck_assert(exta_rows(a < b ? a : b, a < b ? b : a,
+				    ags.excl_offs, ags.excl_pairs) == 1);
+	}
+	for (i = 0; i < l->nfat; i++)
+		for (j = 0; j < l->nsat[i]; j++) {
+			const int a = l->ifat[i], b = l->isat[i][j];
+			ck_assert_msg(exta_rows(a < b ? a : b, a < b ? b : a,
+						ags.excl_offs,
+						ags.excl_pairs) == 0,
+				      "bonded pair %d %d listed", a, b);
+		}
+	for (i = 0; i < n; i++)
+		nexcl += ags.excl_offs[i + 1] - ags.excl_offs[i];
+	ck_assert_int_eq(nexcl, (n - 1) + (n - 2) + (n - 3));
+	destroy_agsetup(&ags);
+	for (i = 0; i < n; i++)
+		free(ag->atoms[i].bonds);
+	free(ag->bonds);
+	free(ag->atoms);
+	free(ag);
+}
+END_TEST
+
+Suite *nbenergy_suite(void)
+{
+	Suite *suite = suite_create("nbenergy");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_nblst_csr);
+	tcase_add_test(tcase, test_nblst_allpairs);
+	tcase_add_test(tcase, test_nblst_incremental);
+	tcase_add_test(tcase, test_nblst_threads);
+	tcase_add_test(tcase, test_nblst_spatial_order);
+	tcase_add_test(tcase, test_vdweng_threads);
+	tcase_add_test(tcase, test_eleng_threads);
+	tcase_add_test(tcase, test_vdweng_simd);
+	tcase_add_test(tcase, test_eleng_simd);
+	tcase_add_test(tcase, test_vdwengs03_simd);
+
+	suite_add_tcase(suite, tcase);
+
+	TCase *tcase_excl = tcase_create("excl");
+	tcase_add_test(tcase_excl, test_excl_rows_tab);
+	tcase_add_test(tcase_excl, test_gen_nblist_tab);
+	tcase_add_test(tcase_excl, test_gen_nblist_cap);
+	suite_add_tcase(suite, tcase_excl);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = nbenergy_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_ag;
+struct agsetup test_ags;
+struct acesetup test_acs;
+const double tolerance = 0.0001;
+
+// 512 atoms on a jittered 3 A lattice, parameters in CHARMM ranges
+static struct atomgrp *make_ace_lattice(void)
+{
+	int i;
+	struct atomgrp *ag = make_lattice_ag(512, 3.0, 0.4, 12345u);
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		a->acevolume = 10.0 + 10.0 * lcg_uniform();
+		a->ftype_name = (a->atom_ftypen == 1) ? "H" : "C";
+	}
+	return ag;
+}
+
+// Runs efun in double and mixed precision and compares the results.
+static void check_mixed(struct atomgrp *ag, void (*efun) (double *))
+{
+	int i;
+	double en = 0, enm = 0, *g, *gm;
+	char msg[256];
+
+	mol_nb_set_precision(MOL_NB_DOUBLE);
+	zero_grads(ag);
+	(*efun) (&en);
+	g = copy_grads(ag);
+
+	mol_nb_set_precision(MOL_NB_MIXED);
+	zero_grads(ag);
+	(*efun) (&enm);
+	gm = copy_grads(ag);
+	mol_nb_set_precision(MOL_NB_DOUBLE);
+
+	sprintf(msg, "\ndouble: %lf mixed: %lf\n", en, enm);
+	ck_assert_msg(fabs(en - enm) < tolerance * (1 + fabs(en)), msg);
+	for (i = 0; i < 3 * ag->natoms; i++) {
+		sprintf(msg, "\n(atom: %d) double: %lf mixed: %lf\n", i / 3,
+			g[i], gm[i]);
+		ck_assert_msg(fabs(g[i] - gm[i]) < tolerance * (1 + fabs(g[i])),
+			      msg);
+	}
+	free(g);
+	free(gm);
+}
+
+static void vdw_efun(double *en)
+{
+	vdweng(test_ag, en, test_ags.nblst);
+}
+
+static void ele_efun(double *en)
+{
+	eleng(test_ag, 1.0, en, test_ags.nblst);
+}
+
+static void ace_efun(double *en)
+{
+	aceeng(test_ag, en, &test_acs, &test_ags);
+}
+
+static void nbeng_efun(double *en)
+{
+	double ven = 0.0, een = 0.0, aen = 0.0;
+	nbeng(test_ag, NBENG_VDW | NBENG_ELEC | NBENG_ACE, 1.0, &ven, &een,
+	      &aen, &test_acs, &test_ags);
+	*en += ven + een + aen;
+}
+
+static void nbeng_vdwele_efun(double *en)
+{
+	double ven = 0.0, een = 0.0;
+	nbeng(test_ag, NBENG_VDW | NBENG_ELEC, 1.0, &ven, &een, NULL, NULL,
+	      &test_ags);
+	*en += ven + een;
+}
+
+static void sum_efun(double *en)
+{
+	vdweng(test_ag, en, test_ags.nblst);
+	eleng(test_ag, 1.0, en, test_ags.nblst);
+	aceeng(test_ag, en, &test_acs, &test_ags);
+}
+
+// efun on nthreads threads, returns the gradients
+static double *run_threads(struct atomgrp *ag, void (*efun) (double *),
+			   int nthreads, double *en)
+{
+	int nt = set_threads(nthreads);
+	*en = 0;
+	zero_grads(ag);
+	(*efun) (en);
+	set_threads(nt);
+	return copy_grads(ag);
+}
+
+// efun on 2 and 4 threads matches the 1-thread result, and a second
+// call on the same number of threads repeats the first bit for bit.
+static void check_threads(struct atomgrp *ag, void (*efun) (double *))
+{
+	int nthreads, i;
+	double en1, en, enr, *g1, *g, *gr;
+
+	ck_assert(test_ags.nblst->npairs >= MOL_PARALLEL_MIN_PAIRS);
+	g1 = run_threads(ag, efun, 1, &en1);
+	for (nthreads = 2; nthreads <= 4; nthreads += 2) {
+		g = run_threads(ag, efun, nthreads, &en);
+		gr = run_threads(ag, efun, nthreads, &enr);
+		ck_assert_msg(fabs(en - en1) < 1e-9 * (1 + fabs(en1)),
+			      "\n1 thread: %.17g %d threads: %.17g\n",
+			      en1, nthreads, en);
+		ck_assert_msg(enr == en, "\n%d threads: %.17g repeat: %.17g\n",
+			      nthreads, en, enr);
+		for (i = 0; i < 3 * ag->natoms; i++) {
+			ck_assert_msg(fabs(g[i] - g1[i]) <
+				      1e-9 * (1 + fabs(g1[i])),
+				      "\n(atom: %d) 1 thread: %.17g "
+				      "%d threads: %.17g\n", i / 3, g1[i],
+				      nthreads, g[i]);
+			ck_assert_msg(gr[i] == g[i],
+				      "\n(atom: %d) %d threads: %.17g "
+				      "repeat: %.17g\n", i / 3, nthreads,
+				      g[i], gr[i]);
+		}
+		free(g);
+		free(gr);
+	}
+	free(g1);
+}
+
+void setup(void)
+{
+	test_ag = make_ace_lattice();
+	init_nblst(test_ag, &test_ags);
+	update_nblst(test_ag, &test_ags);
+	ace_ini(test_ag, &test_acs);
+	ace_fixedupdate(test_ag, &test_ags, &test_acs);
+	ace_updatenblst(&test_ags, &test_acs);
+	test_acs.efac = 0.5;
+}
+
+void teardown(void)
+{
+	destroy_acesetup(&test_acs);
+	destroy_agsetup(&test_ags);
+	free_lattice_ag(test_ag);
+}
+
+// Test cases
+START_TEST(test_vdweng_mixed)
+{
+	check_mixed(test_ag, vdw_efun);
+}
+END_TEST
+
+START_TEST(test_eleng_mixed)
+{
+	check_mixed(test_ag, ele_efun);
+}
+END_TEST
+
+START_TEST(test_aceeng_mixed)
+{
+	check_mixed(test_ag, ace_efun);
+}
+END_TEST
+
+// The fused pass follows the precision mode, for vdw and elec as well
+// as for ACE.
+START_TEST(test_nbeng_mixed)
+{
+	double en = 0, enm = 0;
+
+	check_mixed(test_ag, nbeng_efun);
+	mol_nb_set_precision(MOL_NB_MIXED);
+	zero_grads(test_ag);
+	nbeng_vdwele_efun(&enm);
+	mol_nb_set_precision(MOL_NB_DOUBLE);
+	zero_grads(test_ag);
+	nbeng_vdwele_efun(&en);
+	ck_assert(en != enm);
+	ck_assert(fabs(en - enm) < tolerance * (1 + fabs(en)));
+}
+END_TEST
+
+// A list over the budget of the acesetup makes it lean, and the lean
+// acesetup, without per-pair arrays, gives the stored results.
+START_TEST(test_aceeng_lean)
+{
+	int i;
+	double en = 0, enl = 0, *g, *gl;
+	char msg[256];
+
+	zero_grads(test_ag);
+	aceeng(test_ag, &en, &test_acs, &test_ags);
+	g = copy_grads(test_ag);
+
+	ck_assert(test_acs.budget == ACE_DEFAULT_BUDGET && !test_acs.lean);
+	test_acs.budget = 9 * sizeof(double) * test_acs.nbsize;
+	ace_updatenblst(&test_ags, &test_acs);
+	ck_assert(!test_acs.lean && test_acs.swarr != NULL);
+	test_acs.budget -= 1;
+	ace_updatenblst(&test_ags, &test_acs);
+	ck_assert(test_acs.lean && test_acs.swarr == NULL);
+	zero_grads(test_ag);
+	aceeng(test_ag, &enl, &test_acs, &test_ags);
+	gl = copy_grads(test_ag);
+
+	sprintf(msg, "\nstored: %lf lean: %lf\n", en, enl);
+	ck_assert_msg(fabs(en - enl) < 1e-9 * (1 + fabs(en)), msg);
+	for (i = 0; i < 3 * test_ag->natoms; i++) {
+		sprintf(msg, "\n(atom: %d) stored: %lf lean: %lf\n", i / 3,
+			g[i], gl[i]);
+		ck_assert_msg(fabs(g[i] - gl[i]) < 1e-9 * (1 + fabs(g[i])),
+			      msg);
+	}
+	free(g);
+	free(gl);
+}
+END_TEST
+
+// At the 12 A default the self energy switches from 8 A as it did
+// before short cutoffs were allowed; the value is that of the old code.
+// Cutoffs below 8 A switch from 2/3 of the cutoff and stay finite.
+START_TEST(test_aceeng_switch)
+{
+	const double en_old = -287.63540690326829;
+	double en = 0;
+	struct agsetup ags;
+	struct acesetup acs;
+
+	zero_grads(test_ag);
+	aceeng(test_ag, &en, &test_acs, &test_ags);
+	ck_assert_msg(fabs(en - en_old) < 1e-9 * fabs(en_old),
+		      "\nace: %.12f expected: %.12f\n", en, en_old);
+
+	init_nblst_cutoff(test_ag, &ags, 6.0, 1.0);
+	update_nblst(test_ag, &ags);
+	ace_ini(test_ag, &acs);
+	ace_fixedupdate(test_ag, &ags, &acs);
+	ace_updatenblst(&ags, &acs);
+	acs.efac = 0.5;
+	en = 0;
+	zero_grads(test_ag);
+	aceeng(test_ag, &en, &acs, &ags);
+	ck_assert(isfinite(en) && en < 0);
+	destroy_acesetup(&acs);
+	destroy_agsetup(&ags);
+}
+END_TEST
+
+START_TEST(test_aceeng_threads)
+{
+	check_threads(test_ag, ace_efun);
+}
+END_TEST
+
+// The fused pass threads its vdw, elec and ACE self energy sweeps, and
+// matches the separate kernels.
+START_TEST(test_nbeng_threads)
+{
+	int i;
+	double en, ens, *g, *gs;
+
+	check_threads(test_ag, nbeng_efun);
+	check_threads(test_ag, nbeng_vdwele_efun);
+	g = run_threads(test_ag, nbeng_efun, 4, &en);
+	gs = run_threads(test_ag, sum_efun, 4, &ens);
+	ck_assert_msg(fabs(en - ens) < 1e-9 * (1 + fabs(ens)),
+		      "\nnbeng: %.12f separate: %.12f\n", en, ens);
+	for (i = 0; i < 3 * test_ag->natoms; i++)
+		ck_assert_msg(fabs(g[i] - gs[i]) < 1e-9 * (1 + fabs(gs[i])),
+			      "\n(atom: %d) nbeng: %.12f separate: %.12f\n",
+			      i / 3, g[i], gs[i]);
+	free(g);
+	free(gs);
+}
+END_TEST
+
+Suite *nbmixed_suite(void)
+{
+	Suite *suite = suite_create("nbmixed");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_vdweng_mixed);
+	tcase_add_test(tcase, test_eleng_mixed);
+	tcase_add_test(tcase, test_aceeng_mixed);
+	tcase_add_test(tcase, test_nbeng_mixed);
+	tcase_add_test(tcase, test_aceeng_lean);
+	tcase_add_test(tcase, test_aceeng_switch);
+	tcase_add_test(tcase, test_aceeng_threads);
+	tcase_add_test(tcase, test_nbeng_threads);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = nbmixed_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}
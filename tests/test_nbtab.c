@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_ag;
+struct agsetup test_ags;
+struct nbtab *test_tab;
+const double delta = 0.000001;
+const double tolerance = 0.0001;
+
+// 216 atoms of three types on a jittered 3.2 A lattice
+static struct atomgrp *make_tab_lattice(void)
+{
+	int i;
+	struct atomgrp *ag = make_lattice_ag(216, 3.2, 0.6, 12345u);
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		a->eps = -(0.05 + 0.05 * a->atom_ftypen);
+		a->rminh = 1.2 + 0.3 * a->atom_ftypen;
+	}
+	return ag;
+}
+
+// Compares the tabulated efun with the analytic afun; the two must
+// differ, or efun did not go through the table.
+static void check_analytic(struct atomgrp *ag, void (*efun) (double *),
+			   void (*afun) (double *))
+{
+	int i;
+	double en = 0, ena = 0, gmax = 0, *g, *ga;
+	char msg[256];
+
+	zero_grads(ag);
+	(*efun) (&en);
+	g = copy_grads(ag);
+	zero_grads(ag);
+	(*afun) (&ena);
+	ga = copy_grads(ag);
+
+	sprintf(msg, "\nanalytic: %lf table: %lf\n", ena, en);
+	ck_assert_msg(fabs(en - ena) < tolerance * (1 + fabs(ena)), msg);
+	ck_assert(en != ena);
+	for (i = 0; i < 3 * ag->natoms; i++)
+		gmax = fmax(gmax, fabs(ga[i]));
+	for (i = 0; i < 3 * ag->natoms; i++) {
+		sprintf(msg, "\n(atom: %d) analytic: %lf table: %lf\n", i / 3,
+			ga[i], g[i]);
+		ck_assert_msg(fabs(g[i] - ga[i]) < tolerance * (1 + gmax), msg);
+	}
+	free(g);
+	free(ga);
+}
+
+// Compares the gradients of efun with finite differences.
+static void check_grads(struct atomgrp *ag, double d, void (*efun) (double *))
+{
+	int i, k;
+	double en = 0, en1, *x, t, *g;
+	char msg[256];
+
+	zero_grads(ag);
+	(*efun) (&en);
+	g = copy_grads(ag);
+	for (i = 0; i < ag->natoms; i++) {
+		for (k = 0; k < 3; k++) {
+			x = (k == 0) ? &(ag->atoms[i].X) :
+			    (k == 1) ? &(ag->atoms[i].Y) : &(ag->atoms[i].Z);
+			t = *x;
+			*x = t + d;
+			en1 = 0;
+			(*efun) (&en1);
+			*x = t;
+			sprintf(msg, "\n(atom: %d) calc: %lf numerical: %lf\n",
+				i, g[3 * i + k], (en - en1) / d);
+			ck_assert_msg(fabs(g[3 * i + k] - (en - en1) / d) <
+				      0.1, msg);
+		}
+	}
+	free(g);
+}
+
+static void vdw_tab_efun(double *en)
+{
+	vdweng_tab(test_ag, en, test_ags.nblst, test_tab);
+}
+
+static void vdw_efun(double *en)
+{
+	vdweng(test_ag, en, test_ags.nblst);
+}
+
+static void ele_tab_efun(double *en)
+{
+	eleng_tab(test_ag, 1.0, en, test_ags.nblst, test_tab);
+}
+
+static void ele_efun(double *en)
+{
+	eleng(test_ag, 1.0, en, test_ags.nblst);
+}
+
+// efun on nthreads threads (one without OpenMP).
+static void run_threads(void (*efun) (double *), int nthreads, double *en,
+			double **g)
+{
+	int nt = set_threads(nthreads);
+	zero_grads(test_ag);
+	*en = 0;
+	(*efun) (en);
+	*g = copy_grads(test_ag);
+	set_threads(nt);
+}
+
+// SIMD stays at the detected level: a table takes over from the
+// vectorized kernels.
+void setup(void)
+{
+	test_ag = make_tab_lattice();
+	init_nblst(test_ag, &test_ags);
+	update_nblst(test_ag, &test_ags);
+	test_tab = nbtab_create(test_ag, test_ags.nblst->nbcof,
+				NBTAB_VDW | NBTAB_ELE, NBTAB_DEFAULT_NPTS);
+}
+
+void teardown(void)
+{
+	free_nbtab(test_tab);
+	destroy_agsetup(&test_ags);
+	free_lattice_ag(test_ag);
+}
+
+// Test cases
+START_TEST(test_vdweng_tab)
+{
+	check_analytic(test_ag, vdw_tab_efun, vdw_efun);
+	check_grads(test_ag, delta, vdw_tab_efun);
+}
+END_TEST
+
+START_TEST(test_eleng_tab)
+{
+	check_analytic(test_ag, ele_tab_efun, ele_efun);
+	check_grads(test_ag, delta, ele_tab_efun);
+}
+END_TEST
+
+// Threads give the one thread result, and the same one every run.
+static void check_threads(void (*efun) (double *))
+{
+	int i;
+	double en1, en4, en4b, *g1, *g4, *g4b;
+
+	run_threads(efun, 1, &en1, &g1);
+	run_threads(efun, 4, &en4, &g4);
+	run_threads(efun, 4, &en4b, &g4b);
+	ck_assert_msg(fabs(en4 - en1) < 1e-9 * (1 + fabs(en1)),
+		      "\n1 thread: %.12f 4 threads: %.12f\n", en1, en4);
+	for (i = 0; i < 3 * test_ag->natoms; i++)
+		ck_assert_msg(fabs(g4[i] - g1[i]) < 1e-9 * (1 + fabs(g1[i])),
+			      "\n(atom: %d) 1 thread: %.12f 4 threads: %.12f\n",
+			      i / 3, g1[i], g4[i]);
+	ck_assert(en4 == en4b);
+	ck_assert(memcmp(g4, g4b, 3 * test_ag->natoms * sizeof(double)) == 0);
+	free(g1);
+	free(g4);
+	free(g4b);
+}
+
+START_TEST(test_nbtab_threads)
+{
+	ck_assert(test_ags.nblst->npairs >= MOL_PARALLEL_MIN_PAIRS);
+	check_threads(vdw_tab_efun);
+	check_threads(ele_tab_efun);
+}
+END_TEST
+
+// Only the terms asked for are tabulated, the others run analytic.
+START_TEST(test_nbtab_terms)
+{
+	struct nbtab *tab = nbtab_create(test_ag, test_ags.nblst->nbcof,
+					 NBTAB_VDW, NBTAB_DEFAULT_NPTS);
+	double en = 0, ena = 0;
+
+	ck_assert(tab->vdw != NULL && tab->ele == NULL);
+	eleng_tab(test_ag, 1.0, &en, test_ags.nblst, tab);
+	ele_efun(&ena);
+	ck_assert(en == ena);
+	free_nbtab(tab);
+	tab = nbtab_create(test_ag, test_ags.nblst->nbcof, NBTAB_ELE,
+			   NBTAB_DEFAULT_NPTS);
+	ck_assert(tab->vdw == NULL && tab->ele != NULL);
+	en = ena = 0;
+	vdweng_tab(test_ag, &en, test_ags.nblst, tab);
+	vdw_efun(&ena);
+	ck_assert(en == ena);
+	free_nbtab(tab);
+}
+END_TEST
+
+START_TEST(test_nbtab_types)
+{
+	struct nbtab *tab;
+	test_ag->atoms[3].eps *= 2.0;
+	tab = nbtab_create(test_ag, test_ags.nblst->nbcof, NBTAB_VDW,
+			   NBTAB_DEFAULT_NPTS);
+	ck_assert_msg(tab == NULL, "\ntypes with different eps accepted\n");
+}
+END_TEST
+
+START_TEST(test_nbtab_args)
+{
+	struct nbtab *tab;
+	tab = nbtab_create(test_ag, test_ags.nblst->nbcof, NBTAB_VDW, 0);
+	ck_assert_msg(tab == NULL, "\nno intervals accepted\n");
+	tab = nbtab_create(test_ag, 0.9, NBTAB_VDW, NBTAB_DEFAULT_NPTS);
+	ck_assert_msg(tab == NULL, "\ncutoff below NBTAB_S0 accepted\n");
+}
+END_TEST
+
+Suite *nbtab_suite(void)
+{
+	Suite *suite = suite_create("nbtab");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_vdweng_tab);
+	tcase_add_test(tcase, test_eleng_tab);
+	tcase_add_test(tcase, test_nbtab_threads);
+	tcase_add_test(tcase, test_nbtab_terms);
+	tcase_add_test(tcase, test_nbtab_types);
+	tcase_add_test(tcase, test_nbtab_args);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = nbtab_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}
@@ -0,0 +1,644 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_ag;
+struct agsetup test_ags;
+OCTREE test_static, test_moving;
+OCTREE_PARAMS test_prms;
+const double test_rc = 12.0;
+const int test_nmoving = 36;
+
+// m^3 atoms on a jittered lattice of spacing a, the last nmoving nonfixed
+static struct atomgrp *make_fixed_lattice(int m, double a, int nmoving,
+					  unsigned int seed)
+{
+	int i;
+	struct atomgrp *ag = make_lattice_ag(m * m * m, a, 0.3 * a, seed);
+	ag->nactives = nmoving;
+	for (i = 0; i < ag->natoms; i++) {
+		ag->atoms[i].fixed = (i < ag->natoms - nmoving);
+		if (!ag->atoms[i].fixed)
+			ag->activelist[i - (ag->natoms - nmoving)] = i;
+	}
+	return ag;
+}
+
+// Rows of 12 bonded atoms along x, zigzag in y so that 1-4 pairs are
+// 3.8 A apart, on a 3.5 A grid of 6 x 6 rows; the top layer is nonfixed.
+static struct atomgrp *make_chain_ag(unsigned int seed)
+{
+	const int nx = 12, m = 6;
+	int i, nb = 0;
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+	lcg_seed(seed);
+	ag->natoms = nx * m * m;
+	ag->atoms = calloc(ag->natoms, sizeof(struct atom));
+	ag->bonds = calloc(ag->natoms, sizeof(struct atombond));
+	ag->nactives = nx * m;
+	ag->activelist = malloc(ag->nactives * sizeof(int));
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *at = &(ag->atoms[i]);
+		const int r = i / nx;
+		at->X = 1.25 * (i % nx) + 0.05 * lcg_uniform();
+		at->Y = 3.5 * (r % m) + 0.4 * ((i % 2) ? 1 : -1);
+		at->Z = 3.5 * (r / m) + 0.05 * lcg_uniform();
+		lcg_params(at);
+		at->ingrp = i;
+		at->fixed = (r < m * (m - 1));
+		if (!at->fixed)
+			ag->activelist[i - nx * m * (m - 1)] = i;
+		at->bonds = calloc(2, sizeof(struct atombond *));
+	}
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *a = &(ag->atoms[i]), *b = &(ag->atoms[i + 1]);
+		if (i % nx == nx - 1)
+			continue;
+		ag->bonds[nb].a0 = a;
+		ag->bonds[nb].a1 = b;
+		ag->bonds[nb].ai = i;
+		ag->bonds[nb].aj = i + 1;
+		a->bonds[a->nbonds++] = &(ag->bonds[nb]);
+		b->bonds[b->nbonds++] = &(ag->bonds[nb]);
+		nb++;
+	}
+	ag->nbonds = nb;
+	return ag;
+}
+
+static void free_chain_ag(struct atomgrp *ag)
+{
+	int i;
+	for (i = 0; i < ag->natoms; i++)
+		free(ag->atoms[i].bonds);
+	free_lattice_ag(ag);
+}
+
+// Rotation by angles a, b about x and z around (cx, cy, cz), then a
+// shift of (tx, ty, tz).
+static void make_trans(double *trans, double a, double b, const double *c,
+		       double tx, double ty, double tz)
+{
+	const double r[9] = {
+		cos(b), -sin(b) * cos(a), sin(b) * sin(a),
+		sin(b), cos(b) * cos(a), -cos(b) * sin(a),
+		0.0, sin(a), cos(a)
+	};
+	const double t[3] = { tx, ty, tz };
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		trans[4 * i] = r[3 * i];
+		trans[4 * i + 1] = r[3 * i + 1];
+		trans[4 * i + 2] = r[3 * i + 2];
+		trans[4 * i + 3] = c[i] + t[i] - r[3 * i] * c[0]
+		    - r[3 * i + 1] * c[1] - r[3 * i + 2] * c[2];
+	}
+}
+
+// Center of the moving atoms
+static void moving_center(double *c)
+{
+	int i;
+	c[0] = c[1] = c[2] = 0.0;
+	for (i = 0; i < test_ag->nactives; i++) {
+		const int j = test_ag->activelist[i];
+		const struct atom *a = &(test_ag->atoms[j]);
+		c[0] += a->X / test_ag->nactives;
+		c[1] += a->Y / test_ag->nactives;
+		c[2] += a->Z / test_ag->nactives;
+	}
+}
+
+void setup(void)
+{
+	test_ag = make_fixed_lattice(6, 3.0, test_nmoving, 4242u);
+	init_nblst_cutoff(test_ag, &test_ags, test_rc, 1.0);
+	build_octree(&test_static, 10, 6.0, 1.0, test_ag);
+	build_octree_excluding_fixed_atoms(&test_moving, 10, 6.0, 1.0,
+					   test_ag);
+	memset(&test_prms, 0, sizeof(OCTREE_PARAMS));
+	test_prms.ags = &test_ags;
+	test_prms.eps = 1.0;
+	zero_grads(test_ag);
+}
+
+void teardown(void)
+{
+	destroy_octree(&test_static);
+	destroy_octree(&test_moving);
+	destroy_agsetup(&test_ags);
+	free_lattice_ag(test_ag);
+}
+
+// Test cases
+
+// Each pose of a batch scores as one octree_accumulation_excluding_far
+// call with its matrix, on one thread or four, and the batch leaves the
+// gradients untouched.
+START_TEST(test_octree_batch)
+{
+	void (*kernel[2]) (OCTREE_PARAMS *, double *) = {
+		vdweng_octree_single_mol, eleng_octree_single_mol};
+	const int ntrans = 12;
+	double trans[12 * 12], en[12], enb[12], enb1[12], c[3];
+	int i, k, w, nt;
+
+	moving_center(c);
+	lcg_seed(77u);
+	for (k = 0; k < ntrans; k++)
+		make_trans(trans + 12 * k, 6.28 * lcg_uniform(),
+			   6.28 * lcg_uniform(), c, 2.0 * lcg_uniform(),
+			   2.0 * lcg_uniform(), 2.0 * lcg_uniform());
+	for (w = 0; w < 2; w++) {
+		for (k = 0; k < ntrans; k++)
+			en[k] = octree_accumulation_excluding_far(
+			    &test_static, &test_moving, test_rc, test_rc, 1,
+			    trans + 12 * k, &test_prms, kernel[w]);
+		zero_grads(test_ag);
+		nt = set_threads(1);
+		octree_accumulation_excluding_far_batch(&test_static,
+							&test_moving, test_rc,
+							1, ntrans, trans,
+							&test_prms, kernel[w],
+							enb1);
+		set_threads(4);
+		octree_accumulation_excluding_far_batch(&test_static,
+							&test_moving, test_rc,
+							1, ntrans, trans,
+							&test_prms, kernel[w],
+							enb);
+		set_threads(nt);
+		ck_assert(memcmp(enb, enb1, ntrans * sizeof(double)) == 0);
+		for (k = 0; k < ntrans; k++)
+			ck_assert_msg(fabs(enb[k] - en[k]) <
+				      1e-9 * (1 + fabs(en[k])),
+				      "\nkernel %d pose %d batch: %.12f "
+				      "single: %.12f\n", w, k, enb[k], en[k]);
+		ck_assert(en[0] != en[1]);
+		for (i = 0; i < test_ag->natoms; i++) {
+			const struct atom *a = &(test_ag->atoms[i]);
+			ck_assert(a->GX == 0.0 && a->GY == 0.0
+				  && a->GZ == 0.0);
+		}
+	}
+}
+END_TEST
+
+// The threaded accumulation matches the serial one, for one octree
+// against itself and against its nonfixed atoms, and repeats bit for
+// bit on four threads.
+START_TEST(test_octree_parallel)
+{
+	void (*kernel[2]) (OCTREE_PARAMS *, double *) = {
+		vdweng_octree_single_mol, eleng_octree_single_mol};
+	struct atomgrp *ag = make_fixed_lattice(12, 3.0, 864, 99u);
+	struct agsetup ags;
+	OCTREE ostatic, omoving, *moving[2];
+	OCTREE_PARAMS prms;
+	double en, en1, en2, *g, *g1, *g2, gmax;
+	int i, m, w, nt;
+
+	init_nblst_cutoff(ag, &ags, test_rc, 1.0);
+	build_octree(&ostatic, 10, 6.0, 1.0, ag);
+	build_octree_excluding_fixed_atoms(&omoving, 10, 6.0, 1.0, ag);
+	moving[0] = &ostatic;
+	moving[1] = &omoving;
+	memset(&prms, 0, sizeof(OCTREE_PARAMS));
+	prms.ags = &ags;
+	prms.eps = 1.0;
+	for (m = 0; m < 2; m++) {
+		for (w = 0; w < 2; w++) {
+			zero_grads(ag);
+			en = octree_accumulation_excluding_far(&ostatic,
+							       moving[m],
+							       test_rc,
+							       test_rc, 1,
+							       NULL, &prms,
+							       kernel[w]);
+			g = copy_grads(ag);
+			nt = set_threads(4);
+			zero_grads(ag);
+			en1 = octree_accumulation_excluding_far_parallel(
+			    &ostatic, moving[m], test_rc, test_rc, 1, NULL,
+			    &prms, kernel[w]);
+			g1 = copy_grads(ag);
+			zero_grads(ag);
+			en2 = octree_accumulation_excluding_far_parallel(
+			    &ostatic, moving[m], test_rc, test_rc, 1, NULL,
+			    &prms, kernel[w]);
+			g2 = copy_grads(ag);
+			set_threads(nt);
+
+			ck_assert_msg(fabs(en1 - en) < 1e-9 * (1 + fabs(en)),
+				      "\nmoving %d kernel %d threaded: %.12f "
+				      "serial: %.12f\n", m, w, en1, en);
+			ck_assert(en2 == en1);
+			ck_assert(memcmp(g1, g2,
+					 3 * ag->natoms * sizeof(double)) == 0);
+			gmax = 0.0;
+			for (i = 0; i < 3 * ag->natoms; i++)
+				gmax = fmax(gmax, fabs(g[i]));
+			ck_assert(gmax > 0.0);
+			for (i = 0; i < 3 * ag->natoms; i++)
+				ck_assert_msg(fabs(g1[i] - g[i]) <
+					      1e-9 * (1 + gmax),
+					      "\nmoving %d kernel %d (atom: %d) "
+					      "threaded: %.12f serial: %.12f\n",
+					      m, w, i / 3, g1[i], g[i]);
+			free(g);
+			free(g1);
+			free(g2);
+		}
+	}
+	destroy_octree(&ostatic);
+	destroy_octree(&omoving);
+	destroy_agsetup(&ags);
+	free_lattice_ag(ag);
+}
+END_TEST
+
+// Serial octree and packed octree accumulations of kernel w (0 vdW,
+// 1 electrostatics) of ag against itself (m 0) or its nonfixed atoms
+// (m 1) agree to tol.
+static void check_packed(struct atomgrp *ag, struct agsetup *ags,
+			 OCTREE *ostatic, OCTREE *omoving,
+			 PACKED_OCTREE *pstatic, PACKED_OCTREE *pmoving,
+			 int m, int w, double tol)
+{
+	void (*kernel[2]) (OCTREE_PARAMS *, double *) = {
+		vdweng_octree_single_mol, eleng_octree_single_mol};
+	void (*pkernel[2]) (PACKED_OCTREE_PARAMS *, double *) = {
+		vdweng_packed_octree_single_mol,
+		eleng_packed_octree_single_mol};
+	OCTREE_PARAMS prms;
+	double en, enp, *g, *gp, gmax = 0.0;
+	int i;
+
+	memset(&prms, 0, sizeof(OCTREE_PARAMS));
+	prms.ags = ags;
+	prms.eps = 1.0;
+	zero_grads(ag);
+	en = octree_accumulation_excluding_far(ostatic, m ? omoving : ostatic,
+					       test_rc, test_rc, 1, NULL,
+					       &prms, kernel[w]);
+	g = copy_grads(ag);
+	zero_grads(ag);
+	enp = packed_octree_accumulation_excluding_far(pstatic,
+						       m ? pmoving : pstatic,
+						       test_rc, &prms,
+						       pkernel[w]);
+	gp = copy_grads(ag);
+
+	ck_assert_msg(fabs(enp - en) < tol * (1 + fabs(en)),
+		      "\nmoving %d kernel %d packed: %.12f octree: %.12f\n",
+		      m, w, enp, en);
+	for (i = 0; i < 3 * ag->natoms; i++)
+		gmax = fmax(gmax, fabs(g[i]));
+	ck_assert(gmax > 0.0);
+	for (i = 0; i < 3 * ag->natoms; i++)
+		ck_assert_msg(fabs(gp[i] - g[i]) < tol * (1 + gmax),
+			      "\nmoving %d kernel %d (atom: %d) packed: %.12f "
+			      "octree: %.12f\n", m, w, i / 3, gp[i], g[i]);
+	free(g);
+	free(gp);
+}
+
+// The packed octree, without exclusion masks, scores as the octree it
+// was packed from, on bonded chains whose exclusions matter, also after
+// the atom parameters change.
+START_TEST(test_packed_octree)
+{
+	struct atomgrp *ag = make_chain_ag(5u);
+	struct agsetup ags;
+	OCTREE ostatic, omoving;
+	PACKED_OCTREE pstatic, pmoving;
+	int i, m, w;
+
+	init_nblst_cutoff(ag, &ags, test_rc, 1.0);
+	ck_assert(ags.excl_offs[ag->natoms] > 0);
+	build_octree(&ostatic, 10, 6.0, 1.0, ag);
+	build_octree_excluding_fixed_atoms(&omoving, 10, 6.0, 1.0, ag);
+	ck_assert(pack_octree(&pstatic, &ostatic));
+	ck_assert(pack_octree(&pmoving, &omoving));
+	ck_assert_int_eq(pstatic.natoms, ag->natoms);
+	ck_assert_int_eq(pmoving.natoms, ag->nactives);
+	for (m = 0; m < 2; m++)
+		for (w = 0; w < 2; w++)
+			check_packed(ag, &ags, &ostatic, &omoving, &pstatic,
+				     &pmoving, m, w, 1e-9);
+	/* new parameters, same coordinates: repacking picks them up */
+	for (i = 0; i < ag->natoms; i += 5) {
+		ag->atoms[i].eps *= 1.5;
+		ag->atoms[i].rminh += 0.1;
+		ag->atoms[i].chrg = -ag->atoms[i].chrg;
+	}
+	ck_assert(repack_octree(&pstatic) > 0);
+	ck_assert(repack_octree(&pmoving) > 0);
+	for (m = 0; m < 2; m++)
+		for (w = 0; w < 2; w++)
+			check_packed(ag, &ags, &ostatic, &omoving, &pstatic,
+				     &pmoving, m, w, 1e-9);
+	destroy_packed_octree(&pstatic);
+	destroy_packed_octree(&pmoving);
+	destroy_octree(&ostatic);
+	destroy_octree(&omoving);
+	destroy_agsetup(&ags);
+	free_chain_ag(ag);
+}
+END_TEST
+
+// With exclusion masks the packed octree of ag against itself goes
+// through the vectorized leaf kernels, which must score as the octree
+// at every SIMD level, before and after the atoms move and the tree is
+// repacked.
+static void check_packed_masks(struct atomgrp *ag)
+{
+	struct agsetup ags;
+	OCTREE ostatic;
+	PACKED_OCTREE pstatic;
+	int i, level, pass, w;
+
+	init_nblst_cutoff(ag, &ags, test_rc, 1.0);
+	build_octree(&ostatic, 10, 6.0, 1.0, ag);
+	ck_assert(pack_octree(&pstatic, &ostatic));
+	ck_assert(pack_octree_exclusions(&pstatic, &ags));
+	ck_assert(pstatic.excl_offs[pstatic.num_nodes] > 0);
+	for (pass = 0; pass < 2; pass++) {
+		for (level = MOL_SIMD_NONE; level <= MOL_SIMD_AVX512; level++) {
+			mol_simd_set_level(level);
+			for (w = 0; w < 2; w++)
+				check_packed(ag, &ags, &ostatic, NULL,
+					     &pstatic, NULL, 0, w, 1e-9);
+		}
+		mol_simd_set_level(-1);
+		for (i = 0; i < ag->nactives; i++) {
+			struct atom *a = &(ag->atoms[ag->activelist[i]]);
+			a->X += 0.3 * lcg_uniform() - 0.15;
+			a->Y += 0.3 * lcg_uniform() - 0.15;
+			a->Z += 0.3 * lcg_uniform() - 0.15;
+		}
+		ck_assert(reorganize_octree(&ostatic, 1));
+		repack_octree(&pstatic);
+	}
+	destroy_packed_octree(&pstatic);
+	destroy_octree(&ostatic);
+	destroy_agsetup(&ags);
+}
+
+// On the bonded chains and on small01.pdb, renumbered so that bonded
+// atoms fall in different leaves.
+START_TEST(test_packed_octree_masks)
+{
+	struct atomgrp *ag = make_chain_ag(5u);
+	int i;
+
+	check_packed_masks(ag);
+	free_chain_ag(ag);
+	ag = read_bonded_pdb("small01.pdb", 13);
+	lcg_seed(5u);
+	for (i = 0; i < ag->natoms; i++)
+		lcg_params(&(ag->atoms[i]));
+	check_packed_masks(ag);
+	mol_atom_group_destroy(ag);
+}
+END_TEST
+
+// Coulomb energy (dielectric 1) of the nonfixed atoms of ag with all
+// atoms, nonfixed pairs once, and the gradients of the nonfixed atoms
+// into g. Pairs excluded in ags (if not NULL) are left out, as in
+// eleng_octree_single_mol. With far set, pairs inside rc only count
+// with 1/r minus the shifted kernel of the near field, 2/rc - r/rc^2,
+// as eleng_octree_far_field defines them; otherwise all in full.
+static double coulomb_exact(struct atomgrp *ag, struct agsetup *ags,
+			    double rc, int far, double *g)
+{
+	int i, j;
+	double en = 0.0;
+
+	for (i = 0; i < 3 * ag->natoms; i++)
+		g[i] = 0.0;
+	for (i = 0; i < ag->natoms; i++) {
+		const struct atom *a = &(ag->atoms[i]);
+		const double f = CCELEC * a->chrg;
+		if (a->fixed)
+			continue;
+		for (j = 0; j < ag->natoms; j++) {
+			const struct atom *b = &(ag->atoms[j]);
+			const double dx = a->X - b->X, dy = a->Y - b->Y;
+			const double dz = a->Z - b->Z;
+			const double d2 = dx * dx + dy * dy + dz * dz;
+			double d, e, de;
+			if (j == i)
+				continue;
+			if (ags != NULL && d2 < 20 &&
+			    exta_rows(i < j ? i : j, i < j ? j : i,
+				      ags->excl_offs, ags->excl_pairs) > 0)
+				continue;
+			d = sqrt(d2);
+			if (far && d < rc) {
+				e = f * b->chrg * (2.0 / rc - d / (rc * rc));
+				de = f * b->chrg / (rc * rc * d);
+			} else {
+				e = f * b->chrg / d;
+				de = e / d2;
+			}
+			en += b->fixed ? e : 0.5 * e;
+			g[3 * i] += de * dx;
+			g[3 * i + 1] += de * dy;
+			g[3 * i + 2] += de * dz;
+		}
+	}
+	return en;
+}
+
+// The multipole far field converges to the exact sum as theta goes to
+// 0: the largest gradient error shrinks with theta, the energy is within
+// 10^-(3 + order) of the exact one at theta 0.1 and equal to it, up to
+// rounding, at theta 0.
+START_TEST(test_octree_far_field)
+{
+	struct atomgrp *ag = make_fixed_lattice(12, 3.0, 864, 99u);
+	const double rc = 8.0, thetas[5] = { 0.8, 0.4, 0.2, 0.1, 0.0 };
+	OCTREE ostatic, omoving;
+	OCTREE_MULTIPOLE *mp;
+	double en, ef[5], *g, *gf, gmax = 0.0, gerr[5];
+	int i, k, order;
+
+	build_octree(&ostatic, 10, 6.0, 1.0, ag);
+	build_octree_excluding_fixed_atoms(&omoving, 10, 6.0, 1.0, ag);
+	mp = octree_multipoles(&ostatic);
+	g = malloc(3 * ag->natoms * sizeof(double));
+	en = coulomb_exact(ag, NULL, rc, 1, g);
+	for (i = 0; i < 3 * ag->natoms; i++)
+		gmax = fmax(gmax, fabs(g[i]));
+	ck_assert(fabs(en) > 1.0);
+	for (order = 0; order <= 2; order++) {
+		for (k = 0; k < 5; k++) {
+			zero_grads(ag);
+			ef[k] = eleng_octree_far_field(&ostatic, mp, &omoving,
+						       NULL, NULL, 1.0, rc,
+						       thetas[k], order);
+			gf = copy_grads(ag);
+			gerr[k] = 0.0;
+			for (i = 0; i < 3 * ag->natoms; i++)
+				gerr[k] = fmax(gerr[k], fabs(gf[i] - g[i]));
+			free(gf);
+			if (k > 0)
+				ck_assert_msg(gerr[k] < gerr[k - 1],
+					      "\norder %d gradient error %g at "
+					      "theta %.1f, %g at theta %.1f\n",
+					      order, gerr[k], thetas[k],
+					      gerr[k - 1], thetas[k - 1]);
+		}
+		ck_assert_msg(fabs(ef[3] - en) <
+			      pow(10.0, -3 - order) * fabs(en),
+			      "\norder %d theta 0.1: %.9f exact: %.9f\n",
+			      order, ef[3], en);
+		ck_assert_msg(fabs(ef[4] - en) < 1e-9 * fabs(en)
+			      && gerr[4] < 1e-9 * gmax,
+			      "\norder %d theta 0: %.12f exact: %.12f gradient "
+			      "error %g\n", order, ef[4], en, gerr[4]);
+	}
+	free(g);
+	freeMem(mp);
+	destroy_octree(&ostatic);
+	destroy_octree(&omoving);
+	free_lattice_ag(ag);
+}
+END_TEST
+
+// Shifted near field plus exact (theta 0) far field of ag at cutoff
+// rc, on octrees built for the current coordinates; the gradients go
+// to a new array in *g.
+static double near_far(struct atomgrp *ag, struct agsetup *ags, double rc,
+		       double **g)
+{
+	OCTREE ostatic, omoving;
+	OCTREE_MULTIPOLE *mp;
+	OCTREE_PARAMS prms;
+	double en;
+
+	build_octree(&ostatic, 10, 6.0, 1.0, ag);
+	build_octree_excluding_fixed_atoms(&omoving, 10, 6.0, 1.0, ag);
+	mp = octree_multipoles(&ostatic);
+	memset(&prms, 0, sizeof(OCTREE_PARAMS));
+	prms.ags = ags;
+	prms.eps = 1.0;
+	zero_grads(ag);
+	en = octree_accumulation_excluding_far(&ostatic, &omoving, rc, rc, 1,
+					       NULL, &prms,
+					       eleng_octree_single_mol);
+	en += eleng_octree_far_field(&ostatic, mp, &omoving, NULL, ags, 1.0,
+				     rc, 0.0, 0);
+	*g = copy_grads(ag);
+	freeMem(mp);
+	destroy_octree(&ostatic);
+	destroy_octree(&omoving);
+	return en;
+}
+
+// Near and far field together give the full Coulomb sum, bonded
+// exclusions left out, for any cutoff.
+START_TEST(test_octree_far_complement)
+{
+	struct atomgrp *ag = make_chain_ag(5u);
+	const double rcs[2] = { 6.0, 9.0 };
+	struct agsetup ags;
+	double en, ec, *g, *gc, gmax;
+	int i, r;
+
+	init_nblst_cutoff(ag, &ags, test_rc, 1.0);
+	gc = malloc(3 * ag->natoms * sizeof(double));
+	ec = coulomb_exact(ag, &ags, 0.0, 0, gc);
+	for (r = 0; r < 2; r++) {
+		en = near_far(ag, &ags, rcs[r], &g);
+		ck_assert_msg(fabs(en - ec) < 1e-9 * fabs(ec),
+			      "\nrc %.1f near + far: %.12f coulomb: %.12f\n",
+			      rcs[r], en, ec);
+		gmax = 0.0;
+		for (i = 0; i < ag->nactives; i++)
+			gmax = fmax(gmax, fabs(gc[3 * ag->activelist[i]]));
+		for (i = 0; i < ag->nactives; i++) {
+			const int k = 3 * ag->activelist[i];
+			ck_assert_msg(fabs(g[k] - gc[k]) < 1e-9 * gmax
+				      && fabs(g[k + 1] - gc[k + 1]) < 1e-9 * gmax
+				      && fabs(g[k + 2] - gc[k + 2]) < 1e-9 * gmax,
+				      "\nrc %.1f (atom: %d) near + far: %.12f "
+				      "coulomb: %.12f\n", rcs[r], k / 3, g[k],
+				      gc[k]);
+		}
+		free(g);
+	}
+	free(gc);
+	destroy_agsetup(&ags);
+	free_chain_ag(ag);
+}
+END_TEST
+
+// Energy and gradient of near plus far field are continuous as a
+// nonfixed atom moves through the cutoff distance of a fixed one.
+START_TEST(test_octree_far_continuity)
+{
+	const double rc = 8.0, dr = 1e-7;
+	struct atom *a = &(test_ag->atoms[test_ag->activelist[0]]);
+	const struct atom *b = &(test_ag->atoms[0]);
+	double ux = a->X - b->X, uy = a->Y - b->Y, uz = a->Z - b->Z, d;
+	double en[2], *g[2];
+	int i, s;
+
+	d = sqrt(ux * ux + uy * uy + uz * uz);
+	ck_assert(a->chrg * b->chrg != 0.0);
+	for (s = 0; s < 2; s++) {
+		const double r = rc + (s ? dr : -dr);
+		a->X = b->X + r * ux / d;
+		a->Y = b->Y + r * uy / d;
+		a->Z = b->Z + r * uz / d;
+		en[s] = near_far(test_ag, &test_ags, rc, &g[s]);
+	}
+	ck_assert_msg(fabs(en[1] - en[0]) < 1e-4,
+		      "\ninside: %.12f outside: %.12f\n", en[0], en[1]);
+	for (i = 0; i < 3 * test_ag->natoms; i++)
+		ck_assert_msg(fabs(g[1][i] - g[0][i]) < 1e-4,
+			      "\n(atom: %d) inside: %.12f outside: %.12f\n",
+			      i / 3, g[0][i], g[1][i]);
+	free(g[0]);
+	free(g[1]);
+}
+END_TEST
+
+Suite *octree_suite(void)
+{
+	Suite *suite = suite_create("octree");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_octree_batch);
+	tcase_add_test(tcase, test_octree_parallel);
+	tcase_add_test(tcase, test_packed_octree);
+	tcase_add_test(tcase, test_packed_octree_masks);
+	tcase_add_test(tcase, test_octree_far_field);
+	tcase_add_test(tcase, test_octree_far_complement);
+	tcase_add_test(tcase, test_octree_far_continuity);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = octree_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_rec;
+struct atomgrp *test_lig;
+struct rgrid *test_grid;
+const double test_rc = 9.0;
+const double test_lo[3] = { -3.0, -3.0, -3.0 };
+const double test_hi[3] = { 16.0, 16.0, 16.0 };
+
+// 64 atoms on a jittered 3.5 A lattice
+static struct atomgrp *make_receptor(void)
+{
+	return make_lattice_ag(64, 3.5, 0.5, 4242u);
+}
+
+// Two ligand atoms of types 1 and 2, placed by the tests.
+static struct atomgrp *make_ligand(void)
+{
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+	ag->natoms = 2;
+	ag->atoms = calloc(2, sizeof(struct atom));
+	ag->bonds = calloc(1, sizeof(struct atombond));
+	ag->atoms[0].eps = -0.11;
+	ag->atoms[0].rminh = 1.7;
+	ag->atoms[0].chrg = 0.3;
+	ag->atoms[0].atom_ftypen = 1;
+	ag->atoms[1].eps = -0.15;
+	ag->atoms[1].rminh = 1.4;
+	ag->atoms[1].chrg = -0.5;
+	ag->atoms[1].atom_ftypen = 2;
+	return ag;
+}
+
+static void free_ag(struct atomgrp *ag)
+{
+	free(ag->bonds);
+	free(ag->atoms);
+	free(ag);
+}
+
+// Distance from (x, y, z) to the nearest receptor atom
+static double rec_dist(double x, double y, double z)
+{
+	int i;
+	double d2min = INFINITY;
+	for (i = 0; i < test_rec->natoms; i++) {
+		const struct atom *a = &(test_rec->atoms[i]);
+		const double dx = a->X - x, dy = a->Y - y, dz = a->Z - z;
+		d2min = fmin(d2min, dx * dx + dy * dy + dz * dz);
+	}
+	return sqrt(d2min);
+}
+
+// vdweng and eleng of ligand atom k at (x, y, z) against the receptor,
+// from the receptor joined with that atom alone. Receptor atoms are
+// fixed, so only receptor-ligand pairs are listed.
+static void direct_energy(int k, double x, double y, double z, double *ven,
+			  double *een)
+{
+	int i, nrec = test_rec->natoms;
+	struct agsetup ags;
+	struct atomgrp *join = calloc(1, sizeof(struct atomgrp));
+
+	join->natoms = nrec + 1;
+	join->atoms = calloc(join->natoms, sizeof(struct atom));
+	join->bonds = calloc(1, sizeof(struct atombond));
+	memcpy(join->atoms, test_rec->atoms, nrec * sizeof(struct atom));
+	join->atoms[nrec] = test_lig->atoms[k];
+	join->atoms[nrec].X = x;
+	join->atoms[nrec].Y = y;
+	join->atoms[nrec].Z = z;
+	join->nactives = 1;
+	join->activelist = malloc(sizeof(int));
+	join->activelist[0] = nrec;
+	for (i = 0; i < join->natoms; i++) {
+		join->atoms[i].ingrp = i;
+		join->atoms[i].fixed = (i < nrec);
+	}
+	init_nblst_cutoff(join, &ags, test_rc, 1.0);
+	update_nblst(join, &ags);
+	zero_grads(join);
+	*ven = *een = 0.0;
+	vdweng(join, ven, ags.nblst);
+	eleng(join, 1.0, een, ags.nblst);
+	destroy_agsetup(&ags);
+	free(join->activelist);
+	free_ag(join);
+}
+
+// Map energies of ligand atom k at (x, y, z), the other atom left
+// outside the box.
+static void grid_energy(int k, double x, double y, double z, double *ven,
+			double *een)
+{
+	struct atom *a = &(test_lig->atoms[k]), *b;
+
+	b = &(test_lig->atoms[1 - k]);
+	b->X = b->Y = b->Z = -100.0;
+	a->X = x;
+	a->Y = y;
+	a->Z = z;
+	zero_grads(test_lig);
+	*ven = *een = 0.0;
+	ck_assert(rgrid_eng(test_grid, test_lig, ven, een, NULL));
+}
+
+void setup(void)
+{
+	test_rec = make_receptor();
+	test_lig = make_ligand();
+	test_grid = rgrid_create(test_rec, test_lig, test_lo, test_hi,
+				 RGRID_DEFAULT_SPACING, test_rc, 1.0,
+				 RGRID_VDW | RGRID_ELE);
+}
+
+void teardown(void)
+{
+	free_rgrid(test_grid);
+	free_ag(test_lig);
+	free_lattice_ag(test_rec);
+}
+
+// Test cases
+
+// At grid points the maps hold the direct sums, rounded to float:
+// tolerance 1e-5 relative.
+START_TEST(test_rgrid_points)
+{
+	int n = 0, k, ix, iy, iz;
+	double x, y, z, gv, ge, dv, de;
+	const double h = test_grid->h;
+
+	ck_assert(test_grid != NULL);
+	lcg_seed(99u);
+	while (n < 40) {
+		ix = 8 + (int)(lcg_uniform() * (test_grid->nx - 16));
+		iy = 8 + (int)(lcg_uniform() * (test_grid->ny - 16));
+		iz = 8 + (int)(lcg_uniform() * (test_grid->nz - 16));
+		x = test_grid->ox + h * ix;
+		y = test_grid->oy + h * iy;
+		z = test_grid->oz + h * iz;
+		if (rec_dist(x, y, z) < 2.0)
+			continue;
+		k = n % 2;
+		direct_energy(k, x, y, z, &dv, &de);
+		grid_energy(k, x, y, z, &gv, &ge);
+		ck_assert_msg(fabs(gv - dv) < 1e-5 * (1 + fabs(dv)),
+			      "\n(%f %f %f) vdw grid: %.9f direct: %.9f\n",
+			      x, y, z, gv, dv);
+		ck_assert_msg(fabs(ge - de) < 1e-5 * (1 + fabs(de)),
+			      "\n(%f %f %f) ele grid: %.9f direct: %.9f\n",
+			      x, y, z, ge, de);
+		n++;
+	}
+}
+END_TEST
+
+// Between grid points the trilinear interpolant differs from the
+// direct sums by O(h^2) times their curvature. At the default spacing,
+// 3 A or more from the receptor atoms, the tolerance is 0.05 kcal/mol
+// plus 5% of the energy.
+START_TEST(test_rgrid_interp)
+{
+	int n = 0, k;
+	double x, y, z, gv, ge, dv, de;
+
+	ck_assert(test_grid != NULL);
+	lcg_seed(123u);
+	while (n < 40) {
+		x = -1.0 + 16.0 * lcg_uniform();
+		y = -1.0 + 16.0 * lcg_uniform();
+		z = -1.0 + 16.0 * lcg_uniform();
+		if (rec_dist(x, y, z) < 3.0)
+			continue;
+		k = n % 2;
+		direct_energy(k, x, y, z, &dv, &de);
+		grid_energy(k, x, y, z, &gv, &ge);
+		ck_assert_msg(fabs(gv - dv) < 0.05 + 0.05 * fabs(dv),
+			      "\n(%f %f %f) vdw grid: %.6f direct: %.6f\n",
+			      x, y, z, gv, dv);
+		ck_assert_msg(fabs(ge - de) < 0.05 + 0.05 * fabs(de),
+			      "\n(%f %f %f) ele grid: %.6f direct: %.6f\n",
+			      x, y, z, ge, de);
+		n++;
+	}
+}
+END_TEST
+
+// A ligand atom type without a vdW map is reported, not scored.
+START_TEST(test_rgrid_types)
+{
+	double ven = 0.0, een = 0.0;
+
+	ck_assert(test_grid != NULL);
+	ck_assert(rgrid_check_types(test_grid, test_lig));
+	test_lig->atoms[1].atom_ftypen = 3;
+	ck_assert(!rgrid_check_types(test_grid, test_lig));
+	ck_assert(!rgrid_eng(test_grid, test_lig, &ven, &een, NULL));
+	ck_assert(ven == 0.0 && een == 0.0);
+	ck_assert(rgrid_eng(test_grid, test_lig, NULL, &een, NULL));
+	test_lig->atoms[1].atom_ftypen = 2;
+}
+END_TEST
+
+Suite *rgrid_suite(void)
+{
+	Suite *suite = suite_create("rgrid");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_rgrid_points);
+	tcase_add_test(tcase, test_rgrid_interp);
+	tcase_add_test(tcase, test_rgrid_types);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = rgrid_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_rec;
+struct rlcomplex *test_cx;
+
+// 64 unbonded atoms on a jittered 3.5 A lattice
+static struct atomgrp *make_receptor(void)
+{
+	return make_lattice_ag(64, 3.5, 0.5, 4242u);
+}
+
+// Chain of n atoms along x beside the receptor, bonds stretched to
+// 2.2 A against an equilibrium length of 1.5 A.
+static struct atomgrp *make_chain(int n)
+{
+	int i;
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+	ag->natoms = n;
+	ag->atoms = calloc(n, sizeof(struct atom));
+	ag->nbonds = n - 1;
+	ag->bonds = calloc(n, sizeof(struct atombond));
+	ag->num_atom_types = 1;
+	for (i = 0; i < n; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		a->X = 2.2 * i;
+		a->Y = 5.0 + 0.3 * (i % 2);
+		a->Z = 16.0;
+		a->eps = -0.1;
+		a->rminh = 1.5;
+		a->chrg = (i % 2) ? 0.2 : -0.2;
+		a->atom_ftypen = 1;
+		a->ingrp = i;
+		a->fixed = 1;
+		a->bonds = calloc(2, sizeof(struct atombond *));
+	}
+	for (i = 0; i < n - 1; i++) {
+		struct atombond *b = &(ag->bonds[i]);
+		b->a0 = &(ag->atoms[i]);
+		b->a1 = &(ag->atoms[i + 1]);
+		b->ai = i;
+		b->aj = i + 1;
+		b->k = 300.0;
+		b->l0 = 1.5;
+		ag->atoms[i].bonds[ag->atoms[i].nbonds++] = b;
+		ag->atoms[i + 1].bonds[ag->atoms[i + 1].nbonds++] = b;
+	}
+	return ag;
+}
+
+static void free_ag(struct atomgrp *ag)
+{
+	int i;
+	for (i = 0; i < ag->natoms; i++)
+		free(ag->atoms[i].bonds);
+	free(ag->atoms);
+	free(ag->bonds);
+	free(ag);
+}
+
+// Bond and nonbonded energy of the complex through cx->ag.
+static void cx_egfun(int ndim, double *inp, void *prms, double *en,
+		     double *grad)
+{
+	int i, j;
+	struct rlcomplex *cx = (struct rlcomplex *)prms;
+	struct atomgrp *ag = cx->ag;
+
+	if (inp != NULL)
+		array2ag(inp, ag);
+	update_nblst(ag, &(cx->ags));
+	zero_grads(ag);
+	*en = 0.0;
+	beng(ag, en);
+	vdweng(ag, en, cx->ags.nblst);
+	eleng(ag, 1.0, en, cx->ags.nblst);
+	if (grad == NULL)
+		return;
+	for (j = 0; j < ndim / 3; j++) {
+		i = ag->activelist[j];
+		grad[3 * j] = -ag->atoms[i].GX;
+		grad[3 * j + 1] = -ag->atoms[i].GY;
+		grad[3 * j + 2] = -ag->atoms[i].GZ;
+	}
+}
+
+// Sets lig, checks the active lists and minimizes it in the complex.
+static void check_minimize(struct atomgrp *lig)
+{
+	int i, nrec = test_rec->natoms;
+	double en0, en1, dmax = 0.0;
+	struct atomgrp *ag;
+	double *rx;
+
+	rlcomplex_set_ligand(test_cx, lig);
+	ag = test_cx->ag;
+	ck_assert_int_eq(ag->natoms, nrec + lig->natoms);
+	ck_assert_int_eq(ag->nactives, lig->natoms);
+	for (i = 0; i < lig->natoms; i++) {
+		ck_assert_int_eq(ag->activelist[i], nrec + i);
+		ck_assert_int_eq(ag->atoms[nrec + i].fixed, 0);
+	}
+	ck_assert_int_eq(ag->nbact, lig->nbonds);
+	for (i = 0; i < lig->nbonds; i++)
+		ck_assert(ag->bact[i]->a0 == &(ag->atoms[nrec + i]));
+	ck_assert(ag->btab != NULL);
+	ck_assert_int_eq(ag->btab->nbonds, lig->nbonds);
+
+	rx = malloc(3 * nrec * sizeof(double));
+	for (i = 0; i < nrec; i++) {
+		rx[3 * i] = ag->atoms[i].X;
+		rx[3 * i + 1] = ag->atoms[i].Y;
+		rx[3 * i + 2] = ag->atoms[i].Z;
+	}
+	cx_egfun(0, NULL, test_cx, &en0, NULL);
+	minimize_ag(MOL_LBFGS, 500, 1e-5, ag, test_cx, cx_egfun);
+	cx_egfun(0, NULL, test_cx, &en1, NULL);
+	ck_assert_msg(en1 < en0 - 1.0, "\nbefore: %lf after: %lf\n", en0, en1);
+	for (i = 0; i < lig->natoms; i++) {
+		const struct atom *a = &(ag->atoms[nrec + i]);
+		const struct atom *b = &(lig->atoms[i]);
+		dmax = fmax(dmax, fabs(a->X - b->X) + fabs(a->Y - b->Y) +
+			    fabs(a->Z - b->Z));
+	}
+	ck_assert_msg(dmax > 0.1, "\nligand moved by %lf\n", dmax);
+	for (i = 0; i < nrec; i++) {
+		ck_assert(ag->atoms[i].X == rx[3 * i]);
+		ck_assert(ag->atoms[i].Y == rx[3 * i + 1]);
+		ck_assert(ag->atoms[i].Z == rx[3 * i + 2]);
+	}
+	free(rx);
+}
+
+void setup(void)
+{
+	test_rec = make_receptor();
+	test_cx = rlcomplex_create(test_rec, 9.0, 1.0);
+}
+
+void teardown(void)
+{
+	free_rlcomplex(test_cx);
+	free_lattice_ag(test_rec);
+}
+
+// Test cases
+START_TEST(test_rlcomplex_minimize)
+{
+	struct atomgrp *lig = make_chain(6);
+
+	ck_assert(test_cx != NULL);
+	check_minimize(lig);
+	free_ag(lig);
+}
+END_TEST
+
+// A second, larger ligand replaces the first one's lists, growing the
+// arrays past RLCOMPLEX_LIG_CAP.
+START_TEST(test_rlcomplex_swap)
+{
+	struct atomgrp *lig1 = make_chain(6);
+	struct atomgrp *lig2 = make_chain(RLCOMPLEX_LIG_CAP + 10);
+	struct atomgrp *lig3 = make_chain(4);
+
+	check_minimize(lig1);
+	check_minimize(lig2);
+	check_minimize(lig3);
+	free_ag(lig1);
+	free_ag(lig2);
+	free_ag(lig3);
+}
+END_TEST
+
+// Base atoms of ligand acceptors are shifted past the receptor, a
+// missing base (-1) stays missing.
+START_TEST(test_rlcomplex_base)
+{
+	int nrec = test_rec->natoms;
+	struct atomgrp *lig = make_chain(4);
+	struct atom *a;
+
+	lig->atoms[0].base = lig->atoms[0].base2 = -1;
+	lig->atoms[1].base = 0;
+	lig->atoms[1].base2 = -1;
+	lig->atoms[2].base = 1;
+	lig->atoms[2].base2 = 3;
+	lig->atoms[3].base = lig->atoms[3].base2 = -1;
+	rlcomplex_set_ligand(test_cx, lig);
+	a = &(test_cx->ag->atoms[nrec]);
+	ck_assert_int_eq(a[0].base, -1);
+	ck_assert_int_eq(a[0].base2, -1);
+	ck_assert_int_eq(a[1].base, nrec);
+	ck_assert_int_eq(a[1].base2, -1);
+	ck_assert_int_eq(a[2].base, nrec + 1);
+	ck_assert_int_eq(a[2].base2, nrec + 3);
+	ck_assert_int_eq(a[3].base, -1);
+	ck_assert_int_eq(a[3].base2, -1);
+	free_ag(lig);
+}
+END_TEST
+
+START_TEST(test_rlcomplex_args)
+{
+	struct atomgrp *empty = calloc(1, sizeof(struct atomgrp));
+
+	ck_assert(rlcomplex_create(empty, 9.0, 1.0) == NULL);
+	ck_assert(rlcomplex_create(test_rec, 0.0, 1.0) == NULL);
+	ck_assert(rlcomplex_create(test_rec, 9.0, -1.0) == NULL);
+	free(empty);
+}
+END_TEST
+
+Suite *rlcomplex_suite(void)
+{
+	Suite *suite = suite_create("rlcomplex");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_rlcomplex_minimize);
+	tcase_add_test(tcase, test_rlcomplex_swap);
+	tcase_add_test(tcase, test_rlcomplex_base);
+	tcase_add_test(tcase, test_rlcomplex_args);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = rlcomplex_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}
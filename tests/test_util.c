@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+static unsigned int lcg_state;
+
+void lcg_seed(unsigned int seed)
+{
+	lcg_state = seed;
+}
+
+double lcg_uniform(void)
+{
+	lcg_state = lcg_state * 1103515245u + 12345u;
+	return ((lcg_state >> 8) & 0xffffff) / (double)0x1000000;
+}
+
+void lcg_params(struct atom *a)
+{
+	a->eps = -(0.05 + 0.15 * lcg_uniform());
+	a->rminh = 1.2 + 0.8 * lcg_uniform();
+	a->chrg = 0.8 * lcg_uniform() - 0.4;
+}
+
+struct atomgrp *make_lattice_ag(int natoms, double a, double jit,
+				unsigned int seed)
+{
+	int i, m = 1;
+	struct atomgrp *ag = calloc(1, sizeof(struct atomgrp));
+	while (m * m * m < natoms)
+		m++;
+	lcg_seed(seed);
+	ag->natoms = natoms;
+	ag->atoms = calloc(natoms, sizeof(struct atom));
+	ag->nactives = natoms;
+	ag->activelist = malloc(natoms * sizeof(int));
+	ag->bonds = calloc(1, sizeof(struct atombond));
+	ag->num_atom_types = 3;
+	for (i = 0; i < natoms; i++) {
+		struct atom *at = &(ag->atoms[i]);
+		at->X = a * (i % m) + jit * lcg_uniform();
+		at->Y = a * ((i / m) % m) + jit * lcg_uniform();
+		at->Z = a * (i / (m * m)) + jit * lcg_uniform();
+		lcg_params(at);
+		at->atom_ftypen = i % 3 + 1;
+		at->ingrp = i;
+		ag->activelist[i] = i;
+	}
+	return ag;
+}
+
+void free_lattice_ag(struct atomgrp *ag)
+{
+	free(ag->bonds);
+	free(ag->activelist);
+	free(ag->atoms);
+	free(ag);
+}
+
+struct atomgrp *read_bonded_pdb(const char *path, int stride)
+{
+	int i, j, n = 0;
+	struct atomgrp *ag = read_pdb_nopar(path);
+	struct atom *atoms = calloc(ag->natoms, sizeof(struct atom));
+
+	// read_pdb_nopar leaves most atom fields unset: keep the ones it reads
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *a = &(atoms[stride * i % ag->natoms]);
+		a->X = ag->atoms[i].X;
+		a->Y = ag->atoms[i].Y;
+		a->Z = ag->atoms[i].Z;
+		a->B = ag->atoms[i].B;
+		a->name = ag->atoms[i].name;
+		a->res_seq = ag->atoms[i].res_seq;
+		a->backbone = ag->atoms[i].backbone;
+		a->atom_typen = ag->atoms[i].atom_typen;
+		a->sa = -1;
+	}
+	free(ag->atoms);
+	ag->atoms = atoms;
+	ag->bonds = malloc(4 * ag->natoms * sizeof(struct atombond));
+	ag->nactives = ag->natoms;
+	ag->activelist = malloc(ag->natoms * sizeof(int));
+	for (i = 0; i < ag->natoms; i++) {
+		ag->atoms[i].ingrp = i;
+		ag->atoms[i].bonds = malloc(4 * sizeof(struct atombond *));
+		ag->activelist[i] = i;
+	}
+	for (i = 0; i < ag->natoms; i++) {
+		struct atom *a = &(ag->atoms[i]);
+		for (j = i + 1; j < ag->natoms; j++) {
+			struct atom *b = &(ag->atoms[j]);
+			double dx = a->X - b->X, dy = a->Y - b->Y, dz = a->Z - b->Z;
+			if (dx * dx + dy * dy + dz * dz > 1.9 * 1.9)
+				continue;
+			if (a->nbonds == 4 || b->nbonds == 4) {
+				fprintf(stderr, "%s: atom %d or %d has more "
+					"than 4 bonds\n", path, i, j);
+				exit(EXIT_FAILURE);
+			}
+			ag->bonds[n].a0 = a;
+			ag->bonds[n].a1 = b;
+			ag->bonds[n].ai = i;
+			ag->bonds[n].aj = j;
+			a->bonds[a->nbonds++] = &(ag->bonds[n]);
+			b->bonds[b->nbonds++] = &(ag->bonds[n]);
+			n++;
+		}
+	}
+	ag->nbonds = n;
+	return ag;
+}
+
+double *copy_grads(const struct atomgrp *ag)
+{
+	int i;
+	double *g = malloc(3 * ag->natoms * sizeof(double));
+	for (i = 0; i < ag->natoms; i++) {
+		g[3 * i] = ag->atoms[i].GX;
+		g[3 * i + 1] = ag->atoms[i].GY;
+		g[3 * i + 2] = ag->atoms[i].GZ;
+	}
+	return g;
+}
+
+int set_threads(int nthreads)
+{
+#ifdef _OPENMP
+	int nt = omp_get_max_threads();
+	omp_set_num_threads(nthreads);
+	return nt;
+#else
+	return nthreads;
+#endif
+}
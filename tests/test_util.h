@@ -0,0 +1,35 @@
+#ifndef _MOL_TEST_UTIL_H_
+#define _MOL_TEST_UTIL_H_
+
+// Helpers shared by the tests and the benchmarks, included after
+// mol.0.0.6.h: a seeded generator and the molecules they score.
+
+// Restarts lcg_uniform from seed
+void lcg_seed(unsigned int seed);
+
+// Uniform in [0, 1), 24 bits of a 32-bit linear congruential generator
+double lcg_uniform(void);
+
+// eps, rminh and chrg of a in CHARMM ranges, drawn from lcg_uniform
+void lcg_params(struct atom *a);
+
+// natoms atoms on the smallest m^3 lattice of spacing a that holds
+// them, x fastest, each coordinate jittered by up to jit and the
+// parameters from lcg_params, both after lcg_seed(seed). Atom types
+// cycle through 1, 2, 3, every atom is active, there are no bonds.
+struct atomgrp *make_lattice_ag(int natoms, double a, double jit,
+				unsigned int seed);
+void free_lattice_ag(struct atomgrp *ag);
+
+// The pdb file with atom i moved to stride * i mod natoms (stride
+// coprime to natoms, 1 keeps the order), atoms closer than 1.9 A
+// bonded and every atom active. Free with mol_atom_group_destroy.
+struct atomgrp *read_bonded_pdb(const char *path, int stride);
+
+// Gradients of ag into a new array of 3 * natoms
+double *copy_grads(const struct atomgrp *ag);
+
+// Sets the OpenMP thread count (nothing without OpenMP), returns the old one
+int set_threads(int nthreads);
+
+#endif
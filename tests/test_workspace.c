@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include "mol.0.0.6.h"
+#include "test_util.h"
+
+struct atomgrp *test_rec;
+struct atomgrp *test_lig;
+struct rec_cells *test_cells;
+const double test_rc = 9.0;
+const double tolerance = 1e-8;
+
+// rotation by angle about z followed by a shift of (tx, ty, tz)
+static void make_trans(double *trans, double angle, double tx, double ty,
+		       double tz)
+{
+	memset(trans, 0, 12 * sizeof(double));
+	trans[0] = cos(angle);
+	trans[1] = -sin(angle);
+	trans[4] = sin(angle);
+	trans[5] = cos(angle);
+	trans[10] = 1.0;
+	trans[3] = tx;
+	trans[7] = ty;
+	trans[11] = tz;
+}
+
+// vdweng + eleng of ag through its own nblist, gradients into a new *g
+static double nb_energy(struct atomgrp *ag, double **g)
+{
+	double en = 0.0;
+	struct agsetup ags;
+
+	init_nblst_cutoff(ag, &ags, test_rc, 1.0);
+	update_nblst(ag, &ags);
+	zero_grads(ag);
+	vdweng(ag, &en, ags.nblst);
+	eleng(ag, 1.0, &en, ags.nblst);
+	*g = copy_grads(ag);
+	destroy_agsetup(&ags);
+	return en;
+}
+
+// Receptor-ligand energy of test_lig posed by trans, and the ligand
+// gradients, from vdweng and eleng on the joined group less the ligand
+// alone. Receptor atoms are fixed, so their pairs are not listed.
+static double reference_energy(double *trans, double *glig)
+{
+	int i, nrec = test_rec->natoms, nlig = test_lig->natoms;
+	double en, enlig, *g, *gl;
+	struct atomgrp *join = make_lattice_ag(1, 1.0, 0.3, 1u);
+	struct atomgrp *lig = make_lattice_ag(1, 1.0, 0.3, 1u);
+
+	join->natoms = nrec + nlig;
+	join->atoms = realloc(join->atoms, join->natoms * sizeof(struct atom));
+	memcpy(join->atoms, test_rec->atoms, nrec * sizeof(struct atom));
+	memcpy(join->atoms + nrec, test_lig->atoms,
+	       nlig * sizeof(struct atom));
+	lig->natoms = nlig;
+	lig->atoms = realloc(lig->atoms, nlig * sizeof(struct atom));
+	memcpy(lig->atoms, test_lig->atoms, nlig * sizeof(struct atom));
+	for (i = 0; i < join->natoms; i++) {
+		struct atom *a = &(join->atoms[i]);
+		a->ingrp = i;
+		a->fixed = (i < nrec);
+		if (i >= nrec)
+			transform_point(a->X, a->Y, a->Z, trans, &(a->X),
+					&(a->Y), &(a->Z));
+	}
+	for (i = 0; i < nlig; i++)
+		lig->atoms[i] = join->atoms[nrec + i];
+	for (i = 0; i < nlig; i++) {
+		lig->atoms[i].ingrp = i;
+		lig->atoms[i].fixed = 0;
+	}
+
+	en = nb_energy(join, &g);
+	enlig = nb_energy(lig, &gl);
+	for (i = 0; i < 3 * nlig; i++)
+		glig[i] = g[3 * nrec + i] - gl[i];
+	free(g);
+	free(gl);
+	free_lattice_ag(join);
+	free_lattice_ag(lig);
+	return en - enlig;
+}
+
+void setup(void)
+{
+	test_rec = make_lattice_ag(512, 3.0, 0.9, 4242u);
+	test_lig = make_lattice_ag(27, 1.6, 0.48, 777u);
+	test_cells = rec_cells_create(test_rec, test_rc);
+}
+
+void teardown(void)
+{
+	free_rec_cells(test_cells);
+	free_lattice_ag(test_rec);
+	free_lattice_ag(test_lig);
+}
+
+// Test cases
+START_TEST(test_workspace_nbeng)
+{
+	int i, p;
+	double trans[12], ven, een, en, *g, gmax;
+	struct mol_workspace *ws = mol_workspace_create(test_lig->natoms);
+	const int nlig = test_lig->natoms;
+
+	ck_assert(test_cells != NULL && ws != NULL);
+	g = malloc(3 * nlig * sizeof(double));
+	for (p = 0; p < 3; p++) {
+		make_trans(trans, 0.4 * p, 24.5 + p, 4.0 + 3.0 * p, 6.0);
+		en = reference_energy(trans, g);
+		ven = een = 0.0;
+		ck_assert(mol_workspace_nbeng(ws, test_cells, test_lig, trans,
+					      1.0, &ven, &een));
+		ck_assert(ws->npairs > 0);
+		ck_assert_msg(fabs(ven + een - en) < tolerance * (1 + fabs(en)),
+			      "\npose %d workspace: %.12f reference: %.12f\n",
+			      p, ven + een, en);
+		gmax = 0.0;
+		for (i = 0; i < 3 * nlig; i++)
+			gmax = fmax(gmax, fabs(g[i]));
+		for (i = 0; i < 3 * nlig; i++)
+			ck_assert_msg(fabs(ws->grad[i] - g[i]) <
+				      tolerance * (1 + gmax),
+				      "\npose %d (atom: %d) workspace: %.12f "
+				      "reference: %.12f\n", p, i / 3,
+				      ws->grad[i], g[i]);
+	}
+	free(g);
+	free_mol_workspace(ws);
+}
+END_TEST
+
+// Two workspaces scoring their own poses against one receptor, from
+// two threads with OpenMP, give the results of one workspace alone.
+START_TEST(test_workspace_shared_rec)
+{
+	int t, r;
+	double trans[2][12], en[2], gref[2][81];
+	struct mol_workspace *ws[2];
+	const int nlig = test_lig->natoms;
+	int ok[2] = { 1, 1 };
+
+	ck_assert(3 * nlig <= 81);
+	for (t = 0; t < 2; t++) {
+		double ven = 0.0, een = 0.0;
+		ws[t] = mol_workspace_create(nlig);
+		make_trans(trans[t], 0.5 * t, 24.0 - 2.0 * t, 5.0 + 6.0 * t,
+			   4.0 + 2.0 * t);
+		ck_assert(mol_workspace_nbeng(ws[0], test_cells, test_lig,
+					      trans[t], 1.0, &ven, &een));
+		en[t] = ven + een;
+		memcpy(gref[t], ws[0]->grad, 3 * nlig * sizeof(double));
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(2) schedule(static, 1) private(r)
+#endif
+	for (t = 0; t < 2; t++) {
+		for (r = 0; r < 20; r++) {
+			double ven = 0.0, een = 0.0;
+			if (!mol_workspace_nbeng(ws[t], test_cells, test_lig,
+						 trans[t], 1.0, &ven, &een)
+			    || ven + een != en[t]
+			    || memcmp(ws[t]->grad, gref[t],
+				      3 * nlig * sizeof(double)) != 0)
+				ok[t] = 0;
+		}
+	}
+	for (t = 0; t < 2; t++) {
+		ck_assert_msg(ok[t], "\nworkspace %d differs\n", t);
+		free_mol_workspace(ws[t]);
+	}
+	ck_assert(en[0] != en[1]);
+}
+END_TEST
+
+Suite *workspace_suite(void)
+{
+	Suite *suite = suite_create("workspace");
+
+	TCase *tcase = tcase_create("test");
+	tcase_set_timeout(tcase, 20);
+	tcase_add_checked_fixture(tcase, setup, teardown);
+	tcase_add_test(tcase, test_workspace_nbeng);
+	tcase_add_test(tcase, test_workspace_shared_rec);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite = workspace_suite();
+	SRunner *runner = srunner_create(suite);
+	srunner_run_all(runner, CK_ENV);
+
+	int number_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+	return number_failed;
+}